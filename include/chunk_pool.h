@@ -0,0 +1,41 @@
+#ifndef DX8GLES11_CHUNK_POOL_H
+#define DX8GLES11_CHUNK_POOL_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fixed number of equally sized chunks carved from one slab. A chunk keeps
+ * its address until it is released, which any thread may do, and released
+ * chunks are reused before untouched ones. Acquire and release are
+ * lock-free and never allocate; once every chunk is out, acquire returns
+ * NULL and the caller decides how to wait.
+ */
+typedef struct chunk_pool {
+    _Alignas(64) atomic_uint_least64_t free; /* tag << 32 | index + 1 */
+    _Alignas(64) atomic_uint_least32_t carved; /* chunks ever handed out */
+    _Alignas(64) unsigned char *slab;
+    _Atomic(uint32_t) *links; /* free list, by index */
+    size_t stride;
+    uint32_t max_chunks;
+} chunk_pool;
+
+/* chunk_size bytes each, 64-byte aligned */
+int chunk_pool_init(chunk_pool *cp, size_t chunk_size, size_t max_chunks);
+/* every chunk must have been released, or be no longer used */
+void chunk_pool_destroy(chunk_pool *cp);
+void *chunk_acquire(chunk_pool *cp);
+void chunk_release(chunk_pool *cp, void *chunk);
+/* most chunks ever out at once: memory actually touched */
+size_t chunk_pool_high_water(const chunk_pool *cp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DX8GLES11_CHUNK_POOL_H */
@@ -0,0 +1,86 @@
+#ifndef DX8GLES11_DX8ASM_OPCODES_H
+#define DX8GLES11_DX8ASM_OPCODES_H
+#include <stddef.h>
+
+/*
+ * Single description of the DX8 opcode set. The parser interns mnemonics
+ * into asm_opcode, validate_shader() counts instructions by class, the
+ * translator indexes its dispatch table by opcode and
+ * tools/usage_coverage.py reads this list to report coverage.
+ *
+ * X(ID, mnemonic, class)
+ */
+#define DX8ASM_OPCODES(X)                                                                          \
+    X(NOP, "nop", ASM_OPC_ARITH)                                                                   \
+    X(MOV, "mov", ASM_OPC_ARITH)                                                                   \
+    X(ADD, "add", ASM_OPC_ARITH)                                                                   \
+    X(SUB, "sub", ASM_OPC_ARITH)                                                                   \
+    X(MUL, "mul", ASM_OPC_ARITH)                                                                   \
+    X(MAD, "mad", ASM_OPC_ARITH)                                                                   \
+    X(LRP, "lrp", ASM_OPC_ARITH)                                                                   \
+    X(CND, "cnd", ASM_OPC_ARITH)                                                                   \
+    X(CMP, "cmp", ASM_OPC_ARITH)                                                                   \
+    X(DP3, "dp3", ASM_OPC_ARITH)                                                                   \
+    X(DP4, "dp4", ASM_OPC_ARITH)                                                                   \
+    X(MAX, "max", ASM_OPC_ARITH)                                                                   \
+    X(MIN, "min", ASM_OPC_ARITH)                                                                   \
+    X(RCP, "rcp", ASM_OPC_ARITH)                                                                   \
+    X(RSQ, "rsq", ASM_OPC_ARITH)                                                                   \
+    X(SGE, "sge", ASM_OPC_ARITH)                                                                   \
+    X(SLT, "slt", ASM_OPC_ARITH)                                                                   \
+    X(DST, "dst", ASM_OPC_ARITH)                                                                   \
+    X(LIT, "lit", ASM_OPC_ARITH)                                                                   \
+    X(EXP, "exp", ASM_OPC_ARITH)                                                                   \
+    X(EXPP, "expp", ASM_OPC_ARITH)                                                                 \
+    X(LOG, "log", ASM_OPC_ARITH)                                                                   \
+    X(LOGP, "logp", ASM_OPC_ARITH)                                                                 \
+    X(FRC, "frc", ASM_OPC_ARITH)                                                                   \
+    X(M3X2, "m3x2", ASM_OPC_ARITH)                                                                 \
+    X(M3X3, "m3x3", ASM_OPC_ARITH)                                                                 \
+    X(M3X4, "m3x4", ASM_OPC_ARITH)                                                                 \
+    X(M4X3, "m4x3", ASM_OPC_ARITH)                                                                 \
+    X(M4X4, "m4x4", ASM_OPC_ARITH)                                                                 \
+    X(BEM, "bem", ASM_OPC_ARITH)                                                                   \
+    X(PHASE, "phase", ASM_OPC_ARITH)                                                               \
+    X(MLOAD, "mload", ASM_OPC_ARITH)                                                               \
+    X(LOADI, "loadi", ASM_OPC_ARITH)                                                               \
+    X(TEX, "tex", ASM_OPC_TEX)                                                                     \
+    X(TEXLD, "texld", ASM_OPC_TEX)                                                                 \
+    X(TEXCRD, "texcrd", ASM_OPC_TEX)                                                               \
+    X(TEXKILL, "texkill", ASM_OPC_TEX)                                                             \
+    X(TEXCOORD, "texcoord", ASM_OPC_TEX)                                                           \
+    X(TEXDEPTH, "texdepth", ASM_OPC_TEX)                                                           \
+    X(TEXBEM, "texbem", ASM_OPC_TEX)                                                               \
+    X(TEXBEML, "texbeml", ASM_OPC_TEX)                                                             \
+    X(TEXDP3, "texdp3", ASM_OPC_TEX)                                                               \
+    X(TEXDP3TEX, "texdp3tex", ASM_OPC_TEX)                                                         \
+    X(TEXM3X2PAD, "texm3x2pad", ASM_OPC_TEX)                                                       \
+    X(TEXM3X2TEX, "texm3x2tex", ASM_OPC_TEX)                                                       \
+    X(TEXM3X2DEPTH, "texm3x2depth", ASM_OPC_TEX)                                                   \
+    X(TEXM3X3, "texm3x3", ASM_OPC_TEX)                                                             \
+    X(TEXM3X3PAD, "texm3x3pad", ASM_OPC_TEX)                                                       \
+    X(TEXM3X3TEX, "texm3x3tex", ASM_OPC_TEX)                                                       \
+    X(TEXM3X3SPEC, "texm3x3spec", ASM_OPC_TEX)                                                     \
+    X(TEXM3X3VSPEC, "texm3x3vspec", ASM_OPC_TEX)                                                   \
+    X(TEXREG2AR, "texreg2ar", ASM_OPC_TEX)                                                         \
+    X(TEXREG2GB, "texreg2gb", ASM_OPC_TEX)                                                         \
+    X(TEXREG2RGB, "texreg2rgb", ASM_OPC_TEX)
+
+typedef enum asm_opcode_class {
+    ASM_OPC_ARITH, /* counts against the arithmetic slot limit */
+    ASM_OPC_TEX    /* counts against the texture slot limit */
+} asm_opcode_class;
+
+typedef enum asm_opcode {
+    ASM_OP_UNKNOWN = 0, /* mnemonic not in DX8ASM_OPCODES */
+#define DX8ASM_OP_ENUM(id, name, cls) ASM_OP_##id,
+    DX8ASM_OPCODES(DX8ASM_OP_ENUM)
+#undef DX8ASM_OP_ENUM
+    ASM_OP_COUNT
+} asm_opcode;
+
+/* Intern a mnemonic of length n; returns ASM_OP_UNKNOWN when not found. */
+asm_opcode asm_opcode_lookup(const char *name, size_t n);
+const char *asm_opcode_name(asm_opcode op);
+asm_opcode_class asm_opcode_class_of(asm_opcode op);
+#endif
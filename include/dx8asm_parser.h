@@ -1,11 +1,83 @@
 #ifndef DX8ASM_PARSER_H
 #define DX8ASM_PARSER_H
+#include "dx8asm_opcodes.h"
 #include <stddef.h>
+#include <stdint.h>
 
+typedef enum asm_reg_file {
+    ASM_REG_NONE,     /* operand slot unused */
+    ASM_REG_TEMP,     /* rN */
+    ASM_REG_INPUT,    /* vN */
+    ASM_REG_CONST,    /* cN, c[a0.x+N] */
+    ASM_REG_TEXTURE,  /* tN */
+    ASM_REG_ADDR,     /* a0 */
+    ASM_REG_RASTOUT,  /* oPos, oFog, oPts (index is asm_rastout) */
+    ASM_REG_ATTROUT,  /* oDN */
+    ASM_REG_TEXCRDOUT, /* oTN */
+    ASM_REG_IMM       /* literal; index selects asm_instr.imm[] */
+} asm_reg_file;
+
+typedef enum asm_rastout { ASM_RASTOUT_POS, ASM_RASTOUT_FOG, ASM_RASTOUT_PTS } asm_rastout;
+
+/* source swizzle: two bits per component, x in the low bits */
+#define ASM_SWZ(x, y, z, w) ((uint8_t)((x) | (y) << 2 | (z) << 4 | (w) << 6))
+#define ASM_SWZ_IDENTITY ASM_SWZ(0, 1, 2, 3)
+/* destination write mask */
+#define ASM_MASK_ALL 0x0f
+
+/* operand modifiers */
+enum {
+    ASM_MOD_NEG = 1 << 0,  /* -r0 */
+    ASM_MOD_COMP = 1 << 1, /* 1-r0 */
+    ASM_MOD_BIAS = 1 << 2, /* r0_bias */
+    ASM_MOD_BX2 = 1 << 3,  /* r0_bx2 */
+    ASM_MOD_X2 = 1 << 4,   /* r0_x2 */
+    ASM_MOD_DZ = 1 << 5,   /* t0_dz / t0_db */
+    ASM_MOD_DW = 1 << 6,   /* t0_dw / t0_da */
+    ASM_MOD_REL = 1 << 7   /* c[a0.x+N] */
+};
+
+/* instruction flags */
+enum {
+    ASM_INSTR_VOLUME = 1 << 0, /* "volume" hint on the source line */
+    ASM_INSTR_SHADOW = 1 << 1, /* "shadow" hint */
+    ASM_INSTR_NPOT = 1 << 2,   /* "npot" hint */
+    ASM_INSTR_COISSUE = 1 << 3 /* '+' prefix */
+};
+
+/* instruction modifiers (opcode suffix) */
+enum {
+    ASM_IMOD_X2 = 1 << 0,
+    ASM_IMOD_X4 = 1 << 1,
+    ASM_IMOD_X8 = 1 << 2,
+    ASM_IMOD_D2 = 1 << 3,
+    ASM_IMOD_D4 = 1 << 4,
+    ASM_IMOD_D8 = 1 << 5,
+    ASM_IMOD_SAT = 1 << 6
+};
+
+typedef struct asm_operand {
+    uint8_t file;  /* asm_reg_file */
+    uint8_t index; /* register number or imm[] slot */
+    uint8_t swz;   /* source swizzle, or write mask for the destination */
+    uint8_t mod;   /* ASM_MOD_* */
+} asm_operand;
+
+#define ASM_MAX_SRC 3
+#define ASM_MAX_IMM 3
+
+/*
+ * Decoded instruction. Operand text is parsed once by asm_parse(); two
+ * instructions share a 64-byte cache line.
+ */
 typedef struct asm_instr {
-    /* opcode buffer must hold instructions like "texbeml" or longer */
-    char opcode[16], dst[32], src0[32], src1[32], src2[32];
-    char comment[64];
+    uint8_t op;    /* asm_opcode */
+    uint8_t flags; /* ASM_INSTR_* */
+    uint8_t imod;  /* ASM_IMOD_* */
+    uint8_t nsrc;  /* populated src[] slots */
+    asm_operand dst;
+    asm_operand src[ASM_MAX_SRC];
+    float imm[ASM_MAX_IMM];
 } asm_instr;
 
 typedef enum asm_shader_type {
@@ -20,13 +92,35 @@ typedef struct asm_constant {
     float value[4];
 } asm_constant;
 
+struct util_arena;
+
 typedef struct asm_program {
     asm_shader_type type;
     asm_instr *code;
     size_t count, capacity;
     asm_constant *consts;
     size_t const_count, const_capacity;
+    struct util_arena *arena; /* owner of code/consts; NULL when malloc'd */
 } asm_program;
 int asm_parse(const char *src, asm_program *, char **err);
+/* as asm_parse(), with all memory carved from arena (released with it) */
+int asm_parse_arena(const char *src, asm_program *, struct util_arena *arena, char **err);
 void asm_program_free(asm_program *);
+
+/*
+ * Line-at-a-time parsing, for text that is never held as one string (see
+ * pp_stream_cfg()). Lines are numbered from 1 in the order they arrive.
+ * After an error the program is freed, *err is set and further lines are
+ * rejected.
+ */
+typedef struct asm_stream {
+    asm_program *prog;
+    size_t line;
+    int failed;
+} asm_stream;
+void asm_stream_begin(asm_stream *s, asm_program *prog, struct util_arena *arena);
+/* one line without its newline */
+int asm_stream_line(asm_stream *s, const char *text, size_t len, char **err);
+/* Format an operand back to assembly text (e.g. "oT3", "-c[a0.x+2].xyzz"). */
+size_t asm_operand_format(const asm_instr *i, const asm_operand *o, char *buf, size_t n);
 #endif
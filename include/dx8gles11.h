@@ -9,10 +9,20 @@ extern "C" {
 #include <stdint.h>
 
 struct GLES_CommandList; /* forward */
+struct pp_snapshot;      /* preprocess.h */
+struct dx8gles11_caps;   /* see dx8gles11_caps_probe() */
+typedef struct dx8gles11_cache dx8gles11_cache;
+typedef struct dx8gles11_session dx8gles11_session;
 
 typedef struct dx8gles11_options {
-    const char *include_dir; /* search path for #include */
-    int optimize;            /* reserved */
+    const char *include_dir;           /* search path for #include */
+    const char *const *include_paths;  /* optional NULL-terminated paths searched after include_dir */
+    int optimize;                      /* reserved */
+    dx8gles11_cache *cache;            /* optional compile cache, see dx8gles11_cache_create() */
+    const char *cache_dir;             /* optional directory for persisted command lists */
+    const struct pp_snapshot *prelude; /* optional, see pp_snapshot_create() */
+    const char *const *defines;        /* optional NULL-terminated "NAME" or "NAME=value" macros */
+    const struct dx8gles11_caps *caps; /* optional target; NULL probes the current GL context */
 } dx8gles11_options;
 
 typedef enum gles_cmd_type {
@@ -63,6 +73,338 @@ const char *dx8gles11_error(void);
 void gles_cmdlist_free(GLES_CommandList *);
 int dx8gles11_has_extension(const char *name);
 
+/* Target capabilities ----------------------------------------- */
+/*
+ * The GL extensions that change the translator's output or the runtime's
+ * GL calls, as a bit set. Compiles without dx8gles11_options.caps use the
+ * caps of their dx8gles11_context; with a profile loaded from a file they
+ * need no GL at all.
+ */
+enum {
+    DX8GLES11_CAP_VBO = 1u << 0,           /* GL_OES_vertex_buffer_object */
+    DX8GLES11_CAP_BLEND_MINMAX = 1u << 1,  /* GL_EXT_blend_minmax */
+    DX8GLES11_CAP_TEXTURE_NPOT = 1u << 2,  /* GL_OES_texture_npot */
+    DX8GLES11_CAP_TEXTURE_3D = 1u << 3,    /* GL_OES_texture_3D */
+    DX8GLES11_CAP_DEPTH_TEXTURE = 1u << 4, /* GL_OES_depth_texture */
+};
+
+typedef struct dx8gles11_caps {
+    uint32_t bits; /* DX8GLES11_CAP_* */
+} dx8gles11_caps;
+
+/* from the current GL context; fails when there is none */
+int dx8gles11_caps_probe(dx8gles11_caps *out);
+/* from a space-separated list such as a saved GL_EXTENSIONS string */
+void dx8gles11_caps_parse(const char *extensions, dx8gles11_caps *out);
+/* from a target profile file: extension names separated by whitespace,
+ * '#' comments; names the translator does not use are ignored */
+int dx8gles11_caps_load(const char *path, dx8gles11_caps *out);
+/* extension name of one DX8GLES11_CAP_* bit */
+const char *dx8gles11_caps_name(uint32_t bit);
+
+/* Contexts ------------------------------------------------------ */
+/*
+ * A context owns what compiles share: the target capabilities, the caches
+ * used when the options name none, the allocator for scratch memory, an
+ * error callback and counters. Compiles on one context may run on any
+ * number of threads; none of them takes a lock in the context. The plain
+ * dx8gles11_* functions use dx8gles11_context_default(), whose caps are
+ * probed from the current GL context on first use.
+ */
+typedef struct dx8gles11_context dx8gles11_context;
+
+typedef struct dx8gles11_allocator {
+    void *(*alloc)(void *user, size_t size);
+    void (*free)(void *user, void *p);
+    void *user;
+} dx8gles11_allocator;
+
+/* called on the failing thread with the return code and dx8gles11_error() */
+typedef void (*dx8gles11_diag_fn)(void *user, int rc, const char *msg);
+
+typedef struct dx8gles11_context_desc {
+    const dx8gles11_caps *caps;       /* copied; NULL probes the current GL context once */
+    dx8gles11_cache *cache;           /* used when the options set no cache */
+    const char *cache_dir;            /* used when the options set no cache_dir */
+    const dx8gles11_allocator *alloc; /* copied; scratch memory, NULL uses malloc */
+    dx8gles11_diag_fn diag;           /* optional */
+    void *diag_user;
+    int threads;                      /* async compile workers; 0 picks 2 */
+} dx8gles11_context_desc;
+
+typedef struct dx8gles11_context_stats {
+    uint64_t compiles; /* calls that returned 0 */
+    uint64_t failures; /* calls that returned an error */
+} dx8gles11_context_stats;
+
+/* desc may be NULL; the caches it names must outlive the context */
+dx8gles11_context *dx8gles11_context_create(const dx8gles11_context_desc *desc);
+void dx8gles11_context_destroy(dx8gles11_context *ctx);
+dx8gles11_context *dx8gles11_context_default(void);
+/* opts may be NULL; its caps, when set, win over the context's */
+int dx8gles11_context_compile_string(dx8gles11_context *ctx, const char *src,
+                                     const dx8gles11_options *opts, GLES_CommandList *out);
+int dx8gles11_context_compile_file(dx8gles11_context *ctx, const char *path,
+                                   const dx8gles11_options *opts, GLES_CommandList *out);
+/* the context's caps, probing the current GL context if still unknown */
+void dx8gles11_context_caps(dx8gles11_context *ctx, dx8gles11_caps *out);
+void dx8gles11_context_get_stats(dx8gles11_context *ctx, dx8gles11_context_stats *out);
+
+/* Batch compile ------------------------------------------------- */
+/*
+ * Compiles many shaders in parallel, e.g. everything a level loads. Workers
+ * claim items one at a time until none are left, so uneven shader sizes
+ * balance out, and share the include cache plus the options' prelude and
+ * compile cache. threads < 1 compiles on the calling thread. Results are
+ * stored in the items themselves, so they stay in input order.
+ */
+typedef struct dx8gles11_batch_item {
+    const char *source;            /* shader text; NULL compiles path */
+    const char *path;
+    const dx8gles11_options *opts; /* NULL uses the batch's options */
+    GLES_CommandList list;         /* out: the commands when rc is 0 */
+    int rc;                        /* out: as dx8gles11_compile_string() */
+    char *error;                   /* out: dx8gles11_error() text when rc is not 0 */
+} dx8gles11_batch_item;
+
+/* number of failed items, or -1 on bad arguments */
+int dx8gles11_compile_batch(dx8gles11_batch_item *items, size_t count,
+                            const dx8gles11_options *opts, int threads);
+int dx8gles11_context_compile_batch(dx8gles11_context *ctx, dx8gles11_batch_item *items,
+                                    size_t count, const dx8gles11_options *opts, int threads);
+/* frees the lists and error texts of the items */
+void dx8gles11_batch_free(dx8gles11_batch_item *items, size_t count);
+
+/* Asynchronous compile ------------------------------------------ */
+/*
+ * Queues a compile on the context's worker threads and returns a ticket
+ * for it right away. source is copied; NULL compiles path instead. opts,
+ * and what it points to, must stay valid until the ticket is done. done,
+ * when given, runs on the worker thread once the result is in.
+ * Cancelling only stops a compile that has not started; releasing a
+ * ticket that has not started cancels it.
+ */
+typedef struct dx8gles11_ticket dx8gles11_ticket;
+typedef void (*dx8gles11_done_fn)(dx8gles11_ticket *t, void *user);
+
+enum {
+    DX8GLES11_TICKET_PENDING,
+    DX8GLES11_TICKET_RUNNING,
+    DX8GLES11_TICKET_DONE,
+    DX8GLES11_TICKET_CANCELLED
+};
+
+dx8gles11_ticket *dx8gles11_compile_async(const char *source, const char *path,
+                                          const dx8gles11_options *opts, dx8gles11_done_fn done,
+                                          void *user);
+dx8gles11_ticket *dx8gles11_context_compile_async(dx8gles11_context *ctx, const char *source,
+                                                  const char *path, const dx8gles11_options *opts,
+                                                  dx8gles11_done_fn done, void *user);
+int dx8gles11_ticket_status(const dx8gles11_ticket *t);
+/* status once done or cancelled, or after timeout_ms; < 0 waits forever */
+int dx8gles11_ticket_wait(dx8gles11_ticket *t, long timeout_ms);
+/* 0 when the compile will not run */
+int dx8gles11_ticket_cancel(dx8gles11_ticket *t);
+/* the compile's return code; moves the list into *out and sets
+ * dx8gles11_error() on failure. -1 while not done. */
+int dx8gles11_ticket_result(dx8gles11_ticket *t, GLES_CommandList *out);
+void dx8gles11_ticket_release(dx8gles11_ticket *t);
+
+/* Compile session ----------------------------------------------- */
+/*
+ * Keeps the scratch memory of a compile (preprocessor output, parsed
+ * program, line buffers) alive for the next one, so repeated compiles on
+ * one thread only allocate the output list. A session is not thread-safe;
+ * use one per thread.
+ */
+dx8gles11_session *dx8gles11_session_create(void);
+void dx8gles11_session_destroy(dx8gles11_session *s);
+int dx8gles11_session_compile_string(dx8gles11_session *s, const char *src,
+                                     const dx8gles11_options *opts, GLES_CommandList *out);
+int dx8gles11_session_compile_file(dx8gles11_session *s, const char *path,
+                                   const dx8gles11_options *opts, GLES_CommandList *out);
+
+/* Streamed compile -------------------------------------------- */
+/*
+ * Compiles a source that arrives in pieces, such as the output of a
+ * decompressor. Each feed preprocesses and parses the lines it completes,
+ * so only an unfinished last line is held back. Errors carry the codes and
+ * dx8gles11_error() text of dx8gles11_compile_string() and are reported by
+ * the call that hits them; every later call then fails with the same code.
+ * opts, and what it points to, must outlive the stream. Neither cache is
+ * consulted.
+ */
+typedef struct dx8gles11_stream dx8gles11_stream;
+
+dx8gles11_stream *dx8gles11_stream_create(const dx8gles11_options *opts);
+int dx8gles11_stream_feed(dx8gles11_stream *s, const char *data, size_t len);
+/* ends the source and translates it into *out */
+int dx8gles11_stream_finish(dx8gles11_stream *s, GLES_CommandList *out);
+void dx8gles11_stream_destroy(dx8gles11_stream *s);
+
+/* Compile cache ------------------------------------------------- */
+/*
+ * Content-addressed cache of compiled command lists, keyed by the
+ * preprocessed source and the options that affect translation. Lookups are
+ * lock-free; concurrent requests for the same uncached shader compile it
+ * once while the other callers wait for that result. Entries beyond
+ * budget_bytes are evicted roughly least recently used first (a clock).
+ */
+typedef struct dx8gles11_cache_stats {
+    uint64_t hits;      /* served from the cache, including waits on an in-flight compile */
+    uint64_t misses;    /* compiled and inserted */
+    uint64_t evictions; /* dropped to stay within the budget */
+    size_t entries;
+    size_t bytes;
+    size_t retired; /* dropped but not yet freed: lookups may still see them */
+} dx8gles11_cache_stats;
+
+dx8gles11_cache *dx8gles11_cache_create(size_t budget_bytes);
+/* all lists returned by the cache must be released first */
+void dx8gles11_cache_destroy(dx8gles11_cache *c);
+/* *out is shared and read-only; hand it back with dx8gles11_cache_release() */
+int dx8gles11_cache_compile_string(dx8gles11_cache *c, const char *src,
+                                   const dx8gles11_options *opts, const GLES_CommandList **out);
+int dx8gles11_cache_compile_file(dx8gles11_cache *c, const char *path,
+                                 const dx8gles11_options *opts, const GLES_CommandList **out);
+void dx8gles11_cache_release(dx8gles11_cache *c, const GLES_CommandList *list);
+void dx8gles11_cache_get_stats(dx8gles11_cache *c, dx8gles11_cache_stats *out);
+
+/* Shared command lists ------------------------------------------ */
+/*
+ * Interning pool: identical command lists, from any shaders, share one
+ * immutable copy with a reference count, so resident memory follows the
+ * number of distinct lists rather than the number of shaders. Safe to use
+ * from several threads.
+ */
+typedef struct dx8gles11_intern dx8gles11_intern;
+
+typedef struct dx8gles11_intern_stats {
+    size_t refs;          /* live references */
+    size_t unique;        /* distinct lists held */
+    size_t bytes;         /* held, including per-list overhead */
+    size_t logical_bytes; /* commands of every reference, were none shared */
+    double dedup_ratio;   /* commands referenced per command stored */
+} dx8gles11_intern_stats;
+
+dx8gles11_intern *dx8gles11_intern_create(void);
+/* all interned lists must be released first */
+void dx8gles11_intern_destroy(dx8gles11_intern *p);
+/* takes *list, leaving it empty, and returns the shared, read-only copy;
+ * NULL on failure, with *list untouched */
+const GLES_CommandList *dx8gles11_intern_list(dx8gles11_intern *p, GLES_CommandList *list);
+/* one more reference to an interned list */
+const GLES_CommandList *dx8gles11_intern_retain(dx8gles11_intern *p, const GLES_CommandList *list);
+void dx8gles11_intern_release(dx8gles11_intern *p, const GLES_CommandList *list);
+void dx8gles11_intern_get_stats(dx8gles11_intern *p, dx8gles11_intern_stats *out);
+
+/* Packed command lists ------------------------------------------ */
+/*
+ * Variable-length form of a command list for lists kept resident: a tag
+ * byte per command followed by only its nonzero fields, integers as
+ * varints; the test fixtures pack to about a sixth of their gles_cmd size.
+ * Walk it with an iterator or convert it back.
+ */
+typedef struct GLES_PackedList {
+    uint8_t *data;
+    size_t size;  /* bytes */
+    size_t count; /* commands */
+} GLES_PackedList;
+
+typedef struct gles_packed_iter {
+    const uint8_t *p, *end;
+} gles_packed_iter;
+
+int gles_cmdlist_pack(const GLES_CommandList *in, GLES_PackedList *out);
+int gles_packed_unpack(const GLES_PackedList *in, GLES_CommandList *out);
+void gles_packed_free(GLES_PackedList *l);
+void gles_packed_begin(const GLES_PackedList *l, gles_packed_iter *it);
+/* 1 with the next command in *cmd, 0 at the end, -1 on a malformed list */
+int gles_packed_next(gles_packed_iter *it, gles_cmd *cmd);
+
+/* Permutations ------------------------------------------------ */
+/*
+ * Compiles every combination of a set of feature macros over one source.
+ * A boolean feature (values == NULL) is either left undefined or defined
+ * as 1; an enum feature is defined to each of its values in turn. The
+ * source up to the first line that depends on a feature is preprocessed
+ * once and shared by all variants, and variants that produce the same
+ * command list share one entry of lists.
+ */
+typedef struct dx8gles11_feature {
+    const char *name;
+    const char *const *values; /* NULL-terminated, or NULL for an off/on switch */
+} dx8gles11_feature;
+
+typedef struct dx8gles11_permutations {
+    size_t count;            /* variants: the product of the features' value counts */
+    size_t *variant;         /* count entries, each an index into lists */
+    GLES_CommandList *lists; /* distinct outputs */
+    size_t nlists;
+} dx8gles11_permutations;
+
+/*
+ * Variant i takes value (i / stride_f) % n_f of feature f, where n_f is the
+ * feature's value count and stride_f the product of the counts before it;
+ * feature 0 varies fastest. threads < 1 compiles on the calling thread.
+ * On failure nothing is returned and the error names a failing variant.
+ * cache_dir is not consulted; the in-memory cache is.
+ */
+int dx8gles11_compile_permutations(const char *src, const dx8gles11_feature *features,
+                                   size_t nfeatures, const dx8gles11_options *opts, int threads,
+                                   dx8gles11_permutations *out);
+void dx8gles11_permutations_free(dx8gles11_permutations *p);
+
+/* Shader archives ----------------------------------------------- */
+/*
+ * A packed, memory-mappable set of named command lists for one target,
+ * written offline (see the dx8gles11c tool). Readers use the data in
+ * place: opening checks the header and section bounds, lookups binary
+ * search a hash index, and neither parses nor allocates. Identical lists
+ * are stored once. The layout is native-endian; archives written for a
+ * different gles_cmd size or byte order are rejected.
+ */
+typedef struct dx8gles11_archive {
+    const void *data;
+    size_t size;
+    int mapped; /* set by dx8gles11_archive_map() */
+} dx8gles11_archive;
+
+typedef struct dx8gles11_archive_item {
+    const char *name; /* unique, e.g. a path relative to the source root */
+    const GLES_CommandList *list;
+} dx8gles11_archive_item;
+
+/* target may be NULL; it only records the caps the lists were built for */
+int dx8gles11_archive_write(const char *path, const dx8gles11_archive_item *items, size_t count,
+                            const dx8gles11_caps *target);
+/* over caller-owned memory, 16-byte aligned, that outlives the archive */
+int dx8gles11_archive_init(dx8gles11_archive *a, const void *data, size_t size);
+int dx8gles11_archive_map(dx8gles11_archive *a, const char *path);
+void dx8gles11_archive_unmap(dx8gles11_archive *a);
+/* full checksum check; init and map only check the layout */
+int dx8gles11_archive_verify(const dx8gles11_archive *a);
+uint32_t dx8gles11_archive_caps(const dx8gles11_archive *a);
+size_t dx8gles11_archive_count(const dx8gles11_archive *a);
+const char *dx8gles11_archive_name(const dx8gles11_archive *a, size_t i);
+const gles_cmd *dx8gles11_archive_entry_cmds(const dx8gles11_archive *a, size_t i, size_t *count);
+/* the commands stored under name, in place; NULL when absent */
+const gles_cmd *dx8gles11_archive_find(const dx8gles11_archive *a, const char *name,
+                                       size_t *count);
+
+/* Persistent cache ---------------------------------------------- */
+/*
+ * With dx8gles11_options.cache_dir set, compiled lists are written to that
+ * directory keyed by the source, its include dependencies, the options and
+ * the target capabilities, and reused on later runs. Corrupt or stale
+ * entries are recompiled and replaced.
+ */
+/* map and validate every entry in dir on a background thread */
+int dx8gles11_disk_cache_preload(const char *dir);
+void dx8gles11_disk_cache_preload_wait(void);
+/* release the mappings held by the last preload */
+void dx8gles11_disk_cache_unload(void);
+
 #ifdef __cplusplus
 }
 #endif
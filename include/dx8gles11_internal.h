@@ -0,0 +1,59 @@
+#ifndef DX8GLES11_INTERNAL_H
+#define DX8GLES11_INTERNAL_H
+/* Entry points shared between the library's translation units; not part of
+ * the public API. */
+#include "dx8gles11.h"
+#include "preprocess.h"
+#include <stdio.h>
+
+/* dx8_to_gles11.c */
+/* arena may be NULL; scratch memory is then freed before returning */
+int compile_preprocessed(const char *pp_src, const dx8gles11_options *opt,
+                         struct util_arena *arena, GLES_CommandList *out);
+/* compile_preprocessed() through opt->cache when one is set */
+int compile_or_lookup(const char *pp_src, const dx8gles11_options *opt, struct util_arena *arena,
+                      GLES_CommandList *out);
+/* dx8gles11_compile_string()/_file() with scratch memory from arena */
+int compile_string_arena(const char *src, const dx8gles11_options *opt, struct util_arena *arena,
+                         GLES_CommandList *out);
+int compile_file_arena(const char *path, const dx8gles11_options *opt, struct util_arena *arena,
+                       GLES_CommandList *out);
+void dx8gles11_set_error(const char *msg);
+struct asm_instr;
+/* translate one instruction for a target with the DX8GLES11_CAP_* caps */
+void translate_instr_caps(const struct asm_instr *i, uint32_t caps, GLES_CommandList *out);
+struct asm_program;
+/* validate a parsed program and append its constants and instructions to
+ * out; 0 or compile_preprocessed()'s -4 */
+int translate_program_caps(const struct asm_program *prog, uint32_t caps, GLES_CommandList *out);
+
+/* context.c: opt->caps, or the default context's */
+uint32_t translate_caps(const dx8gles11_options *opt);
+/* the context's caps, probed on first use */
+uint32_t context_caps(dx8gles11_context *ctx);
+/* *o = opts with caps pinned (opts' own, else bits) and the context's
+ * caches filled in */
+void context_pin(dx8gles11_context *ctx, const dx8gles11_options *opts, uint32_t bits,
+                 dx8gles11_options *o, dx8gles11_caps *caps);
+/* an empty scratch arena on the context's allocator */
+void context_arena(dx8gles11_context *ctx, struct util_arena *arena);
+/* counts a compile and reports a failure; returns rc */
+int context_count(dx8gles11_context *ctx, int rc);
+/* async workers, started on first use; NULL when they cannot be */
+struct mt_pool *context_pool(dx8gles11_context *ctx);
+
+/* compile_cache.c: returns a shared list the caller releases with
+ * dx8gles11_cache_release(); error codes match compile_preprocessed() */
+int cache_compile_preprocessed(dx8gles11_cache *c, const char *pp_src,
+                               const dx8gles11_options *opt, const GLES_CommandList **out);
+
+/* disk_cache.c: load returns 0 and fills out on a valid, current entry */
+uint64_t disk_cache_key(const char *src, size_t len, const char *path,
+                        const dx8gles11_options *opt, uint32_t caps);
+int disk_cache_load(const char *dir, uint64_t key, GLES_CommandList *out);
+void disk_cache_store(const char *dir, uint64_t key, const pp_dep *deps,
+                      const GLES_CommandList *l);
+/* a new file beside path, named in tmp, to write and then rename over path;
+ * NULL when it cannot be created */
+FILE *temp_beside(const char *path, char *tmp, size_t n);
+#endif
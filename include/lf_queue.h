@@ -2,25 +2,36 @@
 #define DX8GLES11_LF_QUEUE_H
 
 #include <stdatomic.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*
+ * Unbounded multi-producer/multi-consumer queue (Michael & Scott). Popped
+ * nodes are reclaimed with hazard pointers and recycled through per-thread
+ * pools, so concurrent pops never touch freed memory and a queue in steady
+ * state does not allocate.
+ */
 typedef struct lf_queue_node {
     void *value;
-    struct lf_queue_node *next;
+    _Atomic(struct lf_queue_node *) next;
+    struct lf_queue_node *free_next; /* retired and pooled nodes */
 } lf_queue_node;
 
 typedef struct lf_queue {
-    _Atomic(lf_queue_node *) head;
-    _Atomic(lf_queue_node *) tail;
+    _Alignas(64) _Atomic(lf_queue_node *) head;
+    _Alignas(64) _Atomic(lf_queue_node *) tail;
 } lf_queue;
 
 int lf_queue_init(lf_queue *q);
+/* no other thread may be using q */
 void lf_queue_destroy(lf_queue *q);
 int lf_queue_push(lf_queue *q, void *value);
 void *lf_queue_pop(lf_queue *q);
+/* nodes obtained from malloc so far, by all queues */
+size_t lf_queue_nodes_allocated(void);
 
 #ifdef __cplusplus
 }
@@ -1,5 +1,106 @@
 #ifndef DX8GLES11_PREPROCESS_H
 #define DX8GLES11_PREPROCESS_H
+#include <stddef.h>
+#include <stdint.h>
+
+/* an #include resolved while preprocessing */
+typedef struct pp_dep {
+    char *path;    /* path the include was read from */
+    uint64_t hash; /* util_hash64 of its contents */
+} pp_dep;
+
+struct util_arena;
+
+/* include contents shared through a pp_include_cache (include_cache.c) */
+typedef struct pp_file {
+    const char *path; /* path the file was read from */
+    const char *data; /* not NUL-terminated */
+    size_t len;
+    uint64_t hash; /* util_hash64 of data */
+} pp_file;
+
+typedef struct pp_include_cache pp_include_cache;
+
+typedef struct pp_include_stats {
+    uint64_t hits;          /* opens served from cached contents */
+    uint64_t loads;         /* files read or mapped */
+    uint64_t negative_hits; /* search directories skipped by their index */
+} pp_include_stats;
+
+/* thread-safe; the default cache lives for the whole process */
+pp_include_cache *pp_include_cache_create(void);
+void pp_include_cache_destroy(pp_include_cache *c);
+pp_include_cache *pp_include_cache_default(void);
+void pp_include_cache_get_stats(pp_include_cache *c, pp_include_stats *out);
+/* first dirs[i]/name that exists, or NULL; close every file opened */
+const pp_file *pp_include_open(pp_include_cache *c, const char *const *dirs, size_t ndirs,
+                               const char *name, size_t n);
+const pp_file *pp_include_open_path(pp_include_cache *c, const char *path);
+void pp_include_close(pp_include_cache *c, const pp_file *f);
+
+/*
+ * Preprocessed prelude (a "precompiled header"): the macros it defines and
+ * the output it expands to. A run given a snapshot whose source starts with
+ * the same prelude text, resolved against the same directory and include
+ * paths, resumes after it instead of reprocessing it; if any include the
+ * prelude read has changed content the run silently preprocesses in full.
+ * Snapshots are immutable and may be shared between threads.
+ */
+typedef struct pp_snapshot pp_snapshot;
+
+typedef struct pp_config {
+    const char *include_dir;
+    const char *const *include_paths; /* optional: NULL-terminated, searched after
+                                         include_dir */
+    pp_include_cache *includes;       /* optional: NULL uses the default cache */
+    const pp_snapshot *snapshot;      /* optional: prelude to resume from */
+    const char *const *defines;       /* optional: NULL-terminated "NAME" or "NAME=value",
+                                         defined before the source like -D */
+    pp_dep **deps;                    /* optional: every include read is appended here */
+    struct util_arena *arena;         /* optional: scratch and result memory; the result
+                                         is then owned by the arena instead of malloc'd */
+} pp_config;
+
 char *pp_run(const char *source_path, const char *include_dir, char **err);
 char *pp_run_string(const char *source, const char *include_dir, char **err);
+char *pp_run_cfg(const char *source_path, const pp_config *cfg, char **err);
+char *pp_run_string_cfg(const char *source, const pp_config *cfg, char **err);
+/*
+ * Streaming runs: each output line goes to fn, without its newline, as soon
+ * as it is expanded, and the full output is never built. The line is only
+ * valid during the call. A nonzero return from fn ends the run with -1 and
+ * leaves *err unset; preprocessing errors return -1 with *err set.
+ */
+typedef int (*pp_line_fn)(void *ctx, const char *line, size_t len);
+int pp_stream_cfg(const char *source_path, const pp_config *cfg, pp_line_fn fn, void *ctx,
+                  char **err);
+int pp_stream_string_cfg(const char *source, const pp_config *cfg, pp_line_fn fn, void *ctx,
+                         char **err);
+/*
+ * Push runs take the source in arbitrary chunks and emit each line to fn as
+ * soon as its newline has arrived. Includes resolve as for a string source;
+ * cfg->snapshot is not used. After an error every later call fails.
+ */
+typedef struct pp_push pp_push;
+pp_push *pp_push_begin(const pp_config *cfg, pp_line_fn fn, void *ctx, char **err);
+int pp_push_feed(pp_push *p, const char *data, size_t len, char **err);
+/* ends the source: its last line need not end with a newline */
+int pp_push_finish(pp_push *p, char **err);
+void pp_push_free(pp_push *p);
+void pp_deps_free(pp_dep *deps);
+/* dir is where the prelude's includes are resolved first: the directory of
+ * the sources it will serve, or NULL for strings; cfg->snapshot is ignored */
+pp_snapshot *pp_snapshot_create(const char *prelude, const char *dir, const pp_config *cfg,
+                                char **err);
+/*
+ * Snapshot of the longest run of whole lines at the start of src whose
+ * preprocessing never names one of keys (NULL-terminated), stopping before
+ * any #if group that does. Runs may predefine any of keys and still resume
+ * from it; shader permutations use this to share their common prefix.
+ */
+pp_snapshot *pp_snapshot_create_for(const char *src, const char *dir, const pp_config *cfg,
+                                    const char *const *keys, char **err);
+/* runs that resumed from snap so far */
+uint64_t pp_snapshot_resumed(const pp_snapshot *snap);
+void pp_snapshot_destroy(pp_snapshot *snap);
 #endif
@@ -0,0 +1,51 @@
+#ifndef DX8GLES11_RING_H
+#define DX8GLES11_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bounded ring of fixed-size elements stored inline, either single
+ * producer/single consumer or multi producer/multi consumer. Operations
+ * never block or allocate: push_many stores as many leading items as fit
+ * and pop_many takes as many as are ready, so callers choose how to wait
+ * on a full or empty ring. The producer and consumer indices sit on
+ * separate cache lines.
+ */
+typedef struct ring_buffer {
+    _Alignas(64) atomic_size_t tail; /* next position to fill */
+    size_t head_cache;               /* spsc producer: head as last seen */
+    _Alignas(64) atomic_size_t head; /* next position to read */
+    size_t tail_cache;               /* spsc consumer: tail as last seen */
+    _Alignas(64) unsigned char *slots;
+    size_t mask;   /* capacity - 1 */
+    size_t elem;   /* payload bytes */
+    size_t stride; /* slot bytes; mpmc slots start with a sequence number */
+    int spsc;
+} ring_buffer;
+
+/* capacity is rounded up to a power of two */
+int ring_init(ring_buffer *r, size_t elem_size, size_t capacity, int spsc);
+void ring_destroy(ring_buffer *r);
+/* returns how many of the n items were queued */
+size_t ring_push_many(ring_buffer *r, const void *items, size_t n);
+/* returns how many items, up to max, were copied to out */
+size_t ring_pop_many(ring_buffer *r, void *out, size_t max);
+/* as ring_pop_many(); *pos receives the first item's position, counted over
+ * everything ever queued, so positions order pops across consumers */
+size_t ring_pop_many_at(ring_buffer *r, void *out, size_t max, size_t *pos);
+
+static inline int ring_push(ring_buffer *r, const void *item) {
+    return ring_push_many(r, item, 1) ? 0 : -1;
+}
+static inline int ring_pop(ring_buffer *r, void *out) { return ring_pop_many(r, out, 1) ? 0 : -1; }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DX8GLES11_RING_H */
@@ -2,7 +2,10 @@
 #define DX8GLES11_RUNTIME_PIPELINE_H
 
 #include "minithread.h"
+#include "chunk_pool.h"
 #include "lf_queue.h"
+#include "ring.h"
+#include <stdint.h>
 #include <time.h>
 
 #ifdef __cplusplus
@@ -15,24 +18,49 @@ extern "C" {
  */
 
 struct pipeline_stats;
+struct gles_cmd;
 
 typedef struct pipeline {
     mt_pool workers;
-    lf_queue decode_q;
-    lf_queue prepare_q;
-    lf_queue dispatch_q;
+    lf_queue decode_q;      /* sources, owned by the caller */
+    ring_buffer prepare_q;  /* chunks of parsed programs from prog_pool */
+    ring_buffer dispatch_q; /* chunks of gles_cmd from cmd_pool; pipeline_render() drains it */
+    chunk_pool prog_pool;
+    chunk_pool cmd_pool;
+    atomic_size_t next_seq; /* prepare_q position whose commands are queued next */
+    void *render_chunk; /* render mode: partly dispatched chunk */
+    size_t render_pos;
     int decode_threads;
     int prepare_threads;
-    int num_threads; /* dispatch threads */
+    int num_threads; /* dispatch threads; 1 in render mode */
+    int render;      /* dispatch happens in pipeline_render() on the GL thread */
+    uint32_t render_caps;
     struct pipeline_stats *stats;
+    /* optional, set between init and start: sees each run of commands just
+     * before the dispatching thread issues it */
+    void (*trace)(void *user, const struct gles_cmd *cmds, size_t n);
+    void *trace_user;
+    atomic_int running;      /* set by pipeline_start(), cleared by pipeline_stop() */
+    atomic_int live_decode;  /* workers of a stage still able to feed the next */
+    atomic_int live_prepare;
 } pipeline;
 
 double pipeline_commands_per_second(const pipeline *p);
+/* commands dispatched since pipeline_start() */
+size_t pipeline_commands_dispatched(const pipeline *p);
 
 int pipeline_init(pipeline *p, int num_threads);
 int pipeline_init_stages(pipeline *p, int decode_threads, int prepare_threads,
                          int dispatch_threads);
+/* decode and prepare scale out while one thread, the one that owns the GL
+ * context, dispatches: it calls pipeline_start(), pipeline_render() and
+ * pipeline_stop() */
+int pipeline_init_render(pipeline *p, int decode_threads, int prepare_threads);
 int pipeline_start(pipeline *p);
+/* render mode: dispatch up to max queued commands (0: all that are queued)
+ * on the calling thread; returns how many, or -1 on another pipeline */
+int pipeline_render(pipeline *p, int max);
+/* render mode: keeps dispatching until the other stages have drained */
 void pipeline_stop(pipeline *p);
 void pipeline_join(pipeline *p);
 
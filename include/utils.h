@@ -29,10 +29,83 @@ static inline size_t *sb__raw(void *a) { return (size_t *)((char *)a - sizeof(si
         }                                                                                          \
         (a)[sb__raw(a)[0]++] = (v);                                                                \
     } while (0)
+/* grow capacity to at least n elements so the next pushes do not reallocate */
+#define sb_reserve(a, n)                                                                           \
+    do {                                                                                           \
+        if ((size_t)(n) > sb_capacity(a)) {                                                        \
+            size_t newcap = (size_t)(n);                                                           \
+            size_t *nb = (a) ? realloc(sb__raw(a), newcap * sizeof(*(a)) + sizeof(size_t) * 2)     \
+                             : malloc(newcap * sizeof(*(a)) + sizeof(size_t) * 2);                 \
+            if (!nb)                                                                               \
+                abort();                                                                           \
+            if (!a) {                                                                              \
+                nb[0] = 0;                                                                         \
+            }                                                                                      \
+            a = (void *)((size_t *)nb + 2);                                                        \
+            nb[1] = newcap;                                                                        \
+        }                                                                                          \
+    } while (0)
+/* empty the buffer, keeping its capacity */
+#define sb_clear(a)                                                                                \
+    do {                                                                                           \
+        if (a)                                                                                     \
+            sb__raw(a)[0] = 0;                                                                     \
+    } while (0)
+/* drop unused capacity; kept as is when the allocator will not shrink it */
+#define sb_shrink(a)                                                                               \
+    do {                                                                                           \
+        if (sb_count(a) && sb_count(a) < sb_capacity(a)) {                                         \
+            size_t *nb = realloc(sb__raw(a), sb_count(a) * sizeof(*(a)) + sizeof(size_t) * 2);     \
+            if (nb) {                                                                              \
+                a = (void *)((size_t *)nb + 2);                                                    \
+                nb[1] = nb[0];                                                                     \
+            }                                                                                      \
+        }                                                                                          \
+    } while (0)
+
+#include <stdint.h>
 
 char *util_strndup(const char *s, size_t n);
 char *util_strdup(const char *s);
 int util_vasprintf(char **out, const char *fmt, va_list ap);
 int util_asprintf(char **out, const char *fmt, ...);
+/*
+ * Bump allocator for compile-scoped scratch memory. Allocations are only
+ * released together by util_arena_reset()/util_arena_free(); a reset keeps
+ * the memory, coalescing overflow blocks so the next use of the same size
+ * needs a single block.
+ */
+typedef struct util_arena_block util_arena_block;
+typedef struct util_arena {
+    util_arena_block *head; /* block being carved; older blocks follow */
+    void *last;             /* most recent allocation, growable in place */
+    /* optional block allocator, kept across reset/free; NULL uses malloc */
+    void *(*alloc)(void *user, size_t n);
+    void (*release)(void *user, void *p);
+    void *user;
+} util_arena;
+
+void *util_arena_alloc(util_arena *a, size_t n);
+/* resize p (NULL or the result of an arena call) to n bytes, in place when possible */
+void *util_arena_grow(util_arena *a, void *p, size_t old_n, size_t n);
+char *util_arena_strndup(util_arena *a, const char *s, size_t n);
+void util_arena_reset(util_arena *a);
+void util_arena_free(util_arena *a);
+
+/* first byte in [p, end) equal to a or b, or end; vectorised on SSE2/NEON */
+const char *util_find2(const char *p, const char *end, char a, char b);
+
+/*
+ * Locale-independent, correctly rounded decimal parsing (float_parse.c).
+ * Both scan [p, e) like strtof/strtoul and return the end of the number, or
+ * NULL when p does not start one. Only decimal syntax is accepted:
+ * [+-]digits[.digits][(e|E)[+-]digits]; no hex, inf or nan.
+ */
+const char *util_parse_float(const char *p, const char *e, float *out);
+/* unsigned decimal; NULL on overflow */
+const char *util_parse_u32(const char *p, const char *e, uint32_t *out);
+
+/* fast non-cryptographic 64-bit hash */
+uint64_t util_hash64(const void *data, size_t n, uint64_t seed);
 
 #endif
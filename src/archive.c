@@ -0,0 +1,363 @@
+#include "dx8gles11.h"
+#include "dx8gles11_internal.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Archive layout, all fields native-endian:
+ *
+ *   archive_header
+ *   archive_entry[entry_count]  sorted by name hash
+ *   gles_cmd[]                  at blob_offset; identical lists stored once
+ *   char strtab[strtab_size]    entry names, each NUL-terminated
+ *
+ * Readers use the file in place: opening checks the header and section
+ * bounds, lookups binary search the index. `checksum` covers everything
+ * after the header and is only checked by dx8gles11_archive_verify().
+ */
+
+#define ARCHIVE_MAGIC "DX8GLA\r\n"
+#define ARCHIVE_VERSION 1u
+#define ARCHIVE_ALIGN 16
+
+typedef struct archive_header {
+    char magic[8];
+    uint32_t version;
+    uint16_t cmd_size; /* sizeof(gles_cmd) of the writer */
+    uint16_t endian;   /* 0x0102 as written */
+    uint32_t caps;     /* DX8GLES11_CAP_* the lists were translated for */
+    uint32_t entry_count;
+    uint64_t size; /* of the whole archive */
+    uint64_t checksum;
+    uint32_t blob_offset;
+    uint32_t blob_count; /* commands */
+    uint32_t strtab_offset;
+    uint32_t strtab_size;
+} archive_header;
+
+typedef struct archive_entry {
+    uint64_t hash; /* util_hash64 of the name */
+    uint32_t name_off;
+    uint32_t name_len;
+    uint32_t cmd_first; /* index into the blob section */
+    uint32_t cmd_count;
+} archive_entry;
+
+static const archive_header *header(const dx8gles11_archive *a) { return a->data; }
+
+static const archive_entry *entries(const dx8gles11_archive *a) {
+    return (const archive_entry *)((const char *)a->data + sizeof(archive_header));
+}
+
+int dx8gles11_archive_init(dx8gles11_archive *a, const void *data, size_t size) {
+    if (!a || !data) {
+        dx8gles11_set_error(!a ? "archive null" : "data null");
+        return -1;
+    }
+    const archive_header *h = data;
+    const char *why = NULL;
+    if (size < sizeof(*h) || ((uintptr_t)data & (ARCHIVE_ALIGN - 1)))
+        why = "truncated or misaligned";
+    else if (memcmp(h->magic, ARCHIVE_MAGIC, 8) || h->version != ARCHIVE_VERSION)
+        why = "not a shader archive of this version";
+    else if (h->cmd_size != sizeof(gles_cmd) || h->endian != 0x0102)
+        why = "written for another platform";
+    else if (h->size != size ||
+             (uint64_t)h->entry_count * sizeof(archive_entry) > size - sizeof(*h) ||
+             h->blob_offset < sizeof(*h) + (uint64_t)h->entry_count * sizeof(archive_entry) ||
+             (uint64_t)h->blob_offset + (uint64_t)h->blob_count * sizeof(gles_cmd) > size ||
+             h->blob_offset % ARCHIVE_ALIGN ||
+             (uint64_t)h->strtab_offset + h->strtab_size > size)
+        why = "sections out of bounds";
+    if (why) {
+        char msg[100];
+        snprintf(msg, sizeof(msg), "bad archive: %s", why);
+        dx8gles11_set_error(msg);
+        return -1;
+    }
+    a->data = data;
+    a->size = size;
+    a->mapped = 0;
+    return 0;
+}
+
+int dx8gles11_archive_map(dx8gles11_archive *a, const char *path) {
+    if (!a || !path) {
+        dx8gles11_set_error(!a ? "archive null" : "path null");
+        return -1;
+    }
+    void *data = NULL;
+    size_t size = 0;
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        size = (size_t)st.st_size;
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+            data = NULL;
+    }
+    if (fd >= 0)
+        close(fd);
+#else
+    FILE *f = fopen(path, "rb");
+    struct stat st;
+    if (f && stat(path, &st) == 0 && st.st_size > 0) {
+        size = (size_t)st.st_size;
+        data = _aligned_malloc(size, ARCHIVE_ALIGN);
+        if (data && fread(data, 1, size, f) != size) {
+            _aligned_free(data);
+            data = NULL;
+        }
+    }
+    if (f)
+        fclose(f);
+#endif
+    if (!data) {
+        char msg[300];
+        snprintf(msg, sizeof(msg), "could not map archive %s", path);
+        dx8gles11_set_error(msg);
+        return -1;
+    }
+    if (dx8gles11_archive_init(a, data, size)) {
+#ifndef _WIN32
+        munmap(data, size);
+#else
+        _aligned_free(data);
+#endif
+        return -1;
+    }
+    a->mapped = 1;
+    return 0;
+}
+
+void dx8gles11_archive_unmap(dx8gles11_archive *a) {
+    if (!a || !a->mapped)
+        return;
+#ifndef _WIN32
+    munmap((void *)a->data, a->size);
+#else
+    _aligned_free((void *)a->data);
+#endif
+    a->data = NULL;
+    a->size = 0;
+    a->mapped = 0;
+}
+
+int dx8gles11_archive_verify(const dx8gles11_archive *a) {
+    const archive_header *h = header(a);
+    if (util_hash64(h + 1, a->size - sizeof(*h), 0) != h->checksum) {
+        dx8gles11_set_error("bad archive: checksum mismatch");
+        return -1;
+    }
+    return 0;
+}
+
+uint32_t dx8gles11_archive_caps(const dx8gles11_archive *a) { return header(a)->caps; }
+
+size_t dx8gles11_archive_count(const dx8gles11_archive *a) { return header(a)->entry_count; }
+
+/* the entry's name, or NULL when it points outside the string table */
+static const char *entry_name(const dx8gles11_archive *a, const archive_entry *e) {
+    const archive_header *h = header(a);
+    if ((uint64_t)e->name_off + e->name_len >= h->strtab_size)
+        return NULL;
+    const char *n = (const char *)a->data + h->strtab_offset + e->name_off;
+    return n[e->name_len] ? NULL : n;
+}
+
+static const gles_cmd *entry_cmds(const dx8gles11_archive *a, const archive_entry *e,
+                                  size_t *count) {
+    const archive_header *h = header(a);
+    if ((uint64_t)e->cmd_first + e->cmd_count > h->blob_count)
+        return NULL;
+    *count = e->cmd_count;
+    return (const gles_cmd *)((const char *)a->data + h->blob_offset) + e->cmd_first;
+}
+
+const char *dx8gles11_archive_name(const dx8gles11_archive *a, size_t i) {
+    return i < header(a)->entry_count ? entry_name(a, &entries(a)[i]) : NULL;
+}
+
+const gles_cmd *dx8gles11_archive_entry_cmds(const dx8gles11_archive *a, size_t i, size_t *count) {
+    *count = 0;
+    return i < header(a)->entry_count ? entry_cmds(a, &entries(a)[i], count) : NULL;
+}
+
+const gles_cmd *dx8gles11_archive_find(const dx8gles11_archive *a, const char *name,
+                                       size_t *count) {
+    *count = 0;
+    size_t len = strlen(name);
+    uint64_t hash = util_hash64(name, len, 0);
+    const archive_entry *e = entries(a);
+    size_t lo = 0, hi = header(a)->entry_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (e[mid].hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (; lo < header(a)->entry_count && e[lo].hash == hash; ++lo) {
+        const char *n = entry_name(a, &e[lo]);
+        if (n && e[lo].name_len == len && !memcmp(n, name, len))
+            return entry_cmds(a, &e[lo], count);
+    }
+    return NULL;
+}
+
+/* Writer ------------------------------------------------------- */
+
+typedef struct blob_slot {
+    uint64_t hash;
+    const GLES_CommandList *list; /* NULL: empty slot */
+    uint32_t first;
+} blob_slot;
+
+static int by_entry_hash(const void *x, const void *y) {
+    const archive_entry *a = x, *b = y;
+    return a->hash < b->hash ? -1 : a->hash > b->hash;
+}
+
+static size_t align_up(size_t n) { return (n + ARCHIVE_ALIGN - 1) & ~(size_t)(ARCHIVE_ALIGN - 1); }
+
+/* index, deduplicated blob order and string table of the items */
+typedef struct archive_build {
+    archive_entry *index;
+    const GLES_CommandList **blobs;
+    size_t nblobs;
+    uint32_t ncmds;
+    char *strtab; /* stretchy buffer */
+} archive_build;
+
+static int build(archive_build *b, const dx8gles11_archive_item *items, size_t count) {
+    size_t cap = 16;
+    while (cap < 2 * count)
+        cap *= 2;
+    blob_slot *slots = calloc(cap, sizeof(*slots));
+    b->index = calloc(count ? count : 1, sizeof(*b->index));
+    b->blobs = calloc(count ? count : 1, sizeof(*b->blobs));
+    if (!slots || !b->index || !b->blobs) {
+        free(slots);
+        dx8gles11_set_error("out of memory");
+        return -1;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const GLES_CommandList *l = items[i].list;
+        size_t bytes = l->count * sizeof(gles_cmd);
+        uint64_t h = util_hash64(l->data, bytes, l->count);
+        size_t s = h & (cap - 1);
+        while (slots[s].list && !(slots[s].hash == h && slots[s].list->count == l->count &&
+                                  !memcmp(slots[s].list->data, l->data, bytes)))
+            s = (s + 1) & (cap - 1);
+        if (!slots[s].list) {
+            slots[s] = (blob_slot){h, l, b->ncmds};
+            b->blobs[b->nblobs++] = l;
+            b->ncmds += (uint32_t)l->count;
+        }
+        size_t len = strlen(items[i].name);
+        b->index[i] = (archive_entry){util_hash64(items[i].name, len, 0),
+                                      (uint32_t)sb_count(b->strtab), (uint32_t)len,
+                                      slots[s].first, (uint32_t)l->count};
+        for (size_t c = 0; c <= len; ++c)
+            sb_push(b->strtab, items[i].name[c]);
+    }
+    free(slots);
+    qsort(b->index, count, sizeof(*b->index), by_entry_hash);
+    for (size_t i = 1; i < count; ++i) {
+        const archive_entry *x = &b->index[i - 1], *y = &b->index[i];
+        if (x->hash == y->hash && x->name_len == y->name_len &&
+            !memcmp(b->strtab + x->name_off, b->strtab + y->name_off, x->name_len)) {
+            char msg[300];
+            snprintf(msg, sizeof(msg), "duplicate archive entry %s", b->strtab + x->name_off);
+            dx8gles11_set_error(msg);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* the archive image of b, written beside path and renamed into place */
+static int emit(const char *path, const archive_build *b, size_t count, uint32_t caps) {
+    archive_header h = {.version = ARCHIVE_VERSION,
+                        .cmd_size = sizeof(gles_cmd),
+                        .endian = 0x0102,
+                        .caps = caps,
+                        .entry_count = (uint32_t)count,
+                        .blob_count = b->ncmds,
+                        .strtab_size = (uint32_t)sb_count(b->strtab)};
+    memcpy(h.magic, ARCHIVE_MAGIC, 8);
+    size_t blob_offset = align_up(sizeof(h) + count * sizeof(archive_entry));
+    size_t strtab_offset = blob_offset + (size_t)b->ncmds * sizeof(gles_cmd);
+    size_t size = strtab_offset + h.strtab_size;
+    if (size > UINT32_MAX) {
+        dx8gles11_set_error("archive larger than 4 GiB");
+        return -1;
+    }
+    char *img = calloc(1, size);
+    if (!img) {
+        dx8gles11_set_error("out of memory");
+        return -1;
+    }
+    h.blob_offset = (uint32_t)blob_offset;
+    h.strtab_offset = (uint32_t)strtab_offset;
+    h.size = size;
+    if (count)
+        memcpy(img + sizeof(h), b->index, count * sizeof(archive_entry));
+    gles_cmd *cmds = (gles_cmd *)(img + blob_offset);
+    for (size_t i = 0; i < b->nblobs; ++i) {
+        if (b->blobs[i]->count)
+            memcpy(cmds, b->blobs[i]->data, b->blobs[i]->count * sizeof(gles_cmd));
+        cmds += b->blobs[i]->count;
+    }
+    if (h.strtab_size)
+        memcpy(img + strtab_offset, b->strtab, h.strtab_size);
+    h.checksum = util_hash64(img + sizeof(h), size - sizeof(h), 0);
+    memcpy(img, &h, sizeof(h));
+
+    char tmp[1100];
+    FILE *f = temp_beside(path, tmp, sizeof(tmp));
+    int ok = f && fwrite(img, 1, size, f) == size;
+    if (f)
+        ok = fclose(f) == 0 && ok;
+    free(img);
+    if (!ok || rename(tmp, path) != 0) {
+        if (f)
+            remove(tmp);
+        char msg[300];
+        snprintf(msg, sizeof(msg), "could not write archive %s", path);
+        dx8gles11_set_error(msg);
+        return -1;
+    }
+    return 0;
+}
+
+int dx8gles11_archive_write(const char *path, const dx8gles11_archive_item *items, size_t count,
+                            const dx8gles11_caps *target) {
+    if (!path || (count && !items)) {
+        dx8gles11_set_error(!path ? "path null" : "items null");
+        return -1;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (!items[i].name || !items[i].list) {
+            dx8gles11_set_error(!items[i].name ? "item name null" : "item list null");
+            return -1;
+        }
+    }
+    archive_build b = {0};
+    int rc = build(&b, items, count);
+    if (!rc)
+        rc = emit(path, &b, count, target ? target->bits : 0);
+    free(b.index);
+    free(b.blobs);
+    sb_free(b.strtab);
+    return rc;
+}
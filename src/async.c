@@ -0,0 +1,186 @@
+#include "dx8gles11.h"
+#include "dx8gles11_internal.h"
+#include "minithread.h"
+#include "utils.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <time.h>
+
+/*
+ * A ticket is shared by the caller and the queued task, each holding a
+ * reference. State moves PENDING -> RUNNING -> DONE on the worker, or
+ * PENDING -> CANCELLED on whoever wins the exchange first; polling is a
+ * single atomic load. The mutex only serves waiters.
+ */
+
+struct dx8gles11_ticket {
+    dx8gles11_context *ctx;
+    char *source, *path;
+    dx8gles11_options opts;
+    dx8gles11_caps caps; /* pinned on the submitting thread */
+    dx8gles11_done_fn done;
+    void *user;
+    atomic_int state;
+    atomic_int refs;
+    mtx_t lock;
+    cnd_t finished;
+    GLES_CommandList list;
+    int rc;
+    char *error;
+};
+
+static void ticket_unref(dx8gles11_ticket *t) {
+    if (atomic_fetch_sub(&t->refs, 1) != 1)
+        return;
+    gles_cmdlist_free(&t->list);
+    free(t->error);
+    free(t->source);
+    free(t->path);
+    mtx_destroy(&t->lock);
+    cnd_destroy(&t->finished);
+    free(t);
+}
+
+/* publish a final state and wake the waiters */
+static void ticket_finish(dx8gles11_ticket *t, int state) {
+    mtx_lock(&t->lock);
+    atomic_store(&t->state, state);
+    cnd_broadcast(&t->finished);
+    mtx_unlock(&t->lock);
+}
+
+static void ticket_run(void *arg) {
+    dx8gles11_ticket *t = arg;
+    int expect = DX8GLES11_TICKET_PENDING;
+    if (atomic_compare_exchange_strong(&t->state, &expect, DX8GLES11_TICKET_RUNNING)) {
+        util_arena arena;
+        context_arena(t->ctx, &arena);
+        int rc = t->source ? compile_string_arena(t->source, &t->opts, &arena, &t->list)
+                           : compile_file_arena(t->path, &t->opts, &arena, &t->list);
+        util_arena_free(&arena);
+        t->rc = context_count(t->ctx, rc);
+        t->error = rc ? util_strdup(dx8gles11_error()) : NULL;
+        ticket_finish(t, DX8GLES11_TICKET_DONE);
+        if (t->done)
+            t->done(t, t->user);
+    }
+    ticket_unref(t);
+}
+
+dx8gles11_ticket *dx8gles11_context_compile_async(dx8gles11_context *ctx, const char *source,
+                                                  const char *path, const dx8gles11_options *opts,
+                                                  dx8gles11_done_fn done, void *user) {
+    if (!ctx || (!source && !path)) {
+        dx8gles11_set_error(!ctx ? "context null" : "source and path null");
+        return NULL;
+    }
+    dx8gles11_ticket *t = calloc(1, sizeof(*t));
+    if (!t) {
+        dx8gles11_set_error("out of memory");
+        return NULL;
+    }
+    char **copy = source ? &t->source : &t->path;
+    *copy = util_strdup(source ? source : path);
+    int locks = *copy && mtx_init(&t->lock, mtx_plain) == thrd_success;
+    if (!locks || cnd_init(&t->finished) != thrd_success) {
+        if (locks)
+            mtx_destroy(&t->lock);
+        free(*copy);
+        free(t);
+        dx8gles11_set_error("out of memory");
+        return NULL;
+    }
+    t->ctx = ctx;
+    t->done = done;
+    t->user = user;
+    /* workers do not own the GL context, so caps are resolved here */
+    context_pin(ctx, opts, opts && opts->caps ? 0 : context_caps(ctx), &t->opts, &t->caps);
+    atomic_init(&t->state, DX8GLES11_TICKET_PENDING);
+    atomic_init(&t->refs, 2); /* caller + task */
+    mt_pool *pool = context_pool(ctx);
+    if (!pool || mt_pool_submit(pool, ticket_run, t)) {
+        atomic_store(&t->refs, 1);
+        ticket_unref(t);
+        dx8gles11_set_error("could not queue compile");
+        return NULL;
+    }
+    return t;
+}
+
+dx8gles11_ticket *dx8gles11_compile_async(const char *source, const char *path,
+                                          const dx8gles11_options *opts, dx8gles11_done_fn done,
+                                          void *user) {
+    return dx8gles11_context_compile_async(dx8gles11_context_default(), source, path, opts, done,
+                                           user);
+}
+
+int dx8gles11_ticket_status(const dx8gles11_ticket *t) {
+    return t ? atomic_load(&((dx8gles11_ticket *)t)->state) : DX8GLES11_TICKET_CANCELLED;
+}
+
+static int is_final(int state) {
+    return state == DX8GLES11_TICKET_DONE || state == DX8GLES11_TICKET_CANCELLED;
+}
+
+int dx8gles11_ticket_wait(dx8gles11_ticket *t, long timeout_ms) {
+    if (!t)
+        return DX8GLES11_TICKET_CANCELLED;
+    int state = atomic_load(&t->state);
+    if (is_final(state) || timeout_ms == 0)
+        return state;
+    struct timespec until;
+    timespec_get(&until, TIME_UTC);
+    until.tv_sec += timeout_ms / 1000;
+    until.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+    }
+    mtx_lock(&t->lock);
+    while (!is_final(state = atomic_load(&t->state))) {
+        if (timeout_ms < 0)
+            cnd_wait(&t->finished, &t->lock);
+        else if (cnd_timedwait(&t->finished, &t->lock, &until) == thrd_timedout)
+            break;
+    }
+    mtx_unlock(&t->lock);
+    return atomic_load(&t->state);
+}
+
+int dx8gles11_ticket_cancel(dx8gles11_ticket *t) {
+    if (!t)
+        return -1;
+    int expect = DX8GLES11_TICKET_PENDING;
+    if (atomic_compare_exchange_strong(&t->state, &expect, DX8GLES11_TICKET_CANCELLED)) {
+        ticket_finish(t, DX8GLES11_TICKET_CANCELLED);
+        return 0;
+    }
+    return expect == DX8GLES11_TICKET_CANCELLED ? 0 : -1;
+}
+
+int dx8gles11_ticket_result(dx8gles11_ticket *t, GLES_CommandList *out) {
+    if (!t || !out) {
+        dx8gles11_set_error(!t ? "ticket null" : "out list null");
+        return -1;
+    }
+    *out = (GLES_CommandList){0};
+    if (atomic_load(&t->state) != DX8GLES11_TICKET_DONE) {
+        dx8gles11_set_error("ticket not done");
+        return -1;
+    }
+    if (t->rc) {
+        dx8gles11_set_error(t->error ? t->error : "?");
+        return t->rc;
+    }
+    *out = t->list;
+    t->list = (GLES_CommandList){0};
+    return 0;
+}
+
+void dx8gles11_ticket_release(dx8gles11_ticket *t) {
+    if (!t)
+        return;
+    dx8gles11_ticket_cancel(t);
+    ticket_unref(t);
+}
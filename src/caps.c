@@ -0,0 +1,105 @@
+#include "dx8gles11.h"
+#include "dx8gles11_internal.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <GLES/gl.h>
+
+/*
+ * Capabilities are a bit set so the translator and the dispatch loop test a
+ * bit instead of scanning the extension string. They come from a live
+ * context (dx8gles11_caps_probe()) or from a target profile, which lets
+ * shader caches for a device be built on a machine without GL.
+ */
+
+static const struct {
+    uint32_t bit;
+    const char *name;
+} k_caps[] = {
+    {DX8GLES11_CAP_VBO, "GL_OES_vertex_buffer_object"},
+    {DX8GLES11_CAP_BLEND_MINMAX, "GL_EXT_blend_minmax"},
+    {DX8GLES11_CAP_TEXTURE_NPOT, "GL_OES_texture_npot"},
+    {DX8GLES11_CAP_TEXTURE_3D, "GL_OES_texture_3D"},
+    {DX8GLES11_CAP_DEPTH_TEXTURE, "GL_OES_depth_texture"},
+};
+
+static int is_sep(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+/* bits of the extension names in [s, end); '#' starts a comment when allowed */
+static uint32_t parse_names(const char *s, const char *end, int comments) {
+    uint32_t bits = 0;
+    while (s < end) {
+        if (is_sep(*s)) {
+            ++s;
+            continue;
+        }
+        if (comments && *s == '#') {
+            while (s < end && *s != '\n')
+                ++s;
+            continue;
+        }
+        const char *e = s;
+        while (e < end && !is_sep(*e) && !(comments && *e == '#'))
+            ++e;
+        for (size_t i = 0; i < sizeof(k_caps) / sizeof(k_caps[0]); ++i)
+            if (strlen(k_caps[i].name) == (size_t)(e - s) && !memcmp(k_caps[i].name, s, e - s))
+                bits |= k_caps[i].bit;
+        s = e;
+    }
+    return bits;
+}
+
+void dx8gles11_caps_parse(const char *extensions, dx8gles11_caps *out) {
+    out->bits = extensions ? parse_names(extensions, extensions + strlen(extensions), 0) : 0;
+}
+
+/* GL_EXTENSIONS of the current context, NULL without one */
+static const char *gl_extensions(void) { return (const char *)glGetString(GL_EXTENSIONS); }
+
+int dx8gles11_caps_probe(dx8gles11_caps *out) {
+    if (!out) {
+        dx8gles11_set_error("caps null");
+        return -1;
+    }
+    const char *ext = gl_extensions();
+    if (!ext) {
+        out->bits = 0;
+        dx8gles11_set_error("glGetString(GL_EXTENSIONS) failed");
+        return -1;
+    }
+    dx8gles11_caps_parse(ext, out);
+    return 0;
+}
+
+int dx8gles11_caps_load(const char *path, dx8gles11_caps *out) {
+    if (!path || !out) {
+        dx8gles11_set_error(!path ? "path null" : "caps null");
+        return -1;
+    }
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        char msg[300];
+        snprintf(msg, sizeof(msg), "could not read target profile %s", path);
+        dx8gles11_set_error(msg);
+        return -1;
+    }
+    char *text = NULL;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        for (size_t i = 0; i < n; ++i)
+            sb_push(text, buf[i]);
+    fclose(f);
+    out->bits = parse_names(text, text + sb_count(text), 1);
+    sb_free(text);
+    return 0;
+}
+
+const char *dx8gles11_caps_name(uint32_t bit) {
+    for (size_t i = 0; i < sizeof(k_caps) / sizeof(k_caps[0]); ++i)
+        if (k_caps[i].bit == bit)
+            return k_caps[i].name;
+    return NULL;
+}
@@ -0,0 +1,74 @@
+#include "chunk_pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The free list is a Treiber stack of chunk indices. Its head carries a tag
+ * bumped by every pop, so a pop that read a stale link fails its CAS
+ * instead of installing a chunk another thread has since taken (ABA); the
+ * tag survives the list running empty.
+ * Chunks that were never used are carved off the slab in order, leaving
+ * its untouched pages uncommitted.
+ */
+
+#define HEAD(tag, idx) ((uint_least64_t)(tag) << 32 | ((uint_least64_t)(idx) + 1))
+#define HEAD_LINK(h) ((uint32_t)(h)) /* index + 1, 0 when empty */
+#define HEAD_TAG(h) ((uint32_t)((h) >> 32))
+
+int chunk_pool_init(chunk_pool *cp, size_t chunk_size, size_t max_chunks) {
+    memset(cp, 0, sizeof(*cp));
+    if (!chunk_size || !max_chunks || max_chunks >= UINT32_MAX)
+        return -1;
+    cp->stride = (chunk_size + 63) & ~(size_t)63;
+    if (max_chunks > SIZE_MAX / cp->stride)
+        return -1;
+    cp->max_chunks = (uint32_t)max_chunks;
+    cp->slab = aligned_alloc(64, max_chunks * cp->stride);
+    cp->links = malloc(max_chunks * sizeof(*cp->links));
+    if (!cp->slab || !cp->links) {
+        chunk_pool_destroy(cp);
+        return -1;
+    }
+    atomic_init(&cp->free, 0);
+    atomic_init(&cp->carved, 0);
+    return 0;
+}
+
+void chunk_pool_destroy(chunk_pool *cp) {
+    free(cp->slab);
+    free(cp->links);
+    cp->slab = NULL;
+    cp->links = NULL;
+}
+
+void *chunk_acquire(chunk_pool *cp) {
+    uint_least64_t h = atomic_load_explicit(&cp->free, memory_order_acquire);
+    while (HEAD_LINK(h)) {
+        uint32_t idx = HEAD_LINK(h) - 1;
+        uint32_t next = atomic_load_explicit(&cp->links[idx], memory_order_relaxed);
+        uint_least64_t nh = (uint_least64_t)(HEAD_TAG(h) + 1) << 32 | next;
+        if (atomic_compare_exchange_weak_explicit(&cp->free, &h, nh, memory_order_acquire,
+                                                  memory_order_acquire))
+            return cp->slab + (size_t)idx * cp->stride;
+    }
+    uint_least32_t n = atomic_load_explicit(&cp->carved, memory_order_relaxed);
+    while (n < cp->max_chunks) {
+        if (atomic_compare_exchange_weak_explicit(&cp->carved, &n, n + 1, memory_order_relaxed,
+                                                  memory_order_relaxed))
+            return cp->slab + (size_t)n * cp->stride;
+    }
+    return NULL;
+}
+
+void chunk_release(chunk_pool *cp, void *chunk) {
+    uint32_t idx = (uint32_t)(((unsigned char *)chunk - cp->slab) / cp->stride);
+    uint_least64_t h = atomic_load_explicit(&cp->free, memory_order_relaxed);
+    do
+        atomic_store_explicit(&cp->links[idx], HEAD_LINK(h), memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&cp->free, &h, HEAD(HEAD_TAG(h), idx),
+                                                  memory_order_release, memory_order_relaxed));
+}
+
+size_t chunk_pool_high_water(const chunk_pool *cp) {
+    return atomic_load_explicit(&cp->carved, memory_order_relaxed);
+}
@@ -0,0 +1,417 @@
+#include "dx8gles11.h"
+#include "dx8gles11_internal.h"
+#include "preprocess.h"
+#include "utils.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+/*
+ * Entries live in a fixed array of hash chains. Readers walk the chains
+ * without locking and take a reference with a CAS that refuses to revive a
+ * zero count. Inserts, unlinks and frees happen under `lock`.
+ *
+ * Unlinked entries are freed by epoch: a lookup registers in the counter of
+ * the current epoch's parity, and entries retired in an epoch go to that
+ * epoch's batch. The epoch only advances once the counter it is about to
+ * reuse, that of the epoch before last, has drained; that is exactly when
+ * the batch retired then can no longer be reached, so it is freed. Busy
+ * readers keep moving to the new counter, which lets the old one drain.
+ *
+ * Eviction is a clock over the ready entries: lookups set `used`, and the
+ * hand clears it on its first pass and evicts on the second.
+ */
+
+#define CACHE_BUCKETS 1024
+
+enum { ENTRY_PENDING, ENTRY_READY, ENTRY_FAILED };
+
+typedef struct cache_entry {
+    GLES_CommandList list; /* first: release() maps the list back to its entry */
+    _Atomic(struct cache_entry *) next;
+    struct cache_entry *retired_next;
+    struct cache_entry *clock_prev, *clock_next; /* ring of ready entries */
+    uint64_t key;
+    uint32_t caps; /* target the list was translated for */
+    char *src;
+    size_t src_len;
+    size_t bytes;
+    _Atomic unsigned refs; /* one held by the table while linked */
+    _Atomic int state;
+    atomic_int used; /* looked up since the clock hand last passed */
+    int rc;
+    char *err;
+} cache_entry;
+
+struct dx8gles11_cache {
+    _Atomic(cache_entry *) buckets[CACHE_BUCKETS];
+    _Atomic size_t readers[2]; /* lookups in progress, by epoch parity */
+    _Atomic uint64_t epoch;    /* advanced under lock */
+    _Atomic size_t retired;    /* entries in both batches */
+    _Atomic uint64_t hits, misses, evictions;
+    mtx_t lock;
+    cnd_t done;
+    size_t budget, bytes, entries, clocked;
+    cache_entry *batch[2]; /* retired, by the parity of the epoch they left in */
+    cache_entry *hand;
+};
+
+static uint64_t cache_key(const char *src, size_t len, const dx8gles11_options *opt,
+                          uint32_t caps) {
+    uint64_t seed = (uint64_t)(opt ? opt->optimize : 0) ^ (uint64_t)caps << 32;
+    return util_hash64(src, len, seed);
+}
+
+static int entry_matches(const cache_entry *e, uint64_t key, uint32_t caps, const char *src,
+                         size_t len) {
+    return e->key == key && e->caps == caps && e->src_len == len && !memcmp(e->src, src, len);
+}
+
+static int entry_acquire(cache_entry *e) {
+    unsigned n = atomic_load(&e->refs);
+    while (n) {
+        if (atomic_compare_exchange_weak(&e->refs, &n, n + 1))
+            return 1;
+    }
+    return 0;
+}
+
+static void entry_free(cache_entry *e) {
+    gles_cmdlist_free(&e->list);
+    free(e->src);
+    free(e->err);
+    free(e);
+}
+
+static void free_batch(cache_entry *e) {
+    while (e) {
+        cache_entry *next = e->retired_next;
+        entry_free(e);
+        e = next;
+    }
+}
+
+/* lock held: once the lookups of the epoch before last have left, free
+ * what was retired then and move on */
+static void reclaim(dx8gles11_cache *c) {
+    uint64_t e = atomic_load(&c->epoch);
+    int old = (int)((e + 1) & 1);
+    if (!atomic_load(&c->retired) || atomic_load(&c->readers[old]))
+        return;
+    size_t n = 0;
+    for (cache_entry *r = c->batch[old]; r; r = r->retired_next)
+        ++n;
+    free_batch(c->batch[old]);
+    c->batch[old] = NULL;
+    atomic_fetch_sub(&c->retired, n);
+    atomic_store(&c->epoch, e + 1);
+}
+
+/* lock held */
+static void retire(dx8gles11_cache *c, cache_entry *e) {
+    int now = (int)(atomic_load(&c->epoch) & 1);
+    e->retired_next = c->batch[now];
+    c->batch[now] = e;
+    atomic_fetch_add(&c->retired, 1);
+}
+
+/* lock held: ready entries join the clock just behind the hand */
+static void clock_insert(dx8gles11_cache *c, cache_entry *e) {
+    if (!c->hand) {
+        e->clock_prev = e->clock_next = e;
+        c->hand = e;
+    } else {
+        e->clock_next = c->hand;
+        e->clock_prev = c->hand->clock_prev;
+        e->clock_prev->clock_next = e;
+        c->hand->clock_prev = e;
+    }
+    c->clocked++;
+}
+
+static void clock_remove(dx8gles11_cache *c, cache_entry *e) {
+    if (!e->clock_next)
+        return;
+    if (e->clock_next == e) {
+        c->hand = NULL;
+    } else {
+        e->clock_prev->clock_next = e->clock_next;
+        e->clock_next->clock_prev = e->clock_prev;
+        if (c->hand == e)
+            c->hand = e->clock_next;
+    }
+    e->clock_prev = e->clock_next = NULL;
+    c->clocked--;
+}
+
+static void mark_used(cache_entry *e) {
+    /* skip the store when set: hot entries stay shared in every cache */
+    if (!atomic_load_explicit(&e->used, memory_order_relaxed))
+        atomic_store_explicit(&e->used, 1, memory_order_relaxed);
+}
+
+/* lock held: unlink e and drop the table's reference */
+static void unlink_entry(dx8gles11_cache *c, cache_entry *e) {
+    clock_remove(c, e);
+    _Atomic(cache_entry *) *link = &c->buckets[e->key & (CACHE_BUCKETS - 1)];
+    for (cache_entry *p = atomic_load(link); p; p = atomic_load(link)) {
+        if (p == e) {
+            atomic_store(link, atomic_load(&e->next));
+            break;
+        }
+        link = &p->next;
+    }
+    c->bytes -= e->bytes;
+    c->entries--;
+    if (atomic_fetch_sub(&e->refs, 1) == 1)
+        retire(c, e);
+}
+
+/* lock held: advance the clock hand until within budget; every entry is
+ * passed at most twice, once to clear `used` and once to evict it */
+static void evict(dx8gles11_cache *c) {
+    for (size_t n = 2 * c->clocked; n && c->hand && c->bytes > c->budget; --n) {
+        cache_entry *e = c->hand;
+        c->hand = e->clock_next;
+        if (atomic_exchange_explicit(&e->used, 0, memory_order_relaxed))
+            continue;
+        unlink_entry(c, e);
+        atomic_fetch_add(&c->evictions, 1);
+    }
+}
+
+static cache_entry *lookup(dx8gles11_cache *c, uint64_t key, uint32_t caps, const char *src,
+                           size_t len) {
+    uint64_t epoch;
+    int slot;
+    for (;;) {
+        /* the recheck keeps a lookup that raced an advance out of a counter
+         * the writer already found empty */
+        epoch = atomic_load(&c->epoch);
+        slot = (int)(epoch & 1);
+        atomic_fetch_add(&c->readers[slot], 1);
+        if (atomic_load(&c->epoch) == epoch)
+            break;
+        atomic_fetch_sub(&c->readers[slot], 1);
+    }
+    cache_entry *hit = NULL;
+    for (cache_entry *e = atomic_load(&c->buckets[key & (CACHE_BUCKETS - 1)]); e;
+         e = atomic_load(&e->next)) {
+        if (atomic_load(&e->state) == ENTRY_READY && entry_matches(e, key, caps, src, len) &&
+            entry_acquire(e)) {
+            mark_used(e);
+            hit = e;
+            break;
+        }
+    }
+    /* the last lookup of an old epoch frees its batch, unless a writer is
+     * already at it */
+    if (atomic_fetch_sub(&c->readers[slot], 1) == 1 && atomic_load(&c->retired) &&
+        atomic_load(&c->epoch) != epoch && mtx_trylock(&c->lock) == thrd_success) {
+        reclaim(c);
+        mtx_unlock(&c->lock);
+    }
+    return hit;
+}
+
+/* lock held: wait for an in-flight compile of e, which the caller references */
+static int wait_result(dx8gles11_cache *c, cache_entry *e, const GLES_CommandList **out) {
+    while (atomic_load(&e->state) == ENTRY_PENDING)
+        cnd_wait(&c->done, &c->lock);
+    if (atomic_load(&e->state) == ENTRY_READY) {
+        mark_used(e);
+        *out = &e->list;
+        return 0;
+    }
+    int rc = e->rc;
+    dx8gles11_set_error(e->err ? e->err : "compile failed");
+    if (atomic_fetch_sub(&e->refs, 1) == 1)
+        retire(c, e);
+    reclaim(c);
+    return rc;
+}
+
+int cache_compile_preprocessed(dx8gles11_cache *c, const char *pp_src,
+                               const dx8gles11_options *opt, const GLES_CommandList **out) {
+    size_t len = strlen(pp_src);
+    /* pinned so the key and the translation agree on the target */
+    dx8gles11_caps caps = {translate_caps(opt)};
+    dx8gles11_options pinned = opt ? *opt : (dx8gles11_options){0};
+    pinned.caps = &caps;
+    uint64_t key = cache_key(pp_src, len, opt, caps.bits);
+    cache_entry *e = lookup(c, key, caps.bits, pp_src, len);
+    if (e) {
+        atomic_fetch_add(&c->hits, 1);
+        *out = &e->list;
+        return 0;
+    }
+
+    mtx_lock(&c->lock);
+    _Atomic(cache_entry *) *bucket = &c->buckets[key & (CACHE_BUCKETS - 1)];
+    for (e = atomic_load(bucket); e; e = atomic_load(&e->next)) {
+        if (atomic_load(&e->state) != ENTRY_FAILED && entry_matches(e, key, caps.bits, pp_src, len) &&
+            entry_acquire(e)) {
+            int rc = wait_result(c, e, out);
+            if (!rc)
+                atomic_fetch_add(&c->hits, 1);
+            mtx_unlock(&c->lock);
+            return rc;
+        }
+    }
+    e = calloc(1, sizeof(*e));
+    char *copy = e ? util_strndup(pp_src, len) : NULL;
+    if (!copy) {
+        free(e);
+        mtx_unlock(&c->lock);
+        dx8gles11_set_error("out of memory");
+        return -1;
+    }
+    e->key = key;
+    e->caps = caps.bits;
+    e->src = copy;
+    e->src_len = len;
+    atomic_init(&e->refs, 2); /* table + caller */
+    atomic_init(&e->state, ENTRY_PENDING);
+    atomic_init(&e->next, atomic_load(bucket));
+    atomic_store(bucket, e);
+    c->entries++;
+    atomic_fetch_add(&c->misses, 1);
+    mtx_unlock(&c->lock);
+
+    int rc = compile_preprocessed(pp_src, &pinned, NULL, &e->list);
+
+    mtx_lock(&c->lock);
+    if (rc) {
+        e->rc = rc;
+        e->err = util_strdup(dx8gles11_error());
+        gles_cmdlist_free(&e->list);
+        atomic_store(&e->state, ENTRY_FAILED);
+        unlink_entry(c, e);
+    } else {
+        e->bytes = sizeof(*e) + len + 1 + e->list.capacity * sizeof(gles_cmd);
+        c->bytes += e->bytes;
+        atomic_store(&e->used, 1);
+        atomic_store(&e->state, ENTRY_READY);
+        clock_insert(c, e);
+        evict(c);
+    }
+    cnd_broadcast(&c->done);
+    if (rc && atomic_fetch_sub(&e->refs, 1) == 1)
+        retire(c, e);
+    reclaim(c);
+    mtx_unlock(&c->lock);
+    if (!rc)
+        *out = &e->list;
+    return rc;
+}
+
+dx8gles11_cache *dx8gles11_cache_create(size_t budget_bytes) {
+    dx8gles11_cache *c = calloc(1, sizeof(*c));
+    if (!c)
+        return NULL;
+    if (mtx_init(&c->lock, mtx_plain) != thrd_success) {
+        free(c);
+        return NULL;
+    }
+    if (cnd_init(&c->done) != thrd_success) {
+        mtx_destroy(&c->lock);
+        free(c);
+        return NULL;
+    }
+    c->budget = budget_bytes;
+    return c;
+}
+
+void dx8gles11_cache_destroy(dx8gles11_cache *c) {
+    if (!c)
+        return;
+    for (size_t b = 0; b < CACHE_BUCKETS; ++b) {
+        cache_entry *e = atomic_load(&c->buckets[b]);
+        while (e) {
+            cache_entry *next = atomic_load(&e->next);
+            entry_free(e);
+            e = next;
+        }
+    }
+    free_batch(c->batch[0]);
+    free_batch(c->batch[1]);
+    cnd_destroy(&c->done);
+    mtx_destroy(&c->lock);
+    free(c);
+}
+
+int dx8gles11_cache_compile_string(dx8gles11_cache *c, const char *src,
+                                   const dx8gles11_options *opts, const GLES_CommandList **out) {
+    if (!c || !src || !out) {
+        dx8gles11_set_error(!c ? "cache null" : !src ? "source null" : "out list null");
+        return -1;
+    }
+    char *pp_err = NULL;
+    pp_config cfg = {.include_dir = opts ? opts->include_dir : NULL,
+                     .include_paths = opts ? opts->include_paths : NULL,
+                     .snapshot = opts ? opts->prelude : NULL,
+                     .defines = opts ? opts->defines : NULL};
+    char *pp_src = pp_run_string_cfg(src, &cfg, &pp_err);
+    if (!pp_src) {
+        char *msg = NULL;
+        util_asprintf(&msg, "preprocess fail: %s", pp_err ? pp_err : "?");
+        dx8gles11_set_error(msg ? msg : "preprocess fail");
+        free(msg);
+        free(pp_err);
+        return -2;
+    }
+    int rc = cache_compile_preprocessed(c, pp_src, opts, out);
+    free(pp_src);
+    return rc;
+}
+
+int dx8gles11_cache_compile_file(dx8gles11_cache *c, const char *path,
+                                 const dx8gles11_options *opts, const GLES_CommandList **out) {
+    if (!c || !path || !out) {
+        dx8gles11_set_error(!c ? "cache null" : !path ? "path null" : "out list null");
+        return -1;
+    }
+    char *pp_err = NULL;
+    pp_config cfg = {.include_dir = opts ? opts->include_dir : NULL,
+                     .include_paths = opts ? opts->include_paths : NULL,
+                     .snapshot = opts ? opts->prelude : NULL,
+                     .defines = opts ? opts->defines : NULL};
+    char *pp_src = pp_run_cfg(path, &cfg, &pp_err);
+    if (!pp_src) {
+        char *msg = NULL;
+        util_asprintf(&msg, "preprocess fail: %s", pp_err ? pp_err : "?");
+        dx8gles11_set_error(msg ? msg : "preprocess fail");
+        free(msg);
+        free(pp_err);
+        return -2;
+    }
+    int rc = cache_compile_preprocessed(c, pp_src, opts, out);
+    free(pp_src);
+    return rc;
+}
+
+void dx8gles11_cache_release(dx8gles11_cache *c, const GLES_CommandList *list) {
+    if (!c || !list)
+        return;
+    cache_entry *e = (cache_entry *)list;
+    if (atomic_fetch_sub(&e->refs, 1) != 1)
+        return;
+    mtx_lock(&c->lock);
+    retire(c, e);
+    reclaim(c);
+    mtx_unlock(&c->lock);
+}
+
+void dx8gles11_cache_get_stats(dx8gles11_cache *c, dx8gles11_cache_stats *out) {
+    if (!c || !out)
+        return;
+    out->hits = atomic_load(&c->hits);
+    out->misses = atomic_load(&c->misses);
+    out->evictions = atomic_load(&c->evictions);
+    mtx_lock(&c->lock);
+    out->entries = c->entries;
+    out->bytes = c->bytes;
+    out->retired = atomic_load(&c->retired);
+    mtx_unlock(&c->lock);
+}
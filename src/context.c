@@ -0,0 +1,317 @@
+#include "dx8gles11.h"
+#include "dx8gles11_internal.h"
+#include "minithread.h"
+#include "utils.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include <GLES/gl.h>
+
+/*
+ * Everything a compile reads from its context is either fixed at creation
+ * or atomic: the caps are probed by whichever compile gets there first and
+ * published with a release store, the counters are relaxed adds. The
+ * default context is a zero-initialized static, so it needs no setup and
+ * is never destroyed.
+ */
+
+struct dx8gles11_context {
+    _Atomic uint32_t caps;
+    atomic_int caps_known;              /* caps is valid */
+    _Atomic(const char *) extensions;   /* GL_EXTENSIONS, for dx8gles11_has_extension() */
+    dx8gles11_cache *cache;
+    char *cache_dir;
+    dx8gles11_allocator alloc;          /* alloc.alloc NULL: malloc */
+    dx8gles11_diag_fn diag;
+    void *diag_user;
+    _Atomic uint64_t compiles, failures;
+    int threads;                        /* async workers */
+    _Atomic(mt_pool *) pool;            /* created by the first async compile */
+};
+
+#define CONTEXT_ASYNC_THREADS 2
+
+static dx8gles11_context g_default;
+
+dx8gles11_context *dx8gles11_context_default(void) { return &g_default; }
+
+dx8gles11_context *dx8gles11_context_create(const dx8gles11_context_desc *desc) {
+    dx8gles11_context *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        dx8gles11_set_error("out of memory");
+        return NULL;
+    }
+    if (!desc)
+        return ctx;
+    if (desc->alloc && (!desc->alloc->alloc || !desc->alloc->free)) {
+        free(ctx);
+        dx8gles11_set_error("allocator needs alloc and free");
+        return NULL;
+    }
+    if (desc->cache_dir && !(ctx->cache_dir = util_strdup(desc->cache_dir))) {
+        free(ctx);
+        dx8gles11_set_error("out of memory");
+        return NULL;
+    }
+    if (desc->caps) {
+        atomic_init(&ctx->caps, desc->caps->bits);
+        atomic_init(&ctx->caps_known, 1);
+    }
+    if (desc->alloc)
+        ctx->alloc = *desc->alloc;
+    ctx->cache = desc->cache;
+    ctx->diag = desc->diag;
+    ctx->diag_user = desc->diag_user;
+    ctx->threads = desc->threads;
+    return ctx;
+}
+
+void dx8gles11_context_destroy(dx8gles11_context *ctx) {
+    if (!ctx || ctx == &g_default)
+        return;
+    mt_pool *pool = atomic_load(&ctx->pool);
+    if (pool) {
+        mt_pool_destroy(pool);
+        free(pool);
+    }
+    free(ctx->cache_dir);
+    free(ctx);
+}
+
+/* without a GL context nothing is kept and the next compile probes again */
+uint32_t context_caps(dx8gles11_context *ctx) {
+    if (atomic_load_explicit(&ctx->caps_known, memory_order_acquire))
+        return atomic_load_explicit(&ctx->caps, memory_order_relaxed);
+    const char *ext = (const char *)glGetString(GL_EXTENSIONS);
+    if (!ext)
+        return 0;
+    dx8gles11_caps c;
+    dx8gles11_caps_parse(ext, &c);
+    /* racing probes of one GL context store the same bits */
+    atomic_store_explicit(&ctx->caps, c.bits, memory_order_relaxed);
+    atomic_store_explicit(&ctx->caps_known, 1, memory_order_release);
+    return c.bits;
+}
+
+uint32_t translate_caps(const dx8gles11_options *opt) {
+    return opt && opt->caps ? opt->caps->bits : context_caps(&g_default);
+}
+
+void dx8gles11_context_caps(dx8gles11_context *ctx, dx8gles11_caps *out) {
+    if (out)
+        out->bits = ctx ? context_caps(ctx) : 0;
+}
+
+void context_pin(dx8gles11_context *ctx, const dx8gles11_options *opts, uint32_t bits,
+                 dx8gles11_options *o, dx8gles11_caps *caps) {
+    caps->bits = opts && opts->caps ? opts->caps->bits : bits;
+    *o = opts ? *opts : (dx8gles11_options){0};
+    o->caps = caps;
+    if (!o->cache)
+        o->cache = ctx->cache;
+    if (!o->cache_dir)
+        o->cache_dir = ctx->cache_dir;
+}
+
+void context_arena(dx8gles11_context *ctx, util_arena *arena) {
+    *arena = (util_arena){0};
+    if (ctx->alloc.alloc) {
+        arena->alloc = ctx->alloc.alloc;
+        arena->release = ctx->alloc.free;
+        arena->user = ctx->alloc.user;
+    }
+}
+
+mt_pool *context_pool(dx8gles11_context *ctx) {
+    mt_pool *p = atomic_load_explicit(&ctx->pool, memory_order_acquire);
+    if (p)
+        return p;
+    p = calloc(1, sizeof(*p));
+    if (!p || mt_pool_init(p, ctx->threads > 0 ? ctx->threads : CONTEXT_ASYNC_THREADS)) {
+        if (p)
+            free(p->threads);
+        free(p);
+        return NULL;
+    }
+    mt_pool *cur = NULL;
+    if (!atomic_compare_exchange_strong(&ctx->pool, &cur, p)) {
+        mt_pool_destroy(p); /* another thread's pool won */
+        free(p);
+        return cur;
+    }
+    return p;
+}
+
+int context_count(dx8gles11_context *ctx, int rc) {
+    if (!rc) {
+        atomic_fetch_add_explicit(&ctx->compiles, 1, memory_order_relaxed);
+        return 0;
+    }
+    atomic_fetch_add_explicit(&ctx->failures, 1, memory_order_relaxed);
+    if (ctx->diag)
+        ctx->diag(ctx->diag_user, rc, dx8gles11_error());
+    return rc;
+}
+
+int dx8gles11_context_compile_string(dx8gles11_context *ctx, const char *src,
+                                     const dx8gles11_options *opts, GLES_CommandList *out) {
+    if (!ctx) {
+        dx8gles11_set_error("context null");
+        return -1;
+    }
+    dx8gles11_options o;
+    dx8gles11_caps caps;
+    util_arena arena;
+    context_pin(ctx, opts, opts && opts->caps ? 0 : context_caps(ctx), &o, &caps);
+    context_arena(ctx, &arena);
+    int rc = compile_string_arena(src, &o, &arena, out);
+    util_arena_free(&arena);
+    return context_count(ctx, rc);
+}
+
+int dx8gles11_context_compile_file(dx8gles11_context *ctx, const char *path,
+                                   const dx8gles11_options *opts, GLES_CommandList *out) {
+    if (!ctx) {
+        dx8gles11_set_error("context null");
+        return -1;
+    }
+    dx8gles11_options o;
+    dx8gles11_caps caps;
+    util_arena arena;
+    context_pin(ctx, opts, opts && opts->caps ? 0 : context_caps(ctx), &o, &caps);
+    context_arena(ctx, &arena);
+    int rc = compile_file_arena(path, &o, &arena, out);
+    util_arena_free(&arena);
+    return context_count(ctx, rc);
+}
+
+int dx8gles11_compile_string(const char *src, const dx8gles11_options *opts,
+                             GLES_CommandList *out) {
+    return dx8gles11_context_compile_string(&g_default, src, opts, out);
+}
+
+int dx8gles11_compile_file(const char *path, const dx8gles11_options *opts, GLES_CommandList *out) {
+    return dx8gles11_context_compile_file(&g_default, path, opts, out);
+}
+
+/* Items are claimed one at a time from a shared counter, so a worker that
+ * drew small shaders keeps taking more while another is busy with a large
+ * one. Each worker reuses one scratch arena for all its items. */
+typedef struct batch_job {
+    dx8gles11_context *ctx;
+    dx8gles11_batch_item *items;
+    size_t count;
+    const dx8gles11_options *opts;
+    uint32_t caps; /* the context's, resolved on the caller's thread */
+    atomic_size_t next;
+} batch_job;
+
+static void batch_item(batch_job *j, dx8gles11_batch_item *it, util_arena *arena) {
+    const dx8gles11_options *io = it->opts ? it->opts : j->opts;
+    dx8gles11_options o;
+    dx8gles11_caps caps;
+    context_pin(j->ctx, io, j->caps, &o, &caps);
+    int rc;
+    if (it->source) {
+        rc = compile_string_arena(it->source, &o, arena, &it->list);
+    } else if (it->path) {
+        rc = compile_file_arena(it->path, &o, arena, &it->list);
+    } else {
+        it->list = (GLES_CommandList){0};
+        dx8gles11_set_error("source and path null");
+        rc = -1;
+    }
+    util_arena_reset(arena);
+    it->rc = rc;
+    it->error = rc ? util_strdup(dx8gles11_error()) : NULL;
+    context_count(j->ctx, rc);
+}
+
+static int batch_worker(void *arg) {
+    batch_job *j = arg;
+    util_arena arena;
+    context_arena(j->ctx, &arena);
+    for (size_t i; (i = atomic_fetch_add(&j->next, 1)) < j->count;)
+        batch_item(j, &j->items[i], &arena);
+    util_arena_free(&arena);
+    return 0;
+}
+
+int dx8gles11_context_compile_batch(dx8gles11_context *ctx, dx8gles11_batch_item *items,
+                                    size_t count, const dx8gles11_options *opts, int threads) {
+    if (!ctx || (count && !items)) {
+        dx8gles11_set_error(!ctx ? "context null" : "items null");
+        return -1;
+    }
+    batch_job j = {.ctx = ctx, .items = items, .count = count, .opts = opts,
+                   .caps = context_caps(ctx)};
+    atomic_init(&j.next, 0);
+    size_t extra = threads > 1 ? (size_t)threads - 1 : 0;
+    if (count && extra > count - 1)
+        extra = count - 1;
+    thrd_t *t = extra ? malloc(extra * sizeof(*t)) : NULL;
+    size_t started = 0;
+    while (t && started < extra && thrd_create(&t[started], batch_worker, &j) == thrd_success)
+        ++started;
+    batch_worker(&j);
+    for (size_t i = 0; i < started; ++i)
+        thrd_join(t[i], NULL);
+    free(t);
+    int failed = 0;
+    for (size_t i = 0; i < count; ++i)
+        failed += items[i].rc != 0;
+    return failed;
+}
+
+int dx8gles11_compile_batch(dx8gles11_batch_item *items, size_t count,
+                            const dx8gles11_options *opts, int threads) {
+    return dx8gles11_context_compile_batch(&g_default, items, count, opts, threads);
+}
+
+void dx8gles11_batch_free(dx8gles11_batch_item *items, size_t count) {
+    for (size_t i = 0; items && i < count; ++i) {
+        gles_cmdlist_free(&items[i].list);
+        free(items[i].error);
+        items[i].error = NULL;
+    }
+}
+
+void dx8gles11_context_get_stats(dx8gles11_context *ctx, dx8gles11_context_stats *out) {
+    if (!ctx || !out)
+        return;
+    out->compiles = atomic_load_explicit(&ctx->compiles, memory_order_relaxed);
+    out->failures = atomic_load_explicit(&ctx->failures, memory_order_relaxed);
+}
+
+/* the extension string of the default context; a failed query is retried */
+int dx8gles11_has_extension(const char *name) {
+    if (!name)
+        return 0;
+    const char *s = atomic_load(&g_default.extensions);
+    if (!s) {
+        s = (const char *)glGetString(GL_EXTENSIONS);
+        if (!s) {
+            dx8gles11_set_error("glGetString(GL_EXTENSIONS) failed");
+            return 0;
+        }
+        atomic_store(&g_default.extensions, s);
+    }
+    size_t len = strlen(name);
+    while (s && *s) {
+        while (*s == ' ')
+            ++s;
+        if (!strncmp(s, name, len) && (s[len] == ' ' || s[len] == '\0'))
+            return 1;
+        s = strchr(s, ' ');
+        if (!s)
+            break;
+        ++s;
+    }
+    char msg[300];
+    snprintf(msg, sizeof(msg), "missing GL extension: %s", name);
+    dx8gles11_set_error(msg);
+    return 0;
+}
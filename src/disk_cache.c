@@ -0,0 +1,451 @@
+#include "dx8gles11.h"
+#include "dx8gles11_internal.h"
+#include "utils.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <threads.h>
+#include <time.h>
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#include <process.h>
+#define getpid _getpid
+#endif
+
+/*
+ * On-disk entry layout, all fields native-endian:
+ *
+ *   disk_header
+ *   disk_dep[dep_count]     include dependencies
+ *   char strtab[strtab_size] dependency paths, not NUL-terminated
+ *   gles_cmd[cmd_count]     at cmd_offset, 8-byte aligned
+ *
+ * `checksum` covers everything after the header. Entries whose magic,
+ * version, layout, checksum or dependencies do not match are ignored and
+ * rewritten by the next compile.
+ */
+
+#define DISK_MAGIC "DX8GLC\r\n"
+#define DISK_VERSION 1u
+#define DISK_EXT ".dx8c"
+
+typedef struct disk_header {
+    char magic[8];
+    uint32_t version;
+    uint16_t cmd_size;   /* sizeof(gles_cmd) of the writer */
+    uint16_t endian;     /* 0x0102 as written */
+    uint64_t key;
+    uint64_t checksum;
+    uint32_t dep_count;
+    uint32_t strtab_size;
+    uint32_t cmd_count;
+    uint32_t cmd_offset;
+} disk_header;
+
+typedef struct disk_dep {
+    uint64_t hash;  /* util_hash64 of the contents */
+    int64_t mtime;  /* stat() at write time, checked before re-hashing */
+    uint64_t size;
+    uint32_t path_off;
+    uint32_t path_len;
+} disk_dep;
+
+typedef struct mapped_entry {
+    uint64_t key;
+    void *data;
+    size_t size;
+} mapped_entry;
+
+/* entries mapped by dx8gles11_disk_cache_preload(), sorted by key. Loads
+ * hold a reference while they check dependencies and copy, outside the
+ * lock; the last reference unmaps. */
+typedef struct preload_set {
+    atomic_int refs;
+    char *dir;
+    mapped_entry *entries;
+} preload_set;
+
+static struct {
+    mtx_t lock;
+    cnd_t done;
+    int busy;
+    preload_set *set;
+} g_preload;
+static once_flag g_preload_once = ONCE_FLAG_INIT;
+
+static void preload_init(void) {
+    mtx_init(&g_preload.lock, mtx_plain);
+    cnd_init(&g_preload.done);
+}
+
+static char *read_file(const char *p, size_t *len) {
+    FILE *f = fopen(p, "rb");
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    rewind(f);
+    char *b = sz >= 0 ? malloc((size_t)sz + 1) : NULL;
+    if (!b || fread(b, 1, (size_t)sz, f) != (size_t)sz) {
+        free(b);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    b[sz] = '\0';
+    *len = (size_t)sz;
+    return b;
+}
+
+static void *map_file(const char *path, size_t *size) {
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    void *p = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(disk_header)) {
+        p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+            p = NULL;
+        else
+            *size = (size_t)st.st_size;
+    }
+    close(fd);
+    return p;
+#else
+    return read_file(path, size);
+#endif
+}
+
+static void unmap_file(void *p, size_t size) {
+#ifndef _WIN32
+    munmap(p, size);
+#else
+    (void)size;
+    free(p);
+#endif
+}
+
+/* the pid and a counter keep the name apart from other writers, and "x"
+ * refuses a name that exists anyway rather than truncating it */
+FILE *temp_beside(const char *path, char *tmp, size_t n) {
+    static atomic_uint seq;
+    for (int tries = 0; tries < 16; ++tries) {
+        unsigned k = atomic_fetch_add_explicit(&seq, 1, memory_order_relaxed);
+        if ((size_t)snprintf(tmp, n, "%s.%ld.%u.tmp", path, (long)getpid(), k) >= n)
+            return NULL;
+        FILE *f = fopen(tmp, "wbx");
+        if (f)
+            return f;
+    }
+    return NULL;
+}
+
+static void entry_path(char *buf, size_t n, const char *dir, uint64_t key) {
+    snprintf(buf, n, "%s/%016llx" DISK_EXT, dir, (unsigned long long)key);
+}
+
+/* dependency unchanged: same stat, or same contents after a touch */
+static int dep_current(const disk_dep *d, const char *strtab) {
+    char path[1024];
+    if (d->path_len >= sizeof(path))
+        return 0;
+    memcpy(path, strtab + d->path_off, d->path_len);
+    path[d->path_len] = '\0';
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return 0;
+    if ((uint64_t)st.st_size == d->size && (int64_t)st.st_mtime == d->mtime)
+        return 1;
+    size_t len = 0;
+    char *b = read_file(path, &len);
+    int ok = b && util_hash64(b, len, 0) == d->hash;
+    free(b);
+    return ok;
+}
+
+/* header, layout and checksum; dependencies are checked separately */
+static int entry_valid(const void *data, size_t size, uint64_t key) {
+    const disk_header *h = data;
+    if (size < sizeof(*h) || memcmp(h->magic, DISK_MAGIC, 8) || h->version != DISK_VERSION ||
+        h->cmd_size != sizeof(gles_cmd) || h->endian != 0x0102 || h->key != key)
+        return 0;
+    uint64_t deps_end = sizeof(*h) + (uint64_t)h->dep_count * sizeof(disk_dep) + h->strtab_size;
+    if (deps_end > h->cmd_offset || h->cmd_offset % 8 ||
+        (uint64_t)h->cmd_offset + (uint64_t)h->cmd_count * sizeof(gles_cmd) != size)
+        return 0;
+    const disk_dep *deps = (const disk_dep *)(h + 1);
+    for (uint32_t i = 0; i < h->dep_count; ++i)
+        if ((uint64_t)deps[i].path_off + deps[i].path_len > h->strtab_size)
+            return 0;
+    return util_hash64((const char *)data + sizeof(*h), size - sizeof(*h), 0) == h->checksum;
+}
+
+static int entry_read(const void *data, GLES_CommandList *out) {
+    const disk_header *h = data;
+    const disk_dep *deps = (const disk_dep *)(h + 1);
+    const char *strtab = (const char *)(deps + h->dep_count);
+    for (uint32_t i = 0; i < h->dep_count; ++i)
+        if (!dep_current(&deps[i], strtab))
+            return -1;
+    out->count = out->capacity = 0;
+    out->data = NULL;
+    if (h->cmd_count) {
+        sb_reserve(out->data, h->cmd_count);
+        memcpy(out->data, (const char *)data + h->cmd_offset, h->cmd_count * sizeof(gles_cmd));
+        sb__raw(out->data)[0] = h->cmd_count;
+    }
+    out->count = sb_count(out->data);
+    out->capacity = sb_capacity(out->data);
+    return 0;
+}
+
+static void set_release(preload_set *s) {
+    if (!s || atomic_fetch_sub(&s->refs, 1) != 1)
+        return;
+    for (size_t i = 0; i < sb_count(s->entries); ++i)
+        unmap_file(s->entries[i].data, s->entries[i].size);
+    sb_free(s->entries);
+    free(s->dir);
+    free(s);
+}
+
+/* the preloaded entry for key, with a reference on *set; call with the lock */
+static const mapped_entry *preloaded(const char *dir, uint64_t key, preload_set **set) {
+    preload_set *s = g_preload.set;
+    if (!s || strcmp(s->dir, dir))
+        return NULL;
+    size_t lo = 0, hi = sb_count(s->entries);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (s->entries[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == sb_count(s->entries) || s->entries[lo].key != key)
+        return NULL;
+    atomic_fetch_add(&s->refs, 1);
+    *set = s;
+    return &s->entries[lo];
+}
+
+uint64_t disk_cache_key(const char *src, size_t len, const char *path,
+                        const dx8gles11_options *opt, uint32_t caps) {
+    uint64_t h = util_hash64(src, len, DISK_VERSION);
+    const char *inc = opt && opt->include_dir ? opt->include_dir : "";
+    h = util_hash64(inc, strlen(inc), h);
+    for (const char *const *ip = opt ? opt->include_paths : NULL; ip && *ip; ++ip)
+        h = util_hash64(*ip, strlen(*ip) + 1, h);
+    h = util_hash64("", 1, h); /* keeps paths and defines apart */
+    for (const char *const *d = opt ? opt->defines : NULL; d && *d; ++d)
+        h = util_hash64(*d, strlen(*d) + 1, h);
+    if (path)
+        h = util_hash64(path, strlen(path), h);
+    uint64_t tail[2] = {(uint64_t)(opt ? opt->optimize : 0), caps};
+    return util_hash64(tail, sizeof(tail), h);
+}
+
+int disk_cache_load(const char *dir, uint64_t key, GLES_CommandList *out) {
+    call_once(&g_preload_once, preload_init);
+    preload_set *set = NULL;
+    mtx_lock(&g_preload.lock);
+    const mapped_entry *m = preloaded(dir, key, &set);
+    mtx_unlock(&g_preload.lock);
+    /* dependency stats and the copy run unlocked, so loads overlap */
+    int rc = m ? entry_read(m->data, out) : -1;
+    set_release(set);
+    if (rc == 0)
+        return 0;
+
+    char path[1024];
+    entry_path(path, sizeof(path), dir, key);
+    size_t size = 0;
+    void *data = map_file(path, &size);
+    if (!data)
+        return -1;
+    rc = entry_valid(data, size, key) ? entry_read(data, out) : -1;
+    unmap_file(data, size);
+    return rc;
+}
+
+void disk_cache_store(const char *dir, uint64_t key, const pp_dep *deps,
+                      const GLES_CommandList *l) {
+    size_t ndeps = sb_count((pp_dep *)deps);
+    disk_dep *dd = calloc(ndeps ? ndeps : 1, sizeof(*dd));
+    if (!dd)
+        return;
+    size_t strtab = 0;
+    time_t now = time(NULL);
+    for (size_t i = 0; i < ndeps; ++i) {
+        /* record stat only for the contents that were actually compiled */
+        struct stat st;
+        size_t len = 0;
+        char *b = stat(deps[i].path, &st) == 0 ? read_file(deps[i].path, &len) : NULL;
+        int same = b && util_hash64(b, len, 0) == deps[i].hash;
+        free(b);
+        if (!same) {
+            free(dd);
+            return;
+        }
+        dd[i].hash = deps[i].hash;
+        /* a file modified within the timestamp granularity could change again
+         * without its stat changing; make such entries always re-hash */
+        dd[i].mtime = st.st_mtime >= now - 1 ? INT64_MIN : (int64_t)st.st_mtime;
+        dd[i].size = (uint64_t)st.st_size;
+        dd[i].path_off = (uint32_t)strtab;
+        dd[i].path_len = (uint32_t)strlen(deps[i].path);
+        strtab += dd[i].path_len;
+    }
+
+    disk_header h = {.version = DISK_VERSION, .cmd_size = sizeof(gles_cmd), .endian = 0x0102};
+    memcpy(h.magic, DISK_MAGIC, 8);
+    h.key = key;
+    h.dep_count = (uint32_t)ndeps;
+    h.strtab_size = (uint32_t)strtab;
+    h.cmd_count = (uint32_t)l->count;
+    h.cmd_offset = (uint32_t)((sizeof(h) + ndeps * sizeof(*dd) + strtab + 7) & ~(size_t)7);
+    size_t size = h.cmd_offset + l->count * sizeof(gles_cmd);
+    char *buf = calloc(1, size);
+    if (!buf) {
+        free(dd);
+        return;
+    }
+    char *p = buf + sizeof(h);
+    memcpy(p, dd, ndeps * sizeof(*dd));
+    p += ndeps * sizeof(*dd);
+    for (size_t i = 0; i < ndeps; ++i) {
+        memcpy(p, deps[i].path, dd[i].path_len);
+        p += dd[i].path_len;
+    }
+    if (l->count)
+        memcpy(buf + h.cmd_offset, l->data, l->count * sizeof(gles_cmd));
+    h.checksum = util_hash64(buf + sizeof(h), size - sizeof(h), 0);
+    memcpy(buf, &h, sizeof(h));
+    free(dd);
+
+    /* write beside the final name and rename so readers never see a partial entry */
+    char path[1024], tmp[1100];
+    entry_path(path, sizeof(path), dir, key);
+    FILE *f = temp_beside(path, tmp, sizeof(tmp));
+    if (f) {
+        int ok = fwrite(buf, 1, size, f) == size;
+        ok = fclose(f) == 0 && ok;
+        if (!ok || rename(tmp, path) != 0)
+            remove(tmp);
+    }
+    free(buf);
+}
+
+static int by_key(const void *a, const void *b) {
+    uint64_t x = ((const mapped_entry *)a)->key, y = ((const mapped_entry *)b)->key;
+    return x < y ? -1 : x > y;
+}
+
+/* swap in s (may be NULL); call with the lock, release the result after */
+static preload_set *preload_swap(preload_set *s) {
+    preload_set *old = g_preload.set;
+    g_preload.set = s;
+    return old;
+}
+
+static int preload_thread(void *arg) {
+    char *dir = arg;
+    mapped_entry *found = NULL;
+#ifndef _WIN32
+    DIR *d = opendir(dir);
+    struct dirent *de;
+    while (d && (de = readdir(d))) {
+        size_t n = strlen(de->d_name);
+        unsigned long long key;
+        char path[1024];
+        if (n != 16 + strlen(DISK_EXT) || strcmp(de->d_name + 16, DISK_EXT) ||
+            sscanf(de->d_name, "%16llx", &key) != 1)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        mapped_entry m = {key, NULL, 0};
+        m.data = map_file(path, &m.size);
+        if (!m.data)
+            continue;
+        if (entry_valid(m.data, m.size, key))
+            sb_push(found, m);
+        else
+            unmap_file(m.data, m.size);
+    }
+    if (d)
+        closedir(d);
+#endif
+    if (found)
+        qsort(found, sb_count(found), sizeof(*found), by_key);
+    preload_set *s = malloc(sizeof(*s));
+    if (s) {
+        atomic_init(&s->refs, 1);
+        s->dir = dir;
+        s->entries = found;
+    } else {
+        for (size_t i = 0; i < sb_count(found); ++i)
+            unmap_file(found[i].data, found[i].size);
+        sb_free(found);
+        free(dir);
+    }
+    mtx_lock(&g_preload.lock);
+    preload_set *old = preload_swap(s);
+    g_preload.busy = 0;
+    cnd_broadcast(&g_preload.done);
+    mtx_unlock(&g_preload.lock);
+    set_release(old);
+    return 0;
+}
+
+int dx8gles11_disk_cache_preload(const char *dir) {
+    if (!dir) {
+        dx8gles11_set_error("cache dir null");
+        return -1;
+    }
+    call_once(&g_preload_once, preload_init);
+    char *copy = util_strdup(dir);
+    if (!copy) {
+        dx8gles11_set_error("out of memory");
+        return -1;
+    }
+    mtx_lock(&g_preload.lock);
+    while (g_preload.busy)
+        cnd_wait(&g_preload.done, &g_preload.lock);
+    g_preload.busy = 1;
+    mtx_unlock(&g_preload.lock);
+    thrd_t t;
+    if (thrd_create(&t, preload_thread, copy) != thrd_success) {
+        mtx_lock(&g_preload.lock);
+        g_preload.busy = 0;
+        cnd_broadcast(&g_preload.done);
+        mtx_unlock(&g_preload.lock);
+        free(copy);
+        dx8gles11_set_error("preload thread failed");
+        return -1;
+    }
+    thrd_detach(t);
+    return 0;
+}
+
+void dx8gles11_disk_cache_preload_wait(void) {
+    call_once(&g_preload_once, preload_init);
+    mtx_lock(&g_preload.lock);
+    while (g_preload.busy)
+        cnd_wait(&g_preload.done, &g_preload.lock);
+    mtx_unlock(&g_preload.lock);
+}
+
+void dx8gles11_disk_cache_unload(void) {
+    dx8gles11_disk_cache_preload_wait();
+    mtx_lock(&g_preload.lock);
+    preload_set *old = preload_swap(NULL);
+    mtx_unlock(&g_preload.lock);
+    set_release(old);
+}
@@ -1,5 +1,6 @@
 #include "dx8asm_parser.h"
 #include "dx8gles11.h"
+#include "dx8gles11_internal.h"
 #include "preprocess.h"
 #include "utils.h"
 #include <stdarg.h>
@@ -17,44 +18,20 @@ static void set_err(const char *fmt, ...) {
     vsnprintf(g_err, sizeof(g_err), fmt, ap);
     va_end(ap);
 }
+void dx8gles11_set_error(const char *msg) { set_err("%s", msg); }
 const char *dx8gles11_error(void) { return g_err; }
 
-/* cache queried extension string */
-static const char *g_extensions = NULL;
-
-int dx8gles11_has_extension(const char *name) {
-    if (!name)
-        return 0;
-    if (!g_extensions) {
-        const GLubyte *ext = glGetString(GL_EXTENSIONS);
-        if (!ext) {
-            set_err("glGetString(GL_EXTENSIONS) failed");
-            g_extensions = "";
-            return 0;
-        }
-        g_extensions = (const char *)ext;
-    }
-    const char *s = g_extensions;
-    size_t len = strlen(name);
-    while (s && *s) {
-        while (*s == ' ')
-            ++s;
-        if (!strncmp(s, name, len) && (s[len] == ' ' || s[len] == '\0'))
-            return 1;
-        s = strchr(s, ' ');
-        if (!s)
-            break;
-        ++s;
-    }
-    set_err("missing GL extension: %s", name);
-    return 0;
-}
-
 /* Command-list helpers */
 static void cl_init(GLES_CommandList *l) {
     l->data = NULL;
     l->count = l->capacity = 0;
 }
+/* most instructions emit at most two commands; reserving up front keeps the
+ * common compile to a single allocation for the output list */
+static void cl_reserve(GLES_CommandList *l, size_t n) {
+    sb_reserve(l->data, n);
+    l->capacity = sb_capacity(l->data);
+}
 static void cl_push(GLES_CommandList *l, gles_cmd c) {
     sb_push(l->data, c);
     l->count = sb_count(l->data);
@@ -65,12 +42,21 @@ void gles_cmdlist_free(GLES_CommandList *l) {
     l->data = NULL;
     l->count = l->capacity = 0;
 }
-static int parse_stage(const char *restrict reg, unsigned *restrict out) {
-    if (!reg || reg[0] != 't' || reg[1] < '0' || reg[1] > '3' || reg[2] != '\0')
+static int parse_stage(const asm_operand *restrict reg, unsigned *restrict out) {
+    if (reg->file != ASM_REG_TEXTURE || reg->index > 3)
         return -1;
-    *out = (unsigned)(reg[1] - '0');
+    *out = reg->index;
     return 0;
 }
+/* literal operand value; register operands read as 0 */
+static float imm_value(const asm_instr *restrict i, const asm_operand *restrict o) {
+    return o->file == ASM_REG_IMM ? i->imm[o->index] : 0.0f;
+}
+static const char *operand_text(const asm_instr *restrict i, const asm_operand *restrict o,
+                                char *buf, size_t n) {
+    asm_operand_format(i, o, buf, n);
+    return buf;
+}
 static void push4f(GLES_CommandList *restrict o, gles_cmd_type t, float a, float b, float c, float d) {
     gles_cmd cmd = {.type = t};
     cmd.f[0] = a;
@@ -82,269 +68,214 @@ static void push4f(GLES_CommandList *restrict o, gles_cmd_type t, float a, float
 
 /* ----------------------------------------------------------------------------------
 
-Opcode translators – extend as needed.
+Opcode translators – extend as needed. Each handler is reached through
+k_xlate[] indexed by asm_opcode; opcodes without a handler emit
+GLES_CMD_UNKNOWN.
 
 --------------------------------------------------------------------------------*/
-/* Translate a single instruction to one or more GLES commands. */
-void translate_instr(const asm_instr *restrict i, GLES_CommandList *restrict o) {
-    if (!strcmp(i->opcode, "mov") && !strcmp(i->dst, "oPos")) {
-        if (dx8gles11_has_extension("GL_OES_vertex_buffer_object")) {
+typedef void (*xlate_fn)(const asm_instr *restrict, uint32_t caps, GLES_CommandList *restrict);
+
+#define COMBINE(func) {.type = GLES_CMD_TEX_ENV_COMBINE, .u = {GL_COMBINE, (func)}}
+
+/* single-command opcodes: the handler appends the template unchanged */
+static const gles_cmd k_templates[ASM_OP_COUNT] = {
+    [ASM_OP_MUL] = COMBINE(GL_MODULATE),
+    [ASM_OP_SUB] = COMBINE(GL_SUBTRACT),
+    [ASM_OP_MAD] = COMBINE(GL_ADD_SIGNED),
+    [ASM_OP_LRP] = COMBINE(GL_INTERPOLATE),
+    [ASM_OP_CND] = COMBINE(GL_INTERPOLATE),
+    [ASM_OP_ADD] = COMBINE(GL_ADD),
+    [ASM_OP_MAX] = COMBINE(GL_MAX_EXT),
+    [ASM_OP_MIN] = COMBINE(GL_MIN_EXT),
+    [ASM_OP_DP3] = COMBINE(GL_DOT3_RGB),
+    [ASM_OP_TEXDP3] = COMBINE(GL_DOT3_RGB),
+    [ASM_OP_LOADI] = {.type = GLES_CMD_LOAD_IDENTITY},
+    [ASM_OP_TEXCRD] = {.type = GLES_CMD_TEX_COORD_COPY},
+    [ASM_OP_TEXKILL] = {.type = GLES_CMD_TEX_KILL},
+};
+static const gles_cmd k_dot3 = COMBINE(GL_DOT3_RGB);
+#undef COMBINE
+
+static void xl_unknown(const asm_instr *restrict i, uint32_t caps, GLES_CommandList *restrict o) {
+    (void)caps;
+    (void)i;
+    cl_push(o, (gles_cmd){.type = GLES_CMD_UNKNOWN});
+}
+
+static void xl_template(const asm_instr *restrict i, uint32_t caps, GLES_CommandList *restrict o) {
+    (void)caps;
+    cl_push(o, k_templates[i->op]);
+}
+
+static void xl_nop(const asm_instr *restrict i, uint32_t caps, GLES_CommandList *restrict o) {
+    (void)caps;
+    (void)i;
+    (void)o;
+}
+
+static void xl_mov(const asm_instr *restrict i, uint32_t caps, GLES_CommandList *restrict o) {
+    switch (i->dst.file) {
+    case ASM_REG_RASTOUT:
+        if (i->dst.index != ASM_RASTOUT_POS)
+            break;
+        if (caps & DX8GLES11_CAP_VBO) {
             gles_cmd b = {.type = GLES_CMD_BIND_VBO};
             b.u[0] = 0;
             cl_push(o, b);
         }
-        gles_cmd c = {.type = GLES_CMD_VERTEX_ATTRIB};
-        c.u[0] = 0;
-        cl_push(o, c);
+        gles_cmd v = {.type = GLES_CMD_VERTEX_ATTRIB};
+        v.u[0] = 0;
+        cl_push(o, v);
         return;
-    }
-
-    if (!strcmp(i->opcode, "mov") && !strncmp(i->dst, "oD", 2)) {
+    case ASM_REG_ATTROUT: {
         gles_cmd c = {.type = GLES_CMD_COLOR4F};
         c.u[0] = 0;
         cl_push(o, c);
         return;
     }
-
-    if (!strcmp(i->opcode, "dp4") && !strcmp(i->dst, "oPos")) {
-        gles_cmd c = {.type = GLES_CMD_MATRIX_MODE};
-        c.u[0] = GL_MODELVIEW;
-        cl_push(o, c);
-        return;
-    }
-
-    if (!strcmp(i->opcode, "mul")) {
-        gles_cmd c = {.type = GLES_CMD_TEX_ENV_COMBINE};
-        c.u[0] = GL_COMBINE;
-        c.u[1] = GL_MODULATE;
-        cl_push(o, c);
-        return;
-    }
-
-    if (!strcmp(i->opcode, "sub")) {
-        gles_cmd c = {.type = GLES_CMD_TEX_ENV_COMBINE};
-        c.u[0] = GL_COMBINE;
-        c.u[1] = GL_SUBTRACT;
-        cl_push(o, c);
-        return;
-    }
-
-    if (!strcmp(i->opcode, "mad")) {
-        gles_cmd c = {.type = GLES_CMD_TEX_ENV_COMBINE};
-        c.u[0] = GL_COMBINE;
-        c.u[1] = GL_ADD_SIGNED;
-        cl_push(o, c);
-        return;
-    }
-
-    if (!strcmp(i->opcode, "lrp")) {
-        gles_cmd c = {.type = GLES_CMD_TEX_ENV_COMBINE};
-        c.u[0] = GL_COMBINE;
-        c.u[1] = GL_INTERPOLATE;
-        cl_push(o, c);
-        return;
-    }
-
-    if (!strcmp(i->opcode, "cnd")) {
-        gles_cmd c = {.type = GLES_CMD_TEX_ENV_COMBINE};
-        c.u[0] = GL_COMBINE;
-        c.u[1] = GL_INTERPOLATE;
-        cl_push(o, c);
-        return;
-    }
-
-    if (!strcmp(i->opcode, "nop")) {
-        return; /* no-op */
-    }
-
-    if (!strcmp(i->opcode, "add")) {
-        gles_cmd c = {.type = GLES_CMD_TEX_ENV_COMBINE};
-        c.u[0] = GL_COMBINE;
-        c.u[1] = GL_ADD;
+    case ASM_REG_TEXCRDOUT: {
+        if (i->dst.index > 7) {
+            char reg[32];
+            set_err("texture stage must be 0..7: %s", operand_text(i, &i->dst, reg, sizeof(reg)));
+            break;
+        }
+        gles_cmd c = {.type = GLES_CMD_MULTITEXCOORD4F};
+        c.u[0] = GL_TEXTURE0 + i->dst.index;
         cl_push(o, c);
         return;
     }
-
-    if (!strcmp(i->opcode, "max")) {
-        gles_cmd c = {.type = GLES_CMD_TEX_ENV_COMBINE};
-        c.u[0] = GL_COMBINE;
-        c.u[1] = GL_MAX_EXT;
-        cl_push(o, c);
-        return;
+    default:
+        break;
     }
+    xl_unknown(i, caps, o);
+}
 
-    if (!strcmp(i->opcode, "min")) {
-        gles_cmd c = {.type = GLES_CMD_TEX_ENV_COMBINE};
-        c.u[0] = GL_COMBINE;
-        c.u[1] = GL_MIN_EXT;
-        cl_push(o, c);
+static void xl_dp4(const asm_instr *restrict i, uint32_t caps, GLES_CommandList *restrict o) {
+    if (i->dst.file != ASM_REG_RASTOUT || i->dst.index != ASM_RASTOUT_POS) {
+        xl_unknown(i, caps, o);
         return;
     }
+    gles_cmd c = {.type = GLES_CMD_MATRIX_MODE};
+    c.u[0] = GL_MODELVIEW;
+    cl_push(o, c);
+}
 
-    if (!strcmp(i->opcode, "dp3")) {
-        gles_cmd c = {.type = GLES_CMD_TEX_ENV_COMBINE};
-        c.u[0] = GL_COMBINE;
-        c.u[1] = GL_DOT3_RGB;
-        cl_push(o, c);
+static void xl_texdp3tex(const asm_instr *restrict i, uint32_t caps, GLES_CommandList *restrict o) {
+    unsigned stage;
+    if (parse_stage(&i->dst, &stage)) {
+        char reg[32];
+        set_err("invalid texdp3tex stage: %s", operand_text(i, &i->dst, reg, sizeof(reg)));
+        xl_unknown(i, caps, o);
         return;
     }
+    cl_push(o, k_dot3);
+    gles_cmd c = {.type = GLES_CMD_TEX_SAMPLE};
+    c.u[0] = stage;
+    cl_push(o, c);
+}
 
-    if (!strcmp(i->opcode, "texdp3")) {
-        gles_cmd c = {.type = GLES_CMD_TEX_ENV_COMBINE};
-        c.u[0] = GL_COMBINE;
-        c.u[1] = GL_DOT3_RGB;
-        cl_push(o, c);
-        return;
-    }
+static void xl_texm3x3(const asm_instr *restrict i, uint32_t caps, GLES_CommandList *restrict o) {
+    (void)caps;
+    (void)i;
+    cl_push(o, k_dot3);
+    cl_push(o, k_dot3);
+    cl_push(o, k_dot3);
+}
 
-    if (!strcmp(i->opcode, "texdp3tex")) {
-        unsigned stage;
-        if (parse_stage(i->dst, &stage)) {
-            set_err("invalid texdp3tex stage: %s", i->dst);
-            cl_push(o, (gles_cmd){.type = GLES_CMD_UNKNOWN});
-            return;
-        }
-        gles_cmd c = {.type = GLES_CMD_TEX_ENV_COMBINE};
-        c.u[0] = GL_COMBINE;
-        c.u[1] = GL_DOT3_RGB;
-        cl_push(o, c);
-        c = (gles_cmd){.type = GLES_CMD_TEX_SAMPLE};
+static void xl_mload(const asm_instr *restrict i, uint32_t caps, GLES_CommandList *restrict o) {
+    (void)caps;
+    unsigned stage;
+    if (parse_stage(&i->dst, &stage) == 0) {
+        gles_cmd c = {.type = GLES_CMD_TEX_MATRIX_MODE};
         c.u[0] = stage;
         cl_push(o, c);
-        return;
-    }
-
-    if (!strcmp(i->opcode, "texm3x3")) {
-        gles_cmd c = {.type = GLES_CMD_TEX_ENV_COMBINE};
-        c.u[0] = GL_COMBINE;
-        c.u[1] = GL_DOT3_RGB;
-        cl_push(o, c);
+        c = (gles_cmd){.type = GLES_CMD_TEX_MATRIX_LOAD};
+        c.u[0] = stage;
+        c.f[0] = imm_value(i, &i->src[0]);
+        c.f[1] = imm_value(i, &i->src[1]);
+        c.f[2] = imm_value(i, &i->src[2]);
+        c.f[3] = 1.0f;
         cl_push(o, c);
+    } else {
+        gles_cmd c = {.type = GLES_CMD_MATRIX_LOAD};
+        c.f[0] = imm_value(i, &i->dst);
+        c.f[1] = imm_value(i, &i->src[0]);
+        c.f[2] = imm_value(i, &i->src[1]);
+        c.f[3] = 1.0f;
         cl_push(o, c);
-        return;
-    }
-
-    if (!strcmp(i->opcode, "mload")) {
-        unsigned stage;
-        if (parse_stage(i->dst, &stage) == 0) {
-            gles_cmd c = {.type = GLES_CMD_TEX_MATRIX_MODE};
-            c.u[0] = stage;
-            cl_push(o, c);
-            c = (gles_cmd){.type = GLES_CMD_TEX_MATRIX_LOAD};
-            c.u[0] = stage;
-            c.f[0] = strtof(i->src0, NULL);
-            c.f[1] = strtof(i->src1, NULL);
-            c.f[2] = strtof(i->src2, NULL);
-            c.f[3] = 1.0f;
-            cl_push(o, c);
-        } else {
-            gles_cmd c = {.type = GLES_CMD_MATRIX_LOAD};
-            c.f[0] = strtof(i->dst, NULL);
-            c.f[1] = strtof(i->src0, NULL);
-            c.f[2] = strtof(i->src1, NULL);
-            c.f[3] = 1.0f;
-            cl_push(o, c);
-        }
-        return;
     }
+}
 
-    if (!strcmp(i->opcode, "loadi")) {
-        gles_cmd c = {.type = GLES_CMD_LOAD_IDENTITY};
-        cl_push(o, c);
+/* shared by tex/texld: sample or load, then the image kind hinted by the source */
+static void xl_tex_sample(const asm_instr *restrict i, uint32_t caps,
+                          GLES_CommandList *restrict o, gles_cmd_type type) {
+    unsigned stage;
+    if (parse_stage(&i->dst, &stage)) {
+        char reg[32];
+        set_err("invalid %s stage: %s", asm_opcode_name(i->op),
+                operand_text(i, &i->dst, reg, sizeof(reg)));
+        xl_unknown(i, caps, o);
         return;
     }
-
-    if (!strcmp(i->opcode, "tex")) {
-        unsigned stage;
-        if (parse_stage(i->dst, &stage)) {
-            set_err("invalid tex stage: %s", i->dst);
-            cl_push(o, (gles_cmd){.type = GLES_CMD_UNKNOWN});
-            return;
-        }
-        gles_cmd c = {.type = GLES_CMD_TEX_SAMPLE};
-        c.u[0] = stage;
-        cl_push(o, c);
-        if (strstr(i->comment, "volume") || strstr(i->dst, "volume") ||
-            strstr(i->src0, "volume") || strstr(i->src1, "volume") ||
-            strstr(i->src2, "volume")) {
-            gles_cmd v = {.type = GLES_CMD_TEX_IMAGE_3D};
-            v.u[0] = stage;
-            cl_push(o, v);
-        } else if (strstr(i->comment, "shadow") || strstr(i->dst, "shadow") ||
-                   strstr(i->src0, "shadow") || strstr(i->src1, "shadow") ||
-                   strstr(i->src2, "shadow")) {
-            gles_cmd v = {.type = GLES_CMD_TEX_IMAGE_DEPTH};
-            v.u[0] = stage;
-            cl_push(o, v);
-        } else if (strstr(i->comment, "npot") || strstr(i->dst, "npot") ||
-                   strstr(i->src0, "npot") || strstr(i->src1, "npot") ||
-                   strstr(i->src2, "npot")) {
-            gles_cmd v = {.type = GLES_CMD_TEX_IMAGE_2D};
-            v.u[0] = stage;
-            cl_push(o, v);
-        }
+    gles_cmd c = {.type = type};
+    c.u[0] = stage;
+    cl_push(o, c);
+    gles_cmd_type image;
+    if (i->flags & ASM_INSTR_VOLUME)
+        image = GLES_CMD_TEX_IMAGE_3D;
+    else if (i->flags & ASM_INSTR_SHADOW)
+        image = GLES_CMD_TEX_IMAGE_DEPTH;
+    else if (i->flags & ASM_INSTR_NPOT)
+        image = GLES_CMD_TEX_IMAGE_2D;
+    else
         return;
-    }
+    gles_cmd v = {.type = image};
+    v.u[0] = stage;
+    cl_push(o, v);
+}
 
-    if (!strcmp(i->opcode, "texld")) {
-        unsigned stage;
-        if (parse_stage(i->dst, &stage)) {
-            set_err("invalid texld stage: %s", i->dst);
-            cl_push(o, (gles_cmd){.type = GLES_CMD_UNKNOWN});
-            return;
-        }
-        gles_cmd c = {.type = GLES_CMD_TEX_LOAD};
-        c.u[0] = stage;
-        cl_push(o, c);
-        if (strstr(i->comment, "volume") || strstr(i->dst, "volume") ||
-            strstr(i->src0, "volume") || strstr(i->src1, "volume") ||
-            strstr(i->src2, "volume")) {
-            gles_cmd v = {.type = GLES_CMD_TEX_IMAGE_3D};
-            v.u[0] = stage;
-            cl_push(o, v);
-        } else if (strstr(i->comment, "shadow") || strstr(i->dst, "shadow") ||
-                   strstr(i->src0, "shadow") || strstr(i->src1, "shadow") ||
-                   strstr(i->src2, "shadow")) {
-            gles_cmd v = {.type = GLES_CMD_TEX_IMAGE_DEPTH};
-            v.u[0] = stage;
-            cl_push(o, v);
-        } else if (strstr(i->comment, "npot") || strstr(i->dst, "npot") ||
-                   strstr(i->src0, "npot") || strstr(i->src1, "npot") ||
-                   strstr(i->src2, "npot")) {
-            gles_cmd v = {.type = GLES_CMD_TEX_IMAGE_2D};
-            v.u[0] = stage;
-            cl_push(o, v);
-        }
-        return;
-    }
+static void xl_tex(const asm_instr *restrict i, uint32_t caps, GLES_CommandList *restrict o) {
+    xl_tex_sample(i, caps, o, GLES_CMD_TEX_SAMPLE);
+}
 
-    if (!strcmp(i->opcode, "texcrd")) {
-        gles_cmd c = {.type = GLES_CMD_TEX_COORD_COPY};
-        cl_push(o, c);
-        return;
-    }
+static void xl_texld(const asm_instr *restrict i, uint32_t caps, GLES_CommandList *restrict o) {
+    xl_tex_sample(i, caps, o, GLES_CMD_TEX_LOAD);
+}
 
-    if (!strcmp(i->opcode, "texkill")) {
-        gles_cmd c = {.type = GLES_CMD_TEX_KILL};
-        cl_push(o, c);
-        return;
-    }
+static const xlate_fn k_xlate[ASM_OP_COUNT] = {
+    [ASM_OP_NOP] = xl_nop,
+    [ASM_OP_MOV] = xl_mov,
+    [ASM_OP_DP4] = xl_dp4,
+    [ASM_OP_MUL] = xl_template,
+    [ASM_OP_SUB] = xl_template,
+    [ASM_OP_MAD] = xl_template,
+    [ASM_OP_LRP] = xl_template,
+    [ASM_OP_CND] = xl_template,
+    [ASM_OP_ADD] = xl_template,
+    [ASM_OP_MAX] = xl_template,
+    [ASM_OP_MIN] = xl_template,
+    [ASM_OP_DP3] = xl_template,
+    [ASM_OP_TEXDP3] = xl_template,
+    [ASM_OP_TEXDP3TEX] = xl_texdp3tex,
+    [ASM_OP_TEXM3X3] = xl_texm3x3,
+    [ASM_OP_MLOAD] = xl_mload,
+    [ASM_OP_LOADI] = xl_template,
+    [ASM_OP_TEX] = xl_tex,
+    [ASM_OP_TEXLD] = xl_texld,
+    [ASM_OP_TEXCRD] = xl_template,
+    [ASM_OP_TEXKILL] = xl_template,
+};
 
-    if (!strcmp(i->opcode, "mov") && !strncmp(i->dst, "oT", 2)) {
-        if (i->dst[2] < '0' || i->dst[2] > '7') {
-            set_err("texture stage must be 0..7: %s", i->dst);
-            cl_push(o, (gles_cmd){.type = GLES_CMD_UNKNOWN});
-            return;
-        }
-        unsigned stage = (unsigned)(i->dst[2] - '0');
-        gles_cmd c = {.type = GLES_CMD_MULTITEXCOORD4F};
-        c.u[0] = GL_TEXTURE0 + stage;
-        cl_push(o, c);
-        return;
-    }
+/* Translate a single instruction to one or more GLES commands. */
+void translate_instr_caps(const asm_instr *restrict i, uint32_t caps,
+                          GLES_CommandList *restrict o) {
+    xlate_fn fn = (unsigned)i->op < ASM_OP_COUNT ? k_xlate[i->op] : NULL;
+    (fn ? fn : xl_unknown)(i, caps, o);
+}
 
-    /* default */
-    cl_push(o, (gles_cmd){.type = GLES_CMD_UNKNOWN});
+/* for the current GL context */
+void translate_instr(const asm_instr *restrict i, GLES_CommandList *restrict o) {
+    translate_instr_caps(i, translate_caps(NULL), o);
 }
 
 /* validate instruction/constant limits for shader profiles */
@@ -352,7 +283,7 @@ static int validate_shader(const asm_program *p) {
     if (p->type == ASM_SHADER_PS11) {
         size_t tex = 0, arith = 0;
         for (size_t i = 0; i < p->count; ++i) {
-            if (!strncmp(p->code[i].opcode, "tex", 3))
+            if (asm_opcode_class_of(p->code[i].op) == ASM_OPC_TEX)
                 ++tex;
             else
                 ++arith;
@@ -364,7 +295,7 @@ static int validate_shader(const asm_program *p) {
     } else if (p->type == ASM_SHADER_PS13) {
         size_t tex = 0, arith = 0;
         for (size_t i = 0; i < p->count; ++i) {
-            if (!strncmp(p->code[i].opcode, "tex", 3))
+            if (asm_opcode_class_of(p->code[i].op) == ASM_OPC_TEX)
                 ++tex;
             else
                 ++arith;
@@ -386,28 +317,164 @@ static int validate_shader(const asm_program *p) {
     return 0;
 }
 
-/* shared compilation logic for string and file paths */
-static int compile_from_source(const char *src, GLES_CommandList *out) {
+/* validate and translate a parsed program into out for a target's caps */
+int translate_program_caps(const asm_program *prog, uint32_t caps, GLES_CommandList *out) {
+    if (validate_shader(prog))
+        return -4;
+    cl_reserve(out, prog->const_count + 2 * prog->count);
+    for (size_t c = 0; c < prog->const_count; ++c) {
+        gles_cmd cmd = {.type = GLES_CMD_LOAD_CONSTANT};
+        cmd.u[0] = prog->consts[c].idx;
+        cmd.f[0] = prog->consts[c].value[0];
+        cmd.f[1] = prog->consts[c].value[1];
+        cmd.f[2] = prog->consts[c].value[2];
+        cmd.f[3] = prog->consts[c].value[3];
+        cl_push(out, cmd);
+    }
+    for (size_t idx = 0; idx < prog->count; ++idx)
+        translate_instr_caps(&prog->code[idx], caps, out);
+    return 0;
+}
+
+/* shared compilation logic for string and file paths: parse, validate and
+ * translate already preprocessed source into out. Scratch memory comes from
+ * arena when given; only out is malloc'd. */
+int compile_preprocessed(const char *src, const dx8gles11_options *opt, util_arena *arena,
+                         GLES_CommandList *out) {
+    cl_init(out);
+    util_arena local = {0};
     asm_program prog = {0};
     char *parse_err = NULL;
-    if (asm_parse(src, &prog, &parse_err)) {
+    if (asm_parse_arena(src, &prog, arena ? arena : &local, &parse_err)) {
         set_err("parse error: %s", parse_err ? parse_err : "?");
         free(parse_err);
-        return -1;
+        util_arena_free(&local);
+        return -3;
     }
-    if (validate_shader(&prog)) {
+    int rc = translate_program_caps(&prog, translate_caps(opt), out);
+    util_arena_free(&local);
+    return rc;
+}
+
+/* preprocessor lines go straight into the parser; after a parse error the
+ * rest is still preprocessed so preprocessing errors keep precedence */
+typedef struct fused_parse {
+    asm_stream stream;
+    char *err;
+} fused_parse;
+
+static int fused_line(void *ctx, const char *line, size_t len) {
+    fused_parse *f = ctx;
+    if (!f->stream.failed)
+        asm_stream_line(&f->stream, line, len, &f->err);
+    return 0;
+}
+
+/* preprocess and parse in one pass without building the preprocessed text;
+ * the caches that key on that text are not involved */
+static int compile_fused(const char *path, const char *raw, const pp_config *cfg,
+                         uint32_t caps, util_arena *arena, GLES_CommandList *out) {
+    asm_program prog;
+    fused_parse f = {0};
+    asm_stream_begin(&f.stream, &prog, arena);
+    char *pp_err = NULL;
+    int rc = path ? pp_stream_cfg(path, cfg, fused_line, &f, &pp_err)
+                  : pp_stream_string_cfg(raw, cfg, fused_line, &f, &pp_err);
+    if (rc) {
+        set_err("preprocess fail: %s", pp_err ? pp_err : "?");
+        rc = -2;
+    } else if (f.stream.failed) {
+        set_err("parse error: %s", f.err ? f.err : "?");
+        rc = -3;
+    } else {
+        rc = translate_program_caps(&prog, caps, out);
+    }
+    if (!f.stream.failed)
         asm_program_free(&prog);
+    free(pp_err);
+    free(f.err);
+    return rc;
+}
+
+/* compile preprocessed source, through the options' cache when one is set */
+int compile_or_lookup(const char *pp_src, const dx8gles11_options *opt, util_arena *arena,
+                      GLES_CommandList *out) {
+    if (!opt || !opt->cache)
+        return compile_preprocessed(pp_src, opt, arena, out);
+    const GLES_CommandList *shared = NULL;
+    int rc = cache_compile_preprocessed(opt->cache, pp_src, opt, &shared);
+    if (rc)
+        return rc;
+    cl_init(out);
+    cl_reserve(out, shared->count);
+    for (size_t i = 0; i < shared->count; ++i)
+        cl_push(out, shared->data[i]);
+    dx8gles11_cache_release(opt->cache, shared);
+    return 0;
+}
+
+/* preprocess + compile, reusing and refreshing the persistent cache when
+ * opt->cache_dir is set; raw is the unpreprocessed source text. All
+ * intermediate buffers live in arena. */
+static int compile_source(const char *path, const char *raw, const dx8gles11_options *opt,
+                          util_arena *arena, GLES_CommandList *out) {
+    const char *dir = opt ? opt->cache_dir : NULL;
+    uint32_t caps = translate_caps(opt);
+    uint64_t key = 0;
+    if (dir) {
+        key = disk_cache_key(raw, strlen(raw), path, opt, caps);
+        if (disk_cache_load(dir, key, out) == 0)
+            return 0;
+    }
+
+    char *pp_err = NULL;
+    pp_dep *deps = NULL;
+    pp_config cfg = {.include_dir = opt ? opt->include_dir : NULL,
+                     .include_paths = opt ? opt->include_paths : NULL,
+                     .snapshot = opt ? opt->prelude : NULL,
+                     .defines = opt ? opt->defines : NULL,
+                     .deps = dir ? &deps : NULL,
+                     .arena = arena};
+    if (!opt || !opt->cache) {
+        int rc = compile_fused(path, raw, &cfg, caps, arena, out);
+        if (rc == 0 && dir)
+            disk_cache_store(dir, key, deps, out);
+        pp_deps_free(deps);
+        return rc;
+    }
+    char *pp_src = path ? pp_run_cfg(path, &cfg, &pp_err) : pp_run_string_cfg(raw, &cfg, &pp_err);
+    if (!pp_src) {
+        set_err("preprocess fail: %s", pp_err ? pp_err : "?");
+        free(pp_err);
+        pp_deps_free(deps);
         return -2;
     }
-    for (size_t idx = 0; idx < prog.count; ++idx)
-        translate_instr(&prog.code[idx], out);
+    int rc = compile_or_lookup(pp_src, opt, arena, out);
+    if (rc == 0 && dir)
+        disk_cache_store(dir, key, deps, out);
+    pp_deps_free(deps);
+    return rc;
+}
 
-    asm_program_free(&prog);
-    return 0;
+static char *read_source(util_arena *arena, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    rewind(f);
+    char *b = sz >= 0 ? util_arena_alloc(arena, (size_t)sz + 1) : NULL;
+    if (!b || fread(b, 1, (size_t)sz, f) != (size_t)sz) {
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    b[sz] = '\0';
+    return b;
 }
 
-int dx8gles11_compile_string(const char *src, const dx8gles11_options *opt,
-                             GLES_CommandList *out) {
+int compile_string_arena(const char *src, const dx8gles11_options *opt, util_arena *arena,
+                         GLES_CommandList *out) {
     if (!src) {
         set_err("source null");
         return -1;
@@ -417,86 +484,144 @@ int dx8gles11_compile_string(const char *src, const dx8gles11_options *opt,
         return -1;
     }
     cl_init(out);
+    return compile_source(NULL, src, opt, arena, out);
+}
 
-    char *pp_err = NULL;
-    char *pp_src = pp_run_string(src, opt ? opt->include_dir : NULL, &pp_err);
-    if (!pp_src) {
-        set_err("preprocess fail: %s", pp_err ? pp_err : "?");
-        free(pp_err);
-        return -2;
+int compile_file_arena(const char *path, const dx8gles11_options *opt, util_arena *arena,
+                       GLES_CommandList *out) {
+    if (!out) {
+        set_err("out list null");
+        return -1;
     }
+    cl_init(out);
+    if (!opt || !opt->cache_dir)
+        return compile_source(path, "", opt, arena, out);
 
-    asm_program prog = {0};
-    char *parse_err = NULL;
-    if (asm_parse(pp_src, &prog, &parse_err)) {
-        set_err("parse error: %s", parse_err ? parse_err : "?");
-        free(parse_err);
-        free(pp_src);
-        return -3;
-    }
-    if (validate_shader(&prog)) {
-        asm_program_free(&prog);
-        free(pp_src);
-        return -4;
-    }
-    for (size_t c = 0; c < prog.const_count; ++c) {
-        gles_cmd cmd = {.type = GLES_CMD_LOAD_CONSTANT};
-        cmd.u[0] = prog.consts[c].idx;
-        cmd.f[0] = prog.consts[c].value[0];
-        cmd.f[1] = prog.consts[c].value[1];
-        cmd.f[2] = prog.consts[c].value[2];
-        cmd.f[3] = prog.consts[c].value[3];
-        cl_push(out, cmd);
+    char *raw = path ? read_source(arena, path) : NULL;
+    if (!raw) {
+        set_err("preprocess fail: Could not read source file");
+        return -2;
     }
-    for (size_t idx = 0; idx < prog.count; ++idx)
-        translate_instr(&prog.code[idx], out);
+    return compile_source(path, raw, opt, arena, out);
+}
 
-    asm_program_free(&prog);
-    free(pp_src);
-    return 0;
+/* a session is an arena kept warm across compiles */
+struct dx8gles11_session {
+    util_arena arena;
+};
+
+dx8gles11_session *dx8gles11_session_create(void) {
+    return calloc(1, sizeof(dx8gles11_session));
 }
 
-int dx8gles11_compile_file(const char *path, const dx8gles11_options *opt, GLES_CommandList *out) {
-    if (!out) {
-        set_err("out list null");
+void dx8gles11_session_destroy(dx8gles11_session *s) {
+    if (!s)
+        return;
+    util_arena_free(&s->arena);
+    free(s);
+}
+
+int dx8gles11_session_compile_string(dx8gles11_session *s, const char *src,
+                                     const dx8gles11_options *opt, GLES_CommandList *out) {
+    if (!s) {
+        set_err("session null");
         return -1;
     }
-    cl_init(out);
+    int rc = compile_string_arena(src, opt, &s->arena, out);
+    util_arena_reset(&s->arena);
+    return rc;
+}
+
+int dx8gles11_session_compile_file(dx8gles11_session *s, const char *path,
+                                   const dx8gles11_options *opt, GLES_CommandList *out) {
+    if (!s) {
+        set_err("session null");
+        return -1;
+    }
+    int rc = compile_file_arena(path, opt, &s->arena, out);
+    util_arena_reset(&s->arena);
+    return rc;
+}
 
+/* a streamed compile is a push preprocessor feeding a line parser */
+struct dx8gles11_stream {
+    util_arena arena;
+    pp_push *pp;
+    asm_program prog;
+    fused_parse parse;
+    uint32_t caps; /* fixed at create */
+    int rc;        /* first error; every later call returns it */
+};
+
+dx8gles11_stream *dx8gles11_stream_create(const dx8gles11_options *opt) {
+    dx8gles11_stream *s = calloc(1, sizeof(*s));
+    if (!s) {
+        set_err("out of memory");
+        return NULL;
+    }
+    pp_config cfg = {.include_dir = opt ? opt->include_dir : NULL,
+                     .include_paths = opt ? opt->include_paths : NULL,
+                     .defines = opt ? opt->defines : NULL,
+                     .arena = &s->arena};
+    s->caps = translate_caps(opt);
     char *pp_err = NULL;
-    char *src = pp_run(path, opt ? opt->include_dir : NULL, &pp_err);
-    if (!src) {
+    asm_stream_begin(&s->parse.stream, &s->prog, &s->arena);
+    if (!(s->pp = pp_push_begin(&cfg, fused_line, &s->parse, &pp_err))) {
         set_err("preprocess fail: %s", pp_err ? pp_err : "?");
         free(pp_err);
-        return -2;
+        util_arena_free(&s->arena);
+        free(s);
+        return NULL;
     }
+    return s;
+}
 
-    asm_program prog = {0};
-    char *parse_err = NULL;
-    if (asm_parse(src, &prog, &parse_err)) {
-        set_err("parse error: %s", parse_err ? parse_err : "?");
-        free(parse_err);
-        free(src);
-        return -3;
+/* record the first preprocess or parse error */
+static int stream_check(dx8gles11_stream *s, int pp_rc, char *pp_err) {
+    if (pp_rc) {
+        set_err("preprocess fail: %s", pp_err ? pp_err : "?");
+        s->rc = -2;
+    } else if (s->parse.stream.failed) {
+        set_err("parse error: %s", s->parse.err ? s->parse.err : "?");
+        s->rc = -3;
     }
-    if (validate_shader(&prog)) {
-        asm_program_free(&prog);
-        free(src);
-        return -4;
+    free(pp_err);
+    return s->rc;
+}
+
+int dx8gles11_stream_feed(dx8gles11_stream *s, const char *data, size_t len) {
+    if (!s || (!data && len)) {
+        set_err(!s ? "stream null" : "data null");
+        return -1;
     }
-    for (size_t c = 0; c < prog.const_count; ++c) {
-        gles_cmd cmd = {.type = GLES_CMD_LOAD_CONSTANT};
-        cmd.u[0] = prog.consts[c].idx;
-        cmd.f[0] = prog.consts[c].value[0];
-        cmd.f[1] = prog.consts[c].value[1];
-        cmd.f[2] = prog.consts[c].value[2];
-        cmd.f[3] = prog.consts[c].value[3];
-        cl_push(out, cmd);
+    if (s->rc)
+        return s->rc;
+    char *pp_err = NULL;
+    int rc = pp_push_feed(s->pp, data, len, &pp_err);
+    return stream_check(s, rc, pp_err);
+}
+
+int dx8gles11_stream_finish(dx8gles11_stream *s, GLES_CommandList *out) {
+    if (!s || !out) {
+        set_err(!s ? "stream null" : "out list null");
+        return -1;
     }
-    for (size_t idx = 0; idx < prog.count; ++idx)
-        translate_instr(&prog.code[idx], out);
+    cl_init(out);
+    if (s->rc)
+        return s->rc;
+    char *pp_err = NULL;
+    int rc = pp_push_finish(s->pp, &pp_err);
+    if (stream_check(s, rc, pp_err))
+        return s->rc;
+    s->rc = translate_program_caps(&s->prog, s->caps, out);
+    return s->rc;
+}
 
-    asm_program_free(&prog);
-    free(src);
-    return 0;
+void dx8gles11_stream_destroy(dx8gles11_stream *s) {
+    if (!s)
+        return;
+    pp_push_free(s->pp);
+    free(s->parse.err);
+    util_arena_free(&s->arena);
+    free(s);
 }
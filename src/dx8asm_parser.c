@@ -4,195 +4,603 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <threads.h>
 
-static char *trim_ws(char *s) {
-    while (isspace((unsigned char)*s))
-        ++s;
-    size_t len = strlen(s);
-    while (len && isspace((unsigned char)s[len - 1]))
-        s[--len] = '\0';
-    return s;
+static const struct {
+    const char *name;
+    unsigned char len;
+    unsigned char cls;
+} k_opcodes[ASM_OP_COUNT] = {
+    [ASM_OP_UNKNOWN] = {"", 0, ASM_OPC_ARITH},
+#define DX8ASM_OP_ROW(id, mnem, c) [ASM_OP_##id] = {mnem, sizeof(mnem) - 1, c},
+    DX8ASM_OPCODES(DX8ASM_OP_ROW)
+#undef DX8ASM_OP_ROW
+};
+
+/* open-addressed index over k_opcodes, filled once on first lookup */
+#define OPCODE_SLOTS 128
+_Static_assert(ASM_OP_COUNT < OPCODE_SLOTS / 2, "grow OPCODE_SLOTS");
+_Static_assert(ASM_OP_COUNT <= 255, "opcode index must fit in a byte");
+static unsigned char g_opcode_slots[OPCODE_SLOTS];
+static once_flag g_opcode_once = ONCE_FLAG_INIT;
+
+static unsigned opcode_hash(const char *s, size_t n) {
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h & (OPCODE_SLOTS - 1);
 }
 
-int asm_parse(const char *src, asm_program *prog, char **err) {
-    prog->code = NULL;
-    prog->consts = NULL;
-    prog->count = prog->capacity = 0;
-    prog->const_count = prog->const_capacity = 0;
-    prog->type = ASM_SHADER_NONE;
+static void opcode_index_init(void) {
+    for (unsigned op = 1; op < ASM_OP_COUNT; ++op) {
+        unsigned h = opcode_hash(k_opcodes[op].name, k_opcodes[op].len);
+        while (g_opcode_slots[h])
+            h = (h + 1) & (OPCODE_SLOTS - 1);
+        g_opcode_slots[h] = (unsigned char)op;
+    }
+}
 
-    size_t line = 1;
-    const char *cur = src;
-    while (*cur) {
-        while (*cur == '\n' || *cur == '\r') {
-            ++cur;
-            ++line;
-        }
-        const char *ls = cur;
-        while (*cur && *cur != '\n')
-            ++cur;
-        size_t len = cur - ls;
-        if (*cur == '\n') {
-            ++cur;
-            ++line;
-        }
-        if (len == 0)
-            continue;
-
-        char *buf = util_strndup(ls, len);
-        char *sc = strchr(buf, ';');
-        char comment[64] = "";
-        if (sc) {
-            strncpy(comment, sc + 1, sizeof(comment) - 1);
-            *sc = '\0';
-        }
+asm_opcode asm_opcode_lookup(const char *name, size_t n) {
+    call_once(&g_opcode_once, opcode_index_init);
+    for (unsigned h = opcode_hash(name, n);; h = (h + 1) & (OPCODE_SLOTS - 1)) {
+        unsigned op = g_opcode_slots[h];
+        if (!op)
+            return ASM_OP_UNKNOWN;
+        if (k_opcodes[op].len == n && !memcmp(k_opcodes[op].name, name, n))
+            return (asm_opcode)op;
+    }
+}
 
-        char *trim = trim_ws(buf);
-        if (*trim == '\0') {
-            free(buf);
-            continue; /* comment or blank line */
+const char *asm_opcode_name(asm_opcode op) {
+    return (unsigned)op < ASM_OP_COUNT ? k_opcodes[op].name : "";
+}
+
+asm_opcode_class asm_opcode_class_of(asm_opcode op) {
+    return (unsigned)op < ASM_OP_COUNT ? (asm_opcode_class)k_opcodes[op].cls : ASM_OPC_ARITH;
+}
+
+_Static_assert(sizeof(asm_instr) == 32, "asm_instr should stay two per cache line");
+
+/*
+ * The parser works on views into the caller's buffer: lines, operands and
+ * suffixes are [p, e) ranges and nothing is copied or NUL-terminated. at()
+ * reads one byte of a view, yielding 0 past its end the way a terminator
+ * would.
+ */
+static int at(const char *p, const char *e) {
+    return p < e ? (unsigned char)*p : 0;
+}
+
+static int is_ws(int c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+static const char *skip_ws(const char *p, const char *e) {
+    while (p < e && is_ws((unsigned char)*p))
+        ++p;
+    return p;
+}
+
+static const char *trim_end(const char *p, const char *e) {
+    while (e > p && is_ws((unsigned char)e[-1]))
+        --e;
+    return e;
+}
+
+static int view_eq(const char *p, const char *e, const char *lit) {
+    size_t n = strlen(lit);
+    return (size_t)(e - p) == n && !memcmp(p, lit, n);
+}
+
+static int view_contains(const char *p, const char *e, const char *lit) {
+    size_t n = strlen(lit);
+    while ((size_t)(e - p) >= n) {
+        const char *c = memchr(p, lit[0], (size_t)(e - p) - n + 1);
+        if (!c)
+            return 0;
+        if (!memcmp(c, lit, n))
+            return 1;
+        p = c + 1;
+    }
+    return 0;
+}
+
+/* advance *p past lit when the view starts with it, ignoring case */
+static int take_ci(const char **p, const char *e, const char *lit) {
+    const char *q = *p;
+    for (; *lit; ++lit, ++q)
+        if (tolower(at(q, e)) != *lit)
+            return 0;
+    *p = q;
+    return 1;
+}
+
+static int comp_index(char ch) {
+    switch (tolower((unsigned char)ch)) {
+    case 'x':
+    case 'r':
+        return 0;
+    case 'y':
+    case 'g':
+        return 1;
+    case 'z':
+    case 'b':
+        return 2;
+    case 'w':
+    case 'a':
+        return 3;
+    default:
+        return -1;
+    }
+}
+
+static int parse_index(const char **s, const char *e, uint8_t *out) {
+    uint32_t v;
+    const char *p = util_parse_u32(*s, e, &v);
+    if (!p || v > 255)
+        return -1;
+    *out = (uint8_t)v;
+    *s = p;
+    return 0;
+}
+
+static unsigned scan_hints(const char *p, const char *e) {
+    unsigned f = 0;
+    if (view_contains(p, e, "volume"))
+        f |= ASM_INSTR_VOLUME;
+    if (view_contains(p, e, "shadow"))
+        f |= ASM_INSTR_SHADOW;
+    if (view_contains(p, e, "npot"))
+        f |= ASM_INSTR_NPOT;
+    return f;
+}
+
+/* register prefix, in any case; leaves *s after the register name, before the index */
+static int parse_reg_file(const char **s, const char *e, asm_operand *o) {
+    const char *p = *s;
+    switch (tolower(at(p, e))) {
+    case 'r':
+        o->file = ASM_REG_TEMP;
+        break;
+    case 'v':
+        o->file = ASM_REG_INPUT;
+        break;
+    case 'c':
+        o->file = ASM_REG_CONST;
+        break;
+    case 't':
+        o->file = ASM_REG_TEXTURE;
+        break;
+    case 'a':
+        o->file = ASM_REG_ADDR;
+        break;
+    case 'o':
+        if (take_ci(s, e, "opos") || take_ci(s, e, "ofog") || take_ci(s, e, "opts")) {
+            o->file = ASM_REG_RASTOUT;
+            o->index = tolower(p[1]) == 'p'
+                           ? (tolower(p[2]) == 'o' ? ASM_RASTOUT_POS : ASM_RASTOUT_PTS)
+                           : ASM_RASTOUT_FOG;
+            return 1; /* no index follows */
         }
+        if (tolower(at(p + 1, e)) == 'd')
+            o->file = ASM_REG_ATTROUT;
+        else if (tolower(at(p + 1, e)) == 't')
+            o->file = ASM_REG_TEXCRDOUT;
+        else
+            return -1;
+        *s = p + 2;
+        return 0;
+    default:
+        return -1;
+    }
+    *s = p + 1;
+    return 0;
+}
 
-        if (!strcmp(trim, "ps.1.1")) {
-            prog->type = ASM_SHADER_PS11;
-            free(buf);
-            continue;
+/* c[a0.x], c[a0.x+N] or c[N+a0.x] */
+static int parse_relative(const char **s, const char *e, asm_operand *o) {
+    const char *p = *s + 1;
+    o->index = 0;
+    if (isdigit(at(p, e))) {
+        if (parse_index(&p, e, &o->index) || at(p, e) != '+')
+            return -1;
+        ++p;
+        if (!take_ci(&p, e, "a0.x"))
+            return -1;
+    } else {
+        if (!take_ci(&p, e, "a0.x"))
+            return -1;
+        if (at(p, e) == '+') {
+            ++p;
+            if (parse_index(&p, e, &o->index))
+                return -1;
         }
-        if (!strcmp(trim, "ps.1.3")) {
-            prog->type = ASM_SHADER_PS13;
-            free(buf);
-            continue;
+    }
+    if (at(p, e) != ']')
+        return -1;
+    o->mod |= ASM_MOD_REL;
+    *s = p + 1;
+    return 0;
+}
+
+static int parse_suffix(const char **s, const char *e, int is_dst, asm_instr *inst,
+                        asm_operand *o) {
+    const char *p = *s + 1;
+    const char *w = p;
+    while (isalnum(at(p, e)))
+        ++p;
+    size_t n = (size_t)(p - w);
+    if (**s == '.') {
+        if (n == 0 || n > 4)
+            return -1;
+        int comp[4];
+        for (size_t k = 0; k < n; ++k)
+            if ((comp[k] = comp_index(w[k])) < 0)
+                return -1;
+        if (is_dst) {
+            o->swz = 0;
+            for (size_t k = 0; k < n; ++k)
+                o->swz |= (uint8_t)(1u << comp[k]);
+        } else {
+            for (size_t k = n; k < 4; ++k)
+                comp[k] = comp[n - 1];
+            o->swz = ASM_SWZ(comp[0], comp[1], comp[2], comp[3]);
         }
-        if (!strcmp(trim, "vs.1.1")) {
-            prog->type = ASM_SHADER_VS11;
-            free(buf);
-            continue;
+    } else {
+#define SUFFIX(str) (n == sizeof(str) - 1 && !memcmp(w, str, n))
+        if (SUFFIX("bias"))
+            o->mod |= ASM_MOD_BIAS;
+        else if (SUFFIX("bx2"))
+            o->mod |= ASM_MOD_BX2;
+        else if (SUFFIX("x2"))
+            o->mod |= ASM_MOD_X2;
+        else if (SUFFIX("dz") || SUFFIX("db"))
+            o->mod |= ASM_MOD_DZ;
+        else if (SUFFIX("dw") || SUFFIX("da"))
+            o->mod |= ASM_MOD_DW;
+        else if (SUFFIX("volume"))
+            inst->flags |= ASM_INSTR_VOLUME;
+        else if (SUFFIX("shadow"))
+            inst->flags |= ASM_INSTR_SHADOW;
+        else if (SUFFIX("npot"))
+            inst->flags |= ASM_INSTR_NPOT;
+        else
+            return -1;
+#undef SUFFIX
+    }
+    *s = p;
+    return 0;
+}
+
+/* number that must span the whole view [p, e) */
+static int parse_float(const char *p, const char *e, float *out) {
+    return util_parse_float(p, e, out) == e ? 0 : -1;
+}
+
+static int parse_operand(const char *t, const char *e, int is_dst, asm_instr *inst,
+                         unsigned *nimm, asm_operand *o) {
+    *o = (asm_operand){.swz = is_dst ? ASM_MASK_ALL : ASM_SWZ_IDENTITY};
+    if (at(t, e) == '1' && at(t + 1, e) == '-') {
+        o->mod |= ASM_MOD_COMP;
+        t += 2;
+    } else if (at(t, e) == '-' && !isdigit(at(t + 1, e)) && at(t + 1, e) != '.') {
+        o->mod |= ASM_MOD_NEG;
+        ++t;
+    }
+    int c = at(t, e);
+    if (!o->mod && (isdigit(c) || c == '-' || c == '+' || c == '.')) {
+        float v;
+        if (parse_float(t, e, &v) || *nimm >= ASM_MAX_IMM)
+            return -1;
+        o->file = ASM_REG_IMM;
+        o->index = (uint8_t)*nimm;
+        inst->imm[(*nimm)++] = v;
+        return 0;
+    }
+    int r = parse_reg_file(&t, e, o);
+    if (r < 0)
+        return -1;
+    if (r == 0) {
+        if (o->file == ASM_REG_CONST && at(t, e) == '[') {
+            if (parse_relative(&t, e, o))
+                return -1;
+        } else if (parse_index(&t, e, &o->index)) {
+            return -1;
         }
+    }
+    while (t < e) {
+        if ((*t != '.' && *t != '_') || parse_suffix(&t, e, is_dst, inst, o))
+            return -1;
+    }
+    return 0;
+}
 
-        if (!strncmp(trim, "def", 3)) {
-            asm_constant c = {0};
-            if (sscanf(trim, "def c%u, %f, %f, %f, %f", &c.idx, &c.value[0],
-                       &c.value[1], &c.value[2], &c.value[3]) == 5) {
-                sb_push(prog->consts, c);
-                free(buf);
-                continue;
-            }
-            if (err)
-                util_asprintf(err, "line %zu: invalid constant: %s", line - 1,
-                              trim);
-            free(buf);
-            asm_program_free(prog);
+/* "+mul_x2" -> coissue flag, ASM_OP_MUL, ASM_IMOD_X2 */
+static void parse_opcode(const char *t, const char *e, asm_instr *inst) {
+    if (at(t, e) == '+') {
+        inst->flags |= ASM_INSTR_COISSUE;
+        ++t;
+    }
+    const char *us = memchr(t, '_', (size_t)(e - t));
+    inst->op = asm_opcode_lookup(t, (size_t)((us ? us : e) - t));
+    while (us && inst->op != ASM_OP_UNKNOWN) {
+        const char *w = us + 1;
+        us = memchr(w, '_', (size_t)(e - w));
+        size_t n = (size_t)((us ? us : e) - w);
+        static const char *const k_imods[] = {"x2", "x4", "x8", "d2", "d4", "d8", "sat"};
+        unsigned k = 0;
+        while (k < sizeof(k_imods) / sizeof(k_imods[0]) &&
+               (strlen(k_imods[k]) != n || memcmp(w, k_imods[k], n)))
+            ++k;
+        if (k == sizeof(k_imods) / sizeof(k_imods[0]))
+            inst->op = ASM_OP_UNKNOWN;
+        else
+            inst->imod |= (uint8_t)(1u << k);
+    }
+}
+
+/* "def cN, x, y, z, w"; text after the fourth value is ignored */
+static int parse_def(const char *p, const char *e, asm_constant *c) {
+    p = skip_ws(p + 3, e);
+    if (at(p, e) != 'c')
+        return -1;
+    uint32_t idx;
+    if (!(p = util_parse_u32(p + 1, e, &idx)))
+        return -1;
+    c->idx = idx;
+    for (int k = 0; k < 4; ++k) {
+        p = skip_ws(p, e);
+        if (at(p, e) != ',')
             return -1;
+        p = skip_ws(p + 1, e);
+        if (!(p = util_parse_float(p, e, &c->value[k])))
+            return -1;
+    }
+    return 0;
+}
+
+static int parse_fail(asm_program *prog, char **err, size_t line, const char *what,
+                      const char *text, size_t n) {
+    if (err)
+        util_asprintf(err, "line %zu: %s: %.*s", line, what, (int)n, text);
+    asm_program_free(prog);
+    return -1;
+}
+
+/* upper bound on instructions and constants: the number of non-empty lines */
+static size_t count_lines(const char *src, const char *end) {
+    size_t n = 0;
+    for (const char *cur = src; cur < end;) {
+        const char *nl = memchr(cur, '\n', (size_t)(end - cur));
+        if (!nl)
+            nl = end;
+        n += nl > cur;
+        cur = nl + 1;
+    }
+    return n;
+}
+
+static void *prog_alloc(util_arena *a, size_t n) {
+    return a ? util_arena_alloc(a, n) : malloc(n);
+}
+
+int asm_parse(const char *src, asm_program *prog, char **err) {
+    return asm_parse_arena(src, prog, NULL, err);
+}
+
+/* grow code or consts to hold one more entry; batch parses are sized up front */
+static int prog_reserve(asm_program *prog, void **items, size_t *cap, size_t count,
+                        size_t size) {
+    if (count < *cap)
+        return 0;
+    size_t n = *cap ? *cap * 2 : 16;
+    void *p = prog->arena ? util_arena_grow(prog->arena, *items, *cap * size, n * size)
+                          : realloc(*items, n * size);
+    if (!p)
+        return -1;
+    *items = p;
+    *cap = n;
+    return 0;
+}
+
+/* one line: code is [ls, code_end), hints come from its comment */
+static int parse_statement(asm_program *prog, size_t line, const char *ls, const char *code_end,
+                           unsigned hints, char **err) {
+    const char *t = skip_ws(ls, code_end);
+    const char *te = trim_end(t, code_end);
+    if (t == te)
+        return 0; /* comment or blank line */
+
+    if (view_eq(t, te, "ps.1.1")) {
+        prog->type = ASM_SHADER_PS11;
+        return 0;
+    }
+    if (view_eq(t, te, "ps.1.3")) {
+        prog->type = ASM_SHADER_PS13;
+        return 0;
+    }
+    if (view_eq(t, te, "vs.1.1")) {
+        prog->type = ASM_SHADER_VS11;
+        return 0;
+    }
+
+    if (te - t >= 3 && !memcmp(t, "def", 3)) {
+        asm_constant c = {0};
+        if (parse_def(t, te, &c))
+            return parse_fail(prog, err, line, "invalid constant", t, (size_t)(te - t));
+        if (prog_reserve(prog, (void **)&prog->consts, &prog->const_capacity, prog->const_count,
+                         sizeof(c)))
+            return parse_fail(prog, err, line, "out of memory", "", 0);
+        prog->consts[prog->const_count++] = c;
+        return 0;
+    }
+
+    asm_instr inst = {0};
+    const char *op_end = t;
+    while (op_end < te && !is_ws((unsigned char)*op_end))
+        ++op_end;
+    parse_opcode(t, op_end, &inst);
+    inst.flags |= (uint8_t)(hints | scan_hints(op_end, te));
+
+    const char *p = skip_ws(op_end, te);
+    unsigned nops = 0, nimm = 0;
+    while (p < te) {
+        const char *comma = util_find2(p, te, ',', ',');
+        const char *a = skip_ws(p, comma);
+        const char *b = trim_end(a, comma);
+        const char *ws = a;
+        while (ws < b && !is_ws((unsigned char)*ws))
+            ++ws;
+        if (ws < b || (a < b && nops > ASM_MAX_SRC))
+            return parse_fail(prog, err, line, "invalid instruction", t, (size_t)(te - t));
+        /* stray commas leave empty operands, which are skipped */
+        if (a < b) {
+            asm_operand *o = nops ? &inst.src[nops - 1] : &inst.dst;
+            if (parse_operand(a, b, nops == 0, &inst, &nimm, o))
+                return parse_fail(prog, err, line, "invalid operand", a, (size_t)(b - a));
+            ++nops;
         }
+        if (comma == te)
+            break;
+        p = comma + 1;
+    }
+    inst.nsrc = (uint8_t)(nops ? nops - 1 : 0);
+    if (prog_reserve(prog, (void **)&prog->code, &prog->capacity, prog->count, sizeof(inst)))
+        return parse_fail(prog, err, line, "out of memory", "", 0);
+    prog->code[prog->count++] = inst;
+    return 0;
+}
 
-        asm_instr inst = {0};
-        strncpy(inst.comment, trim_ws(comment), sizeof(inst.comment) - 1);
-        char operands[128] = "";
-        if (sscanf(trim, "%15s%127[^\n]", inst.opcode, operands) < 1) {
+int asm_parse_arena(const char *src, asm_program *prog, util_arena *arena, char **err) {
+    memset(prog, 0, sizeof(*prog));
+    prog->arena = arena;
+
+    const char *end = src + strlen(src);
+    size_t lines = count_lines(src, end);
+    if (lines) {
+        prog->code = prog_alloc(arena, lines * sizeof(*prog->code));
+        prog->consts = prog_alloc(arena, lines * sizeof(*prog->consts));
+        if (!prog->code || !prog->consts) {
             if (err)
-                util_asprintf(err, "line %zu: invalid instruction: %s",
-                              line - 1, trim);
-            free(buf);
+                *err = util_strdup("out of memory");
             asm_program_free(prog);
             return -1;
         }
+    }
+    prog->capacity = prog->const_capacity = lines;
 
-        char *p = trim_ws(operands);
-        if (*p) {
-            char *save = NULL;
-            char *tok = strtok_r(p, ",", &save);
-            if (!tok) {
-                if (err)
-                    util_asprintf(err, "line %zu: invalid instruction: %s",
-                                  line - 1, trim);
-                free(buf);
-                asm_program_free(prog);
-                return -1;
-            }
-            tok = trim_ws(tok);
-            if (strchr(tok, ' ') || strchr(tok, '\t')) {
-                if (err)
-                    util_asprintf(err, "line %zu: invalid instruction: %s",
-                                  line - 1, trim);
-                free(buf);
-                asm_program_free(prog);
-                return -1;
-            }
-            strncpy(inst.dst, tok, sizeof(inst.dst) - 1);
-
-            tok = strtok_r(NULL, ",", &save);
-            if (tok) {
-                tok = trim_ws(tok);
-                if (strchr(tok, ' ') || strchr(tok, '\t')) {
-                    if (err)
-                        util_asprintf(err,
-                                      "line %zu: invalid instruction: %s",
-                                      line - 1, trim);
-                    free(buf);
-                    asm_program_free(prog);
-                    return -1;
-                }
-                strncpy(inst.src0, tok, sizeof(inst.src0) - 1);
-
-                tok = strtok_r(NULL, ",", &save);
-                if (tok) {
-                    tok = trim_ws(tok);
-                    if (strchr(tok, ' ') || strchr(tok, '\t')) {
-                        if (err)
-                            util_asprintf(err,
-                                          "line %zu: invalid instruction: %s",
-                                          line - 1, trim);
-                        free(buf);
-                        asm_program_free(prog);
-                        return -1;
-                    }
-                    strncpy(inst.src1, tok, sizeof(inst.src1) - 1);
-
-                    tok = strtok_r(NULL, ",", &save);
-                    if (tok) {
-                        tok = trim_ws(tok);
-                        if (strchr(tok, ' ') || strchr(tok, '\t')) {
-                            if (err)
-                                util_asprintf(err,
-                                              "line %zu: invalid instruction: %s",
-                                              line - 1, trim);
-                            free(buf);
-                            asm_program_free(prog);
-                            return -1;
-                        }
-                        strncpy(inst.src2, tok, sizeof(inst.src2) - 1);
-
-                        if (strtok_r(NULL, ",", &save)) {
-                            if (err)
-                                util_asprintf(
-                                    err,
-                                    "line %zu: invalid instruction: %s",
-                                    line - 1, trim);
-                            free(buf);
-                            asm_program_free(prog);
-                            return -1;
-                        }
-                    }
-                }
-            }
+    size_t line = 1;
+    const char *cur = src;
+    while (cur < end) {
+        while (cur < end && (*cur == '\n' || *cur == '\r')) {
+            ++cur;
+            ++line;
+        }
+        if (cur == end)
+            break;
+        /* code runs to the first ';' or newline; a comment only carries hints */
+        const char *ls = cur;
+        const char *code_end = util_find2(cur, end, '\n', ';');
+        unsigned hints = 0;
+        cur = code_end;
+        if (cur < end && *cur == ';') {
+            const char *nl = memchr(cur, '\n', (size_t)(end - cur));
+            cur = nl ? nl : end;
+            hints = scan_hints(code_end + 1, cur);
+        }
+        if (parse_statement(prog, line, ls, code_end, hints, err))
+            return -1;
+        if (cur < end) {
+            ++cur;
+            ++line;
         }
-
-        sb_push(prog->code, inst);
-        free(buf);
-        continue;
     }
-
-    prog->count = sb_count(prog->code);
-    prog->capacity = sb_capacity(prog->code);
-    prog->const_count = sb_count(prog->consts);
-    prog->const_capacity = sb_capacity(prog->consts);
     return 0;
 }
+
+void asm_stream_begin(asm_stream *s, asm_program *prog, util_arena *arena) {
+    memset(prog, 0, sizeof(*prog));
+    prog->arena = arena;
+    s->prog = prog;
+    s->line = 0;
+    s->failed = 0;
+}
+
+int asm_stream_line(asm_stream *s, const char *text, size_t len, char **err) {
+    if (s->failed)
+        return -1;
+    ++s->line;
+    const char *end = text + len;
+    const char *code_end = util_find2(text, end, ';', ';');
+    unsigned hints = code_end < end ? scan_hints(code_end + 1, end) : 0;
+    if (parse_statement(s->prog, s->line, text, code_end, hints, err))
+        s->failed = 1;
+    return -s->failed;
+}
+
 void asm_program_free(asm_program *p) {
-    sb_free(p->code);
-    sb_free(p->consts);
+    if (!p->arena) {
+        free(p->code);
+        free(p->consts);
+    }
     p->code = NULL;
     p->consts = NULL;
+    p->arena = NULL;
     p->count = p->capacity = 0;
     p->const_count = p->const_capacity = 0;
 }
+
+size_t asm_operand_format(const asm_instr *i, const asm_operand *o, char *buf, size_t n) {
+    static const char *const k_prefix[] = {
+        [ASM_REG_TEMP] = "r",      [ASM_REG_INPUT] = "v",     [ASM_REG_CONST] = "c",
+        [ASM_REG_TEXTURE] = "t",   [ASM_REG_ADDR] = "a",      [ASM_REG_ATTROUT] = "oD",
+        [ASM_REG_TEXCRDOUT] = "oT",
+    };
+    static const char *const k_rastout[] = {"oPos", "oFog", "oPts"};
+    char tmp[64];
+    int len = 0;
+    if (o->file == ASM_REG_NONE) {
+        tmp[0] = '\0';
+    } else if (o->file == ASM_REG_IMM) {
+        len = snprintf(tmp, sizeof(tmp), "%g", i->imm[o->index % ASM_MAX_IMM]);
+    } else {
+        const char *pre = o->mod & ASM_MOD_COMP ? "1-" : o->mod & ASM_MOD_NEG ? "-" : "";
+        if (o->file == ASM_REG_RASTOUT)
+            len = snprintf(tmp, sizeof(tmp), "%s%s", pre, k_rastout[o->index % 3]);
+        else if (o->mod & ASM_MOD_REL)
+            len = snprintf(tmp, sizeof(tmp), "%sc[a0.x+%u]", pre, o->index);
+        else
+            len = snprintf(tmp, sizeof(tmp), "%s%s%u", pre,
+                           o->file < sizeof(k_prefix) / sizeof(k_prefix[0]) && k_prefix[o->file]
+                               ? k_prefix[o->file]
+                               : "?",
+                           o->index);
+        static const struct {
+            unsigned bit;
+            const char *text;
+        } k_mods[] = {{ASM_MOD_BIAS, "_bias"}, {ASM_MOD_BX2, "_bx2"}, {ASM_MOD_X2, "_x2"},
+                      {ASM_MOD_DZ, "_dz"},     {ASM_MOD_DW, "_dw"}};
+        for (size_t k = 0; k < sizeof(k_mods) / sizeof(k_mods[0]); ++k)
+            if (o->mod & k_mods[k].bit)
+                len += snprintf(tmp + len, sizeof(tmp) - (size_t)len, "%s", k_mods[k].text);
+        int is_dst = o == &i->dst;
+        if (is_dst ? o->swz != ASM_MASK_ALL : o->swz != ASM_SWZ_IDENTITY) {
+            tmp[len++] = '.';
+            for (unsigned k = 0; k < 4; ++k) {
+                if (is_dst && (o->swz & (1u << k)))
+                    tmp[len++] = "xyzw"[k];
+                else if (!is_dst)
+                    tmp[len++] = "xyzw"[(o->swz >> (2 * k)) & 3];
+            }
+            tmp[len] = '\0';
+        }
+    }
+    if (n) {
+        size_t c = (size_t)len < n - 1 ? (size_t)len : n - 1;
+        memcpy(buf, tmp, c);
+        buf[c] = '\0';
+    }
+    return (size_t)len;
+}
@@ -0,0 +1,353 @@
+/*
+ * Locale-independent decimal parsing for the assembler's numeric fields.
+ *
+ * util_parse_float() follows the Eisel-Lemire scheme specialised to binary32:
+ * up to 19 significant digits are gathered into a 64-bit integer w, the
+ * value w * 10^q is approximated by a 128-bit product with a truncated power
+ * of five, and the float is taken directly from the high bits. Inputs whose
+ * rounding cannot be decided from the approximation (and inputs with more
+ * than 19 significant digits whose truncation matters) fall back to strtof
+ * evaluated in the "C" locale, so every result is correctly rounded.
+ */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* strtof_l */
+#endif
+#include "utils.h"
+#include <float.h>
+#include <limits.h>
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#if defined(__APPLE__) || defined(__FreeBSD__)
+#include <xlocale.h>
+#endif
+
+#define FLOAT_MANTISSA_BITS 23
+#define FLOAT_MIN_EXPONENT (-127)
+#define FLOAT_INFINITE_POWER 0xff
+#define POW5_MIN_Q (-65) /* below: rounds to zero even with 19 nines */
+#define POW5_MAX_Q 38    /* above: overflows even for w == 1 */
+
+/*
+ * 5^q normalised so bit 127 is set: truncated for q >= 0, rounded up for
+ * q < 0. Generated with
+ *   q >= 0:   c = 5**q
+ *   q >= -27: c = 2**(z+127) // 5**-q + 1      (2**z >= 5**-q)
+ *   q < -27:  c = 2**(2*z+128) // 5**-q + 1
+ * then scaled by powers of two into [2**127, 2**128).
+ */
+static const uint64_t k_pow5[POW5_MAX_Q - POW5_MIN_Q + 1][2] = {
+    {0x86ccbb52ea94baeaull, 0x98e947129fc2b4e9ull}, /* 5^-65 */
+    {0xa87fea27a539e9a5ull, 0x3f2398d747b36224ull}, /* 5^-64 */
+    {0xd29fe4b18e88640eull, 0x8eec7f0d19a03aadull}, /* 5^-63 */
+    {0x83a3eeeef9153e89ull, 0x1953cf68300424acull}, /* 5^-62 */
+    {0xa48ceaaab75a8e2bull, 0x5fa8c3423c052dd7ull}, /* 5^-61 */
+    {0xcdb02555653131b6ull, 0x3792f412cb06794dull}, /* 5^-60 */
+    {0x808e17555f3ebf11ull, 0xe2bbd88bbee40bd0ull}, /* 5^-59 */
+    {0xa0b19d2ab70e6ed6ull, 0x5b6aceaeae9d0ec4ull}, /* 5^-58 */
+    {0xc8de047564d20a8bull, 0xf245825a5a445275ull}, /* 5^-57 */
+    {0xfb158592be068d2eull, 0xeed6e2f0f0d56712ull}, /* 5^-56 */
+    {0x9ced737bb6c4183dull, 0x55464dd69685606bull}, /* 5^-55 */
+    {0xc428d05aa4751e4cull, 0xaa97e14c3c26b886ull}, /* 5^-54 */
+    {0xf53304714d9265dfull, 0xd53dd99f4b3066a8ull}, /* 5^-53 */
+    {0x993fe2c6d07b7fabull, 0xe546a8038efe4029ull}, /* 5^-52 */
+    {0xbf8fdb78849a5f96ull, 0xde98520472bdd033ull}, /* 5^-51 */
+    {0xef73d256a5c0f77cull, 0x963e66858f6d4440ull}, /* 5^-50 */
+    {0x95a8637627989aadull, 0xdde7001379a44aa8ull}, /* 5^-49 */
+    {0xbb127c53b17ec159ull, 0x5560c018580d5d52ull}, /* 5^-48 */
+    {0xe9d71b689dde71afull, 0xaab8f01e6e10b4a6ull}, /* 5^-47 */
+    {0x9226712162ab070dull, 0xcab3961304ca70e8ull}, /* 5^-46 */
+    {0xb6b00d69bb55c8d1ull, 0x3d607b97c5fd0d22ull}, /* 5^-45 */
+    {0xe45c10c42a2b3b05ull, 0x8cb89a7db77c506aull}, /* 5^-44 */
+    {0x8eb98a7a9a5b04e3ull, 0x77f3608e92adb242ull}, /* 5^-43 */
+    {0xb267ed1940f1c61cull, 0x55f038b237591ed3ull}, /* 5^-42 */
+    {0xdf01e85f912e37a3ull, 0x6b6c46dec52f6688ull}, /* 5^-41 */
+    {0x8b61313bbabce2c6ull, 0x2323ac4b3b3da015ull}, /* 5^-40 */
+    {0xae397d8aa96c1b77ull, 0xabec975e0a0d081aull}, /* 5^-39 */
+    {0xd9c7dced53c72255ull, 0x96e7bd358c904a21ull}, /* 5^-38 */
+    {0x881cea14545c7575ull, 0x7e50d64177da2e54ull}, /* 5^-37 */
+    {0xaa242499697392d2ull, 0xdde50bd1d5d0b9e9ull}, /* 5^-36 */
+    {0xd4ad2dbfc3d07787ull, 0x955e4ec64b44e864ull}, /* 5^-35 */
+    {0x84ec3c97da624ab4ull, 0xbd5af13bef0b113eull}, /* 5^-34 */
+    {0xa6274bbdd0fadd61ull, 0xecb1ad8aeacdd58eull}, /* 5^-33 */
+    {0xcfb11ead453994baull, 0x67de18eda5814af2ull}, /* 5^-32 */
+    {0x81ceb32c4b43fcf4ull, 0x80eacf948770ced7ull}, /* 5^-31 */
+    {0xa2425ff75e14fc31ull, 0xa1258379a94d028dull}, /* 5^-30 */
+    {0xcad2f7f5359a3b3eull, 0x096ee45813a04330ull}, /* 5^-29 */
+    {0xfd87b5f28300ca0dull, 0x8bca9d6e188853fcull}, /* 5^-28 */
+    {0x9e74d1b791e07e48ull, 0x775ea264cf55347eull}, /* 5^-27 */
+    {0xc612062576589ddaull, 0x95364afe032a819eull}, /* 5^-26 */
+    {0xf79687aed3eec551ull, 0x3a83ddbd83f52205ull}, /* 5^-25 */
+    {0x9abe14cd44753b52ull, 0xc4926a9672793543ull}, /* 5^-24 */
+    {0xc16d9a0095928a27ull, 0x75b7053c0f178294ull}, /* 5^-23 */
+    {0xf1c90080baf72cb1ull, 0x5324c68b12dd6339ull}, /* 5^-22 */
+    {0x971da05074da7beeull, 0xd3f6fc16ebca5e04ull}, /* 5^-21 */
+    {0xbce5086492111aeaull, 0x88f4bb1ca6bcf585ull}, /* 5^-20 */
+    {0xec1e4a7db69561a5ull, 0x2b31e9e3d06c32e6ull}, /* 5^-19 */
+    {0x9392ee8e921d5d07ull, 0x3aff322e62439fd0ull}, /* 5^-18 */
+    {0xb877aa3236a4b449ull, 0x09befeb9fad487c3ull}, /* 5^-17 */
+    {0xe69594bec44de15bull, 0x4c2ebe687989a9b4ull}, /* 5^-16 */
+    {0x901d7cf73ab0acd9ull, 0x0f9d37014bf60a11ull}, /* 5^-15 */
+    {0xb424dc35095cd80full, 0x538484c19ef38c95ull}, /* 5^-14 */
+    {0xe12e13424bb40e13ull, 0x2865a5f206b06fbaull}, /* 5^-13 */
+    {0x8cbccc096f5088cbull, 0xf93f87b7442e45d4ull}, /* 5^-12 */
+    {0xafebff0bcb24aafeull, 0xf78f69a51539d749ull}, /* 5^-11 */
+    {0xdbe6fecebdedd5beull, 0xb573440e5a884d1cull}, /* 5^-10 */
+    {0x89705f4136b4a597ull, 0x31680a88f8953031ull}, /* 5^-9 */
+    {0xabcc77118461cefcull, 0xfdc20d2b36ba7c3eull}, /* 5^-8 */
+    {0xd6bf94d5e57a42bcull, 0x3d32907604691b4dull}, /* 5^-7 */
+    {0x8637bd05af6c69b5ull, 0xa63f9a49c2c1b110ull}, /* 5^-6 */
+    {0xa7c5ac471b478423ull, 0x0fcf80dc33721d54ull}, /* 5^-5 */
+    {0xd1b71758e219652bull, 0xd3c36113404ea4a9ull}, /* 5^-4 */
+    {0x83126e978d4fdf3bull, 0x645a1cac083126eaull}, /* 5^-3 */
+    {0xa3d70a3d70a3d70aull, 0x3d70a3d70a3d70a4ull}, /* 5^-2 */
+    {0xccccccccccccccccull, 0xcccccccccccccccdull}, /* 5^-1 */
+    {0x8000000000000000ull, 0x0000000000000000ull}, /* 5^0 */
+    {0xa000000000000000ull, 0x0000000000000000ull}, /* 5^1 */
+    {0xc800000000000000ull, 0x0000000000000000ull}, /* 5^2 */
+    {0xfa00000000000000ull, 0x0000000000000000ull}, /* 5^3 */
+    {0x9c40000000000000ull, 0x0000000000000000ull}, /* 5^4 */
+    {0xc350000000000000ull, 0x0000000000000000ull}, /* 5^5 */
+    {0xf424000000000000ull, 0x0000000000000000ull}, /* 5^6 */
+    {0x9896800000000000ull, 0x0000000000000000ull}, /* 5^7 */
+    {0xbebc200000000000ull, 0x0000000000000000ull}, /* 5^8 */
+    {0xee6b280000000000ull, 0x0000000000000000ull}, /* 5^9 */
+    {0x9502f90000000000ull, 0x0000000000000000ull}, /* 5^10 */
+    {0xba43b74000000000ull, 0x0000000000000000ull}, /* 5^11 */
+    {0xe8d4a51000000000ull, 0x0000000000000000ull}, /* 5^12 */
+    {0x9184e72a00000000ull, 0x0000000000000000ull}, /* 5^13 */
+    {0xb5e620f480000000ull, 0x0000000000000000ull}, /* 5^14 */
+    {0xe35fa931a0000000ull, 0x0000000000000000ull}, /* 5^15 */
+    {0x8e1bc9bf04000000ull, 0x0000000000000000ull}, /* 5^16 */
+    {0xb1a2bc2ec5000000ull, 0x0000000000000000ull}, /* 5^17 */
+    {0xde0b6b3a76400000ull, 0x0000000000000000ull}, /* 5^18 */
+    {0x8ac7230489e80000ull, 0x0000000000000000ull}, /* 5^19 */
+    {0xad78ebc5ac620000ull, 0x0000000000000000ull}, /* 5^20 */
+    {0xd8d726b7177a8000ull, 0x0000000000000000ull}, /* 5^21 */
+    {0x878678326eac9000ull, 0x0000000000000000ull}, /* 5^22 */
+    {0xa968163f0a57b400ull, 0x0000000000000000ull}, /* 5^23 */
+    {0xd3c21bcecceda100ull, 0x0000000000000000ull}, /* 5^24 */
+    {0x84595161401484a0ull, 0x0000000000000000ull}, /* 5^25 */
+    {0xa56fa5b99019a5c8ull, 0x0000000000000000ull}, /* 5^26 */
+    {0xcecb8f27f4200f3aull, 0x0000000000000000ull}, /* 5^27 */
+    {0x813f3978f8940984ull, 0x4000000000000000ull}, /* 5^28 */
+    {0xa18f07d736b90be5ull, 0x5000000000000000ull}, /* 5^29 */
+    {0xc9f2c9cd04674edeull, 0xa400000000000000ull}, /* 5^30 */
+    {0xfc6f7c4045812296ull, 0x4d00000000000000ull}, /* 5^31 */
+    {0x9dc5ada82b70b59dull, 0xf020000000000000ull}, /* 5^32 */
+    {0xc5371912364ce305ull, 0x6c28000000000000ull}, /* 5^33 */
+    {0xf684df56c3e01bc6ull, 0xc732000000000000ull}, /* 5^34 */
+    {0x9a130b963a6c115cull, 0x3c7f400000000000ull}, /* 5^35 */
+    {0xc097ce7bc90715b3ull, 0x4b9f100000000000ull}, /* 5^36 */
+    {0xf0bdc21abb48db20ull, 0x1e86d40000000000ull}, /* 5^37 */
+    {0x96769950b50d88f4ull, 0x1314448000000000ull}, /* 5^38 */
+};
+
+typedef struct u128 {
+    uint64_t lo, hi;
+} u128;
+
+static u128 mul64(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 r = (unsigned __int128)a * b;
+    return (u128){(uint64_t)r, (uint64_t)(r >> 64)};
+#else
+    uint64_t a0 = (uint32_t)a, a1 = a >> 32, b0 = (uint32_t)b, b1 = b >> 32;
+    uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    uint64_t mid = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+    return (u128){(mid << 32) | (uint32_t)p00, p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32)};
+#endif
+}
+
+static unsigned clz64(uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_clzll(v);
+#else
+    unsigned n = 0;
+    while (!(v & (1ull << 63))) {
+        v <<= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+static float make_float(int negative, uint32_t bits) {
+    float f;
+    bits |= (uint32_t)negative << 31;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+/*
+ * w * 10^q as binary32 bits; -1 when the approximation cannot decide the
+ * rounding and the caller must take the slow path. w is non-zero.
+ */
+static int64_t eisel_lemire(uint64_t w, int q) {
+    if (q < POW5_MIN_Q)
+        return 0;
+    if (q > POW5_MAX_Q)
+        return (int64_t)FLOAT_INFINITE_POWER << FLOAT_MANTISSA_BITS;
+    unsigned lz = clz64(w);
+    w <<= lz;
+    const uint64_t *pow5 = k_pow5[q - POW5_MIN_Q];
+    /* 64 bits of the product are enough unless the bits below the float's
+     * precision are all ones; then fold in the next word of 5^q */
+    const uint64_t precision_mask = UINT64_MAX >> (FLOAT_MANTISSA_BITS + 3);
+    u128 p = mul64(w, pow5[0]);
+    if ((p.hi & precision_mask) == precision_mask) {
+        u128 p2 = mul64(w, pow5[1]);
+        p.lo += p2.hi;
+        if (p2.hi > p.lo)
+            p.hi++;
+        if (p.lo == UINT64_MAX && (q < -27 || q > 55))
+            return -1;
+    }
+    unsigned upper = (unsigned)(p.hi >> 63);
+    unsigned shift = upper + 64 - FLOAT_MANTISSA_BITS - 3;
+    uint64_t mantissa = p.hi >> shift;
+    /* floor(log2(10^q)) + 63, see the Eisel-Lemire paper */
+    int power2 = (int)((((int64_t)152170 + 65536) * q) >> 16) + 63 + (int)upper - (int)lz -
+                 FLOAT_MIN_EXPONENT;
+    if (power2 <= 0) { /* subnormal */
+        if (-power2 + 1 >= 64)
+            return 0;
+        mantissa >>= -power2 + 1;
+        mantissa += mantissa & 1;
+        mantissa >>= 1;
+        power2 = mantissa < (1ull << FLOAT_MANTISSA_BITS) ? 0 : 1;
+        return ((int64_t)power2 << FLOAT_MANTISSA_BITS) |
+               (int64_t)(mantissa & ((1ull << FLOAT_MANTISSA_BITS) - 1));
+    }
+    /* exactly halfway between two floats: round to even */
+    if (p.lo <= 1 && q >= -17 && q <= 10 && (mantissa & 3) == 1 && (mantissa << shift) == p.hi)
+        mantissa &= ~1ull;
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= (2ull << FLOAT_MANTISSA_BITS)) {
+        mantissa = 1ull << FLOAT_MANTISSA_BITS;
+        power2++;
+    }
+    if (power2 >= FLOAT_INFINITE_POWER)
+        return (int64_t)FLOAT_INFINITE_POWER << FLOAT_MANTISSA_BITS;
+    return ((int64_t)power2 << FLOAT_MANTISSA_BITS) |
+           (int64_t)(mantissa & ((1ull << FLOAT_MANTISSA_BITS) - 1));
+}
+
+/* slow path: strtof pinned to the "C" locale */
+#if defined(_WIN32)
+static _locale_t g_c_locale;
+static void c_locale_init(void) { g_c_locale = _create_locale(LC_NUMERIC, "C"); }
+#elif defined(__GLIBC__) || defined(__APPLE__) || defined(__FreeBSD__)
+static locale_t g_c_locale;
+static void c_locale_init(void) { g_c_locale = newlocale(LC_NUMERIC_MASK, "C", (locale_t)0); }
+#endif
+
+static float slow_parse(const char *p, size_t n) {
+    char small[64];
+    char *buf = n < sizeof(small) ? small : malloc(n + 1);
+    if (!buf)
+        return 0.0f;
+    memcpy(buf, p, n);
+    buf[n] = '\0';
+    float f;
+#if defined(_WIN32)
+    static once_flag once = ONCE_FLAG_INIT;
+    call_once(&once, c_locale_init);
+    f = _strtof_l(buf, NULL, g_c_locale);
+#elif defined(__GLIBC__) || defined(__APPLE__) || defined(__FreeBSD__)
+    static once_flag once = ONCE_FLAG_INIT;
+    call_once(&once, c_locale_init);
+    f = g_c_locale ? strtof_l(buf, NULL, g_c_locale) : strtof(buf, NULL);
+#else
+    f = strtof(buf, NULL); /* assumes the "C" numeric locale */
+#endif
+    if (buf != small)
+        free(buf);
+    return f;
+}
+
+static int is_digit(int c) { return c >= '0' && c <= '9'; }
+
+/* exact powers of ten for the Clinger fast path */
+static const float k_pow10f[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f,  1e5f,
+                                 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+const char *util_parse_float(const char *p, const char *e, float *out) {
+    const char *start = p;
+    int negative = 0;
+    if (p < e && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    /* mantissa digits, keeping the first 19 significant ones in w */
+    uint64_t w = 0;
+    int digits = 0, exp10 = 0, any = 0, truncated = 0;
+    for (; p < e && is_digit(*p); ++p, any = 1) {
+        if (digits < 19) {
+            w = w * 10 + (uint64_t)(*p - '0');
+            digits += w != 0;
+        } else {
+            exp10++;
+            truncated |= *p != '0';
+        }
+    }
+    if (p < e && *p == '.') {
+        for (++p; p < e && is_digit(*p); ++p, any = 1) {
+            if (digits < 19) {
+                w = w * 10 + (uint64_t)(*p - '0');
+                digits += w != 0;
+                exp10--;
+            } else {
+                truncated |= *p != '0';
+            }
+        }
+    }
+    if (!any)
+        return NULL;
+    /* the exponent is only consumed when it has digits, as with strtof */
+    if (p < e && (*p == 'e' || *p == 'E')) {
+        const char *x = p + 1;
+        int eneg = 0;
+        if (x < e && (*x == '-' || *x == '+'))
+            eneg = *x++ == '-';
+        if (x < e && is_digit(*x)) {
+            int ev = 0;
+            for (; x < e && is_digit(*x); ++x)
+                if (ev < 100000)
+                    ev = ev * 10 + (*x - '0');
+            exp10 += eneg ? -ev : ev;
+            p = x;
+        }
+    }
+
+    if (w == 0) {
+        *out = make_float(negative, 0);
+        return p;
+    }
+    if (!truncated && w <= (1u << 24) && exp10 >= -10 && exp10 <= 10) {
+        float f = (float)w;
+        f = exp10 < 0 ? f / k_pow10f[-exp10] : f * k_pow10f[exp10];
+        *out = negative ? -f : f;
+        return p;
+    }
+    int64_t bits = eisel_lemire(w, exp10);
+    /* dropped digits: w and w + 1 bracket the value and must agree */
+    if (bits >= 0 && truncated && eisel_lemire(w + 1, exp10) != bits)
+        bits = -1;
+    *out = bits >= 0 ? make_float(negative, (uint32_t)bits) : slow_parse(start, (size_t)(p - start));
+    return p;
+}
+
+const char *util_parse_u32(const char *p, const char *e, uint32_t *out) {
+    if (p >= e || !is_digit(*p))
+        return NULL;
+    uint64_t v = 0;
+    for (; p < e && is_digit(*p); ++p) {
+        v = v * 10 + (uint64_t)(*p - '0');
+        if (v > UINT32_MAX)
+            return NULL;
+    }
+    *out = (uint32_t)v;
+    return p;
+}
@@ -0,0 +1,343 @@
+#include "preprocess.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <threads.h>
+#include <time.h>
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Shared cache behind #include resolution.
+ *
+ * File contents are keyed by path and revalidated with one stat() per use:
+ * an entry is current while the file's mtime and size match the values
+ * recorded when it was mapped. Entries whose mtime was within a second of
+ * the load are "racy" (a rewrite in the same second would not change the
+ * stat) and are always reloaded.
+ *
+ * Each searched directory gets an index of the hashes of its entry names,
+ * valid while the directory's mtime is unchanged. A name missing from a
+ * current index is a cached miss and costs no open(); racy directories are
+ * not indexed. Windows has no index and always probes.
+ *
+ * One mutex guards both tables. Files are loaded outside of it and
+ * reference counted, so a replaced entry stays readable until its last
+ * user closes it.
+ */
+
+#define INC_BUCKETS 256
+
+typedef struct inc_file {
+    pp_file f; /* first: pp_include_close() maps back to the entry */
+    struct inc_file *next;
+    uint64_t path_hash;
+    int64_t mtime;
+    uint64_t size;
+    int racy, mapped, linked;
+    unsigned refs;
+} inc_file;
+
+typedef struct inc_dir {
+    struct inc_dir *next;
+    char *path;
+    uint64_t path_hash;
+    int64_t mtime;   /* directory mtime the index was built from */
+    uint64_t *names; /* sorted hashes of the entry names */
+    size_t nnames;
+} inc_dir;
+
+struct pp_include_cache {
+    mtx_t lock;
+    inc_file *files[INC_BUCKETS];
+    inc_dir *dirs[INC_BUCKETS];
+    pp_include_stats stats;
+};
+
+static int is_racy(time_t mtime) { return mtime >= time(NULL) - 1; }
+
+pp_include_cache *pp_include_cache_create(void) {
+    pp_include_cache *c = calloc(1, sizeof(*c));
+    if (c && mtx_init(&c->lock, mtx_plain) != thrd_success) {
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+static void file_free(inc_file *e) {
+#ifndef _WIN32
+    if (e->mapped)
+        munmap((void *)e->f.data, e->f.len);
+#else
+    if (e->f.len)
+        free((void *)e->f.data);
+#endif
+    free((void *)e->f.path);
+    free(e);
+}
+
+static void dir_free(inc_dir *d) {
+    free(d->names);
+    free(d->path);
+    free(d);
+}
+
+void pp_include_cache_destroy(pp_include_cache *c) {
+    if (!c)
+        return;
+    for (size_t b = 0; b < INC_BUCKETS; ++b) {
+        for (inc_file *e = c->files[b], *n; e; e = n) {
+            n = e->next;
+            file_free(e);
+        }
+        for (inc_dir *d = c->dirs[b], *n; d; d = n) {
+            n = d->next;
+            dir_free(d);
+        }
+    }
+    mtx_destroy(&c->lock);
+    free(c);
+}
+
+static pp_include_cache *g_default;
+static once_flag g_default_once = ONCE_FLAG_INIT;
+static void default_init(void) { g_default = pp_include_cache_create(); }
+
+pp_include_cache *pp_include_cache_default(void) {
+    call_once(&g_default_once, default_init);
+    return g_default;
+}
+
+void pp_include_cache_get_stats(pp_include_cache *c, pp_include_stats *out) {
+    mtx_lock(&c->lock);
+    *out = c->stats;
+    mtx_unlock(&c->lock);
+}
+
+static int by_hash(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* lock held: 1 if the directory's index proves name absent */
+static int dir_lacks(pp_include_cache *c, const char *dir, size_t dir_len, const char *name,
+                     size_t n) {
+#ifndef _WIN32
+    struct stat st;
+    char path[1024];
+    if (dir_len >= sizeof(path))
+        return 0;
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '\0';
+    if (stat(path, &st) != 0)
+        return 1;
+    if (is_racy(st.st_mtime))
+        return 0;
+    uint64_t h = util_hash64(path, dir_len, 0);
+    inc_dir **link = &c->dirs[h & (INC_BUCKETS - 1)], *d;
+    for (d = *link; d; d = d->next)
+        if (d->path_hash == h && !strcmp(d->path, path))
+            break;
+    if (!d) {
+        d = calloc(1, sizeof(*d));
+        if (!d || !(d->path = util_strdup(path))) {
+            free(d);
+            return 0;
+        }
+        d->path_hash = h;
+        d->mtime = INT64_MIN;
+        d->next = *link;
+        *link = d;
+    }
+    if (d->mtime != (int64_t)st.st_mtime) {
+        /* listing under the lock keeps the index consistent with its mtime */
+        DIR *dd = opendir(path);
+        if (!dd)
+            return 0;
+        struct dirent *de;
+        uint64_t *names = NULL;
+        while ((de = readdir(dd)))
+            sb_push(names, util_hash64(de->d_name, strlen(de->d_name), 0));
+        closedir(dd);
+        size_t count = sb_count(names);
+        uint64_t *sorted = malloc((count ? count : 1) * sizeof(*sorted));
+        if (!sorted) {
+            sb_free(names);
+            return 0;
+        }
+        if (count)
+            memcpy(sorted, names, count * sizeof(*sorted));
+        sb_free(names);
+        qsort(sorted, count, sizeof(*sorted), by_hash);
+        free(d->names);
+        d->names = sorted;
+        d->nnames = count;
+        d->mtime = (int64_t)st.st_mtime;
+    }
+    uint64_t key = util_hash64(name, n, 0);
+    return !bsearch(&key, d->names, d->nnames, sizeof(key), by_hash);
+#else
+    (void)c, (void)dir, (void)dir_len, (void)name, (void)n;
+    return 0;
+#endif
+}
+
+/* contents of an open file; empty files get a static "" */
+static int load(inc_file *e, const char *path) {
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    int rc = -1;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        e->mtime = (int64_t)st.st_mtime;
+        e->size = (uint64_t)st.st_size;
+        e->racy = is_racy(st.st_mtime);
+        rc = 0;
+        if (st.st_size == 0) {
+            e->f.data = "";
+        } else {
+            void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                rc = -1;
+            } else {
+                e->f.data = p;
+                e->f.len = (size_t)st.st_size;
+                e->mapped = 1;
+            }
+        }
+    }
+    close(fd);
+    return rc;
+#else
+    struct stat st;
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return -1;
+    if (stat(path, &st) != 0) {
+        fclose(f);
+        return -1;
+    }
+    char *b = st.st_size ? malloc((size_t)st.st_size) : NULL;
+    size_t n = b ? fread(b, 1, (size_t)st.st_size, f) : 0;
+    fclose(f);
+    if (st.st_size && n != (size_t)st.st_size) {
+        free(b);
+        return -1;
+    }
+    e->mtime = (int64_t)st.st_mtime;
+    e->size = (uint64_t)st.st_size;
+    e->racy = is_racy(st.st_mtime);
+    e->f.data = b ? b : "";
+    e->f.len = n;
+    return 0;
+#endif
+}
+
+/* lock held: drop e from its chain; freed now or by the last close */
+static void unlink_file(pp_include_cache *c, inc_file *e) {
+    inc_file **link = &c->files[e->path_hash & (INC_BUCKETS - 1)];
+    while (*link != e)
+        link = &(*link)->next;
+    *link = e->next;
+    e->linked = 0;
+    if (!e->refs)
+        file_free(e);
+}
+
+/* cached contents of path, loading or reloading as needed */
+const pp_file *pp_include_open_path(pp_include_cache *c, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return NULL;
+    uint64_t h = util_hash64(path, strlen(path), 0);
+    mtx_lock(&c->lock);
+    for (inc_file *e = c->files[h & (INC_BUCKETS - 1)]; e; e = e->next) {
+        if (e->path_hash != h || strcmp(e->f.path, path))
+            continue;
+        if (!e->racy && e->mtime == (int64_t)st.st_mtime && e->size == (uint64_t)st.st_size) {
+            e->refs++;
+            c->stats.hits++;
+            mtx_unlock(&c->lock);
+            return &e->f;
+        }
+        unlink_file(c, e);
+        break;
+    }
+    mtx_unlock(&c->lock);
+
+    inc_file *e = calloc(1, sizeof(*e));
+    if (!e || !(e->f.path = util_strdup(path)) || load(e, path)) {
+        if (e)
+            free((void *)e->f.path);
+        free(e);
+        return NULL;
+    }
+    e->f.hash = util_hash64(e->f.data, e->f.len, 0);
+    e->path_hash = h;
+    e->refs = 1;
+    mtx_lock(&c->lock);
+    c->stats.loads++;
+    /* a concurrent load of the same path may have won; newest stays */
+    for (inc_file *o = c->files[h & (INC_BUCKETS - 1)]; o; o = o->next) {
+        if (o->path_hash == h && !strcmp(o->f.path, path)) {
+            unlink_file(c, o);
+            break;
+        }
+    }
+    e->linked = 1;
+    e->next = c->files[h & (INC_BUCKETS - 1)];
+    c->files[h & (INC_BUCKETS - 1)] = e;
+    mtx_unlock(&c->lock);
+    return &e->f;
+}
+
+const pp_file *pp_include_open(pp_include_cache *c, const char *const *dirs, size_t ndirs,
+                               const char *name, size_t n) {
+    /* the index covers the directory the last path component lives in */
+    size_t base = n;
+    while (base && name[base - 1] != '/'
+#ifdef _WIN32
+           && name[base - 1] != '\\'
+#endif
+    )
+        --base;
+    for (size_t i = 0; i < ndirs; ++i) {
+        if (!dirs[i])
+            continue;
+        char path[1024];
+        int len = snprintf(path, sizeof(path), "%s/%.*s", dirs[i], (int)n, name);
+        if (len < 0 || (size_t)len >= sizeof(path))
+            continue;
+        size_t dir_len = (size_t)len - (n - base) - 1;
+        mtx_lock(&c->lock);
+        int absent = dir_lacks(c, path, dir_len, name + base, n - base);
+        if (absent)
+            c->stats.negative_hits++;
+        mtx_unlock(&c->lock);
+        if (absent)
+            continue;
+        const pp_file *f = pp_include_open_path(c, path);
+        if (f)
+            return f;
+    }
+    return NULL;
+}
+
+void pp_include_close(pp_include_cache *c, const pp_file *f) {
+    if (!f)
+        return;
+    inc_file *e = (inc_file *)f;
+    mtx_lock(&c->lock);
+    if (--e->refs == 0 && !e->linked)
+        file_free(e);
+    mtx_unlock(&c->lock);
+}
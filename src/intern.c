@@ -0,0 +1,174 @@
+#include "dx8gles11.h"
+#include "dx8gles11_internal.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+/*
+ * Interned lists live in a chained hash table keyed by a hash of their
+ * commands. Everything, reference counts included, is under one mutex:
+ * interning happens when shaders are loaded, not per draw, and a count
+ * that only changes under the lock cannot be revived by a lookup racing
+ * the last release.
+ */
+
+typedef struct intern_entry {
+    GLES_CommandList list; /* first: release() maps the list back to its entry */
+    struct intern_entry *next;
+    uint64_t hash;
+    size_t refs;
+} intern_entry;
+
+struct dx8gles11_intern {
+    mtx_t lock;
+    intern_entry **buckets;
+    size_t nbuckets; /* power of two */
+    size_t entries;
+    size_t refs;
+    size_t cmds;         /* stored */
+    size_t logical_cmds; /* summed over references */
+};
+
+static uint64_t list_hash(const GLES_CommandList *l) {
+    return util_hash64(l->data, l->count * sizeof(gles_cmd), l->count);
+}
+
+static int list_equal(const GLES_CommandList *a, const GLES_CommandList *b) {
+    return a->count == b->count &&
+           (!a->count || !memcmp(a->data, b->data, a->count * sizeof(gles_cmd)));
+}
+
+/* lock held: double the table once it is as full as it is wide */
+static void grow(dx8gles11_intern *p) {
+    if (p->entries < p->nbuckets)
+        return;
+    size_t n = p->nbuckets * 2;
+    intern_entry **b = calloc(n, sizeof(*b));
+    if (!b)
+        return; /* longer chains, still correct */
+    for (size_t i = 0; i < p->nbuckets; ++i) {
+        while (p->buckets[i]) {
+            intern_entry *e = p->buckets[i];
+            p->buckets[i] = e->next;
+            e->next = b[e->hash & (n - 1)];
+            b[e->hash & (n - 1)] = e;
+        }
+    }
+    free(p->buckets);
+    p->buckets = b;
+    p->nbuckets = n;
+}
+
+dx8gles11_intern *dx8gles11_intern_create(void) {
+    dx8gles11_intern *p = calloc(1, sizeof(*p));
+    if (!p)
+        return NULL;
+    p->nbuckets = 256;
+    p->buckets = calloc(p->nbuckets, sizeof(*p->buckets));
+    if (!p->buckets || mtx_init(&p->lock, mtx_plain) != thrd_success) {
+        free(p->buckets);
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+
+void dx8gles11_intern_destroy(dx8gles11_intern *p) {
+    if (!p)
+        return;
+    for (size_t i = 0; i < p->nbuckets; ++i) {
+        while (p->buckets[i]) {
+            intern_entry *e = p->buckets[i];
+            p->buckets[i] = e->next;
+            gles_cmdlist_free(&e->list);
+            free(e);
+        }
+    }
+    free(p->buckets);
+    mtx_destroy(&p->lock);
+    free(p);
+}
+
+const GLES_CommandList *dx8gles11_intern_list(dx8gles11_intern *p, GLES_CommandList *list) {
+    if (!p || !list) {
+        dx8gles11_set_error(!p ? "intern pool null" : "list null");
+        return NULL;
+    }
+    uint64_t h = list_hash(list);
+    mtx_lock(&p->lock);
+    intern_entry **bucket = &p->buckets[h & (p->nbuckets - 1)];
+    intern_entry *e = *bucket;
+    while (e && !(e->hash == h && list_equal(&e->list, list)))
+        e = e->next;
+    if (e) {
+        gles_cmdlist_free(list);
+    } else {
+        e = malloc(sizeof(*e));
+        if (!e) {
+            mtx_unlock(&p->lock);
+            dx8gles11_set_error("out of memory");
+            return NULL;
+        }
+        /* resident for as long as it is shared, so drop the growth slack */
+        sb_shrink(list->data);
+        list->capacity = sb_capacity(list->data);
+        *e = (intern_entry){*list, *bucket, h, 0};
+        *bucket = e;
+        p->entries++;
+        p->cmds += list->count;
+        grow(p);
+    }
+    e->refs++;
+    p->refs++;
+    p->logical_cmds += e->list.count;
+    mtx_unlock(&p->lock);
+    *list = (GLES_CommandList){0};
+    return &e->list;
+}
+
+const GLES_CommandList *dx8gles11_intern_retain(dx8gles11_intern *p, const GLES_CommandList *list) {
+    if (!p || !list)
+        return list;
+    intern_entry *e = (intern_entry *)list;
+    mtx_lock(&p->lock);
+    e->refs++;
+    p->refs++;
+    p->logical_cmds += e->list.count;
+    mtx_unlock(&p->lock);
+    return list;
+}
+
+void dx8gles11_intern_release(dx8gles11_intern *p, const GLES_CommandList *list) {
+    if (!p || !list)
+        return;
+    intern_entry *e = (intern_entry *)list;
+    mtx_lock(&p->lock);
+    p->refs--;
+    p->logical_cmds -= e->list.count;
+    if (--e->refs) {
+        mtx_unlock(&p->lock);
+        return;
+    }
+    intern_entry **link = &p->buckets[e->hash & (p->nbuckets - 1)];
+    while (*link != e)
+        link = &(*link)->next;
+    *link = e->next;
+    p->entries--;
+    p->cmds -= e->list.count;
+    mtx_unlock(&p->lock);
+    gles_cmdlist_free(&e->list);
+    free(e);
+}
+
+void dx8gles11_intern_get_stats(dx8gles11_intern *p, dx8gles11_intern_stats *out) {
+    if (!p || !out)
+        return;
+    mtx_lock(&p->lock);
+    out->refs = p->refs;
+    out->unique = p->entries;
+    out->bytes = p->cmds * sizeof(gles_cmd) + p->entries * sizeof(intern_entry);
+    out->logical_bytes = p->logical_cmds * sizeof(gles_cmd);
+    out->dedup_ratio = p->cmds ? (double)p->logical_cmds / (double)p->cmds : 1.0;
+    mtx_unlock(&p->lock);
+}
@@ -1,73 +1,249 @@
 #include "lf_queue.h"
 #include <stdlib.h>
+#include <threads.h>
+
+/*
+ * Reclamation: every thread that touches a queue owns a record holding two
+ * hazard pointers, the nodes it unlinked that may still be read by others
+ * (`retired`) and a pool of nodes known to be unreferenced. Readers publish
+ * a node in a hazard slot and re-check that it is still reachable before
+ * dereferencing it; a retired node moves to the pool once a scan finds it in
+ * no slot. Pools above POOL_MAX hand a batch to a shared list, under a
+ * mutex, that threads with an empty pool refill from, which covers the usual
+ * split of one thread pushing and others popping. Records outlive their
+ * threads and are adopted by later ones, retired nodes included.
+ */
+
+#define HAZARDS 2
+#define SCAN_AT 64 /* retired nodes that trigger a scan */
+#define POOL_MAX 256
+#define BATCH 64
+
+typedef struct hp_record {
+    _Atomic(lf_queue_node *) hp[HAZARDS];
+    atomic_int in_use;
+    struct hp_record *next; /* registry link, set before publishing */
+    lf_queue_node *retired;
+    size_t nretired;
+    lf_queue_node *pool;
+    size_t npool;
+} hp_record;
+
+static _Atomic(hp_record *) g_records;
+static atomic_size_t g_allocated;
+static once_flag g_once = ONCE_FLAG_INIT;
+static tss_t g_key;
+static mtx_t g_shared_lock;
+static lf_queue_node *g_shared; /* nodes handed over by full pools */
+static _Thread_local hp_record *t_rec;
+
+/* pool and retired lists need their own link: a push that still sees a
+ * retired node as the tail expects its `next` to stay non-NULL */
+static lf_queue_node *link_of(lf_queue_node *n) { return n->free_next; }
+
+static void set_link(lf_queue_node *n, lf_queue_node *to) { n->free_next = to; }
+
+/* move up to max nodes from *from onto *to; returns how many */
+static size_t move_nodes(lf_queue_node **from, lf_queue_node **to, size_t max) {
+    size_t n = 0;
+    while (*from && n < max) {
+        lf_queue_node *x = *from;
+        *from = link_of(x);
+        set_link(x, *to);
+        *to = x;
+        ++n;
+    }
+    return n;
+}
+
+/* thread exit: the pool goes to the shared list, the record to the next
+ * thread; retired nodes stay with it until a scan frees them */
+static void release_record(void *arg) {
+    hp_record *r = arg;
+    for (int i = 0; i < HAZARDS; ++i)
+        atomic_store(&r->hp[i], NULL);
+    mtx_lock(&g_shared_lock);
+    move_nodes(&r->pool, &g_shared, r->npool);
+    mtx_unlock(&g_shared_lock);
+    r->npool = 0;
+    atomic_store(&r->in_use, 0);
+}
+
+static void init_once(void) {
+    if (tss_create(&g_key, release_record) != thrd_success ||
+        mtx_init(&g_shared_lock, mtx_plain) != thrd_success)
+        abort();
+}
+
+static hp_record *record(void) {
+    if (t_rec)
+        return t_rec;
+    call_once(&g_once, init_once);
+    hp_record *r = atomic_load(&g_records);
+    for (; r; r = r->next) {
+        int idle = 0;
+        if (atomic_compare_exchange_strong(&r->in_use, &idle, 1))
+            break;
+    }
+    if (!r) {
+        r = calloc(1, sizeof(*r));
+        if (!r)
+            abort();
+        atomic_init(&r->in_use, 1);
+        r->next = atomic_load(&g_records);
+        while (!atomic_compare_exchange_weak(&g_records, &r->next, r))
+            ;
+    }
+    t_rec = r;
+    tss_set(g_key, r);
+    return r;
+}
+
+static lf_queue_node *node_get(hp_record *r) {
+    if (!r->pool) {
+        mtx_lock(&g_shared_lock);
+        r->npool += move_nodes(&g_shared, &r->pool, BATCH);
+        mtx_unlock(&g_shared_lock);
+    }
+    lf_queue_node *n = r->pool;
+    if (n) {
+        r->pool = link_of(n);
+        r->npool--;
+        return n;
+    }
+    n = malloc(sizeof(*n));
+    if (n)
+        atomic_fetch_add_explicit(&g_allocated, 1, memory_order_relaxed);
+    return n;
+}
+
+static void node_put(hp_record *r, lf_queue_node *n) {
+    set_link(n, r->pool);
+    r->pool = n;
+    if (++r->npool > POOL_MAX) {
+        mtx_lock(&g_shared_lock);
+        r->npool -= move_nodes(&r->pool, &g_shared, BATCH);
+        mtx_unlock(&g_shared_lock);
+    }
+}
+
+static int hazardous(const lf_queue_node *n) {
+    for (hp_record *r = atomic_load(&g_records); r; r = r->next)
+        for (int i = 0; i < HAZARDS; ++i)
+            if (atomic_load(&r->hp[i]) == n)
+                return 1;
+    return 0;
+}
+
+/* pool every retired node no hazard pointer refers to */
+static void scan(hp_record *r) {
+    lf_queue_node *keep = NULL;
+    size_t kept = 0;
+    while (r->retired) {
+        lf_queue_node *n = r->retired;
+        r->retired = link_of(n);
+        if (hazardous(n)) {
+            set_link(n, keep);
+            keep = n;
+            ++kept;
+        } else {
+            node_put(r, n);
+        }
+    }
+    r->retired = keep;
+    r->nretired = kept;
+}
+
+static void retire(hp_record *r, lf_queue_node *n) {
+    set_link(n, r->retired);
+    r->retired = n;
+    if (++r->nretired >= SCAN_AT)
+        scan(r);
+}
+
+static void clear_hazards(hp_record *r) {
+    atomic_store_explicit(&r->hp[0], NULL, memory_order_release);
+    atomic_store_explicit(&r->hp[1], NULL, memory_order_release);
+}
 
 int lf_queue_init(lf_queue *q) {
-    lf_queue_node *n = malloc(sizeof(*n));
+    lf_queue_node *n = node_get(record());
     if (!n)
         return -1;
-    n->next = NULL;
     n->value = NULL;
-    atomic_store(&q->head, n);
-    atomic_store(&q->tail, n);
+    atomic_init(&n->next, NULL);
+    atomic_init(&q->head, n);
+    atomic_init(&q->tail, n);
     return 0;
 }
 
 void lf_queue_destroy(lf_queue *q) {
     lf_queue_node *n = atomic_load(&q->head);
     while (n) {
-        lf_queue_node *next = n->next;
+        lf_queue_node *next = atomic_load(&n->next);
         free(n);
         n = next;
     }
+    atomic_store(&q->head, NULL);
+    atomic_store(&q->tail, NULL);
 }
 
 int lf_queue_push(lf_queue *q, void *value) {
-    lf_queue_node *n = malloc(sizeof(*n));
+    hp_record *r = record();
+    lf_queue_node *n = node_get(r);
     if (!n)
         return -1;
     n->value = value;
-    n->next = NULL;
+    atomic_store_explicit(&n->next, NULL, memory_order_relaxed);
 
     for (;;) {
-        lf_queue_node *tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+        lf_queue_node *tail = atomic_load(&q->tail);
+        atomic_store(&r->hp[0], tail);
+        if (tail != atomic_load(&q->tail))
+            continue;
         lf_queue_node *next = atomic_load_explicit(&tail->next, memory_order_acquire);
-        if (next == NULL) {
-            if (atomic_compare_exchange_weak_explicit(&tail->next, &next, n,
-                                                      memory_order_release,
-                                                      memory_order_relaxed)) {
-                atomic_compare_exchange_weak_explicit(&q->tail, &tail, n,
-                                                      memory_order_release,
-                                                      memory_order_relaxed);
-                return 0;
-            }
-        } else {
-            atomic_compare_exchange_weak_explicit(&q->tail, &tail, next,
-                                                  memory_order_release,
-                                                  memory_order_relaxed);
+        if (tail != atomic_load(&q->tail))
+            continue;
+        if (next) {
+            atomic_compare_exchange_weak(&q->tail, &tail, next);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&tail->next, &next, n, memory_order_release,
+                                                  memory_order_relaxed)) {
+            atomic_compare_exchange_strong(&q->tail, &tail, n);
+            clear_hazards(r);
+            return 0;
         }
     }
 }
 
 void *lf_queue_pop(lf_queue *q) {
+    hp_record *r = record();
     for (;;) {
-        lf_queue_node *head = atomic_load_explicit(&q->head, memory_order_acquire);
-        lf_queue_node *tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+        lf_queue_node *head = atomic_load(&q->head);
+        atomic_store(&r->hp[0], head);
+        if (head != atomic_load(&q->head))
+            continue;
+        lf_queue_node *tail = atomic_load(&q->tail);
         lf_queue_node *next = atomic_load_explicit(&head->next, memory_order_acquire);
+        atomic_store(&r->hp[1], next);
+        if (head != atomic_load(&q->head))
+            continue;
+        if (!next) {
+            clear_hazards(r);
+            return NULL;
+        }
         if (head == tail) {
-            if (next == NULL)
-                return NULL;
-            atomic_compare_exchange_weak_explicit(&q->tail, &tail, next,
-                                                  memory_order_release,
-                                                  memory_order_relaxed);
-        } else {
-            void *value = next->value;
-            if (atomic_compare_exchange_weak_explicit(&q->head, &head, next,
-                                                      memory_order_release,
-                                                      memory_order_relaxed)) {
-                free(head);
-                return value;
-            }
+            atomic_compare_exchange_weak(&q->tail, &tail, next);
+            continue;
+        }
+        void *value = next->value;
+        if (atomic_compare_exchange_weak(&q->head, &head, next)) {
+            clear_hazards(r);
+            retire(r, head);
+            return value;
         }
     }
 }
 
+size_t lf_queue_nodes_allocated(void) { return atomic_load(&g_allocated); }
@@ -0,0 +1,185 @@
+#include "dx8gles11.h"
+#include "dx8gles11_internal.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Each command is one tag byte: the type in the low six bits and, in bit
+ * 7, whether a field mask follows. The mask has bit i set for a nonzero
+ * f[i] and bit 4 + i for a nonzero u[i]; only those fields follow, floats
+ * as their 4 bytes and integers as LEB128 varints. Zero fields, and for
+ * payload-free commands the mask itself, cost nothing, so most commands
+ * take 1 to 6 bytes instead of sizeof(gles_cmd).
+ */
+
+#define TAG_TYPE 0x3f
+#define TAG_MASK 0x80
+
+_Static_assert(GLES_CMD_UNKNOWN <= TAG_TYPE, "command types must fit the tag");
+
+static uint32_t float_bits(float f) {
+    uint32_t b;
+    memcpy(&b, &f, sizeof(b));
+    return b;
+}
+
+static unsigned field_mask(const gles_cmd *c) {
+    unsigned m = 0;
+    for (int k = 0; k < 4; ++k) {
+        m |= float_bits(c->f[k]) ? 1u << k : 0;
+        m |= c->u[k] ? 1u << (4 + k) : 0;
+    }
+    return m;
+}
+
+static size_t varint_size(uint32_t v) {
+    size_t n = 1;
+    while (v >>= 7)
+        ++n;
+    return n;
+}
+
+/* bytes c packs into, given its mask */
+static size_t packed_size(const gles_cmd *c, unsigned m) {
+    size_t n = 1 + (m != 0);
+    for (int k = 0; k < 4; ++k) {
+        n += m & (1u << k) ? 4 : 0;
+        n += m & (1u << (4 + k)) ? varint_size(c->u[k]) : 0;
+    }
+    return n;
+}
+
+static uint8_t *put_cmd(uint8_t *p, const gles_cmd *c, unsigned m) {
+    *p++ = (uint8_t)(c->type | (m ? TAG_MASK : 0));
+    if (!m)
+        return p;
+    *p++ = (uint8_t)m;
+    for (int k = 0; k < 4; ++k) {
+        if (m & (1u << k)) {
+            memcpy(p, &c->f[k], 4);
+            p += 4;
+        }
+    }
+    for (int k = 0; k < 4; ++k) {
+        if (!(m & (1u << (4 + k))))
+            continue;
+        uint32_t v = c->u[k];
+        while (v >= 0x80) {
+            *p++ = (uint8_t)(v | 0x80);
+            v >>= 7;
+        }
+        *p++ = (uint8_t)v;
+    }
+    return p;
+}
+
+int gles_cmdlist_pack(const GLES_CommandList *in, GLES_PackedList *out) {
+    if (!in || !out) {
+        dx8gles11_set_error(!in ? "list null" : "out list null");
+        return -1;
+    }
+    *out = (GLES_PackedList){0};
+    size_t size = 0;
+    for (size_t i = 0; i < in->count; ++i) {
+        if ((unsigned)in->data[i].type > GLES_CMD_UNKNOWN) {
+            dx8gles11_set_error("command type out of range");
+            return -1;
+        }
+        size += packed_size(&in->data[i], field_mask(&in->data[i]));
+    }
+    uint8_t *data = malloc(size ? size : 1);
+    if (!data) {
+        dx8gles11_set_error("out of memory");
+        return -1;
+    }
+    uint8_t *p = data;
+    for (size_t i = 0; i < in->count; ++i)
+        p = put_cmd(p, &in->data[i], field_mask(&in->data[i]));
+    out->data = data;
+    out->size = size;
+    out->count = in->count;
+    return 0;
+}
+
+void gles_packed_free(GLES_PackedList *l) {
+    if (!l)
+        return;
+    free(l->data);
+    *l = (GLES_PackedList){0};
+}
+
+void gles_packed_begin(const GLES_PackedList *l, gles_packed_iter *it) {
+    it->p = l ? l->data : NULL;
+    it->end = l && l->data ? l->data + l->size : NULL;
+}
+
+int gles_packed_next(gles_packed_iter *it, gles_cmd *c) {
+    const uint8_t *p = it->p, *end = it->end;
+    if (p == end)
+        return 0;
+    unsigned tag = *p++;
+    *c = (gles_cmd){.type = (gles_cmd_type)(tag & TAG_TYPE)};
+    if ((tag & TAG_TYPE) > GLES_CMD_UNKNOWN || (tag & 0x40))
+        return -1;
+    if (tag & TAG_MASK) {
+        if (p == end)
+            return -1;
+        unsigned m = *p++;
+        for (int k = 0; k < 4; ++k) {
+            if (!(m & (1u << k)))
+                continue;
+            if (end - p < 4)
+                return -1;
+            memcpy(&c->f[k], p, 4);
+            p += 4;
+        }
+        for (int k = 0; k < 4; ++k) {
+            if (!(m & (1u << (4 + k))))
+                continue;
+            uint32_t v = 0;
+            int shift = 0;
+            uint8_t b;
+            do {
+                if (p == end || shift > 28)
+                    return -1;
+                b = *p++;
+                v |= (uint32_t)(b & 0x7f) << shift;
+                shift += 7;
+            } while (b & 0x80);
+            c->u[k] = v;
+        }
+    }
+    it->p = p;
+    return 1;
+}
+
+int gles_packed_unpack(const GLES_PackedList *in, GLES_CommandList *out) {
+    if (!in || !out) {
+        dx8gles11_set_error(!in ? "list null" : "out list null");
+        return -1;
+    }
+    *out = (GLES_CommandList){0};
+    /* every command takes at least its tag byte; checked before reserving */
+    if (in->count > in->size || (!in->data && in->count)) {
+        dx8gles11_set_error("malformed packed command list");
+        return -1;
+    }
+    gles_cmd *data = NULL;
+    sb_reserve(data, in->count);
+    gles_packed_iter it;
+    gles_packed_begin(in, &it);
+    gles_cmd c;
+    int rc;
+    while ((rc = gles_packed_next(&it, &c)) > 0)
+        sb_push(data, c);
+    if (rc < 0 || sb_count(data) != in->count) {
+        sb_free(data);
+        dx8gles11_set_error("malformed packed command list");
+        return -1;
+    }
+    out->data = data;
+    out->count = sb_count(data);
+    out->capacity = sb_capacity(data);
+    return 0;
+}
@@ -0,0 +1,383 @@
+#include "dx8gles11.h"
+#include "dx8gles11_internal.h"
+#include "preprocess.h"
+#include "utils.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+/*
+ * Variants are handed out to worker threads by an atomic counter. Each one
+ * preprocesses the source with its feature defines, resuming from a single
+ * snapshot of the prefix no feature can change. The preprocessed texts are
+ * interned under `lock` and only the first variant to produce a text
+ * compiles it; lists that still come out equal are merged at the end.
+ */
+
+#define PERM_MAX_VARIANTS (1u << 16)
+
+typedef struct perm_text {
+    uint64_t hash;
+    char *src;
+    size_t len;
+} perm_text;
+
+typedef struct perm_job {
+    const char *src;
+    const dx8gles11_options *opts;
+    size_t nfeatures;
+    const size_t *radix;     /* value count per feature */
+    const char *const *defs; /* per feature and value: its define, NULL when off */
+    const size_t *first;     /* index of each feature's first entry in defs */
+    size_t nbase;            /* count of opts->defines */
+    const pp_snapshot *snap;
+    size_t count;
+    _Atomic size_t next;
+    mtx_t lock;
+    size_t *slots; /* open-addressed text index + 1, cap a power of two */
+    size_t cap;
+    perm_text *texts; /* count slots */
+    size_t ntexts;
+    GLES_CommandList *lists; /* one per text */
+    size_t *variant;
+    size_t failed; /* first failing variant, count while none */
+    int rc;
+    char err[256];
+} perm_job;
+
+/* keep the error of the lowest failing variant, so reports are stable */
+static void perm_fail(perm_job *j, size_t v, int rc, const char *msg) {
+    mtx_lock(&j->lock);
+    if (v < j->failed) {
+        j->failed = v;
+        j->rc = rc;
+        snprintf(j->err, sizeof(j->err), "variant %zu: %s", v, msg);
+    }
+    mtx_unlock(&j->lock);
+}
+
+/* lock held: index of the text equal to s, or ntexts when it is new */
+static size_t intern(perm_job *j, uint64_t h, const char *s, size_t len, size_t **slot) {
+    size_t i = (size_t)h & (j->cap - 1);
+    for (;; i = (i + 1) & (j->cap - 1)) {
+        size_t *p = &j->slots[i];
+        const perm_text *t = *p ? &j->texts[*p - 1] : NULL;
+        if (!t || (t->hash == h && t->len == len && !memcmp(t->src, s, len))) {
+            *slot = p;
+            return t ? *p - 1 : j->ntexts;
+        }
+    }
+}
+
+static void run_variant(perm_job *j, size_t v, const char **defines, util_arena *arena) {
+    size_t n = 0, rest = v;
+    for (; n < j->nbase; ++n)
+        defines[n] = j->opts->defines[n];
+    for (size_t f = 0; f < j->nfeatures; ++f) {
+        const char *d = j->defs[j->first[f] + rest % j->radix[f]];
+        rest /= j->radix[f];
+        if (d)
+            defines[n++] = d;
+    }
+    defines[n] = NULL;
+
+    char *pp_err = NULL;
+    pp_config cfg = {.include_dir = j->opts ? j->opts->include_dir : NULL,
+                     .include_paths = j->opts ? j->opts->include_paths : NULL,
+                     .snapshot = j->snap,
+                     .defines = defines,
+                     .arena = arena};
+    char *text = pp_run_string_cfg(j->src, &cfg, &pp_err);
+    if (!text) {
+        char msg[200];
+        snprintf(msg, sizeof(msg), "preprocess fail: %s", pp_err ? pp_err : "?");
+        perm_fail(j, v, -2, msg);
+        free(pp_err);
+        return;
+    }
+    size_t len = strlen(text);
+    uint64_t h = util_hash64(text, len, 0);
+    size_t *slot;
+    mtx_lock(&j->lock);
+    size_t i = intern(j, h, text, len, &slot);
+    int fresh = i == j->ntexts, oom = 0;
+    if (fresh) {
+        perm_text t = {h, util_strndup(text, len), len};
+        oom = !t.src;
+        if (!oom) {
+            j->texts[j->ntexts++] = t;
+            *slot = j->ntexts;
+        }
+    }
+    j->variant[v] = i;
+    mtx_unlock(&j->lock);
+    if (oom) {
+        perm_fail(j, v, -1, "out of memory");
+        return;
+    }
+    int rc = fresh ? compile_or_lookup(text, j->opts, arena, &j->lists[i]) : 0;
+    if (rc)
+        perm_fail(j, v, rc, dx8gles11_error());
+}
+
+static int perm_worker(void *arg) {
+    perm_job *j = arg;
+    util_arena arena = {0};
+    const char **defines = malloc((j->nbase + j->nfeatures + 1) * sizeof(*defines));
+    if (!defines) {
+        perm_fail(j, 0, -1, "out of memory");
+        return 0;
+    }
+    for (;;) {
+        size_t v = atomic_fetch_add(&j->next, 1);
+        if (v >= j->count)
+            break;
+        mtx_lock(&j->lock);
+        int past_failure = v > j->failed;
+        mtx_unlock(&j->lock);
+        if (past_failure)
+            break;
+        run_variant(j, v, defines, &arena);
+        util_arena_reset(&arena);
+    }
+    free(defines);
+    util_arena_free(&arena);
+    return 0;
+}
+
+typedef struct list_key {
+    uint64_t hash;
+    size_t idx;
+} list_key;
+
+static int by_list_hash(const void *a, const void *b) {
+    const list_key *x = a, *y = b;
+    if (x->hash != y->hash)
+        return x->hash < y->hash ? -1 : 1;
+    return x->idx < y->idx ? -1 : x->idx > y->idx;
+}
+
+static int same_list(const GLES_CommandList *a, const GLES_CommandList *b) {
+    return a->count == b->count &&
+           (!a->count || !memcmp(a->data, b->data, a->count * sizeof(*a->data)));
+}
+
+/* merge equal lists into out; texts differing only in ways the translator
+ * ignores (comments, spacing) compile to the same commands */
+static int merge_lists(perm_job *j, dx8gles11_permutations *out) {
+    list_key *keys = malloc((j->ntexts ? j->ntexts : 1) * sizeof(*keys));
+    size_t *remap = malloc((j->ntexts ? j->ntexts : 1) * sizeof(*remap));
+    out->lists = malloc((j->ntexts ? j->ntexts : 1) * sizeof(*out->lists));
+    if (!keys || !remap || !out->lists) {
+        free(keys);
+        free(remap);
+        free(out->lists);
+        out->lists = NULL;
+        return -1;
+    }
+    for (size_t i = 0; i < j->ntexts; ++i) {
+        const GLES_CommandList *l = &j->lists[i];
+        keys[i] = (list_key){util_hash64(l->data, l->count * sizeof(*l->data), l->count), i};
+    }
+    qsort(keys, j->ntexts, sizeof(*keys), by_list_hash);
+    for (size_t i = 0; i < j->ntexts; ++i)
+        remap[i] = SIZE_MAX;
+    for (size_t a = 0, b; a < j->ntexts; a = b) {
+        for (b = a + 1; b < j->ntexts && keys[b].hash == keys[a].hash; ++b)
+            ;
+        for (size_t x = a; x < b; ++x) {
+            size_t ix = keys[x].idx;
+            for (size_t y = a; y < x && remap[ix] == SIZE_MAX; ++y)
+                if (remap[keys[y].idx] == keys[y].idx &&
+                    same_list(&j->lists[keys[y].idx], &j->lists[ix]))
+                    remap[ix] = keys[y].idx;
+            if (remap[ix] == SIZE_MAX)
+                remap[ix] = ix;
+        }
+    }
+    /* a duplicate maps to a lower index, which is renumbered before it */
+    for (size_t i = 0; i < j->ntexts; ++i) {
+        if (remap[i] == i) {
+            remap[i] = out->nlists;
+            out->lists[out->nlists++] = j->lists[i];
+        } else {
+            remap[i] = remap[remap[i]];
+            gles_cmdlist_free(&j->lists[i]);
+        }
+    }
+    for (size_t v = 0; v < j->count; ++v)
+        j->variant[v] = remap[j->variant[v]];
+    free(keys);
+    free(remap);
+    return 0;
+}
+
+/* every feature's defines in one array; radix and first describe the layout */
+static const char **feature_defines(util_arena *a, const dx8gles11_feature *features,
+                                    size_t nfeatures, size_t *radix, size_t *first,
+                                    size_t *count) {
+    size_t total = 0;
+    *count = 1;
+    for (size_t f = 0; f < nfeatures; ++f) {
+        size_t n = 2;
+        if (features[f].values)
+            for (n = 0; features[f].values[n]; ++n)
+                ;
+        if (!features[f].name || !n) {
+            dx8gles11_set_error(!features[f].name ? "feature name null" : "feature has no values");
+            return NULL;
+        }
+        if (*count > PERM_MAX_VARIANTS / n) {
+            dx8gles11_set_error("too many permutations");
+            return NULL;
+        }
+        *count *= n;
+        radix[f] = n;
+        first[f] = total;
+        total += n;
+    }
+    const char **defs = util_arena_alloc(a, (total ? total : 1) * sizeof(*defs));
+    for (size_t f = 0; defs && f < nfeatures; ++f) {
+        const dx8gles11_feature *ft = &features[f];
+        for (size_t k = 0; k < radix[f]; ++k) {
+            char *d = NULL;
+            if (ft->values)
+                util_asprintf(&d, "%s=%s", ft->name, ft->values[k]);
+            else if (k)
+                d = util_strdup(ft->name);
+            if (!ft->values && !k) {
+                defs[first[f]] = NULL; /* off: left undefined */
+                continue;
+            }
+            defs[first[f] + k] = d ? util_arena_strndup(a, d, strlen(d)) : NULL;
+            if (!d || !defs[first[f] + k])
+                defs = NULL;
+            free(d);
+            if (!defs)
+                break;
+        }
+    }
+    if (!defs)
+        dx8gles11_set_error("out of memory");
+    return defs;
+}
+
+static int run_job(perm_job *j, int threads) {
+    size_t extra = threads > 1 ? (size_t)threads - 1 : 0;
+    if (extra > j->count - 1)
+        extra = j->count - 1;
+    thrd_t *t = extra ? malloc(extra * sizeof(*t)) : NULL;
+    size_t started = 0;
+    while (t && started < extra && thrd_create(&t[started], perm_worker, j) == thrd_success)
+        ++started;
+    perm_worker(j);
+    for (size_t i = 0; i < started; ++i)
+        thrd_join(t[i], NULL);
+    free(t);
+    if (j->failed == j->count)
+        return 0;
+    dx8gles11_set_error(j->err);
+    return j->rc;
+}
+
+int dx8gles11_compile_permutations(const char *src, const dx8gles11_feature *features,
+                                   size_t nfeatures, const dx8gles11_options *opts, int threads,
+                                   dx8gles11_permutations *out) {
+    if (!src || !out || (nfeatures && !features)) {
+        dx8gles11_set_error(!src ? "source null" : !out ? "out null" : "features null");
+        return -1;
+    }
+    memset(out, 0, sizeof(*out));
+    util_arena arena = {0};
+    size_t *radix = util_arena_alloc(&arena, (2 * nfeatures + 1) * sizeof(*radix));
+    const char **keys = util_arena_alloc(&arena, (nfeatures + 1) * sizeof(*keys));
+    /* caps are resolved on the caller's thread, which owns the GL context,
+     * before any worker translates */
+    dx8gles11_caps caps = {translate_caps(opts)};
+    dx8gles11_options pinned = opts ? *opts : (dx8gles11_options){0};
+    pinned.caps = &caps;
+    perm_job j = {.src = src, .opts = &pinned, .nfeatures = nfeatures, .radix = radix};
+    const char **defs = NULL;
+    if (!radix || !keys) {
+        dx8gles11_set_error("out of memory");
+        util_arena_free(&arena);
+        return -1;
+    }
+    defs = feature_defines(&arena, features, nfeatures, radix, radix + nfeatures, &j.count);
+    if (!defs) {
+        util_arena_free(&arena);
+        return -1;
+    }
+    j.defs = defs;
+    j.first = radix + nfeatures;
+    for (size_t f = 0; f < nfeatures; ++f)
+        keys[f] = features[f].name;
+    keys[nfeatures] = NULL;
+    while (opts && opts->defines && opts->defines[j.nbase])
+        ++j.nbase;
+
+    /* the prefix no feature can change is preprocessed once */
+    char *pp_err = NULL;
+    pp_config cfg = {.include_dir = opts ? opts->include_dir : NULL,
+                     .include_paths = opts ? opts->include_paths : NULL,
+                     .defines = opts ? opts->defines : NULL};
+    pp_snapshot *snap = pp_snapshot_create_for(src, NULL, &cfg, keys, &pp_err);
+    if (!snap) {
+        char msg[200];
+        snprintf(msg, sizeof(msg), "preprocess fail: %s", pp_err ? pp_err : "?");
+        dx8gles11_set_error(msg);
+        free(pp_err);
+        util_arena_free(&arena);
+        return -2;
+    }
+    j.snap = snap;
+    for (j.cap = 16; j.cap < 2 * j.count; j.cap *= 2)
+        ;
+    j.slots = calloc(j.cap, sizeof(*j.slots));
+    j.texts = malloc(j.count * sizeof(*j.texts));
+    j.lists = calloc(j.count, sizeof(*j.lists));
+    j.variant = malloc(j.count * sizeof(*j.variant));
+    j.failed = j.count;
+    int rc = -1;
+    if (!j.slots || !j.texts || !j.lists || !j.variant) {
+        dx8gles11_set_error("out of memory");
+    } else if (mtx_init(&j.lock, mtx_plain) != thrd_success) {
+        dx8gles11_set_error("mutex init failed");
+    } else {
+        rc = run_job(&j, threads);
+        if (!rc && merge_lists(&j, out)) {
+            dx8gles11_set_error("out of memory");
+            rc = -1;
+        }
+        mtx_destroy(&j.lock);
+    }
+    if (rc) {
+        for (size_t i = 0; j.lists && i < j.ntexts; ++i)
+            gles_cmdlist_free(&j.lists[i]);
+        free(j.variant);
+        memset(out, 0, sizeof(*out));
+    } else {
+        out->count = j.count;
+        out->variant = j.variant;
+    }
+    for (size_t i = 0; i < j.ntexts; ++i)
+        free(j.texts[i].src);
+    free(j.texts);
+    free(j.lists);
+    free(j.slots);
+    pp_snapshot_destroy(snap);
+    util_arena_free(&arena);
+    return rc;
+}
+
+void dx8gles11_permutations_free(dx8gles11_permutations *p) {
+    if (!p)
+        return;
+    for (size_t i = 0; i < p->nlists; ++i)
+        gles_cmdlist_free(&p->lists[i]);
+    free(p->lists);
+    free(p->variant);
+    memset(p, 0, sizeof(*p));
+}
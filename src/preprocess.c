@@ -1,81 +1,623 @@
 #include "preprocess.h"
 #include "utils.h"
 #include <ctype.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+/*
+ * Macros live in an open-addressed table keyed by util_hash64 of the name,
+ * probed linearly. A redefinition replaces the earlier value, as in a C
+ * preprocessor, and #undef leaves a tombstone (value NULL) so it also hides
+ * a snapshot's frozen definition.
+ */
+typedef struct pp_span {
+    const char *s;
+    size_t n;
+} pp_span;
+
 typedef struct macro {
-    char *name;
-    char *value;
+    const char *name;
+    size_t name_len;
+    const char *value; /* NULL once undefined */
+    size_t value_len;
+    uint64_t hash;
+    int nparams;           /* -1 for object-like macros */
+    const pp_span *params; /* nparams names */
+    int plain;             /* value holds no identifier, so it needs no rescan */
 } macro;
-static void macros_free(macro *m) {
-    for (size_t i = 0; i < sb_count(m); ++i) {
-        free(m[i].name);
-        free(m[i].value);
+
+#define MACRO_TABLE_MIN 64
+#define PP_MAX_IF_DEPTH 64  /* nested #if levels across all open files */
+#define PP_MAX_EXPANSION 64 /* nested macro expansions */
+
+/* output builder shared by the whole include recursion */
+typedef struct pp_buf {
+    char *data;
+    size_t len, cap;
+} pp_buf;
+
+/*
+ * A prelude preprocessed once: its frozen macro table and expanded output,
+ * plus what it was resolved against. Runs whose source starts with the same
+ * text resume after it, layering their own macros over the frozen table.
+ */
+struct pp_snapshot {
+    util_arena arena; /* owns everything below */
+    const char *prelude;
+    size_t prelude_len;
+    uint64_t search_key;  /* current dir and include paths the prelude saw */
+    uint64_t defines_key; /* pp_config.defines it was created with */
+    size_t ndefines;
+    uint64_t *free_names; /* hashes of names the prelude never mentions */
+    size_t nfree;
+    macro **table;
+    size_t table_cap, nmacros;
+    const char *out;
+    size_t out_len;
+    pp_dep *deps; /* includes read by the prelude, paths in the arena */
+    size_t ndeps;
+    _Atomic uint64_t resumed;
+};
+
+/* #if states: taking the current branch, still looking for one, done */
+enum { COND_ACTIVE, COND_SEEKING, COND_DONE };
+
+typedef struct pp_cond {
+    unsigned char state, seen_else;
+} pp_cond;
+
+/* chain of macros being expanded, which must not expand again */
+typedef struct pp_hide {
+    const macro *m;
+    const struct pp_hide *up;
+} pp_hide;
+
+typedef struct pp_state {
+    util_arena *arena; /* every scratch allocation of one run */
+    const pp_snapshot *base; /* frozen macros consulted after the own table */
+    pp_include_cache *includes;
+    const char **search; /* include_dir then include_paths; slot 0 is the current dir */
+    size_t nsearch;
+    macro **table; /* power-of-two slots, at most 3/4 full */
+    size_t table_cap, nmacros;
+    pp_cond cond[PP_MAX_IF_DEPTH];
+    size_t ncond;
+    pp_buf scratch[PP_MAX_EXPANSION + 1]; /* one per expansion level, reused */
+    pp_buf expr[2];                       /* #if text before and after expansion */
+    /* optional stop at the first line naming one of watch (see pp_snapshot_create_for) */
+    const uint64_t *watch;
+    size_t nwatch;
+    int depth, stopped;
+    const char *stop_at, *if_start;
+    pp_line_fn sink; /* optional: receives each output line instead of out */
+    void *sink_ctx;
+    pp_buf line;
+    pp_dep **deps;
+    char **err;
+} pp_state;
+
+static void pp_fail(pp_state *st, const char *fmt, const char *arg, size_t n) {
+    if (st->err && !*st->err)
+        util_asprintf(st->err, fmt, (int)n, arg);
+}
+
+static int buf_append(pp_state *st, pp_buf *b, const char *s, size_t n) {
+    if (b->len + n + 1 > b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 1024;
+        while (cap < b->len + n + 1)
+            cap *= 2;
+        char *d = util_arena_grow(st->arena, b->data, b->cap, cap);
+        if (!d) {
+            pp_fail(st, "out of memory%.*s", "", 0);
+            return -1;
+        }
+        b->data = d;
+        b->cap = cap;
     }
-    sb_free(m);
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+    b->data[b->len] = '\0';
+    return 0;
 }
-static const char *skip_ws(const char *s) {
-    while (*s && isspace((unsigned char)*s))
+
+/* ASCII-only and locale independent, unlike isalpha/isalnum */
+static int ident_start(unsigned char c) { return (unsigned)((c | 32) - 'a') < 26u || c == '_'; }
+static int ident_char(unsigned char c) { return ident_start(c) || (unsigned)(c - '0') < 10u; }
+
+static const char *skip_ws(const char *s, const char *end) {
+    while (s < end && isspace((unsigned char)*s))
         ++s;
     return s;
 }
-static char *read_file(const char *p) {
+
+static const char *skip_ident(const char *s, const char *end) {
+    while (s < end && ident_char((unsigned char)*s))
+        ++s;
+    return s;
+}
+
+/* the main source; includes go through the shared pp_include_cache */
+static char *read_file(util_arena *a, const char *p, size_t *len) {
     FILE *f = fopen(p, "rb");
     if (!f)
         return NULL;
     fseek(f, 0, SEEK_END);
     long sz = ftell(f);
     rewind(f);
-    char *b = malloc(sz + 1);
-    fread(b, 1, sz, f);
+    char *b = sz >= 0 ? util_arena_alloc(a, (size_t)sz + 1) : NULL;
+    if (!b) {
+        fclose(f);
+        return NULL;
+    }
+    size_t n = fread(b, 1, (size_t)sz, f);
     fclose(f);
-    b[sz] = '\0';
+    b[n] = '\0';
+    *len = n;
     return b;
 }
-static char *subst_macros(const char *line, macro *macros) {
-    size_t out_len = 0;
-    char *out = NULL;
-    const char *cur = line;
-    while (*cur) {
-        if (isalpha((unsigned char)*cur) || *cur == '_') {
-            const char *start = cur;
+
+static macro **macro_slot(macro **table, size_t cap, uint64_t h, const char *name, size_t n) {
+    size_t i = (size_t)h & (cap - 1);
+    for (;; i = (i + 1) & (cap - 1)) {
+        macro *m = table[i];
+        if (!m || (m->hash == h && m->name_len == n && !memcmp(m->name, name, n)))
+            return &table[i];
+    }
+}
+
+static int has_macros(const pp_state *st) {
+    return st->nmacros || (st->base && st->base->nmacros);
+}
+
+/* the visible definition of name, or NULL */
+static const macro *find_macro(const pp_state *st, const char *name, size_t n) {
+    uint64_t h = util_hash64(name, n, 0);
+    const macro *m = st->nmacros ? *macro_slot(st->table, st->table_cap, h, name, n) : NULL;
+    if (!m && st->base && st->base->nmacros)
+        m = *macro_slot(st->base->table, st->base->table_cap, h, name, n);
+    return m && m->value ? m : NULL;
+}
+
+/* define (val != NULL) or undefine name; params only for function-like macros */
+static int add_macro(pp_state *st, const char *name, size_t n, const pp_span *params,
+                     int nparams, const char *val, size_t vn) {
+    if ((st->nmacros + 1) * 4 > st->table_cap * 3) {
+        size_t cap = st->table_cap ? st->table_cap * 2 : MACRO_TABLE_MIN;
+        macro **t = util_arena_alloc(st->arena, cap * sizeof(*t));
+        if (!t)
+            return -1;
+        memset(t, 0, cap * sizeof(*t));
+        for (size_t i = 0; i < st->table_cap; ++i) {
+            macro *m = st->table[i];
+            if (!m)
+                continue;
+            size_t j = (size_t)m->hash & (cap - 1);
+            while (t[j])
+                j = (j + 1) & (cap - 1);
+            t[j] = m;
+        }
+        st->table = t;
+        st->table_cap = cap;
+    }
+    uint64_t h = util_hash64(name, n, 0);
+    macro **slot = macro_slot(st->table, st->table_cap, h, name, n);
+    macro *m = *slot;
+    if (!m) {
+        m = util_arena_alloc(st->arena, sizeof(*m));
+        if (!m || !(m->name = util_arena_strndup(st->arena, name, n)))
+            return -1;
+        m->name_len = n;
+        m->hash = h;
+        *slot = m;
+        st->nmacros++;
+    }
+    m->value = NULL;
+    m->value_len = 0;
+    m->nparams = -1;
+    m->params = NULL;
+    m->plain = 1;
+    if (!val)
+        return 0;
+    if (!(m->value = util_arena_strndup(st->arena, val, vn)))
+        return -1;
+    m->value_len = vn;
+    for (size_t i = 0; i < vn && m->plain; ++i)
+        m->plain = !ident_start((unsigned char)val[i]);
+    if (nparams >= 0) {
+        pp_span *p = util_arena_alloc(st->arena, ((size_t)nparams + 1) * sizeof(*p));
+        if (!p)
+            return -1;
+        for (int i = 0; i < nparams; ++i) {
+            p[i].n = params[i].n;
+            if (!(p[i].s = util_arena_strndup(st->arena, params[i].s, params[i].n)))
+                return -1;
+        }
+        m->params = p;
+        m->nparams = nparams;
+    }
+    return 0;
+}
+
+static int hidden(const pp_hide *h, const macro *m) {
+    for (; h; h = h->up)
+        if (h->m == m)
+            return 1;
+    return 0;
+}
+
+static int expand(pp_state *st, const char *cur, const char *end, pp_buf *out,
+                  const pp_hide *hide, int level);
+
+/* [s, e) without surrounding whitespace */
+static pp_span trim_span(const char *s, const char *e) {
+    s = skip_ws(s, e);
+    while (e > s && isspace((unsigned char)e[-1]))
+        --e;
+    return (pp_span){s, (size_t)(e - s)};
+}
+
+/*
+ * Arguments of a call whose '(' is at p, split on top-level commas. Returns
+ * the position after ')' or NULL when the call does not close on this line.
+ */
+static const char *parse_args(const char *p, const char *end, pp_span *args, int max,
+                              int *nargs) {
+    int depth = 0, n = 0;
+    const char *arg = ++p;
+    for (; p < end; ++p) {
+        if (*p == '(') {
+            ++depth;
+        } else if ((*p == ',' && !depth) || (*p == ')' && !depth)) {
+            if (n < max)
+                args[n] = trim_span(arg, p);
+            ++n;
+            arg = p + 1;
+            if (*p == ')') {
+                *nargs = n;
+                return p + 1;
+            }
+        } else if (*p == ')') {
+            --depth;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Body of m with its parameters replaced, into out. Arguments are macro
+ * expanded first except next to ##, which pastes the raw text.
+ */
+static int subst_body(pp_state *st, const macro *m, const pp_span *args, pp_buf *out,
+                      const pp_hide *hide, int level) {
+    const char *p = m->value, *end = m->value + m->value_len;
+    int pasting = 0; /* the last thing emitted was followed by ## */
+    while (p < end) {
+        if (end - p >= 2 && p[0] == '#' && p[1] == '#') {
+            while (out->len && isspace((unsigned char)out->data[out->len - 1]))
+                out->data[--out->len] = '\0';
+            p = skip_ws(p + 2, end);
+            pasting = 1;
+            continue;
+        }
+        if (!ident_start((unsigned char)*p)) {
+            const char *s = p++;
+            while (p < end && !ident_start((unsigned char)*p) && *p != '#')
+                ++p;
+            if (buf_append(st, out, s, (size_t)(p - s)))
+                return -1;
+            pasting = 0;
+            continue;
+        }
+        const char *s = p;
+        p = skip_ident(p, end);
+        size_t n = (size_t)(p - s);
+        int idx = -1;
+        for (int i = 0; i < m->nparams && idx < 0; ++i)
+            if (m->params[i].n == n && !memcmp(m->params[i].s, s, n))
+                idx = i;
+        const char *next = skip_ws(p, end);
+        int raw = pasting || (end - next >= 2 && next[0] == '#' && next[1] == '#');
+        pasting = 0;
+        int rc = idx < 0   ? buf_append(st, out, s, n)
+                 : raw     ? buf_append(st, out, args[idx].s, args[idx].n)
+                           : expand(st, args[idx].s, args[idx].s + args[idx].n, out, hide, level);
+        if (rc)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Append [cur, end) to out with macros expanded. Replacements are rescanned
+ * with the macro hidden, as in C; text between them is copied as one run.
+ * Function-like calls must close on the same line. level picks the scratch
+ * buffer for substituted bodies.
+ */
+static int expand(pp_state *st, const char *cur, const char *end, pp_buf *out,
+                  const pp_hide *hide, int level) {
+    const char *run = cur;
+    if (!has_macros(st))
+        cur = end;
+    while (cur < end) {
+        if (!ident_start((unsigned char)*cur)) {
             ++cur;
-            while (isalnum((unsigned char)*cur) || *cur == '_')
-                ++cur;
-            size_t tok_len = (size_t)(cur - start);
-            const char *replace = NULL;
-            for (size_t i = 0; i < sb_count(macros); ++i) {
-                if (strlen(macros[i].name) == tok_len &&
-                    strncmp(start, macros[i].name, tok_len) == 0) {
-                    replace = macros[i].value;
-                    break;
-                }
+            continue;
+        }
+        const char *start = cur;
+        cur = skip_ident(cur, end);
+        const macro *m = find_macro(st, start, (size_t)(cur - start));
+        if (!m || hidden(hide, m))
+            continue;
+        pp_span args[32];
+        int nargs = 0;
+        const char *after = cur;
+        if (m->nparams >= 0) {
+            const char *open = skip_ws(cur, end);
+            if (open >= end || *open != '(')
+                continue; /* a function-like name without a call is left alone */
+            after = parse_args(open, end, args, 32, &nargs);
+            if (!after) {
+                pp_fail(st, "unterminated call to macro '%.*s'", m->name, m->name_len);
+                return -1;
             }
-            if (replace) {
-                size_t rlen = strlen(replace);
-                out = realloc(out, out_len + rlen + 1);
-                memcpy(out + out_len, replace, rlen);
-                out_len += rlen;
-            } else {
-                out = realloc(out, out_len + tok_len + 1);
-                memcpy(out + out_len, start, tok_len);
-                out_len += tok_len;
+            if (nargs == 1 && !m->nparams && !args[0].n)
+                nargs = 0;
+            if (nargs != m->nparams) {
+                pp_fail(st, "wrong number of arguments to macro '%.*s'", m->name, m->name_len);
+                return -1;
             }
+        }
+        if (buf_append(st, out, run, (size_t)(start - run)))
+            return -1;
+        pp_hide h = {m, hide};
+        if (!m->plain && level >= PP_MAX_EXPANSION) {
+            pp_fail(st, "macro '%.*s' nests too deeply", m->name, m->name_len);
+            return -1;
+        }
+        if (m->nparams < 0 && m->plain) {
+            if (buf_append(st, out, m->value, m->value_len))
+                return -1;
+        } else if (m->nparams < 0) {
+            if (expand(st, m->value, m->value + m->value_len, out, &h, level + 1))
+                return -1;
         } else {
-            out = realloc(out, out_len + 2);
-            out[out_len++] = *cur++;
+            pp_buf *body = &st->scratch[level];
+            body->len = 0;
+            if (buf_append(st, body, "", 0) || subst_body(st, m, args, body, hide, level + 1) ||
+                expand(st, body->data, body->data + body->len, out, &h, level + 1))
+                return -1;
         }
+        cur = run = after;
     }
-    if (!out) {
-        out = util_strdup("");
-    } else {
-        out[out_len] = '\0';
+    return buf_append(st, out, run, (size_t)(end - run));
+}
+
+/* "#define NAME value" or "#define NAME(a, b) body", starting after the keyword */
+static int define_macro(pp_state *st, const char *p, const char *end) {
+    p = skip_ws(p, end);
+    const char *ns = p;
+    p = skip_ident(p, end);
+    if (p == ns || !ident_start((unsigned char)*ns)) {
+        pp_fail(st, "bad macro name in '#define %.*s'", ns, (size_t)(end - ns));
+        return -1;
+    }
+    size_t n = (size_t)(p - ns);
+    pp_span params[32];
+    int nparams = -1;
+    if (p < end && *p == '(') {
+        nparams = 0;
+        p = skip_ws(p + 1, end);
+        while (p < end && *p != ')') {
+            const char *s = p;
+            p = skip_ident(p, end);
+            if (p == s || nparams == 32) {
+                pp_fail(st, "bad parameter list of macro '%.*s'", ns, n);
+                return -1;
+            }
+            params[nparams++] = (pp_span){s, (size_t)(p - s)};
+            p = skip_ws(p, end);
+            if (p < end && *p == ',')
+                p = skip_ws(p + 1, end);
+        }
+        if (p >= end) {
+            pp_fail(st, "bad parameter list of macro '%.*s'", ns, n);
+            return -1;
+        }
+        ++p;
     }
-    return out;
+    pp_span v = trim_span(p, end);
+    if (add_macro(st, ns, n, params, nparams, v.s, v.n)) {
+        pp_fail(st, "out of memory%.*s", "", 0);
+        return -1;
+    }
+    return 0;
+}
+
+/* #if expressions: C integer arithmetic on intmax_t; `live` is 0 in a
+ * branch that short-circuiting skips, where division by zero is allowed */
+typedef struct pp_expr {
+    const char *p, *end;
+    int bad, div0;
+} pp_expr;
+
+static long long expr_cond(pp_expr *x, int live);
+
+static int expr_peek(pp_expr *x, const char *tok) {
+    x->p = skip_ws(x->p, x->end);
+    size_t n = strlen(tok);
+    return (size_t)(x->end - x->p) >= n && !memcmp(x->p, tok, n);
+}
+
+static long long expr_unary(pp_expr *x, int live) {
+    x->p = skip_ws(x->p, x->end);
+    if (x->p >= x->end) {
+        x->bad = 1;
+        return 0;
+    }
+    char c = *x->p;
+    if (c == '(') {
+        ++x->p;
+        long long v = expr_cond(x, live);
+        if (!expr_peek(x, ")"))
+            x->bad = 1;
+        else
+            ++x->p;
+        return v;
+    }
+    if (c == '!' || c == '~' || c == '-' || c == '+') {
+        ++x->p;
+        long long v = expr_unary(x, live);
+        return c == '!' ? !v : c == '~' ? ~v : c == '-' ? (long long)(0ull - (unsigned long long)v) : v;
+    }
+    if (ident_start((unsigned char)c)) { /* identifiers left after expansion are 0 */
+        x->p = skip_ident(x->p, x->end);
+        return 0;
+    }
+    if (c >= '0' && c <= '9') {
+        char *e = NULL;
+        long long v = (long long)strtoull(x->p, &e, 0);
+        x->p = e;
+        while (x->p < x->end && (*x->p == 'u' || *x->p == 'U' || *x->p == 'l' || *x->p == 'L'))
+            ++x->p;
+        return v;
+    }
+    x->bad = 1;
+    return 0;
+}
+
+/* binary operators by precedence, loosest first */
+static const struct {
+    const char *tok;
+    int prec;
+} k_binops[] = {
+    {"||", 1}, {"&&", 2}, {"|", 3},  {"^", 4},  {"&", 5},  {"==", 6}, {"!=", 6},
+    {"<=", 7}, {">=", 7}, {"<<", 8}, {">>", 8}, {"<", 7},  {">", 7},  {"+", 9},
+    {"-", 9},  {"*", 10}, {"/", 10}, {"%", 10},
+};
+
+static int expr_binop(pp_expr *x, int min_prec) {
+    for (size_t i = 0; i < sizeof(k_binops) / sizeof(k_binops[0]); ++i) {
+        if (k_binops[i].prec < min_prec || !expr_peek(x, k_binops[i].tok))
+            continue;
+        /* "|" must not take the first half of "||", and so on */
+        size_t n = strlen(k_binops[i].tok);
+        if (n == 1 && x->end - x->p > 1 && (x->p[1] == x->p[0] || x->p[1] == '=') &&
+            (x->p[0] == '|' || x->p[0] == '&' || x->p[0] == '<' || x->p[0] == '>'))
+            continue;
+        return (int)i;
+    }
+    return -1;
 }
-static char *path_dir(const char *path) {
+
+static long long expr_binary(pp_expr *x, int min_prec, int live) {
+    long long l = expr_unary(x, live);
+    int op;
+    while (!x->bad && (op = expr_binop(x, min_prec)) >= 0) {
+        const char *tok = k_binops[op].tok;
+        x->p += strlen(tok);
+        int rlive = live && (strcmp(tok, "&&") ? strcmp(tok, "||") || !l : l);
+        long long r = expr_binary(x, k_binops[op].prec + 1, rlive);
+        if ((tok[0] == '/' || tok[0] == '%') && !r) {
+            x->div0 |= rlive;
+            r = 1;
+        }
+        switch (tok[0] * 256 + tok[1]) {
+        case '|' * 256 + '|': l = l || r; break;
+        case '&' * 256 + '&': l = l && r; break;
+        case '|' * 256: l |= r; break;
+        case '^' * 256: l ^= r; break;
+        case '&' * 256: l &= r; break;
+        case '=' * 256 + '=': l = l == r; break;
+        case '!' * 256 + '=': l = l != r; break;
+        case '<' * 256 + '=': l = l <= r; break;
+        case '>' * 256 + '=': l = l >= r; break;
+        case '<' * 256 + '<': l = (long long)((unsigned long long)l << (r & 63)); break;
+        case '>' * 256 + '>': l >>= r & 63; break;
+        case '<' * 256: l = l < r; break;
+        case '>' * 256: l = l > r; break;
+        case '+' * 256: l = (long long)((unsigned long long)l + (unsigned long long)r); break;
+        case '-' * 256: l = (long long)((unsigned long long)l - (unsigned long long)r); break;
+        case '*' * 256: l = (long long)((unsigned long long)l * (unsigned long long)r); break;
+        case '/' * 256: l = r == -1 ? (long long)(0ull - (unsigned long long)l) : l / r; break;
+        default: l = r == -1 ? 0 : l % r; break;
+        }
+    }
+    return l;
+}
+
+static long long expr_cond(pp_expr *x, int live) {
+    long long c = expr_binary(x, 1, live);
+    if (x->bad || !expr_peek(x, "?"))
+        return c;
+    ++x->p;
+    long long a = expr_cond(x, live && c);
+    if (!expr_peek(x, ":")) {
+        x->bad = 1;
+        return 0;
+    }
+    ++x->p;
+    long long b = expr_cond(x, live && !c);
+    return c ? a : b;
+}
+
+/* value of the #if/#elif expression in [p, end); -1 on error */
+static int eval_if(pp_state *st, const char *p, const char *end) {
+    /* `defined X` and `defined(X)` are resolved before macro expansion */
+    pp_buf *pre = &st->expr[0], *post = &st->expr[1];
+    pre->len = post->len = 0;
+    const char *text = skip_ws(p, end), *run = p;
+    while (p < end) {
+        if (!ident_start((unsigned char)*p)) {
+            ++p;
+            continue;
+        }
+        const char *s = p;
+        p = skip_ident(p, end);
+        if (p - s != 7 || memcmp(s, "defined", 7))
+            continue;
+        const char *q = skip_ws(p, end);
+        int paren = q < end && *q == '(';
+        if (paren)
+            q = skip_ws(q + 1, end);
+        const char *ns = q;
+        q = skip_ident(q, end);
+        if (q == ns) {
+            pp_fail(st, "bad #if expression: %.*s", text, (size_t)(end - text));
+            return -1;
+        }
+        const char *ne = q;
+        if (paren) {
+            q = skip_ws(q, end);
+            if (q >= end || *q != ')') {
+                pp_fail(st, "bad #if expression: %.*s", text, (size_t)(end - text));
+                return -1;
+            }
+            ++q;
+        }
+        const char *v = find_macro(st, ns, (size_t)(ne - ns)) ? " 1 " : " 0 ";
+        if (buf_append(st, pre, run, (size_t)(s - run)) || buf_append(st, pre, v, 3))
+            return -1;
+        p = run = q;
+    }
+    if (buf_append(st, pre, run, (size_t)(end - run)) ||
+        expand(st, pre->data, pre->data + pre->len, post, NULL, 0))
+        return -1;
+    pp_expr x = {post->data, post->data + post->len, 0, 0};
+    long long v = expr_cond(&x, 1);
+    if (x.bad || skip_ws(x.p, x.end) != x.end) {
+        pp_fail(st, "bad #if expression: %.*s", text, (size_t)(end - text));
+        return -1;
+    }
+    if (x.div0) {
+        pp_fail(st, "division by zero in #if %.*s", text, (size_t)(end - text));
+        return -1;
+    }
+    return v != 0;
+}
+
+static char *path_dir(util_arena *a, const char *path) {
     const char *slash = strrchr(path, '/');
 #ifdef _WIN32
     const char *bslash = strrchr(path, '\\');
@@ -83,135 +625,680 @@ static char *path_dir(const char *path) {
         slash = bslash;
 #endif
     if (!slash)
-        return util_strdup(".");
-    return util_strndup(path, (size_t)(slash - path));
+        return util_arena_strndup(a, ".", 1);
+    return util_arena_strndup(a, path, (size_t)(slash - path));
+}
+
+/* 1 when a line mentions a watched name */
+static int watched(const pp_state *st, const char *p, const char *end) {
+    while (p < end) {
+        if (!ident_start((unsigned char)*p)) {
+            ++p;
+            continue;
+        }
+        const char *s = p;
+        p = skip_ident(p, end);
+        uint64_t h = util_hash64(s, (size_t)(p - s), 0);
+        for (size_t i = 0; i < st->nwatch; ++i)
+            if (st->watch[i] == h)
+                return 1;
+    }
+    return 0;
+}
+
+static int is_active(const pp_state *st) {
+    return !st->ncond || st->cond[st->ncond - 1].state == COND_ACTIVE;
+}
+
+/* #if/#ifdef/#ifndef/#elif/#else/#endif; base is the stack depth of the file */
+static int conditional(pp_state *st, const char *kw, size_t kn, const char *p, const char *end,
+                       size_t base) {
+    int is_if = kn == 2 && !memcmp(kw, "if", 2);
+    int is_ifdef = kn == 5 && !memcmp(kw, "ifdef", 5);
+    int is_ifndef = kn == 6 && !memcmp(kw, "ifndef", 6);
+    if (is_if || is_ifdef || is_ifndef) {
+        if (st->ncond == PP_MAX_IF_DEPTH) {
+            pp_fail(st, "#if nesting too deep%.*s", "", 0);
+            return -1;
+        }
+        int take = 0;
+        if (!is_active(st)) {
+            take = -2; /* the whole group is skipped */
+        } else if (is_if) {
+            take = eval_if(st, p, end);
+        } else {
+            const char *s = skip_ws(p, end), *e = skip_ident(s, end);
+            if (e == s) {
+                pp_fail(st, "#%.*s without a macro name", kw, kn);
+                return -1;
+            }
+            take = !find_macro(st, s, (size_t)(e - s)) != !is_ifndef;
+        }
+        if (take == -1)
+            return -1;
+        st->cond[st->ncond++] =
+            (pp_cond){take == 1 ? COND_ACTIVE : take == 0 ? COND_SEEKING : COND_DONE, 0};
+        return 0;
+    }
+    if (st->ncond == base) {
+        pp_fail(st, "#%.*s without #if", kw, kn);
+        return -1;
+    }
+    pp_cond *c = &st->cond[st->ncond - 1];
+    if (kn == 5 && !memcmp(kw, "endif", 5)) {
+        st->ncond--;
+        return 0;
+    }
+    if (c->seen_else) {
+        pp_fail(st, "#%.*s after #else", kw, kn);
+        return -1;
+    }
+    if (kn == 4 && !memcmp(kw, "else", 4)) {
+        c->seen_else = 1;
+        c->state = c->state == COND_SEEKING ? COND_ACTIVE : COND_DONE;
+        return 0;
+    }
+    /* #elif */
+    if (c->state == COND_ACTIVE) {
+        c->state = COND_DONE;
+    } else if (c->state == COND_SEEKING) {
+        int take = eval_if(st, p, end);
+        if (take < 0)
+            return -1;
+        c->state = take ? COND_ACTIVE : COND_SEEKING;
+    }
+    return 0;
+}
+
+static int is_conditional(const char *kw, size_t kn) {
+    static const char *const k_kw[] = {"if", "ifdef", "ifndef", "elif", "else", "endif"};
+    for (size_t i = 0; i < sizeof(k_kw) / sizeof(k_kw[0]); ++i)
+        if (strlen(k_kw[i]) == kn && !memcmp(k_kw[i], kw, kn))
+            return 1;
+    return 0;
+}
+
+/* hand one finished line to the sink; a nonzero return stops the run */
+static int sink_line(pp_state *st, const char *s, size_t n) {
+    return st->sink(st->sink_ctx, s ? s : "", n) ? -1 : 0;
+}
+
+/* expand the source line [ls, le) into out, or straight into the sink */
+static int emit_line(pp_state *st, const char *ls, const char *le, pp_buf *out) {
+    if (!st->sink)
+        return expand(st, ls, le, out, NULL, 0) || buf_append(st, out, "\n", 1);
+    if (!has_macros(st))
+        return sink_line(st, ls, (size_t)(le - ls));
+    st->line.len = 0;
+    if (expand(st, ls, le, &st->line, NULL, 0))
+        return -1;
+    return sink_line(st, st->line.data, st->line.len);
+}
+
+/* already expanded text of whole lines, as emit_line() */
+static int emit_text(pp_state *st, const char *s, size_t n, pp_buf *out) {
+    if (!st->sink)
+        return buf_append(st, out, s, n);
+    for (const char *end = s + n, *nl; s < end; s = nl + 1) {
+        nl = memchr(s, '\n', (size_t)(end - s));
+        if (!nl)
+            nl = end;
+        if (sink_line(st, s, (size_t)(nl - s)))
+            return -1;
+    }
+    return 0;
 }
 
-static char *process(const char *src_path, const char *src, const char *inc_dir, const char *cur_dir,
-                     macro **macros, char **err) {
-    char *out = NULL;
-    size_t out_len = 0;
+/* record where a watched name stopped the run: before any open top-level #if */
+static void stop(pp_state *st, const char *line) {
+    st->stopped = 1;
+    if (!st->depth)
+        st->stop_at = st->ncond ? st->if_start : line;
+}
+
+static int process(pp_state *st, const char *src, const char *end, const char *cur_dir,
+                   pp_buf *out);
+
+/* lines of [src, end) inside a file whose #if groups start at base; a NUL
+ * byte also ends the input */
+static int process_lines(pp_state *st, const char *src, const char *end, const char *cur_dir,
+                         pp_buf *out, size_t base) {
     const char *cur = src;
-    while (*cur) {
+    while (cur < end && *cur) {
         const char *ls = cur;
-        while (*cur && *cur != '\n')
-            ++cur;
-        size_t ll = cur - ls;
-        if (*cur == '\n')
+        cur = util_find2(cur, end, '\n', '\0');
+        const char *le = cur;
+        if (cur < end && *cur == '\n')
             ++cur;
-        char *line = util_strndup(ls, ll);
-        const char *trim = skip_ws(line);
-        if (*trim == '#') {
-            trim++;
-            if (!strncmp(trim, "include", 7)) {
-                trim += 7;
-                trim = skip_ws(trim);
-                if (*trim == '\"') {
-                    const char *p = ++trim;
-                    while (*trim && *trim != '\"')
-                        ++trim;
-                    char *inc_name = util_strndup(p, trim - p);
-                    char path[260];
-                    snprintf(path, sizeof(path), "%s/%s", cur_dir ? cur_dir : ".", inc_name);
-                    char *inc_src = read_file(path);
-                    if (!inc_src && inc_dir) {
-                        snprintf(path, sizeof(path), "%s/%s", inc_dir, inc_name);
-                        inc_src = read_file(path);
-                    }
-                    if (!inc_src) {
-                        util_asprintf(err, "Could not open include '%s'", inc_name);
-                        free(inc_name);
-                        free(line);
-                        free(out);
-                        return NULL;
-                    }
-                    char *child_dir = path_dir(path);
-                    char *inc_out = process(path, inc_src, inc_dir, child_dir, macros, err);
-                    free(child_dir);
-                    if (!inc_out) {
-                        free(inc_src);
-                        free(inc_name);
-                        free(line);
-                        return NULL;
-                    }
-                    size_t inc_len = strlen(inc_out);
-                    char *tmp = realloc(out, out_len + inc_len + 1);
-                    if (!tmp) {
-                        util_asprintf(err, "out of memory");
-                        free(out);
-                        free(inc_src);
-                        free(inc_out);
-                        free(inc_name);
-                        free(line);
-                        return NULL;
-                    }
-                    out = tmp;
-                    memcpy(out + out_len, inc_out, inc_len);
-                    out_len += inc_len;
-                    out[out_len] = '\0';
-                    free(inc_src);
-                    free(inc_out);
-                    free(inc_name);
-                }
-            } else if (!strncmp(trim, "define", 6)) {
-                trim += 6;
-                trim = skip_ws(trim);
-                const char *ns = trim;
-                while (*trim && !isspace((unsigned char)*trim))
-                    ++trim;
-                char *name = util_strndup(ns, trim - ns);
-                trim = skip_ws(trim);
-                char *val = util_strdup(trim);
-                macro m = {name, val};
-                sb_push(*macros, m);
+        if (st->nwatch && watched(st, ls, le)) {
+            stop(st, ls);
+            return 0;
+        }
+        const char *trim = skip_ws(ls, le);
+        if (trim >= le || *trim != '#') {
+            if (is_active(st) && emit_line(st, ls, le, out))
+                return -1;
+            continue;
+        }
+        const char *kw = skip_ws(trim + 1, le);
+        const char *p = skip_ident(kw, le);
+        size_t kn = (size_t)(p - kw);
+        if (is_conditional(kw, kn)) {
+            if (!st->depth && !st->ncond)
+                st->if_start = ls;
+            if (conditional(st, kw, kn, p, le, base))
+                return -1;
+            continue;
+        }
+        if (!is_active(st))
+            continue;
+        if (kn == 7 && !memcmp(kw, "include", 7)) {
+            p = skip_ws(p, le);
+            if (p >= le || *p != '\"')
+                continue;
+            const char *name = ++p;
+            while (p < le && *p != '\"')
+                ++p;
+            size_t name_len = (size_t)(p - name);
+            st->search[0] = cur_dir ? cur_dir : ".";
+            const pp_file *f = pp_include_open(st->includes, st->search, st->nsearch, name,
+                                               name_len);
+            if (!f) {
+                pp_fail(st, "Could not open include '%.*s'", name, name_len);
+                return -1;
             }
-        } else {
-            char *exp = subst_macros(line, *macros);
-            size_t l = strlen(exp);
-            char *tmp = realloc(out, out_len + l + 2);
-            if (!tmp) {
-                util_asprintf(err, "out of memory");
-                free(out);
-                free(exp);
-                free(line);
-                return NULL;
+            if (st->deps) {
+                pp_dep d = {util_strdup(f->path), f->hash};
+                sb_push(*st->deps, d);
+            }
+            char *child_dir = path_dir(st->arena, f->path);
+            size_t open_conds = st->ncond;
+            st->depth++;
+            int rc = !child_dir || process(st, f->data, f->data + f->len, child_dir, out);
+            st->depth--;
+            pp_include_close(st->includes, f);
+            if (rc)
+                return -1;
+            if (st->stopped) {
+                if (!st->depth)
+                    st->stop_at = open_conds ? st->if_start : ls;
+                return 0;
+            }
+        } else if (kn == 6 && !memcmp(kw, "define", 6)) {
+            if (define_macro(st, p, le))
+                return -1;
+        } else if (kn == 5 && !memcmp(kw, "undef", 5)) {
+            const char *s = skip_ws(p, le), *e = skip_ident(s, le);
+            if (e > s && add_macro(st, s, (size_t)(e - s), NULL, -1, NULL, 0)) {
+                pp_fail(st, "out of memory%.*s", "", 0);
+                return -1;
             }
-            out = tmp;
-            memcpy(out + out_len, exp, l);
-            out_len += l;
-            out[out_len++] = '\n';
-            out[out_len] = '\0';
-            free(exp);
         }
-        free(line);
     }
-    if (!out)
-        out = util_strdup("");
-    return out;
+    return 0;
 }
-char *pp_run(const char *src_p, const char *inc_dir, char **err) {
-    char *s = read_file(src_p);
+
+/* preprocess the whole file [src, end) */
+static int process(pp_state *st, const char *src, const char *end, const char *cur_dir,
+                   pp_buf *out) {
+    size_t base = st->ncond;
+    if (process_lines(st, src, end, cur_dir, out, base))
+        return -1;
+    if (st->stopped)
+        return 0;
+    if (st->ncond != base) {
+        pp_fail(st, "unterminated #if%.*s", "", 0);
+        return -1;
+    }
+    return 0;
+}
+
+/* "NAME" (defined as 1) or "NAME=value", like a compiler's -D */
+static int predefine(pp_state *st, const char *def) {
+    const char *eq = strchr(def, '=');
+    size_t n = eq ? (size_t)(eq - def) : strlen(def);
+    const char *val = eq ? eq + 1 : "1";
+    char *line = util_arena_alloc(st->arena, n + strlen(val) + 2);
+    if (!line) {
+        pp_fail(st, "out of memory%.*s", "", 0);
+        return -1;
+    }
+    memcpy(line, def, n);
+    line[n] = ' ';
+    strcpy(line + n + 1, val);
+    return define_macro(st, line, line + strlen(line));
+}
+
+/* hash of the first n of cfg's predefined macros */
+static uint64_t defines_key(const pp_config *cfg, size_t n) {
+    uint64_t h = 0;
+    for (size_t i = 0; i < n; ++i)
+        h = util_hash64(cfg->defines[i], strlen(cfg->defines[i]) + 1, h);
+    return h;
+}
+
+static size_t count_defines(const pp_config *cfg) {
+    size_t n = 0;
+    while (cfg && cfg->defines && cfg->defines[n])
+        ++n;
+    return n;
+}
+
+/* define cfg's predefined macros from the first-th on */
+static int predefine_from(pp_state *st, const pp_config *cfg, size_t first) {
+    for (size_t i = first; i < count_defines(cfg); ++i)
+        if (predefine(st, cfg->defines[i]))
+            return -1;
+    return 0;
+}
+
+/* include search list of cfg; slot 0 is filled per include with the current dir */
+static int init_paths(pp_state *st, util_arena *a, const pp_config *cfg, char **err) {
+    *st = (pp_state){.arena = a,
+                     .includes = cfg && cfg->includes ? cfg->includes : pp_include_cache_default(),
+                     .deps = cfg ? cfg->deps : NULL,
+                     .err = err};
+    size_t npaths = 0;
+    while (cfg && cfg->include_paths && cfg->include_paths[npaths])
+        ++npaths;
+    st->search = util_arena_alloc(a, (npaths + 2) * sizeof(*st->search));
+    if (!st->includes || !st->search) {
+        pp_fail(st, "out of memory%.*s", "", 0);
+        return -1;
+    }
+    st->search[st->nsearch++] = NULL;
+    if (cfg && cfg->include_dir)
+        st->search[st->nsearch++] = cfg->include_dir;
+    for (size_t i = 0; i < npaths; ++i)
+        st->search[st->nsearch++] = cfg->include_paths[i];
+    return 0;
+}
+
+static int init_state(pp_state *st, util_arena *a, const pp_config *cfg, char **err) {
+    return init_paths(st, a, cfg, err) || predefine_from(st, cfg, 0) ? -1 : 0;
+}
+
+static uint64_t search_key(const pp_state *st, const char *dir) {
+    uint64_t h = util_hash64(dir ? dir : ".", strlen(dir ? dir : ".") + 1, 0);
+    for (size_t i = 1; i < st->nsearch; ++i)
+        h = util_hash64(st->search[i], strlen(st->search[i]) + 1, h);
+    return h;
+}
+
+/* the run starts with the snapshot's predefined macros, and any it adds are
+ * names the prelude never saw */
+static int defines_fit(const pp_snapshot *snap, const pp_config *cfg) {
+    size_t n = count_defines(cfg);
+    if (n < snap->ndefines || defines_key(cfg, snap->ndefines) != snap->defines_key)
+        return 0;
+    for (size_t k = snap->ndefines; k < n; ++k) {
+        const char *d = cfg->defines[k], *eq = strchr(d, '=');
+        uint64_t h = util_hash64(d, eq ? (size_t)(eq - d) : strlen(d), 0);
+        size_t i = 0;
+        while (i < snap->nfree && snap->free_names[i] != h)
+            ++i;
+        if (i == snap->nfree)
+            return 0;
+    }
+    return 1;
+}
+
+/* snap covers the start of src and every include it read is unchanged */
+static int snapshot_applies(const pp_snapshot *snap, const pp_state *st, const pp_config *cfg,
+                            const char *src, const char *dir) {
+    if (strncmp(src, snap->prelude, snap->prelude_len) ||
+        search_key(st, dir) != snap->search_key || !defines_fit(snap, cfg))
+        return 0;
+    for (size_t i = 0; i < snap->ndeps; ++i) {
+        const pp_file *f = pp_include_open_path(st->includes, snap->deps[i].path);
+        int same = f && f->hash == snap->deps[i].hash;
+        pp_include_close(st->includes, f);
+        if (!same)
+            return 0;
+    }
+    return 1;
+}
+
+/* start from the config's snapshot when it covers src: its output, deps and macros */
+static int resume(pp_state *st, const pp_config *cfg, const char **src, const char *dir,
+                  pp_buf *out) {
+    const pp_snapshot *snap = cfg ? cfg->snapshot : NULL;
+    if (!snap || !snapshot_applies(snap, st, cfg, *src, dir))
+        return 0;
+    if (emit_text(st, snap->out, snap->out_len, out))
+        return -1;
+    for (size_t i = 0; st->deps && i < snap->ndeps; ++i) {
+        pp_dep d = {util_strdup(snap->deps[i].path), snap->deps[i].hash};
+        sb_push(*st->deps, d);
+    }
+    st->base = snap;
+    *src += snap->prelude_len;
+    atomic_fetch_add(&((pp_snapshot *)snap)->resumed, 1);
+    return 0;
+}
+
+/* run over src into out, or into fn when it is set; scratch memory comes from a */
+static int run_into(const char *src, const char *cur_dir_of, const pp_config *cfg, util_arena *a,
+                    pp_line_fn fn, void *ctx, pp_buf *out, char **err) {
+    pp_state st;
+    char *dir = cur_dir_of ? path_dir(a, cur_dir_of) : NULL;
+    if (init_paths(&st, a, cfg, err))
+        return -1;
+    st.sink = fn;
+    st.sink_ctx = ctx;
+    if (cur_dir_of && !dir) {
+        pp_fail(&st, "out of memory%.*s", "", 0);
+        return -1;
+    }
+    /* a snapshot's table already holds the final state of the defines it was
+     * made with, whatever its prelude did to them */
+    if (resume(&st, cfg, &src, dir, out) ||
+        predefine_from(&st, cfg, st.base ? st.base->ndefines : 0) ||
+        process(&st, src, src + strlen(src), dir, out))
+        return -1;
+    return fn ? 0 : buf_append(&st, out, "", 0);
+}
+
+/* run over src; the result lives in cfg->arena when given, else it is malloc'd */
+static char *run(const char *src, const char *cur_dir_of, const pp_config *cfg, char **err) {
+    util_arena local = {0};
+    util_arena *a = cfg && cfg->arena ? cfg->arena : &local;
+    pp_buf out = {0};
+    char *o = NULL;
+    if (!run_into(src, cur_dir_of, cfg, a, NULL, NULL, &out, err))
+        o = a == &local ? util_strndup(out.data, out.len) : out.data;
+    util_arena_free(&local);
+    return o;
+}
+
+/* hashes of the NULL-terminated names, in the arena */
+static uint64_t *hash_names(util_arena *a, const char *const *names, size_t *n) {
+    *n = 0;
+    while (names && names[*n])
+        ++*n;
+    uint64_t *h = util_arena_alloc(a, (*n + 1) * sizeof(*h));
+    for (size_t i = 0; h && i < *n; ++i)
+        h[i] = util_hash64(names[i], strlen(names[i]), 0);
+    return h;
+}
+
+/* preprocess prelude into snap; deps collects the includes it read */
+static int snapshot_fill(pp_snapshot *snap, const char *prelude, size_t len, const char *dir,
+                         const pp_config *cfg, pp_dep **deps, char **err) {
+    pp_config c = cfg ? *cfg : (pp_config){0};
+    c.deps = deps;
+    c.snapshot = NULL;
+    pp_state st;
+    if (init_state(&st, &snap->arena, &c, err))
+        return -1;
+    /* resuming splits the source after the prelude, so it must end a line */
+    char *text = util_arena_alloc(&snap->arena, len + 2);
+    if (!text) {
+        pp_fail(&st, "out of memory%.*s", "", 0);
+        return -1;
+    }
+    memcpy(text, prelude, len);
+    if (len && text[len - 1] != '\n')
+        text[len++] = '\n';
+    text[len] = '\0';
+    pp_buf out = {0};
+    if (process(&st, text, text + len, dir, &out) || buf_append(&st, &out, "", 0))
+        return -1;
+    size_t ndeps = sb_count(*deps);
+    snap->deps = util_arena_alloc(&snap->arena, (ndeps + 1) * sizeof(*snap->deps));
+    if (!snap->deps) {
+        pp_fail(&st, "out of memory%.*s", "", 0);
+        return -1;
+    }
+    for (size_t i = 0; i < ndeps; ++i) {
+        const char *path = (*deps)[i].path;
+        pp_dep d = {util_arena_strndup(&snap->arena, path, strlen(path)), (*deps)[i].hash};
+        if (!d.path) {
+            pp_fail(&st, "out of memory%.*s", "", 0);
+            return -1;
+        }
+        snap->deps[snap->ndeps++] = d;
+    }
+    snap->prelude = text;
+    snap->prelude_len = len;
+    snap->search_key = search_key(&st, dir);
+    snap->ndefines = count_defines(cfg);
+    snap->defines_key = defines_key(cfg, snap->ndefines);
+    snap->table = st.table;
+    snap->table_cap = st.table_cap;
+    snap->nmacros = st.nmacros;
+    snap->out = out.data;
+    snap->out_len = out.len;
+    return 0;
+}
+
+static pp_snapshot *snapshot_new(const char *text, size_t len, const char *dir,
+                                 const pp_config *cfg, const char *const *free_names,
+                                 char **err) {
+    pp_snapshot *snap = calloc(1, sizeof(*snap));
+    if (!snap) {
+        if (err)
+            *err = util_strdup("out of memory");
+        return NULL;
+    }
+    pp_dep *deps = NULL;
+    snap->free_names = hash_names(&snap->arena, free_names, &snap->nfree);
+    if (!snap->free_names) {
+        if (err)
+            *err = util_strdup("out of memory");
+        pp_snapshot_destroy(snap);
+        return NULL;
+    }
+    if (snapshot_fill(snap, text, len, dir, cfg, &deps, err)) {
+        pp_snapshot_destroy(snap);
+        snap = NULL;
+    }
+    pp_deps_free(deps);
+    return snap;
+}
+
+pp_snapshot *pp_snapshot_create(const char *prelude, const char *dir, const pp_config *cfg,
+                                char **err) {
+    if (!prelude) {
+        if (err)
+            *err = util_strdup("prelude null");
+        return NULL;
+    }
+    return snapshot_new(prelude, strlen(prelude), dir, cfg, NULL, err);
+}
+
+pp_snapshot *pp_snapshot_create_for(const char *src, const char *dir, const pp_config *cfg,
+                                    const char *const *keys, char **err) {
+    if (!src) {
+        if (err)
+            *err = util_strdup("source null");
+        return NULL;
+    }
+    /* a dry run stops at the first line that names a key */
+    util_arena scratch = {0};
+    pp_config c = cfg ? *cfg : (pp_config){0};
+    c.deps = NULL;
+    c.snapshot = NULL;
+    pp_state st;
+    pp_buf out = {0};
+    size_t len = 0;
+    int rc = init_state(&st, &scratch, &c, err);
+    if (!rc && !(st.watch = hash_names(&scratch, keys, &st.nwatch)))
+        rc = -1;
+    if (!rc)
+        rc = process(&st, src, src + strlen(src), dir, &out);
+    if (!rc)
+        len = st.stopped ? (size_t)(st.stop_at - src) : strlen(src);
+    util_arena_free(&scratch);
+    return rc ? NULL : snapshot_new(src, len, dir, cfg, keys, err);
+}
+
+uint64_t pp_snapshot_resumed(const pp_snapshot *snap) {
+    return atomic_load(&((pp_snapshot *)snap)->resumed);
+}
+
+void pp_snapshot_destroy(pp_snapshot *snap) {
+    if (!snap)
+        return;
+    util_arena_free(&snap->arena);
+    free(snap);
+}
+
+char *pp_run_cfg(const char *src_p, const pp_config *cfg, char **err) {
+    util_arena local = {0};
+    util_arena *a = cfg && cfg->arena ? cfg->arena : &local;
+    size_t len = 0;
+    char *s = read_file(a, src_p, &len);
     if (!s) {
-        *err = util_strdup("Could not read source file");
+        if (err)
+            *err = util_strdup("Could not read source file");
+        util_arena_free(&local);
         return NULL;
     }
-    char *dir = path_dir(src_p);
-    macro *macros = NULL;
-    char *o = process(src_p, s, inc_dir, dir, &macros, err);
-    macros_free(macros);
-    free(dir);
-    free(s);
+    char *o = run(s, src_p, cfg, err);
+    util_arena_free(&local);
     return o;
 }
 
-char *pp_run_string(const char *src, const char *inc_dir, char **err) {
+char *pp_run_string_cfg(const char *src, const pp_config *cfg, char **err) {
     if (!src) {
         if (err)
             *err = util_strdup("source null");
         return NULL;
     }
-    macro *macros = NULL;
-    char *o = process(NULL, src, inc_dir, NULL, &macros, err);
-    macros_free(macros);
-    return o;
+    return run(src, NULL, cfg, err);
+}
+
+int pp_stream_cfg(const char *src_p, const pp_config *cfg, pp_line_fn fn, void *ctx,
+                  char **err) {
+    util_arena local = {0};
+    util_arena *a = cfg && cfg->arena ? cfg->arena : &local;
+    size_t len = 0;
+    char *s = read_file(a, src_p, &len);
+    int rc = -1;
+    if (!s) {
+        if (err)
+            *err = util_strdup("Could not read source file");
+    } else {
+        rc = run_into(s, src_p, cfg, a, fn, ctx, NULL, err);
+    }
+    util_arena_free(&local);
+    return rc;
+}
+
+int pp_stream_string_cfg(const char *src, const pp_config *cfg, pp_line_fn fn, void *ctx,
+                         char **err) {
+    if (!src) {
+        if (err)
+            *err = util_strdup("source null");
+        return -1;
+    }
+    util_arena local = {0};
+    int rc = run_into(src, NULL, cfg, cfg && cfg->arena ? cfg->arena : &local, fn, ctx, NULL, err);
+    util_arena_free(&local);
+    return rc;
+}
+
+char *pp_run(const char *src_p, const char *inc_dir, char **err) {
+    pp_config cfg = {.include_dir = inc_dir};
+    return pp_run_cfg(src_p, &cfg, err);
+}
+
+char *pp_run_string(const char *src, const char *inc_dir, char **err) {
+    pp_config cfg = {.include_dir = inc_dir};
+    return pp_run_string_cfg(src, &cfg, err);
+}
+
+/*
+ * Push runs keep one pp_state across feeds. Complete lines are processed in
+ * place from the caller's chunk; a trailing partial line waits in `carry`
+ * until its newline arrives.
+ */
+struct pp_push {
+    util_arena local;
+    pp_state st;
+    pp_buf carry;
+    int failed;
+};
+
+pp_push *pp_push_begin(const pp_config *cfg, pp_line_fn fn, void *ctx, char **err) {
+    pp_push *p = calloc(1, sizeof(*p));
+    if (!p) {
+        if (err)
+            *err = util_strdup("out of memory");
+        return NULL;
+    }
+    if (init_state(&p->st, cfg && cfg->arena ? cfg->arena : &p->local, cfg, err)) {
+        pp_push_free(p);
+        return NULL;
+    }
+    p->st.sink = fn;
+    p->st.sink_ctx = ctx;
+    return p;
+}
+
+static int push_lines(pp_push *p, const char *s, const char *end) {
+    if (process_lines(&p->st, s, end, NULL, NULL, 0))
+        p->failed = 1;
+    return -p->failed;
+}
+
+int pp_push_feed(pp_push *p, const char *data, size_t len, char **err) {
+    if (p->failed)
+        return -1;
+    p->st.err = err;
+    const char *end = data + len;
+    if (p->carry.len) {
+        const char *nl = memchr(data, '\n', len);
+        const char *take = nl ? nl + 1 : end;
+        if (buf_append(&p->st, &p->carry, data, (size_t)(take - data))) {
+            p->failed = 1;
+            return -1;
+        }
+        if (!nl)
+            return 0;
+        size_t n = p->carry.len;
+        p->carry.len = 0;
+        if (push_lines(p, p->carry.data, p->carry.data + n))
+            return -1;
+        data = take;
+    }
+    const char *last = end;
+    while (last > data && last[-1] != '\n')
+        --last;
+    if (last > data && push_lines(p, data, last))
+        return -1;
+    if (buf_append(&p->st, &p->carry, last, (size_t)(end - last))) {
+        p->failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+int pp_push_finish(pp_push *p, char **err) {
+    if (p->failed)
+        return -1;
+    p->st.err = err;
+    if (p->carry.len && push_lines(p, p->carry.data, p->carry.data + p->carry.len))
+        return -1;
+    p->carry.len = 0;
+    if (p->st.ncond) {
+        pp_fail(&p->st, "unterminated #if%.*s", "", 0);
+        p->failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+void pp_push_free(pp_push *p) {
+    if (!p)
+        return;
+    util_arena_free(&p->local);
+    free(p);
+}
+
+void pp_deps_free(pp_dep *deps) {
+    for (size_t i = 0; i < sb_count(deps); ++i)
+        free(deps[i].path);
+    sb_free(deps);
 }
@@ -0,0 +1,165 @@
+#include "ring.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * spsc: plain slots; each side owns one index and caches the other's, so
+ * it only touches the shared line when the cached value says full/empty.
+ *
+ * mpmc: Vyukov's scheme. Slot i carries a sequence number that is pos
+ * while free for position pos, pos + 1 once filled, and pos + capacity
+ * once read. A batch claims the run of ready slots starting at the index
+ * with one CAS; nobody else can touch that run until the CAS moves the
+ * index, so the ready check made before it still holds afterwards.
+ */
+
+#define SEQ_BYTES sizeof(atomic_size_t)
+
+static atomic_size_t *slot_seq(const ring_buffer *r, size_t pos) {
+    return (atomic_size_t *)(r->slots + (pos & r->mask) * r->stride);
+}
+
+static unsigned char *slot_data(const ring_buffer *r, size_t pos) {
+    return r->slots + (pos & r->mask) * r->stride + (r->spsc ? 0 : SEQ_BYTES);
+}
+
+int ring_init(ring_buffer *r, size_t elem_size, size_t capacity, int spsc) {
+    size_t cap = 2;
+    while (cap < capacity)
+        cap *= 2;
+    memset(r, 0, sizeof(*r));
+    r->elem = elem_size;
+    r->spsc = spsc;
+    r->stride = spsc ? elem_size : (SEQ_BYTES + elem_size + 7) & ~(size_t)7;
+    r->mask = cap - 1;
+    size_t bytes = (cap * r->stride + 63) & ~(size_t)63;
+    r->slots = aligned_alloc(64, bytes ? bytes : 64);
+    if (!r->slots)
+        return -1;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    for (size_t i = 0; !spsc && i < cap; ++i)
+        atomic_init(slot_seq(r, i), i);
+    return 0;
+}
+
+void ring_destroy(ring_buffer *r) {
+    free(r->slots);
+    r->slots = NULL;
+}
+
+/* copy n items between the ring, starting at pos, and a flat array */
+static void copy_in(ring_buffer *r, size_t pos, const unsigned char *src, size_t n) {
+    if (!r->spsc) {
+        for (size_t i = 0; i < n; ++i)
+            memcpy(slot_data(r, pos + i), src + i * r->elem, r->elem);
+        return;
+    }
+    size_t first = r->mask + 1 - (pos & r->mask);
+    if (first > n)
+        first = n;
+    memcpy(slot_data(r, pos), src, first * r->elem);
+    memcpy(r->slots, src + first * r->elem, (n - first) * r->elem);
+}
+
+static void copy_out(const ring_buffer *r, size_t pos, unsigned char *dst, size_t n) {
+    if (!r->spsc) {
+        for (size_t i = 0; i < n; ++i)
+            memcpy(dst + i * r->elem, slot_data(r, pos + i), r->elem);
+        return;
+    }
+    size_t first = r->mask + 1 - (pos & r->mask);
+    if (first > n)
+        first = n;
+    memcpy(dst, slot_data(r, pos), first * r->elem);
+    memcpy(dst + first * r->elem, r->slots, (n - first) * r->elem);
+}
+
+static size_t spsc_push(ring_buffer *r, const void *items, size_t n) {
+    size_t cap = r->mask + 1;
+    size_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    if (cap - (t - r->head_cache) < n)
+        r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+    size_t room = cap - (t - r->head_cache);
+    if (n > room)
+        n = room;
+    if (n) {
+        copy_in(r, t, items, n);
+        atomic_store_explicit(&r->tail, t + n, memory_order_release);
+    }
+    return n;
+}
+
+static size_t spsc_pop(ring_buffer *r, void *out, size_t max, size_t *pos) {
+    size_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    *pos = h;
+    if (r->tail_cache - h < max)
+        r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+    size_t n = r->tail_cache - h;
+    if (n > max)
+        n = max;
+    if (n) {
+        copy_out(r, h, out, n);
+        atomic_store_explicit(&r->head, h + n, memory_order_release);
+    }
+    return n;
+}
+
+/* mpmc: claim up to n slots from index *at whose sequence is pos + ready
+ * (0 for producers, 1 for consumers); *pos receives the first position */
+static size_t mpmc_claim(ring_buffer *r, atomic_size_t *at, size_t n, size_t ready,
+                         size_t *pos) {
+    size_t p = atomic_load_explicit(at, memory_order_relaxed);
+    for (;;) {
+        size_t k = 0;
+        while (k < n &&
+               atomic_load_explicit(slot_seq(r, p + k), memory_order_acquire) == p + k + ready)
+            ++k;
+        if (!k) {
+            size_t seq = atomic_load_explicit(slot_seq(r, p), memory_order_acquire);
+            if ((intptr_t)(seq - (p + ready)) < 0)
+                return 0; /* full, or empty */
+            p = atomic_load_explicit(at, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(at, &p, p + k, memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+            *pos = p;
+            return k;
+        }
+    }
+}
+
+size_t ring_push_many(ring_buffer *r, const void *items, size_t n) {
+    if (!n) /* the mpmc ready check would never fail */
+        return 0;
+    if (r->spsc)
+        return spsc_push(r, items, n);
+    size_t pos = 0;
+    n = mpmc_claim(r, &r->tail, n, 0, &pos);
+    copy_in(r, pos, items, n);
+    for (size_t i = 0; i < n; ++i)
+        atomic_store_explicit(slot_seq(r, pos + i), pos + i + 1, memory_order_release);
+    return n;
+}
+
+size_t ring_pop_many_at(ring_buffer *r, void *out, size_t max, size_t *pos) {
+    if (!max) {
+        *pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+        return 0;
+    }
+    if (r->spsc)
+        return spsc_pop(r, out, max, pos);
+    *pos = 0;
+    max = mpmc_claim(r, &r->head, max, 1, pos);
+    copy_out(r, *pos, out, max);
+    for (size_t i = 0; i < max; ++i)
+        atomic_store_explicit(slot_seq(r, *pos + i), *pos + i + r->mask + 1, memory_order_release);
+    return max;
+}
+
+size_t ring_pop_many(ring_buffer *r, void *out, size_t max) {
+    size_t pos;
+    return ring_pop_many_at(r, out, max, &pos);
+}
@@ -1,10 +1,11 @@
 #include "runtime_pipeline.h"
 #include "dx8asm_parser.h"
 #include "dx8gles11.h"
+#include "dx8gles11_internal.h"
+#include "chunk_pool.h"
+#include "ring.h"
 #include "utils.h"
 #include <threads.h>
-#include <stdarg.h>
-#include <stdalign.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,12 +20,6 @@
 #define GL_DEPTH_COMPONENT 0x1902
 #endif
 
-/* translator provided by dx8_to_gles11.c */
-extern void translate_instr(const asm_instr *restrict, GLES_CommandList *restrict);
-
-static alignas(64) _Thread_local char g_err[256] = "";
-/* per-thread counter tracking active pipeline starts */
-static _Thread_local unsigned g_started = 0;
 
 #define PIPELINE_MIN_THREADS 1
 #define PIPELINE_MAX_THREADS 8
@@ -36,236 +31,407 @@ typedef struct pipeline_stats {
     size_t commands;
 } pipeline_stats;
 
+/* workers stop once their queue is drained after pipeline_stop() and the
+ * stage feeding them has stopped too. Work moves as whole programs: decode
+ * packs parsed programs into chunks, prepare translates each program as a
+ * unit and packs the command lists into chunks of its own, and the rings
+ * carry chunk pointers. Chunks come from a bounded pool per stage and the
+ * consumer returns them, so a stage that runs out waits for the next one to
+ * catch up. Prepare workers hand their output on in the order their input
+ * left the ring, whose position serves as sequence number, so dispatch sees
+ * programs in queue order with each one's commands together. */
+#define PROG_CHUNKS 8
+#define CMD_CHUNKS 16
+#define CHUNK_PROGS 64
+#define CHUNK_INSTRS 256 /* vs.1.1 allows 128 */
+#define CHUNK_CONSTS 64
+#define CHUNK_CMDS 256
+
+struct prog_chunk {
+    size_t nprogs, ninstrs, nconsts;
+    struct {
+        asm_shader_type type;
+        uint32_t count, const_count;
+    } progs[CHUNK_PROGS];
+    asm_instr code[CHUNK_INSTRS];
+    asm_constant consts[CHUNK_CONSTS];
+};
+
+struct cmd_chunk {
+    size_t count;
+    gles_cmd items[CHUNK_CMDS];
+};
+
 typedef struct decode_ctx {
+    pipeline *p;
     lf_queue *decode_q;
-    lf_queue *prepare_q;
-    asm_instr *buffer;
+    ring_buffer *prepare_q;
+    chunk_pool *prog_pool;
 } decode_ctx;
 
 typedef struct prepare_ctx {
-    lf_queue *prepare_q;
-    lf_queue *dispatch_q;
-    gles_cmd *buffer;
+    pipeline *p;
+    ring_buffer *prepare_q;
+    ring_buffer *dispatch_q;
+    chunk_pool *prog_pool;
+    chunk_pool *cmd_pool;
+    uint32_t caps;
 } prepare_ctx;
 
 typedef struct dispatch_ctx {
-    lf_queue *dispatch_q;
+    pipeline *p;
+    ring_buffer *dispatch_q;
+    chunk_pool *cmd_pool;
     pipeline_stats *stats;
+    uint32_t caps;
 } dispatch_ctx;
 
+/* a free chunk, waiting for the next stage to release one if need be */
+static void *acquire_chunk(chunk_pool *cp) {
+    void *c;
+    while (!(c = chunk_acquire(cp)))
+        thrd_yield();
+    return c;
+}
+
+/* rings hold as many pointers as the pool has chunks, so this rarely waits */
+static void push_chunk(ring_buffer *r, void *c) {
+    while (ring_push(r, &c))
+        thrd_yield();
+}
+
+/* 1 and a diagnostic when the context lacks the extension behind bit */
+static int missing(uint32_t caps, uint32_t bit) {
+    if (caps & bit)
+        return 0;
+    fprintf(stderr, "missing GL extension: %s\n", dx8gles11_caps_name(bit));
+    return 1;
+}
+
+/* append prog to the decoder's chunk, handing the chunk on when full */
+static void pack_program(decode_ctx *ctx, struct prog_chunk **cur, const asm_program *prog) {
+    if (prog->count > CHUNK_INSTRS || prog->const_count > CHUNK_CONSTS) {
+        fprintf(stderr, "shader too long for the pipeline: %zu instructions, %zu constants\n",
+                prog->count, prog->const_count);
+        return;
+    }
+    struct prog_chunk *c = *cur;
+    if (c && (c->nprogs == CHUNK_PROGS || c->ninstrs + prog->count > CHUNK_INSTRS ||
+              c->nconsts + prog->const_count > CHUNK_CONSTS)) {
+        push_chunk(ctx->prepare_q, c);
+        c = NULL;
+    }
+    if (!c) {
+        c = acquire_chunk(ctx->prog_pool);
+        c->nprogs = c->ninstrs = c->nconsts = 0;
+    }
+    c->progs[c->nprogs].type = prog->type;
+    c->progs[c->nprogs].count = (uint32_t)prog->count;
+    c->progs[c->nprogs].const_count = (uint32_t)prog->const_count;
+    c->nprogs++;
+    if (prog->count)
+        memcpy(c->code + c->ninstrs, prog->code, prog->count * sizeof(*prog->code));
+    if (prog->const_count)
+        memcpy(c->consts + c->nconsts, prog->consts, prog->const_count * sizeof(*prog->consts));
+    c->ninstrs += prog->count;
+    c->nconsts += prog->const_count;
+    *cur = c;
+}
+
 static void decode_worker(void *arg) {
     decode_ctx *restrict ctx = arg;
+    struct prog_chunk *c = NULL; /* filled until full or idle */
     for (;;) {
         char *src = lf_queue_pop(ctx->decode_q);
         if (!src) {
-            if (!g_started)
+            if (c) {
+                push_chunk(ctx->prepare_q, c);
+                c = NULL;
+            }
+            /* recheck after the stop: a push may have raced the first pop */
+            if (!atomic_load(&ctx->p->running) && !(src = lf_queue_pop(ctx->decode_q)))
                 break;
-            thrd_yield();
-            continue;
+            if (!src) {
+                thrd_yield();
+                continue;
+            }
         }
 
         asm_program prog = {0};
         char *err = NULL;
-        if (asm_parse(src, &prog, &err) == 0) {
-            for (size_t i = 0; i < prog.count; ++i) {
-                sb_push(ctx->buffer, prog.code[i]);
-                asm_instr *in = &ctx->buffer[sb_count(ctx->buffer) - 1];
-                lf_queue_push(ctx->prepare_q, in);
-            }
-        }
+        if (asm_parse(src, &prog, &err) == 0)
+            pack_program(ctx, &c, &prog);
         free(err);
         asm_program_free(&prog);
     }
-    sb_free(ctx->buffer);
+    if (c)
+        push_chunk(ctx->prepare_q, c);
+    atomic_fetch_sub(&ctx->p->live_decode, 1);
     free(ctx);
 }
 
+/* pack the translated programs, ending at ends[0..n), into command chunks;
+ * only a program longer than a chunk is split, over consecutive chunks */
+static void hand_on(prepare_ctx *ctx, const GLES_CommandList *list, const size_t *ends, size_t n) {
+    struct cmd_chunk *c = NULL;
+    size_t at = 0;
+    for (size_t i = 0; i < n; ++i) {
+        size_t len = ends[i] - at;
+        if (c && c->count + len > CHUNK_CMDS) {
+            push_chunk(ctx->dispatch_q, c);
+            c = NULL;
+        }
+        while (len) {
+            if (!c) {
+                c = acquire_chunk(ctx->cmd_pool);
+                c->count = 0;
+            }
+            size_t k = len < CHUNK_CMDS - c->count ? len : CHUNK_CMDS - c->count;
+            memcpy(c->items + c->count, list->data + at, k * sizeof(*c->items));
+            c->count += k;
+            at += k;
+            len -= k;
+            if (len) {
+                push_chunk(ctx->dispatch_q, c);
+                c = NULL;
+            }
+        }
+    }
+    if (c)
+        push_chunk(ctx->dispatch_q, c);
+}
+
 static void prepare_worker(void *arg) {
     prepare_ctx *restrict ctx = arg;
     GLES_CommandList list = {0};
+    size_t ends[CHUNK_PROGS];
+    struct prog_chunk *in;
+    size_t seq;
     for (;;) {
-        asm_instr *in = lf_queue_pop(ctx->prepare_q);
-        if (!in) {
-            if (!g_started)
-                break;
-            thrd_yield();
-            continue;
+        if (!ring_pop_many_at(ctx->prepare_q, &in, 1, &seq)) {
+            /* recheck after the stop: a push may have raced the first pop */
+            int live = atomic_load(&ctx->p->live_decode);
+            if (!ring_pop_many_at(ctx->prepare_q, &in, 1, &seq)) {
+                if (!live)
+                    break;
+                thrd_yield();
+                continue;
+            }
         }
-        translate_instr(in, &list);
-        for (size_t i = 0; i < list.count; ++i) {
-            sb_push(ctx->buffer, list.data[i]);
-            gles_cmd *out = &ctx->buffer[sb_count(ctx->buffer) - 1];
-            lf_queue_push(ctx->dispatch_q, out);
+        size_t n = 0, code = 0, consts = 0;
+        for (size_t i = 0; i < in->nprogs; ++i) {
+            asm_program prog = {
+                .type = in->progs[i].type,
+                .code = in->code + code,
+                .count = in->progs[i].count,
+                .consts = in->consts + consts,
+                .const_count = in->progs[i].const_count,
+            };
+            code += prog.count;
+            consts += prog.const_count;
+            /* programs failing validation are dropped whole */
+            if (translate_program_caps(&prog, ctx->caps, &list) == 0)
+                ends[n++] = list.count;
         }
-        gles_cmdlist_free(&list);
+        chunk_release(ctx->prog_pool, in);
+        /* translated in parallel, handed on in ring order; the chunk ahead
+         * of this one is held by a worker that already popped it */
+        while (atomic_load_explicit(&ctx->p->next_seq, memory_order_acquire) != seq)
+            thrd_yield();
+        hand_on(ctx, &list, ends, n);
+        atomic_store_explicit(&ctx->p->next_seq, seq + 1, memory_order_release);
+        sb_clear(list.data);
+        list.count = 0;
     }
-    sb_free(ctx->buffer);
+    gles_cmdlist_free(&list);
+    atomic_fetch_sub(&ctx->p->live_prepare, 1);
     free(ctx);
 }
 
+/* issue one command on the calling thread's GL context */
+static void dispatch_cmd(const gles_cmd *c, uint32_t caps) {
+    switch (c->type) {
+    case GLES_CMD_COLOR4F:
+        glEnableClientState(GL_COLOR_ARRAY);
+        break;
+    case GLES_CMD_TEX_ENVF:
+        glTexEnvf(GL_TEXTURE_ENV, c->u[0], c->f[0]);
+        break;
+    case GLES_CMD_TEX_ENV_COMBINE:
+        if ((c->u[1] == GL_MAX_EXT || c->u[1] == GL_MIN_EXT) &&
+            missing(caps, DX8GLES11_CAP_BLEND_MINMAX))
+            break;
+        glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, c->u[0]);
+        glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_RGB, c->u[1]);
+        glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_ALPHA, c->u[1]);
+        break;
+    case GLES_CMD_MULTITEXCOORD4F:
+        glClientActiveTexture(c->u[0]);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        break;
+    case GLES_CMD_BIND_VBO:
+        if (missing(caps, DX8GLES11_CAP_VBO))
+            break;
+        glBindBuffer(GL_ARRAY_BUFFER, c->u[0]);
+        break;
+    case GLES_CMD_VERTEX_ATTRIB:
+        if (c->u[0] == 0) {
+            glEnableClientState(GL_VERTEX_ARRAY);
+            glVertexPointer(3, GL_FLOAT, 0, 0);
+        } else if (c->u[0] == 1) {
+            glEnableClientState(GL_COLOR_ARRAY);
+            glColorPointer(4, GL_UNSIGNED_BYTE, 0, 0);
+        }
+        break;
+    case GLES_CMD_MATRIX_MODE:
+        glMatrixMode(c->u[0]);
+        break;
+    case GLES_CMD_MATRIX_LOAD:
+        glLoadMatrixf(c->f);
+        break;
+    case GLES_CMD_TEX_MATRIX_MODE:
+        glActiveTexture(GL_TEXTURE0 + c->u[0]);
+        glMatrixMode(GL_TEXTURE);
+        break;
+    case GLES_CMD_TEX_MATRIX_LOAD:
+        glActiveTexture(GL_TEXTURE0 + c->u[0]);
+        glLoadMatrixf(c->f);
+        break;
+    case GLES_CMD_LOAD_IDENTITY:
+        glLoadIdentity();
+        break;
+    case GLES_CMD_LOAD_CONSTANT:
+        glColor4f(c->f[0], c->f[1], c->f[2], c->f[3]);
+        break;
+    case GLES_CMD_TEX_IMAGE_2D:
+        if (missing(caps, DX8GLES11_CAP_TEXTURE_NPOT))
+            break;
+        if (c->u[3])
+            glCompressedTexImage2D(GL_TEXTURE_2D, 0, c->u[2], c->u[0],
+                                    c->u[1], 0, 0, NULL);
+        else
+            glTexImage2D(GL_TEXTURE_2D, 0, c->u[2], c->u[0], c->u[1], 0,
+                         c->u[2], GL_UNSIGNED_BYTE, NULL);
+        break;
+    case GLES_CMD_TEX_IMAGE_3D:
+#ifdef GL_OES_texture_3D
+        if (missing(caps, DX8GLES11_CAP_TEXTURE_3D))
+            break;
+        glTexImage3DOES(GL_TEXTURE_3D_OES, 0, c->u[3], c->u[0], c->u[1],
+                        c->u[2], 0, c->u[3], GL_UNSIGNED_BYTE, NULL);
+#endif
+        break;
+    case GLES_CMD_TEX_IMAGE_DEPTH:
+        if (missing(caps, DX8GLES11_CAP_DEPTH_TEXTURE))
+            break;
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, c->u[0], c->u[1],
+                     0, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, NULL);
+        break;
+    default:
+        break;
+    }
+}
+
 static void dispatch_worker(void *arg) {
     dispatch_ctx *restrict ctx = arg;
     pipeline_stats *s = ctx->stats;
     memset(s, 0, sizeof(*s));
     timespec_get(&s->start, TIME_UTC);
 
+    struct cmd_chunk *c;
     for (;;) {
-        gles_cmd *c = lf_queue_pop(ctx->dispatch_q);
-        if (!c) {
-            if (!g_started)
-                break;
-            thrd_yield();
-            continue;
-        }
-
-        switch (c->type) {
-        case GLES_CMD_COLOR4F:
-            glEnableClientState(GL_COLOR_ARRAY);
-            break;
-        case GLES_CMD_TEX_ENVF:
-            glTexEnvf(GL_TEXTURE_ENV, c->u[0], c->f[0]);
-            break;
-        case GLES_CMD_TEX_ENV_COMBINE:
-            if ((c->u[1] == GL_MAX_EXT || c->u[1] == GL_MIN_EXT) &&
-                !dx8gles11_has_extension("GL_EXT_blend_minmax")) {
-                fprintf(stderr, "%s\n", dx8gles11_error());
-                break;
+        if (ring_pop(ctx->dispatch_q, &c)) {
+            /* recheck after the stop: a push may have raced the first pop */
+            int live = atomic_load(&ctx->p->live_prepare);
+            if (ring_pop(ctx->dispatch_q, &c)) {
+                if (!live)
+                    break;
+                thrd_yield();
+                continue;
             }
-            glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, c->u[0]);
-            glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_RGB, c->u[1]);
-            glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_ALPHA, c->u[1]);
-            break;
-        case GLES_CMD_MULTITEXCOORD4F:
-            glClientActiveTexture(c->u[0]);
-            glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-            break;
-        case GLES_CMD_BIND_VBO:
-            if (!dx8gles11_has_extension("GL_OES_vertex_buffer_object")) {
-                fprintf(stderr, "%s\n", dx8gles11_error());
-                break;
-            }
-            glBindBuffer(GL_ARRAY_BUFFER, c->u[0]);
-            break;
-        case GLES_CMD_VERTEX_ATTRIB:
-            if (c->u[0] == 0) {
-                glEnableClientState(GL_VERTEX_ARRAY);
-                glVertexPointer(3, GL_FLOAT, 0, 0);
-            } else if (c->u[0] == 1) {
-                glEnableClientState(GL_COLOR_ARRAY);
-                glColorPointer(4, GL_UNSIGNED_BYTE, 0, 0);
-            }
-            break;
-        case GLES_CMD_MATRIX_MODE:
-            glMatrixMode(c->u[0]);
-            break;
-        case GLES_CMD_MATRIX_LOAD:
-            glLoadMatrixf(c->f);
-            break;
-        case GLES_CMD_TEX_MATRIX_MODE:
-            glActiveTexture(GL_TEXTURE0 + c->u[0]);
-            glMatrixMode(GL_TEXTURE);
-            break;
-        case GLES_CMD_TEX_MATRIX_LOAD:
-            glActiveTexture(GL_TEXTURE0 + c->u[0]);
-            glLoadMatrixf(c->f);
-            break;
-        case GLES_CMD_LOAD_IDENTITY:
-            glLoadIdentity();
-            break;
-        case GLES_CMD_LOAD_CONSTANT:
-            glColor4f(c->f[0], c->f[1], c->f[2], c->f[3]);
-            break;
-        case GLES_CMD_TEX_IMAGE_2D:
-            if (!dx8gles11_has_extension("GL_OES_texture_npot")) {
-                fprintf(stderr, "%s\n", dx8gles11_error());
-                break;
-            }
-            if (c->u[3])
-                glCompressedTexImage2D(GL_TEXTURE_2D, 0, c->u[2], c->u[0],
-                                        c->u[1], 0, 0, NULL);
-            else
-                glTexImage2D(GL_TEXTURE_2D, 0, c->u[2], c->u[0], c->u[1], 0,
-                             c->u[2], GL_UNSIGNED_BYTE, NULL);
-            break;
-        case GLES_CMD_TEX_IMAGE_3D:
-#ifdef GL_OES_texture_3D
-            if (!dx8gles11_has_extension("GL_OES_texture_3D")) {
-                fprintf(stderr, "%s\n", dx8gles11_error());
-                break;
-            }
-            glTexImage3DOES(GL_TEXTURE_3D_OES, 0, c->u[3], c->u[0], c->u[1],
-                            c->u[2], 0, c->u[3], GL_UNSIGNED_BYTE, NULL);
-#endif
-            break;
-        case GLES_CMD_TEX_IMAGE_DEPTH:
-            if (!dx8gles11_has_extension("GL_OES_depth_texture")) {
-                fprintf(stderr, "%s\n", dx8gles11_error());
-                break;
-            }
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, c->u[0], c->u[1],
-                         0, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, NULL);
-            break;
-        default:
-            break;
         }
-
-        s->commands++;
+        if (ctx->p->trace)
+            ctx->p->trace(ctx->p->trace_user, c->items, c->count);
+        for (size_t i = 0; i < c->count; ++i)
+            dispatch_cmd(&c->items[i], ctx->caps);
+        s->commands += c->count;
+        chunk_release(ctx->cmd_pool, c);
     }
     free(ctx);
 }
 
-static void set_err(const char *fmt, ...) {
-    va_list ap;
-    va_start(ap, fmt);
-    vsnprintf(g_err, sizeof(g_err), fmt, ap);
-    va_end(ap);
+static void set_err(const char *msg) { dx8gles11_set_error(msg); }
+
+static void destroy_queues(pipeline *p) {
+    lf_queue_destroy(&p->decode_q);
+    ring_destroy(&p->prepare_q);
+    ring_destroy(&p->dispatch_q);
+    chunk_pool_destroy(&p->prog_pool);
+    chunk_pool_destroy(&p->cmd_pool);
 }
 
 static int pipeline_init_internal(pipeline *p, int decode_threads,
-                                 int prepare_threads, int dispatch_threads) {
+                                 int prepare_threads, int dispatch_threads,
+                                 int render) {
     if (!p)
         return -1;
-    if (lf_queue_init(&p->decode_q) || lf_queue_init(&p->prepare_q) ||
-        lf_queue_init(&p->dispatch_q)) {
-        set_err("queue init failed");
-        lf_queue_destroy(&p->decode_q);
-        lf_queue_destroy(&p->prepare_q);
-        lf_queue_destroy(&p->dispatch_q);
-        return -1;
-    }
-
     if (decode_threads < PIPELINE_MIN_THREADS)
         decode_threads = PIPELINE_MIN_THREADS;
     if (prepare_threads < PIPELINE_MIN_THREADS)
         prepare_threads = PIPELINE_MIN_THREADS;
     if (dispatch_threads < PIPELINE_MIN_THREADS)
         dispatch_threads = PIPELINE_MIN_THREADS;
-    if (dispatch_threads > PIPELINE_MAX_THREADS)
-        dispatch_threads = PIPELINE_MAX_THREADS;
+    if (dispatch_threads > PIPELINE_MAX_THREADS || render)
+        dispatch_threads = render ? 1 : PIPELINE_MAX_THREADS;
 
+    atomic_init(&p->running, 0);
+    atomic_init(&p->live_decode, 0);
+    atomic_init(&p->live_prepare, 0);
     p->decode_threads = decode_threads;
     p->prepare_threads = prepare_threads;
     p->num_threads = dispatch_threads;
+    p->render = render;
+
+    /* single-threaded ends get the cheaper spsc rings */
+    memset(&p->decode_q, 0, sizeof(p->decode_q));
+    memset(&p->prepare_q, 0, sizeof(p->prepare_q));
+    memset(&p->dispatch_q, 0, sizeof(p->dispatch_q));
+    memset(&p->prog_pool, 0, sizeof(p->prog_pool));
+    memset(&p->cmd_pool, 0, sizeof(p->cmd_pool));
+    p->render_chunk = NULL;
+    p->render_pos = 0;
+    p->trace = NULL;
+    p->trace_user = NULL;
+    atomic_init(&p->next_seq, 0);
+    if (lf_queue_init(&p->decode_q) ||
+        ring_init(&p->prepare_q, sizeof(struct prog_chunk *), PROG_CHUNKS,
+                  decode_threads == 1 && prepare_threads == 1) ||
+        ring_init(&p->dispatch_q, sizeof(struct cmd_chunk *), CMD_CHUNKS,
+                  prepare_threads == 1 && dispatch_threads == 1) ||
+        chunk_pool_init(&p->prog_pool, sizeof(struct prog_chunk), PROG_CHUNKS) ||
+        chunk_pool_init(&p->cmd_pool, sizeof(struct cmd_chunk), CMD_CHUNKS)) {
+        set_err("queue init failed");
+        destroy_queues(p);
+        return -1;
+    }
 
-    size_t stats_sz = (size_t)p->num_threads * sizeof(*p->stats);
+    /* aligned_alloc() wants a multiple of the alignment */
+    size_t stats_sz = ((size_t)p->num_threads * sizeof(*p->stats) + 63) & ~(size_t)63;
     p->stats = aligned_alloc(64, stats_sz);
     if (p->stats)
         memset(p->stats, 0, stats_sz);
     if (!p->stats) {
         set_err("stats alloc failed");
-        lf_queue_destroy(&p->decode_q);
-        lf_queue_destroy(&p->prepare_q);
-        lf_queue_destroy(&p->dispatch_q);
+        destroy_queues(p);
         return -1;
     }
 
-    int total_threads = p->decode_threads + p->prepare_threads + p->num_threads;
+    /* in render mode the dispatch "worker" is the caller */
+    int total_threads = p->decode_threads + p->prepare_threads + (render ? 0 : p->num_threads);
     if (mt_pool_init(&p->workers, total_threads)) {
         set_err("thread pool init failed");
         free(p->stats);
-        lf_queue_destroy(&p->decode_q);
-        lf_queue_destroy(&p->prepare_q);
-        lf_queue_destroy(&p->dispatch_q);
+        destroy_queues(p);
         return -1;
     }
     return 0;
@@ -273,18 +439,32 @@ static int pipeline_init_internal(pipeline *p, int decode_threads,
 
 /* initialize a pipeline; applications typically use 2-4 threads */
 int pipeline_init(pipeline *p, int num_threads) {
-    return pipeline_init_internal(p, 1, 1, num_threads);
+    return pipeline_init_internal(p, 1, 1, num_threads, 0);
 }
 
 int pipeline_init_stages(pipeline *p, int decode_threads, int prepare_threads,
                          int dispatch_threads) {
     return pipeline_init_internal(p, decode_threads, prepare_threads,
-                                 dispatch_threads);
+                                 dispatch_threads, 0);
+}
+
+int pipeline_init_render(pipeline *p, int decode_threads, int prepare_threads) {
+    return pipeline_init_internal(p, decode_threads, prepare_threads, 1, 1);
 }
 
 int pipeline_start(pipeline *p) {
     if (!p)
         return -1;
+    /* probed once here, on the thread that owns the GL context */
+    uint32_t caps = translate_caps(NULL);
+    atomic_store(&p->live_decode, p->decode_threads);
+    atomic_store(&p->live_prepare, p->prepare_threads);
+    atomic_store(&p->running, 1);
+    if (p->render) {
+        p->render_caps = caps;
+        memset(p->stats, 0, sizeof(*p->stats));
+        timespec_get(&p->stats->start, TIME_UTC);
+    }
 
     decode_ctx **dctx = calloc((size_t)p->decode_threads, sizeof(*dctx));
     prepare_ctx **pct = calloc((size_t)p->prepare_threads, sizeof(*pct));
@@ -303,8 +483,10 @@ int pipeline_start(pipeline *p) {
             set_err("ctx alloc failed");
             return -1;
         }
+        dctx[i]->p = p;
         dctx[i]->decode_q = &p->decode_q;
         dctx[i]->prepare_q = &p->prepare_q;
+        dctx[i]->prog_pool = &p->prog_pool;
         if (mt_pool_submit(&p->workers, decode_worker, dctx[i])) {
             set_err("submit failed");
             return -1;
@@ -317,22 +499,29 @@ int pipeline_start(pipeline *p) {
             set_err("ctx alloc failed");
             return -1;
         }
+        pct[i]->p = p;
         pct[i]->prepare_q = &p->prepare_q;
         pct[i]->dispatch_q = &p->dispatch_q;
+        pct[i]->prog_pool = &p->prog_pool;
+        pct[i]->cmd_pool = &p->cmd_pool;
+        pct[i]->caps = caps;
         if (mt_pool_submit(&p->workers, prepare_worker, pct[i])) {
             set_err("submit failed");
             return -1;
         }
     }
 
-    for (int i = 0; i < p->num_threads; ++i) {
+    for (int i = 0; !p->render && i < p->num_threads; ++i) {
         dispatch[i] = calloc(1, sizeof(**dispatch));
         if (!dispatch[i]) {
             set_err("ctx alloc failed");
             return -1;
         }
+        dispatch[i]->p = p;
         dispatch[i]->dispatch_q = &p->dispatch_q;
+        dispatch[i]->cmd_pool = &p->cmd_pool;
         dispatch[i]->stats = &p->stats[i];
+        dispatch[i]->caps = caps;
         if (mt_pool_submit(&p->workers, dispatch_worker, dispatch[i])) {
             set_err("submit failed");
             return -1;
@@ -342,25 +531,58 @@ int pipeline_start(pipeline *p) {
     free(dispatch);
     free(pct);
     free(dctx);
-    g_started++;
     return 0;
 }
 
+int pipeline_render(pipeline *p, int max) {
+    if (!p || !p->render) {
+        set_err("not a render pipeline");
+        return -1;
+    }
+    /* a chunk cut short by max is kept for the next call */
+    size_t n = 0;
+    while (max <= 0 || n < (size_t)max) {
+        struct cmd_chunk *c = p->render_chunk;
+        if (!c && ring_pop(&p->dispatch_q, &c))
+            break;
+        size_t end = c->count;
+        if (max > 0 && end - p->render_pos > (size_t)max - n)
+            end = p->render_pos + ((size_t)max - n);
+        if (p->trace)
+            p->trace(p->trace_user, c->items + p->render_pos, end - p->render_pos);
+        for (size_t i = p->render_pos; i < end; ++i)
+            dispatch_cmd(&c->items[i], p->render_caps);
+        n += end - p->render_pos;
+        p->render_chunk = end < c->count ? c : NULL;
+        p->render_pos = end < c->count ? end : 0;
+        if (end == c->count)
+            chunk_release(&p->cmd_pool, c);
+    }
+    p->stats->commands += n;
+    return (int)n;
+}
+
 void pipeline_stop(pipeline *p) {
     if (!p)
         return;
-    if (g_started) {
-        g_started--;
-        mt_pool_join(&p->workers);
+    if (!atomic_exchange(&p->running, 0))
+        return;
+    /* prepare workers may be waiting on a full ring; keep it moving */
+    while (p->render) {
+        int live = atomic_load(&p->live_prepare);
+        if (!pipeline_render(p, 0)) {
+            if (!live)
+                break;
+            thrd_yield();
+        }
     }
+    mt_pool_join(&p->workers);
 }
 
 void pipeline_join(pipeline *p) {
     mt_pool_join(&p->workers);
     mt_pool_destroy(&p->workers);
-    lf_queue_destroy(&p->decode_q);
-    lf_queue_destroy(&p->prepare_q);
-    lf_queue_destroy(&p->dispatch_q);
+    destroy_queues(p);
     free(p->stats);
 }
 
@@ -378,3 +600,10 @@ double pipeline_commands_per_second(const pipeline *p) {
     }
     return cps;
 }
+
+size_t pipeline_commands_dispatched(const pipeline *p) {
+    size_t n = 0;
+    for (int i = 0; p && p->stats && i < p->num_threads; ++i)
+        n += p->stats[i].commands;
+    return n;
+}
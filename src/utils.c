@@ -1,8 +1,17 @@
 #include "utils.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UTIL_FIND_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define UTIL_FIND_NEON 1
+#endif
+
 char *util_strndup(const char *s, size_t n) {
     size_t len = 0;
     while (len < n && s[len])
@@ -39,3 +48,166 @@ int util_asprintf(char **out, const char *fmt, ...) {
     va_end(ap);
     return r;
 }
+
+#define ARENA_MIN_BLOCK 16384
+#define ARENA_ALIGN 16
+
+struct util_arena_block {
+    util_arena_block *next;
+    size_t size, used;
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+};
+
+static util_arena_block *arena_block_new(util_arena *a, size_t size, util_arena_block *next) {
+    util_arena_block *b = a->alloc ? a->alloc(a->user, sizeof(*b) + size) : malloc(sizeof(*b) + size);
+    if (!b)
+        return NULL;
+    b->next = next;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+void *util_arena_alloc(util_arena *a, size_t n) {
+    n = (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    util_arena_block *b = a->head;
+    if (!b || b->size - b->used < n) {
+        size_t size = b ? b->size * 2 : ARENA_MIN_BLOCK;
+        while (size < n)
+            size *= 2;
+        b = arena_block_new(a, size, a->head);
+        if (!b)
+            return NULL;
+        a->head = b;
+    }
+    void *p = b->data + b->used;
+    b->used += n;
+    a->last = p;
+    return p;
+}
+
+void *util_arena_grow(util_arena *a, void *p, size_t old_n, size_t n) {
+    if (!p)
+        return util_arena_alloc(a, n);
+    util_arena_block *b = a->head;
+    if (p == a->last && b) {
+        size_t off = (size_t)((unsigned char *)p - b->data);
+        size_t need = (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+        if (off + need <= b->size) {
+            b->used = off + need;
+            return p;
+        }
+    }
+    void *q = util_arena_alloc(a, n);
+    if (q)
+        memcpy(q, p, old_n < n ? old_n : n);
+    return q;
+}
+
+char *util_arena_strndup(util_arena *a, const char *s, size_t n) {
+    char *out = util_arena_alloc(a, n + 1);
+    if (!out)
+        return NULL;
+    memcpy(out, s, n);
+    out[n] = '\0';
+    return out;
+}
+
+void util_arena_reset(util_arena *a) {
+    util_arena_block *b = a->head;
+    a->last = NULL;
+    if (!b)
+        return;
+    if (b->next) {
+        size_t total = 0;
+        for (util_arena_block *i = b; i; i = i->next)
+            total += i->size;
+        util_arena_free(a);
+        a->head = arena_block_new(a, total, NULL);
+        return;
+    }
+    b->used = 0;
+}
+
+void util_arena_free(util_arena *a) {
+    util_arena_block *b = a->head;
+    while (b) {
+        util_arena_block *next = b->next;
+        if (a->release)
+            a->release(a->user, b);
+        else
+            free(b);
+        b = next;
+    }
+    a->head = NULL;
+    a->last = NULL;
+}
+
+static unsigned ctz32(uint32_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctz(v);
+#else
+    unsigned n = 0;
+    while (!(v & 1)) {
+        v >>= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+const char *util_find2(const char *p, const char *end, char a, char b) {
+#if defined(UTIL_FIND_SSE2)
+    const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        int m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (m)
+            return p + ctz32((uint32_t)m);
+    }
+#elif defined(UTIL_FIND_NEON)
+    const uint8x16_t va = vdupq_n_u8((uint8_t)a), vb = vdupq_n_u8((uint8_t)b);
+    for (; end - p >= 16; p += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)p);
+        uint8x16_t eq = vorrq_u8(vceqq_u8(v, va), vceqq_u8(v, vb));
+        /* narrow to four bits per byte to get a scalar mask */
+        uint64_t m = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        if (m) {
+            uint32_t lo = (uint32_t)m;
+            return p + (lo ? ctz32(lo) : 32 + ctz32((uint32_t)(m >> 32))) / 4;
+        }
+    }
+#endif
+    for (; p < end; ++p)
+        if (*p == a || *p == b)
+            return p;
+    return end;
+}
+
+/* MurmurHash64A */
+uint64_t util_hash64(const void *data, size_t n, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ull;
+    const int r = 47;
+    const unsigned char *p = data;
+    uint64_t h = seed ^ (n * m);
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t k;
+        memcpy(&k, p, sizeof(k));
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    if (n) {
+        uint64_t k = 0;
+        for (size_t i = n; i-- > 0;)
+            k = (k << 8) | p[i];
+        h ^= k;
+        h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
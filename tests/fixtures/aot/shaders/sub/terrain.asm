@@ -0,0 +1,7 @@
+#include "common.inc"
+#ifdef DETAIL
+tex t1
+mul r0, t0, t1
+#else
+mov r0, t0
+#endif
@@ -0,0 +1,2 @@
+#include "common.inc"
+mul r0, t0, v0
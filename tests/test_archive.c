@@ -0,0 +1,139 @@
+#include "dx8gles11.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * archives round-trip lists, store identical lists once and reject damage;
+ * with an argument, also checks the archive dx8gles11c built from
+ * fixtures/aot
+ */
+
+static int fail(const char *what) {
+    fprintf(stderr, "failed: %s (%s)\n", what, dx8gles11_error());
+    return 1;
+}
+
+static int same(const gles_cmd *cmds, size_t count, const GLES_CommandList *l) {
+    return cmds && count == l->count && !memcmp(cmds, l->data, count * sizeof(*cmds));
+}
+
+static void *slurp(const char *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    *size = (size_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    void *p = aligned_alloc(16, (*size + 15) & ~(size_t)15);
+    if (p && fread(p, 1, *size, f) != *size) {
+        free(p);
+        p = NULL;
+    }
+    fclose(f);
+    return p;
+}
+
+static int check_cli(const char *path) {
+    dx8gles11_archive a;
+    if (dx8gles11_archive_map(&a, path) || dx8gles11_archive_verify(&a))
+        return fail("map compiler output");
+    if (dx8gles11_archive_count(&a) != 3 ||
+        dx8gles11_archive_caps(&a) != (DX8GLES11_CAP_VBO | DX8GLES11_CAP_TEXTURE_NPOT))
+        return fail("compiler output header");
+    size_t nw, nd, nt;
+    const gles_cmd *w = dx8gles11_archive_find(&a, "water.asm", &nw);
+    const gles_cmd *d = dx8gles11_archive_find(&a, "sub/dup.asm", &nd);
+    const gles_cmd *t = dx8gles11_archive_find(&a, "sub/terrain.asm", &nt);
+    if (!w || w != d || nw != nd || !t || dx8gles11_archive_find(&a, "readme.txt", &nd))
+        return fail("compiler output entries");
+
+    /* the same compile at run time */
+    static const char *const inc[] = {"fixtures/aot/inc", NULL};
+    static const char *const defs[] = {"DETAIL", NULL};
+    dx8gles11_caps caps = {DX8GLES11_CAP_VBO | DX8GLES11_CAP_TEXTURE_NPOT};
+    dx8gles11_options opt = {.include_paths = inc, .defines = defs, .caps = &caps};
+    GLES_CommandList want;
+    if (dx8gles11_compile_file("fixtures/aot/shaders/sub/terrain.asm", &opt, &want))
+        return fail("compile terrain");
+    int ok = same(t, nt, &want);
+    gles_cmdlist_free(&want);
+    dx8gles11_archive_unmap(&a);
+    return ok ? 0 : fail("compiler output differs from a run-time compile");
+}
+
+int main(int argc, char **argv) {
+    static const char *const src[] = {"vs.1.1\nmov oPos, v0\n", "tex t0\nmov r0, t0\n",
+                                      "vs.1.1\nmov oPos, v0\n"};
+    static const char *const names[] = {"a.vs", "b.ps", "c.vs"};
+    dx8gles11_caps caps = {DX8GLES11_CAP_VBO};
+    dx8gles11_options opt = {.caps = &caps};
+    GLES_CommandList lists[3];
+    dx8gles11_archive_item items[3];
+    for (int i = 0; i < 3; ++i) {
+        if (dx8gles11_compile_string(src[i], &opt, &lists[i]))
+            return fail("compile");
+        items[i] = (dx8gles11_archive_item){names[i], &lists[i]};
+    }
+    const char *path = "test_archive.dx8a";
+    if (dx8gles11_archive_write(path, items, 3, &caps))
+        return fail("write");
+
+    dx8gles11_archive a;
+    if (dx8gles11_archive_map(&a, path) || dx8gles11_archive_verify(&a))
+        return fail("map");
+    if (dx8gles11_archive_count(&a) != 3 || dx8gles11_archive_caps(&a) != DX8GLES11_CAP_VBO)
+        return fail("header");
+    for (int i = 0; i < 3; ++i) {
+        size_t n;
+        const gles_cmd *cmds = dx8gles11_archive_find(&a, names[i], &n);
+        if (!same(cmds, n, &lists[i]))
+            return fail("round trip");
+    }
+    size_t na, nc, n;
+    if (dx8gles11_archive_find(&a, "a.vs", &na) != dx8gles11_archive_find(&a, "c.vs", &nc))
+        return fail("identical lists not shared");
+    if (dx8gles11_archive_find(&a, "d.vs", &n) || n || dx8gles11_archive_find(&a, "a.v", &n))
+        return fail("missing name found");
+    int seen = 0;
+    for (size_t i = 0; i < 3; ++i) {
+        const char *name = dx8gles11_archive_name(&a, i);
+        for (int j = 0; j < 3; ++j)
+            seen |= name && !strcmp(name, names[j]) ? 1 << j : 0;
+        if (!dx8gles11_archive_entry_cmds(&a, i, &n))
+            return fail("entry commands");
+    }
+    if (seen != 7 || dx8gles11_archive_name(&a, 3))
+        return fail("enumerate");
+    dx8gles11_archive_unmap(&a);
+
+    /* damage: a flipped byte fails verification, a bad header fails opening */
+    size_t size;
+    unsigned char *img = slurp(path, &size);
+    if (!img)
+        return fail("read back");
+    img[size - 1] ^= 1;
+    if (dx8gles11_archive_init(&a, img, size) || dx8gles11_archive_verify(&a) == 0)
+        return fail("corruption not detected");
+    if (dx8gles11_archive_init(&a, img, size - 1) == 0)
+        return fail("truncation not detected");
+    img[0] = 'X';
+    if (dx8gles11_archive_init(&a, img, size) == 0 || !strstr(dx8gles11_error(), "bad archive"))
+        return fail("bad magic accepted");
+    free(img);
+
+    items[2].name = "a.vs";
+    if (dx8gles11_archive_write(path, items, 3, &caps) == 0 ||
+        !strstr(dx8gles11_error(), "duplicate"))
+        return fail("duplicate names accepted");
+    if (dx8gles11_archive_map(&a, "fixtures/missing.dx8a") == 0)
+        return fail("missing file mapped");
+    remove(path);
+    for (int i = 0; i < 3; ++i)
+        gles_cmdlist_free(&lists[i]);
+
+    int rc = argc > 1 ? check_cli(argv[1]) : 0;
+    if (!rc)
+        puts("archive tests passed");
+    return rc;
+}
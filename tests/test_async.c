@@ -0,0 +1,103 @@
+#include "dx8gles11.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <threads.h>
+
+/* tickets complete, fail, time out and cancel as documented */
+
+static const char *k_src = "vs.1.1\nmov oPos, v0\n";
+static atomic_int g_gate, g_done;
+
+static void count_done(dx8gles11_ticket *t, void *user) {
+    (void)t;
+    (void)user;
+    atomic_fetch_add(&g_done, 1);
+}
+
+/* holds the single worker until the gate opens */
+static void block(dx8gles11_ticket *t, void *user) {
+    (void)t;
+    (void)user;
+    while (!atomic_load(&g_gate))
+        thrd_yield();
+}
+
+static int fail(const char *what) {
+    fprintf(stderr, "failed: %s (%s)\n", what, dx8gles11_error());
+    return 1;
+}
+
+int main(void) {
+    dx8gles11_caps caps = {DX8GLES11_CAP_VBO};
+    dx8gles11_context_desc desc = {.caps = &caps, .threads = 1};
+    dx8gles11_context *ctx = dx8gles11_context_create(&desc);
+    if (!ctx)
+        return fail("create");
+
+    GLES_CommandList want, got;
+    if (dx8gles11_context_compile_string(ctx, k_src, NULL, &want))
+        return fail("sync compile");
+    dx8gles11_ticket *t = dx8gles11_context_compile_async(ctx, k_src, NULL, NULL, count_done, NULL);
+    if (!t || dx8gles11_ticket_wait(t, -1) != DX8GLES11_TICKET_DONE)
+        return fail("async compile");
+    if (dx8gles11_ticket_result(t, &got) || got.count != want.count ||
+        memcmp(got.data, want.data, got.count * sizeof(*got.data)))
+        return fail("async result");
+    /* the list was moved out */
+    GLES_CommandList again;
+    if (dx8gles11_ticket_result(t, &again) || again.count)
+        return fail("second result");
+    dx8gles11_ticket_release(t);
+    gles_cmdlist_free(&got);
+    gles_cmdlist_free(&want);
+
+    t = dx8gles11_context_compile_async(ctx, "vs.1.1\ndef c0, 1.0, 2.0\n", NULL, NULL, NULL, NULL);
+    if (!t || dx8gles11_ticket_wait(t, 5000) != DX8GLES11_TICKET_DONE)
+        return fail("failing compile");
+    if (dx8gles11_ticket_result(t, &got) != -3 || !strstr(dx8gles11_error(), "invalid constant"))
+        return fail("failure result");
+    if (dx8gles11_ticket_cancel(t) == 0)
+        return fail("cancelled a finished compile");
+    dx8gles11_ticket_release(t);
+
+    /* with the only worker held, later tickets stay pending */
+    dx8gles11_ticket *busy = dx8gles11_context_compile_async(ctx, k_src, NULL, NULL, block, NULL);
+    dx8gles11_ticket *queued = dx8gles11_context_compile_async(ctx, k_src, NULL, NULL, count_done, NULL);
+    dx8gles11_ticket *dropped = dx8gles11_context_compile_async(ctx, k_src, NULL, NULL, count_done, NULL);
+    if (!busy || !queued || !dropped)
+        return fail("queue");
+    if (dx8gles11_ticket_wait(queued, 20) != DX8GLES11_TICKET_PENDING)
+        return fail("timed wait");
+    if (dx8gles11_ticket_result(queued, &got) != -1)
+        return fail("result while pending");
+    if (dx8gles11_ticket_cancel(queued) || dx8gles11_ticket_wait(queued, -1) != DX8GLES11_TICKET_CANCELLED)
+        return fail("cancel");
+    dx8gles11_ticket_release(dropped);
+    atomic_store(&g_gate, 1);
+    if (dx8gles11_ticket_wait(busy, -1) != DX8GLES11_TICKET_DONE)
+        return fail("blocked compile");
+    dx8gles11_ticket_release(busy);
+    dx8gles11_ticket_release(queued);
+    /* only the first compile called back; cancelled tickets never ran */
+    if (atomic_load(&g_done) != 1)
+        return fail("callbacks");
+
+    /* destroying the context finishes what is still queued */
+    for (int i = 0; i < 64; ++i)
+        dx8gles11_ticket_release(
+            dx8gles11_context_compile_async(ctx, k_src, NULL, NULL, count_done, NULL));
+    dx8gles11_ticket *kept = dx8gles11_context_compile_async(ctx, k_src, NULL, NULL, count_done, NULL);
+    dx8gles11_context_destroy(ctx);
+    if (dx8gles11_ticket_status(kept) != DX8GLES11_TICKET_DONE)
+        return fail("queued compile after destroy");
+    dx8gles11_ticket_release(kept);
+
+    t = dx8gles11_compile_async(NULL, "fixtures/basic.asm", NULL, NULL, NULL);
+    if (!t || dx8gles11_ticket_wait(t, -1) != DX8GLES11_TICKET_DONE ||
+        dx8gles11_ticket_result(t, &got))
+        return fail("default context file compile");
+    gles_cmdlist_free(&got);
+    dx8gles11_ticket_release(t);
+    return dx8gles11_compile_async(NULL, NULL, NULL, NULL, NULL) != NULL;
+}
@@ -0,0 +1,63 @@
+#include "dx8gles11.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* a parallel batch returns what serial compiles return, in input order */
+
+static const char *k_paths[] = {
+    "fixtures/add.asm",        "fixtures/basic.asm",          "fixtures/cnd.asm",
+    "fixtures/dp3_matrix.asm", "fixtures/matrix_ops.asm",     "fixtures/max_min.asm",
+    "fixtures/mov_tex.asm",    "fixtures/mul_const.asm",      "fixtures/ps13_ops.asm",
+    "fixtures/tex_ops.asm",    "fixtures/motion_blur_vs.asm", "fixtures/invalid_const.asm",
+};
+#define NPATHS (sizeof(k_paths) / sizeof(k_paths[0]))
+#define COUNT 240
+
+static int same(const GLES_CommandList *a, const GLES_CommandList *b) {
+    return a->count == b->count && !memcmp(a->data, b->data, a->count * sizeof(*a->data));
+}
+
+static int fail(const char *what, size_t i) {
+    fprintf(stderr, "failed: %s at item %zu\n", what, i);
+    return 1;
+}
+
+int main(void) {
+    dx8gles11_caps caps = {DX8GLES11_CAP_VBO};
+    dx8gles11_options opt = {.caps = &caps};
+    dx8gles11_batch_item items[COUNT + 2];
+    memset(items, 0, sizeof(items));
+    for (size_t i = 0; i < COUNT; ++i)
+        items[i].path = k_paths[i % NPATHS];
+    items[COUNT].source = "vs.1.1\nmov oPos, v0\n";
+    /* items[COUNT + 1] has neither source nor path */
+    int failed = dx8gles11_compile_batch(items, COUNT + 2, &opt, 8);
+    if (failed != COUNT / NPATHS + 1)
+        return fail("failure count", (size_t)failed);
+
+    for (size_t i = 0; i < COUNT + 1; ++i) {
+        GLES_CommandList want;
+        int rc = items[i].path ? dx8gles11_compile_file(items[i].path, &opt, &want)
+                               : dx8gles11_compile_string(items[i].source, &opt, &want);
+        if (rc != items[i].rc)
+            return fail("return code", i);
+        if (rc ? !items[i].error || strcmp(items[i].error, dx8gles11_error())
+               : items[i].error || !same(&want, &items[i].list))
+            return fail("result", i);
+        gles_cmdlist_free(&want);
+    }
+    if (items[COUNT + 1].rc != -1 || !strstr(items[COUNT + 1].error, "null"))
+        return fail("empty item", COUNT + 1);
+    dx8gles11_batch_free(items, COUNT + 2);
+
+    /* on the calling thread; per-item options win over the batch's */
+    dx8gles11_caps none = {0};
+    dx8gles11_options bare = {.caps = &none};
+    dx8gles11_batch_item two[2] = {{.source = "vs.1.1\nmov oPos, v0\n"},
+                                   {.source = "vs.1.1\nmov oPos, v0\n", .opts = &bare}};
+    if (dx8gles11_compile_batch(two, 2, &opt, 0) || two[0].list.count == two[1].list.count)
+        return fail("item options", 1);
+    dx8gles11_batch_free(two, 2);
+    return dx8gles11_compile_batch(NULL, 0, NULL, 4) != 0;
+}
@@ -0,0 +1,177 @@
+#include "dx8gles11.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#define THREADS 8
+
+static const char *k_shader = "ps.1.1\n"
+                              "tex t0\n"
+                              "tex t1\n"
+                              "mul r0, v0, t0\n"
+                              "add r0, r0, t1\n";
+
+static dx8gles11_cache *g_cache;
+static const GLES_CommandList *g_results[THREADS];
+
+static int compile_thread(void *arg) {
+    int idx = *(int *)arg;
+    return dx8gles11_cache_compile_string(g_cache, k_shader, NULL, &g_results[idx]);
+}
+
+static atomic_int g_stop;
+static char *g_bad_src;
+
+static int failing_thread(void *arg) {
+    const GLES_CommandList *l = NULL;
+    int rc = dx8gles11_cache_compile_string(g_cache, g_bad_src, NULL, &l);
+    *(int *)arg = rc;
+    return 0;
+}
+
+static int hot_reader(void *arg) {
+    (void)arg;
+    while (!atomic_load(&g_stop)) {
+        const GLES_CommandList *l = NULL;
+        if (dx8gles11_cache_compile_string(g_cache, k_shader, NULL, &l))
+            return 1;
+        dx8gles11_cache_release(g_cache, l);
+    }
+    return 0;
+}
+
+static int same_list(const GLES_CommandList *a, const GLES_CommandList *b) {
+    return a->count == b->count && !memcmp(a->data, b->data, a->count * sizeof(gles_cmd));
+}
+
+int main(void) {
+    GLES_CommandList ref;
+    if (dx8gles11_compile_string(k_shader, NULL, &ref)) {
+        fprintf(stderr, "%s\n", dx8gles11_error());
+        return 1;
+    }
+
+    /* concurrent requests for one shader compile it once */
+    g_cache = dx8gles11_cache_create(1 << 20);
+    thrd_t t[THREADS];
+    int ids[THREADS];
+    for (int i = 0; i < THREADS; ++i) {
+        ids[i] = i;
+        thrd_create(&t[i], compile_thread, &ids[i]);
+    }
+    int fail = 0;
+    for (int i = 0; i < THREADS; ++i) {
+        int rc = 0;
+        thrd_join(t[i], &rc);
+        fail |= rc != 0 || g_results[i] != g_results[0] || !same_list(g_results[i], &ref);
+    }
+    dx8gles11_cache_stats st;
+    dx8gles11_cache_get_stats(g_cache, &st);
+    if (fail || st.misses != 1 || st.hits != THREADS - 1 || st.entries != 1) {
+        fprintf(stderr, "single-flight: fail=%d misses=%llu hits=%llu\n", fail,
+                (unsigned long long)st.misses, (unsigned long long)st.hits);
+        return 1;
+    }
+    for (int i = 0; i < THREADS; ++i)
+        dx8gles11_cache_release(g_cache, g_results[i]);
+
+    /* the options' cache serves the plain API with a private copy */
+    dx8gles11_options opt = {.cache = g_cache};
+    GLES_CommandList copy;
+    if (dx8gles11_compile_string(k_shader, &opt, &copy) || !same_list(&copy, &ref)) {
+        fprintf(stderr, "cached copy mismatch\n");
+        return 1;
+    }
+    gles_cmdlist_free(&copy);
+    dx8gles11_cache_get_stats(g_cache, &st);
+    if (st.hits != THREADS) {
+        fprintf(stderr, "options cache not consulted\n");
+        return 1;
+    }
+
+    /* failures are reported to every caller and not cached */
+    const GLES_CommandList *l = NULL;
+    if (dx8gles11_cache_compile_string(g_cache, "mov r0, r1 r2\n", NULL, &l) == 0 ||
+        !strstr(dx8gles11_error(), "invalid")) {
+        fprintf(stderr, "bad failure handling: %s\n", dx8gles11_error());
+        return 1;
+    }
+
+    /* callers that wait on a compile that fails are not hits; a long
+     * program keeps the compile in flight while they arrive */
+    size_t bad_len = 0;
+    g_bad_src = malloc(64 * 1024);
+    bad_len += (size_t)sprintf(g_bad_src, "ps.1.1\n");
+    while (bad_len < 60 * 1024)
+        bad_len += (size_t)sprintf(g_bad_src + bad_len, "add r0, v0, v1\n");
+    strcpy(g_bad_src + bad_len, "mov r0, r1 r2\n");
+    dx8gles11_cache_get_stats(g_cache, &st);
+    uint64_t hits_before = st.hits;
+    for (int i = 0; i < THREADS; ++i)
+        thrd_create(&t[i], failing_thread, &ids[i]);
+    for (int i = 0; i < THREADS; ++i) {
+        thrd_join(t[i], NULL);
+        fail |= ids[i] == 0;
+    }
+    free(g_bad_src);
+    dx8gles11_cache_get_stats(g_cache, &st);
+    if (fail || st.hits != hits_before) {
+        fprintf(stderr, "failed compiles counted as hits: %llu\n",
+                (unsigned long long)(st.hits - hits_before));
+        return 1;
+    }
+    dx8gles11_cache_destroy(g_cache);
+
+    /* a budget that fits one entry evicts the older one; held lists stay valid */
+    g_cache = dx8gles11_cache_create(1);
+    const GLES_CommandList *held = NULL, *other = NULL;
+    if (dx8gles11_cache_compile_string(g_cache, k_shader, NULL, &held) ||
+        dx8gles11_cache_compile_string(g_cache, "mov oD0, v0\n", NULL, &other)) {
+        fprintf(stderr, "%s\n", dx8gles11_error());
+        return 1;
+    }
+    dx8gles11_cache_get_stats(g_cache, &st);
+    if (st.evictions < 1 || !same_list(held, &ref)) {
+        fprintf(stderr, "eviction: %llu\n", (unsigned long long)st.evictions);
+        return 1;
+    }
+    dx8gles11_cache_release(g_cache, held);
+    dx8gles11_cache_release(g_cache, other);
+    dx8gles11_cache_destroy(g_cache);
+
+    /* evicted entries are freed while lookups never stop */
+    g_cache = dx8gles11_cache_create(4096);
+    for (int i = 0; i < THREADS / 2; ++i)
+        thrd_create(&t[i], hot_reader, NULL);
+    /* a preempted lookup holds back its epoch, so retired entries may pile up
+     * for a while; they must still drain while the readers keep going */
+    size_t drained_at = 0;
+    for (int i = 0; i < 20000 && !drained_at; ++i) {
+        char src[64];
+        snprintf(src, sizeof(src), "ps.1.1\ndef c0, %d, 0, 0, 1\nmov r0, c0\n", i);
+        if (dx8gles11_cache_compile_string(g_cache, src, NULL, &l)) {
+            fprintf(stderr, "%s\n", dx8gles11_error());
+            return 1;
+        }
+        dx8gles11_cache_release(g_cache, l);
+        dx8gles11_cache_get_stats(g_cache, &st);
+        if (i >= 2000 && st.retired <= 8)
+            drained_at = (size_t)i;
+    }
+    atomic_store(&g_stop, 1);
+    for (int i = 0; i < THREADS / 2; ++i) {
+        int rc = 0;
+        thrd_join(t[i], &rc);
+        fail |= rc;
+    }
+    if (fail || st.evictions < 1000 || !drained_at) {
+        fprintf(stderr, "reclaim under load: %llu evictions, %zu still retired\n",
+                (unsigned long long)st.evictions, st.retired);
+        return 1;
+    }
+    dx8gles11_cache_destroy(g_cache);
+    gles_cmdlist_free(&ref);
+    return 0;
+}
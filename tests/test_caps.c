@@ -0,0 +1,65 @@
+#include "dx8gles11.h"
+#include <stdio.h>
+#include <string.h>
+
+/* compiles for a target profile depend only on the profile, not on GL */
+
+static int fail(const char *what) {
+    fprintf(stderr, "failed: %s (%s)\n", what, dx8gles11_error());
+    return 1;
+}
+
+static int has_cmd(const GLES_CommandList *l, gles_cmd_type t) {
+    for (size_t i = 0; i < l->count; ++i)
+        if (l->data[i].type == t)
+            return 1;
+    return 0;
+}
+
+int main(void) {
+    dx8gles11_caps vbo, none = {0}, parsed;
+    if (dx8gles11_caps_load("fixtures/profiles/gles11_vbo.txt", &vbo))
+        return fail("load profile");
+    if (vbo.bits != (DX8GLES11_CAP_VBO | DX8GLES11_CAP_TEXTURE_NPOT))
+        return fail("profile bits");
+    if (dx8gles11_caps_load("fixtures/profiles/missing.txt", &parsed) == 0)
+        return fail("missing profile loaded");
+
+    dx8gles11_caps_parse("GL_OES_texture_3D GL_EXT_blend_minmaxx GL_EXT_blend_minmax", &parsed);
+    if (parsed.bits != (DX8GLES11_CAP_TEXTURE_3D | DX8GLES11_CAP_BLEND_MINMAX))
+        return fail("parse extension string");
+    if (strcmp(dx8gles11_caps_name(DX8GLES11_CAP_DEPTH_TEXTURE), "GL_OES_depth_texture") ||
+        dx8gles11_caps_name(1u << 31))
+        return fail("cap names");
+
+    const char *src = "vs.1.1\nmov oPos, v0\n";
+    dx8gles11_options opt = {.caps = &vbo};
+    GLES_CommandList with, without;
+    if (dx8gles11_compile_string(src, &opt, &with))
+        return fail("compile for vbo profile");
+    opt.caps = &none;
+    if (dx8gles11_compile_string(src, &opt, &without))
+        return fail("compile for bare profile");
+    int ok = has_cmd(&with, GLES_CMD_BIND_VBO) && !has_cmd(&without, GLES_CMD_BIND_VBO);
+    gles_cmdlist_free(&with);
+    gles_cmdlist_free(&without);
+    if (!ok)
+        return fail("profile did not select the translation");
+
+    /* one cache serves several targets without mixing their lists */
+    dx8gles11_cache *cache = dx8gles11_cache_create(1 << 20);
+    const GLES_CommandList *a, *b;
+    dx8gles11_options copt = {.caps = &vbo};
+    if (dx8gles11_cache_compile_string(cache, src, &copt, &a))
+        return fail("cached compile for vbo profile");
+    copt.caps = &none;
+    if (dx8gles11_cache_compile_string(cache, src, &copt, &b))
+        return fail("cached compile for bare profile");
+    ok = a != b && has_cmd(a, GLES_CMD_BIND_VBO) && !has_cmd(b, GLES_CMD_BIND_VBO);
+    dx8gles11_cache_release(cache, a);
+    dx8gles11_cache_release(cache, b);
+    dx8gles11_cache_destroy(cache);
+    if (!ok)
+        return fail("cache shared lists across profiles");
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include "chunk_pool.h"
+#include "ring.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <threads.h>
+
+/* chunks keep their contents from acquire to release, come back from any
+ * thread, and the pool never hands out more than it was given */
+
+#define CHUNKS 16
+#define WORDS 40
+#define PER_PRODUCER 50000
+#define THREADS 3
+
+static chunk_pool g_pool;
+static ring_buffer g_ring;
+static atomic_ullong g_sum;
+static atomic_int g_live;
+static atomic_int g_bad;
+
+static int produce(void *arg) {
+    uint32_t id = (uint32_t)(uintptr_t)arg;
+    for (uint32_t n = 1; n <= PER_PRODUCER; ++n) {
+        uint32_t *c;
+        while (!(c = chunk_acquire(&g_pool)))
+            thrd_yield();
+        for (int i = 0; i < WORDS; ++i)
+            c[i] = id << 24 ^ n ^ (uint32_t)i;
+        c[0] = n;
+        c[1] = id;
+        while (ring_push(&g_ring, &c))
+            thrd_yield();
+    }
+    atomic_fetch_sub(&g_live, 1);
+    return 0;
+}
+
+static int consume(void *arg) {
+    (void)arg;
+    for (;;) {
+        uint32_t *c;
+        if (ring_pop(&g_ring, &c)) {
+            int live = atomic_load(&g_live);
+            if (ring_pop(&g_ring, &c)) {
+                if (!live)
+                    break;
+                thrd_yield();
+                continue;
+            }
+        }
+        for (int i = 2; i < WORDS; ++i)
+            if (c[i] != (c[1] << 24 ^ c[0] ^ (uint32_t)i))
+                atomic_store(&g_bad, 1);
+        atomic_fetch_add(&g_sum, c[0]);
+        chunk_release(&g_pool, c);
+    }
+    return 0;
+}
+
+int main(void) {
+    /* exhaustion, reuse of released chunks, alignment */
+    void *c[6];
+    if (chunk_pool_init(&g_pool, 100, 5))
+        return 1;
+    for (int i = 0; i < 6; ++i)
+        c[i] = chunk_acquire(&g_pool);
+    if (c[5] || chunk_pool_high_water(&g_pool) != 5) {
+        fprintf(stderr, "failed: pool of 5 handed out a sixth chunk\n");
+        return 1;
+    }
+    for (int i = 0; i < 5; ++i)
+        for (int j = 0; j < i; ++j)
+            if (!c[i] || c[i] == c[j] || (uintptr_t)c[i] % 64) {
+                fprintf(stderr, "failed: chunk %d null, shared or misaligned\n", i);
+                return 1;
+            }
+    chunk_release(&g_pool, c[3]);
+    chunk_release(&g_pool, c[1]);
+    void *a = chunk_acquire(&g_pool), *b = chunk_acquire(&g_pool);
+    if (a != c[1] || b != c[3] || chunk_acquire(&g_pool)) {
+        fprintf(stderr, "failed: released chunks not reused\n");
+        return 1;
+    }
+    chunk_pool_destroy(&g_pool);
+
+    /* chunks cross threads through a ring of pointers */
+    if (chunk_pool_init(&g_pool, WORDS * sizeof(uint32_t), CHUNKS) ||
+        ring_init(&g_ring, sizeof(uint32_t *), CHUNKS, 0))
+        return 1;
+    atomic_store(&g_live, THREADS);
+    thrd_t t[2 * THREADS];
+    for (int i = 0; i < THREADS; ++i)
+        thrd_create(&t[i], consume, NULL);
+    for (int i = 0; i < THREADS; ++i)
+        thrd_create(&t[THREADS + i], produce, (void *)(uintptr_t)i);
+    for (int i = 0; i < 2 * THREADS; ++i)
+        thrd_join(t[i], NULL);
+    unsigned long long want = (unsigned long long)PER_PRODUCER * (PER_PRODUCER + 1) / 2 * THREADS;
+    if (atomic_load(&g_bad) || atomic_load(&g_sum) != want ||
+        chunk_pool_high_water(&g_pool) > CHUNKS) {
+        fprintf(stderr, "failed: chunks lost, duplicated or overwritten\n");
+        return 1;
+    }
+    ring_destroy(&g_ring);
+    chunk_pool_destroy(&g_pool);
+    puts("chunk pool tests passed");
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "dx8gles11.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+/* contexts carry caps, allocator, diagnostics and counters of their own */
+
+#define THREADS 4
+#define PER_THREAD 200
+
+static atomic_int g_live, g_allocs;
+static int g_diag_rc;
+static char g_diag_msg[256];
+
+static void *count_alloc(void *user, size_t n) {
+    (void)user;
+    atomic_fetch_add(&g_live, 1);
+    atomic_fetch_add(&g_allocs, 1);
+    return malloc(n);
+}
+
+static void count_free(void *user, void *p) {
+    (void)user;
+    atomic_fetch_sub(&g_live, 1);
+    free(p);
+}
+
+static void on_diag(void *user, int rc, const char *msg) {
+    ++*(int *)user;
+    g_diag_rc = rc;
+    snprintf(g_diag_msg, sizeof(g_diag_msg), "%s", msg);
+}
+
+static int has_cmd(const GLES_CommandList *l, gles_cmd_type t) {
+    for (size_t i = 0; i < l->count; ++i)
+        if (l->data[i].type == t)
+            return 1;
+    return 0;
+}
+
+static const char *k_src = "vs.1.1\nmov oPos, v0\n";
+
+static int compile_loop(void *arg) {
+    dx8gles11_context *ctx = arg;
+    for (int i = 0; i < PER_THREAD; ++i) {
+        GLES_CommandList l;
+        if (dx8gles11_context_compile_string(ctx, k_src, NULL, &l))
+            return 1;
+        int ok = has_cmd(&l, GLES_CMD_BIND_VBO);
+        gles_cmdlist_free(&l);
+        if (!ok)
+            return 1;
+    }
+    return 0;
+}
+
+static int fail(const char *what) {
+    fprintf(stderr, "failed: %s (%s)\n", what, dx8gles11_error());
+    return 1;
+}
+
+int main(void) {
+    dx8gles11_caps vbo = {DX8GLES11_CAP_VBO};
+    dx8gles11_allocator alloc = {count_alloc, count_free, NULL};
+    int diags = 0;
+    dx8gles11_context_desc desc = {
+        .caps = &vbo, .alloc = &alloc, .diag = on_diag, .diag_user = &diags};
+    dx8gles11_context *ctx = dx8gles11_context_create(&desc);
+    if (!ctx)
+        return fail("create");
+
+    dx8gles11_caps got;
+    dx8gles11_context_caps(ctx, &got);
+    if (got.bits != DX8GLES11_CAP_VBO)
+        return fail("context caps");
+
+    /* the context's caps select the translation; the options still win */
+    GLES_CommandList l;
+    if (dx8gles11_context_compile_string(ctx, k_src, NULL, &l) || !has_cmd(&l, GLES_CMD_BIND_VBO))
+        return fail("compile with context caps");
+    gles_cmdlist_free(&l);
+    dx8gles11_caps none = {0};
+    dx8gles11_options opt = {.caps = &none};
+    if (dx8gles11_context_compile_string(ctx, k_src, &opt, &l) || has_cmd(&l, GLES_CMD_BIND_VBO))
+        return fail("options caps override");
+    gles_cmdlist_free(&l);
+    if (!atomic_load(&g_allocs) || atomic_load(&g_live))
+        return fail("scratch memory not through the allocator");
+
+    /* failures reach the callback with the error text */
+    if (dx8gles11_context_compile_string(ctx, "vs.1.1\ndef c0, 1.0, 2.0\n", NULL, &l) != -3)
+        return fail("bad constant compiled");
+    if (diags != 1 || g_diag_rc != -3 || !strstr(g_diag_msg, "invalid constant"))
+        return fail("diagnostic callback");
+
+    thrd_t t[THREADS];
+    for (int i = 0; i < THREADS; ++i)
+        if (thrd_create(&t[i], compile_loop, ctx) != thrd_success)
+            return fail("thread");
+    int bad = 0;
+    for (int i = 0; i < THREADS; ++i) {
+        int rc = 0;
+        thrd_join(t[i], &rc);
+        bad |= rc;
+    }
+    if (bad)
+        return fail("concurrent compiles");
+
+    dx8gles11_context_stats st;
+    dx8gles11_context_get_stats(ctx, &st);
+    if (st.compiles != 2 + THREADS * PER_THREAD || st.failures != 1)
+        return fail("stats");
+    dx8gles11_context_destroy(ctx);
+
+    /* the free functions go through the default context */
+    dx8gles11_context_stats before, after;
+    dx8gles11_context_get_stats(dx8gles11_context_default(), &before);
+    if (dx8gles11_compile_string(k_src, NULL, &l))
+        return fail("default compile");
+    gles_cmdlist_free(&l);
+    dx8gles11_context_get_stats(dx8gles11_context_default(), &after);
+    if (after.compiles != before.compiles + 1)
+        return fail("default context stats");
+    return 0;
+}
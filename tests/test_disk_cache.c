@@ -0,0 +1,110 @@
+#include "dx8gles11.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char g_dir[] = "/tmp/dx8gles11_dcXXXXXX";
+
+static void write_text(const char *name, const char *text) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", g_dir, name);
+    FILE *f = fopen(path, "wb");
+    fputs(text, f);
+    fclose(f);
+}
+
+/* path of the single persisted entry */
+static int entry_file(char *out, size_t n) {
+    DIR *d = opendir(g_dir);
+    struct dirent *de;
+    int found = 0;
+    while ((de = readdir(d))) {
+        if (strstr(de->d_name, ".dx8c")) {
+            snprintf(out, n, "%s/%s", g_dir, de->d_name);
+            ++found;
+        }
+    }
+    closedir(d);
+    return found;
+}
+
+/* compile through the disk cache; returns in-memory cache misses, i.e. 0 on a disk hit */
+static int compile(GLES_CommandList *cl) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/main.asm", g_dir);
+    dx8gles11_cache *mem = dx8gles11_cache_create(1 << 20);
+    dx8gles11_options opt = {.cache = mem, .cache_dir = g_dir};
+    if (dx8gles11_compile_file(path, &opt, cl)) {
+        fprintf(stderr, "%s\n", dx8gles11_error());
+        exit(1);
+    }
+    dx8gles11_cache_stats st;
+    dx8gles11_cache_get_stats(mem, &st);
+    dx8gles11_cache_destroy(mem);
+    return (int)st.misses;
+}
+
+static int check(int cond, const char *what) {
+    if (!cond)
+        fprintf(stderr, "failed: %s\n", what);
+    return !cond;
+}
+
+int main(void) {
+    if (!mkdtemp(g_dir))
+        return 1;
+    write_text("a.inc", "#define OUTOP mov\n");
+    write_text("main.asm", "#include \"a.inc\"\nvs.1.1\nOUTOP oD0, v0\n");
+
+    GLES_CommandList cl;
+    int bad = 0;
+    bad |= check(compile(&cl) == 1, "first compile misses");
+    char entry[512];
+    bad |= check(entry_file(entry, sizeof(entry)) == 1, "entry written");
+    bad |= check(cl.count == 1 && cl.data[0].type == GLES_CMD_COLOR4F, "first output");
+    gles_cmdlist_free(&cl);
+
+    bad |= check(compile(&cl) == 0, "warm compile hits");
+    bad |= check(cl.count == 1 && cl.data[0].type == GLES_CMD_COLOR4F, "cached output");
+    gles_cmdlist_free(&cl);
+
+    /* flip a payload byte: detected by the checksum and rewritten */
+    FILE *f = fopen(entry, "r+b");
+    fseek(f, -1, SEEK_END);
+    int ch = fgetc(f);
+    fseek(f, -1, SEEK_END);
+    fputc(ch ^ 0x5a, f);
+    fclose(f);
+    bad |= check(compile(&cl) == 1, "corrupt entry recompiled");
+    gles_cmdlist_free(&cl);
+    bad |= check(compile(&cl) == 0, "corrupt entry replaced");
+    gles_cmdlist_free(&cl);
+
+    /* an edited include invalidates the entry */
+    write_text("a.inc", "#define OUTOP mul\n");
+    bad |= check(compile(&cl) == 1, "stale include recompiled");
+    bad |= check(cl.count == 1 && cl.data[0].type == GLES_CMD_TEX_ENV_COMBINE, "stale output");
+    gles_cmdlist_free(&cl);
+
+    bad |= check(dx8gles11_disk_cache_preload(g_dir) == 0, "preload starts");
+    dx8gles11_disk_cache_preload_wait();
+    bad |= check(compile(&cl) == 0, "preloaded hit");
+    bad |= check(cl.count == 1 && cl.data[0].type == GLES_CMD_TEX_ENV_COMBINE, "preloaded output");
+    gles_cmdlist_free(&cl);
+    dx8gles11_disk_cache_unload();
+
+    DIR *d = opendir(g_dir);
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        char path[512];
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", g_dir, de->d_name);
+        remove(path);
+    }
+    closedir(d);
+    rmdir(g_dir);
+    return bad;
+}
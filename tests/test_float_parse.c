@@ -0,0 +1,118 @@
+#include "utils.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* util_parse_float() must match strtof bit for bit, including where it stops */
+
+static uint64_t g_rng = 0x9e3779b97f4a7c15ull;
+
+static uint64_t rnd(void) {
+    g_rng ^= g_rng << 13;
+    g_rng ^= g_rng >> 7;
+    g_rng ^= g_rng << 17;
+    return g_rng;
+}
+
+static unsigned g_checked;
+
+static int check(const char *s) {
+    size_t n = strlen(s);
+    char *ref_end = NULL;
+    float ref = strtof(s, &ref_end);
+    float got = 0.0f;
+    const char *end = util_parse_float(s, s + n, &got);
+    if (ref_end == s) {
+        if (end) {
+            fprintf(stderr, "'%s': accepted, strtof rejects\n", s);
+            return 1;
+        }
+        return 0;
+    }
+    g_checked++;
+    if (!end || end != ref_end || memcmp(&ref, &got, sizeof(ref))) {
+        fprintf(stderr, "'%s': got %.9g (end %td), strtof %.9g (end %td)\n", s, got,
+                end ? end - s : -1, ref, ref_end - s);
+        return 1;
+    }
+    return 0;
+}
+
+static float random_float(void) {
+    for (;;) {
+        uint32_t bits = (uint32_t)rnd();
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        if (isfinite(f))
+            return f;
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1)
+        g_rng = strtoull(argv[1], NULL, 0) | 1;
+    static const char *const edge[] = {
+        "0", "-0", "+0.0", "0e999", ".5", "5.", "-.25", "1e", "1e+", "1e-", "1.5e3x",
+        "00000000000000000000001.5", "1.4e-45", "1.401298464324817e-45", "7.006492e-46",
+        "7.006492321624087e-46", "7.006492321624086e-46", "1e-46", "1.17549435e-38",
+        "1.1754942e-38", "3.4028235e38", "3.40282356e38", "3.4028236e38", "1e39", "1e-50",
+        "123456789012345678901234567890", "0.000000000000000000000000000000000000001",
+        "16777217", "16777216.5", "33554431", "9007199254740993", "1e10", "1e-10",
+        "4.7019774e-38", "0.1", "0.2", "0.3", "2.5e-1", "9999999999999999999e-64",
+        "1.00000005960464477539062499", "1.000000059604644775390625",
+        "1.00000005960464477539062501", "-", "+", ".", "e5", "",
+    };
+    for (size_t i = 0; i < sizeof(edge) / sizeof(edge[0]); ++i)
+        if (check(edge[i]))
+            return 1;
+
+    char buf[256];
+    for (int i = 0; i < 200000; ++i) {
+        /* round trips at several precisions */
+        float f = random_float();
+        static const int prec[] = {6, 8, 9, 12, 17};
+        snprintf(buf, sizeof(buf), "%.*g", prec[i % 5], f);
+        if (check(buf))
+            return 1;
+
+        /* exact halfway points between neighbours, and just either side */
+        float g = nextafterf(f, INFINITY);
+        if (isfinite(g)) {
+            double mid = ((double)f + (double)g) / 2;
+            int len = snprintf(buf, sizeof(buf), "%.120e", mid);
+            /* trim trailing zeros of the mantissa, keep the exponent */
+            char *ex = strchr(buf, 'e');
+            char *z = ex;
+            while (z[-1] == '0')
+                --z;
+            memmove(z, ex, (size_t)(buf + len - ex) + 1);
+            if (check(buf))
+                return 1;
+            ex = strchr(buf, 'e');
+            char saved[16];
+            snprintf(saved, sizeof(saved), "%s", ex);
+            snprintf(ex, sizeof(buf) - (size_t)(ex - buf), "1%s", saved);
+            if (check(buf))
+                return 1;
+        }
+
+        /* random digit strings with a random point and exponent */
+        int digits = 1 + (int)(rnd() % 30);
+        int dot = (int)(rnd() % (unsigned)(digits + 1));
+        int len = 0;
+        if (rnd() & 1)
+            buf[len++] = '-';
+        for (int d = 0; d < digits; ++d) {
+            if (d == dot)
+                buf[len++] = '.';
+            buf[len++] = (char)('0' + rnd() % 10);
+        }
+        len += snprintf(buf + len, sizeof(buf) - (size_t)len, "e%d", (int)(rnd() % 130) - 80);
+        if (check(buf))
+            return 1;
+    }
+    printf("%u inputs match strtof\n", g_checked);
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include "preprocess.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+
+static char g_dir[] = "/tmp/dx8gles11_incXXXXXX";
+static pp_include_cache *g_cache;
+
+/* files and directories touched in the last second are never cached, so
+ * every write is back-dated to a distinct older time */
+static void age(const char *rel, int seconds_ago) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", g_dir, rel);
+    struct utimbuf t = {time(NULL) - seconds_ago, time(NULL) - seconds_ago};
+    utime(path, &t);
+}
+
+static void write_text(const char *rel, const char *text, int seconds_ago) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", g_dir, rel);
+    FILE *f = fopen(path, "wb");
+    fputs(text, f);
+    fclose(f);
+    age(rel, seconds_ago);
+}
+
+static void make_dir(const char *rel) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", g_dir, rel);
+    mkdir(path, 0700);
+}
+
+static char *run(void) {
+    char main_path[256], a[256], b[256];
+    snprintf(main_path, sizeof(main_path), "%s/main/main.asm", g_dir);
+    snprintf(a, sizeof(a), "%s/a", g_dir);
+    snprintf(b, sizeof(b), "%s/b", g_dir);
+    const char *paths[] = {b, NULL};
+    pp_config cfg = {.include_dir = a, .include_paths = paths, .includes = g_cache};
+    char *err = NULL;
+    char *out = pp_run_cfg(main_path, &cfg, &err);
+    if (!out) {
+        fprintf(stderr, "%s\n", err ? err : "pp_run_cfg failed");
+        free(err);
+    }
+    return out;
+}
+
+static int expect(const char *want, uint64_t hits, uint64_t loads, uint64_t negative) {
+    char *out = run();
+    pp_include_stats st;
+    pp_include_cache_get_stats(g_cache, &st);
+    int bad = !out || strcmp(out, want) || st.hits != hits || st.loads != loads ||
+              st.negative_hits != negative;
+    if (bad)
+        fprintf(stderr, "got '%s' hits %llu loads %llu negative %llu\n", out ? out : "(null)",
+                (unsigned long long)st.hits, (unsigned long long)st.loads,
+                (unsigned long long)st.negative_hits);
+    free(out);
+    return bad;
+}
+
+static int worker(void *arg) {
+    (void)arg;
+    for (int i = 0; i < 200; ++i) {
+        char *out = run();
+        int bad = !out || strcmp(out, "mov r1\n");
+        free(out);
+        if (bad)
+            return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    if (!mkdtemp(g_dir))
+        return 1;
+    make_dir("main");
+    make_dir("a");
+    make_dir("b");
+    write_text("b/x.inc", "#define R r0\n", 100);
+    write_text("main/main.asm", "#include \"x.inc\"\nmov R\n", 100);
+    age("main", 100);
+    age("a", 100);
+    age("b", 100);
+    g_cache = pp_include_cache_create();
+
+    /* main/ and a/ are indexed and skipped, b/x.inc is mapped once */
+    if (expect("mov r0\n", 0, 1, 2) || expect("mov r0\n", 1, 1, 4))
+        return 1;
+    /* a changed file is reloaded */
+    write_text("b/x.inc", "#define R r1\n", 90);
+    if (expect("mov r1\n", 1, 2, 6) || expect("mov r1\n", 2, 2, 8))
+        return 1;
+
+    thrd_t t[4];
+    for (int i = 0; i < 4; ++i)
+        thrd_create(&t[i], worker, NULL);
+    int failed = 0;
+    for (int i = 0; i < 4; ++i) {
+        int rc = 1;
+        thrd_join(t[i], &rc);
+        failed |= rc;
+    }
+    if (failed) {
+        fprintf(stderr, "concurrent runs disagree\n");
+        return 1;
+    }
+
+    /* a new file earlier in the search order is seen once a/ changes */
+    write_text("a/x.inc", "#define R r2\n", 100);
+    age("a", 80);
+    char *out = run();
+    int bad = !out || strcmp(out, "mov r2\n");
+    free(out);
+    if (bad) {
+        fprintf(stderr, "shadowing include not picked up\n");
+        return 1;
+    }
+
+    pp_include_cache_destroy(g_cache);
+    char cmd[300];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", g_dir);
+    return system(cmd) != 0;
+}
@@ -0,0 +1,88 @@
+#include "dx8gles11.h"
+#include <stdio.h>
+#include <string.h>
+#include <threads.h>
+
+/* identical lists from different shaders share one copy until the last
+ * reference goes */
+
+static int fail(const char *what) {
+    fprintf(stderr, "failed: %s (%s)\n", what, dx8gles11_error());
+    return 1;
+}
+
+static const char *k_paths[] = {
+    "fixtures/add.asm",     "fixtures/cnd.asm",     "fixtures/dp3_matrix.asm",
+    "fixtures/max_min.asm", "fixtures/mov_tex.asm", "fixtures/tex_ops.asm",
+};
+#define NPATHS (sizeof(k_paths) / sizeof(k_paths[0]))
+#define COPIES 4
+
+static dx8gles11_intern *g_pool;
+static const GLES_CommandList *g_shared;
+
+static int churn(void *arg) {
+    (void)arg;
+    for (int i = 0; i < 1000; ++i)
+        dx8gles11_intern_release(g_pool, dx8gles11_intern_retain(g_pool, g_shared));
+    return 0;
+}
+
+int main(void) {
+    dx8gles11_caps caps = {DX8GLES11_CAP_VBO};
+    dx8gles11_options opt = {.caps = &caps};
+    g_pool = dx8gles11_intern_create();
+    if (!g_pool)
+        return fail("create");
+
+    const GLES_CommandList *held[NPATHS * COPIES];
+    for (size_t i = 0; i < NPATHS * COPIES; ++i) {
+        GLES_CommandList l;
+        if (dx8gles11_compile_file(k_paths[i % NPATHS], &opt, &l))
+            return fail("compile");
+        GLES_CommandList copy = l;
+        held[i] = dx8gles11_intern_list(g_pool, &l);
+        if (!held[i] || l.data || l.count)
+            return fail("intern");
+        if (i >= NPATHS && held[i] != held[i - NPATHS])
+            return fail("identical list not shared");
+        if (i < NPATHS && (held[i]->count != copy.count || held[i]->capacity != copy.count))
+            return fail("interned copy");
+    }
+    dx8gles11_intern_stats st;
+    dx8gles11_intern_get_stats(g_pool, &st);
+    if (st.refs != NPATHS * COPIES || st.unique != NPATHS || st.dedup_ratio != COPIES ||
+        st.logical_bytes <= st.bytes)
+        return fail("stats");
+
+    /* different text, same translation */
+    const char *a = "vs.1.1\nmov oPos, v0\n", *b = "vs.1.1\n; transform\nmov   oPos,v0\n";
+    GLES_CommandList la, lb;
+    if (dx8gles11_compile_string(a, &opt, &la) || dx8gles11_compile_string(b, &opt, &lb))
+        return fail("compile strings");
+    const GLES_CommandList *sa = dx8gles11_intern_list(g_pool, &la);
+    const GLES_CommandList *sb = dx8gles11_intern_list(g_pool, &lb);
+    if (!sa || sa != sb)
+        return fail("equivalent sources not shared");
+
+    g_shared = sa;
+    thrd_t t[4];
+    for (int i = 0; i < 4; ++i)
+        thrd_create(&t[i], churn, NULL);
+    for (int i = 0; i < 4; ++i)
+        thrd_join(t[i], NULL);
+    dx8gles11_intern_get_stats(g_pool, &st);
+    if (st.refs != NPATHS * COPIES + 2 || st.unique != NPATHS + 1)
+        return fail("references after concurrent churn");
+
+    dx8gles11_intern_release(g_pool, sa);
+    dx8gles11_intern_release(g_pool, sb);
+    for (size_t i = 0; i < NPATHS * COPIES; ++i)
+        dx8gles11_intern_release(g_pool, held[i]);
+    dx8gles11_intern_get_stats(g_pool, &st);
+    if (st.refs || st.unique || st.bytes || st.logical_bytes)
+        return fail("released lists still held");
+    dx8gles11_intern_destroy(g_pool);
+    puts("intern tests passed");
+    return 0;
+}
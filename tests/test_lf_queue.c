@@ -0,0 +1,97 @@
+#include "lf_queue.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <threads.h>
+
+/* concurrent pops never lose or duplicate values, and once the node pools
+ * are warm further rounds allocate nothing */
+
+#define PER_PRODUCER 100000
+#define THREADS 3
+#define ROUNDS 4
+
+static lf_queue g_q;
+static atomic_ullong g_sum;
+static atomic_ullong g_count;
+static atomic_int g_live;
+
+static int produce(void *arg) {
+    (void)arg;
+    for (uintptr_t i = 1; i <= PER_PRODUCER; ++i)
+        while (lf_queue_push(&g_q, (void *)i))
+            thrd_yield();
+    atomic_fetch_sub(&g_live, 1);
+    return 0;
+}
+
+static int consume(void *arg) {
+    (void)arg;
+    for (;;) {
+        void *v = lf_queue_pop(&g_q);
+        if (!v) {
+            if (!atomic_load(&g_live) && !(v = lf_queue_pop(&g_q)))
+                break;
+            if (!v) {
+                thrd_yield();
+                continue;
+            }
+        }
+        atomic_fetch_add(&g_sum, (unsigned long long)(uintptr_t)v);
+        atomic_fetch_add(&g_count, 1);
+    }
+    return 0;
+}
+
+static int round_trip(void) {
+    atomic_store(&g_sum, 0);
+    atomic_store(&g_count, 0);
+    atomic_store(&g_live, THREADS);
+    thrd_t t[2 * THREADS];
+    for (int i = 0; i < THREADS; ++i)
+        thrd_create(&t[i], consume, NULL);
+    for (int i = 0; i < THREADS; ++i)
+        thrd_create(&t[THREADS + i], produce, NULL);
+    for (int i = 0; i < 2 * THREADS; ++i)
+        thrd_join(t[i], NULL);
+    unsigned long long want = (unsigned long long)PER_PRODUCER * (PER_PRODUCER + 1) / 2 * THREADS;
+    if (atomic_load(&g_count) != (unsigned long long)PER_PRODUCER * THREADS ||
+        atomic_load(&g_sum) != want) {
+        fprintf(stderr, "failed: lost or duplicated values (%llu popped)\n",
+                atomic_load(&g_count));
+        return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    if (lf_queue_init(&g_q) || lf_queue_pop(&g_q) != NULL)
+        return 1;
+    if (round_trip())
+        return 1;
+    size_t warm = lf_queue_nodes_allocated();
+    for (int r = 1; r < ROUNDS; ++r)
+        if (round_trip())
+            return 1;
+    size_t after = lf_queue_nodes_allocated();
+    /* later rounds only allocate when the backlog outgrows every earlier
+     * one; without reuse each would allocate a node per value */
+    if (after - warm >= (size_t)PER_PRODUCER * THREADS) {
+        fprintf(stderr, "failed: %zu nodes allocated after warm-up\n", after - warm);
+        return 1;
+    }
+    /* a bounded backlog runs entirely from the pools */
+    for (int r = 0; r < 100; ++r) {
+        for (uintptr_t i = 1; i <= 1000; ++i)
+            lf_queue_push(&g_q, (void *)i);
+        while (lf_queue_pop(&g_q))
+            ;
+    }
+    if (lf_queue_nodes_allocated() != after) {
+        fprintf(stderr, "failed: steady state allocated %zu nodes\n",
+                lf_queue_nodes_allocated() - after);
+        return 1;
+    }
+    lf_queue_destroy(&g_q);
+    printf("lf_queue tests passed (%zu nodes)\n", after);
+    return 0;
+}
@@ -0,0 +1,31 @@
+#include "dx8asm_opcodes.h"
+#include <stdio.h>
+#include <string.h>
+
+int main(void) {
+    for (unsigned op = 1; op < ASM_OP_COUNT; ++op) {
+        const char *name = asm_opcode_name((asm_opcode)op);
+        if (asm_opcode_lookup(name, strlen(name)) != (asm_opcode)op) {
+            fprintf(stderr, "lookup mismatch for %s\n", name);
+            return 1;
+        }
+    }
+    const char *unknown[] = {"", "te", "texx", "mov_x2", "MOV", "texm3x3specx"};
+    for (size_t i = 0; i < sizeof(unknown) / sizeof(unknown[0]); ++i) {
+        if (asm_opcode_lookup(unknown[i], strlen(unknown[i])) != ASM_OP_UNKNOWN) {
+            fprintf(stderr, "unexpected match for '%s'\n", unknown[i]);
+            return 1;
+        }
+    }
+    if (asm_opcode_lookup("texld t0", 5) != ASM_OP_TEXLD) {
+        fprintf(stderr, "length-limited lookup failed\n");
+        return 1;
+    }
+    if (asm_opcode_class_of(ASM_OP_TEXKILL) != ASM_OPC_TEX ||
+        asm_opcode_class_of(ASM_OP_MUL) != ASM_OPC_ARITH ||
+        asm_opcode_class_of(ASM_OP_UNKNOWN) != ASM_OPC_ARITH) {
+        fprintf(stderr, "bad opcode class\n");
+        return 1;
+    }
+    return 0;
+}
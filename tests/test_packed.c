@@ -0,0 +1,111 @@
+#include "dx8gles11.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* packing is lossless, walks in order and rejects malformed streams */
+
+static int fail(const char *what) {
+    fprintf(stderr, "failed: %s (%s)\n", what, dx8gles11_error());
+    return 1;
+}
+
+static int same(const GLES_CommandList *a, const GLES_CommandList *b) {
+    return a->count == b->count &&
+           (!a->count || !memcmp(a->data, b->data, a->count * sizeof(*a->data)));
+}
+
+static const char *k_paths[] = {
+    "fixtures/add.asm",        "fixtures/basic.asm",          "fixtures/cnd.asm",
+    "fixtures/dp3_matrix.asm", "fixtures/matrix_ops.asm",     "fixtures/max_min.asm",
+    "fixtures/mov_tex.asm",    "fixtures/mul_const.asm",      "fixtures/ps13_ops.asm",
+    "fixtures/tex_ops.asm",    "fixtures/motion_blur_vs.asm", "fixtures/tex_matrix.asm",
+};
+
+/* pack, walk and unpack l; adds the packed size to *bytes */
+static int round_trip(const GLES_CommandList *l, size_t *bytes) {
+    GLES_PackedList p;
+    if (gles_cmdlist_pack(l, &p) || p.count != l->count)
+        return fail("pack");
+    gles_packed_iter it;
+    gles_packed_begin(&p, &it);
+    gles_cmd c;
+    size_t n = 0;
+    int rc;
+    while ((rc = gles_packed_next(&it, &c)) > 0) {
+        if (n >= l->count || memcmp(&c, &l->data[n], sizeof(c)))
+            return fail("iterated command");
+        ++n;
+    }
+    if (rc || n != l->count)
+        return fail("iteration length");
+    GLES_CommandList back;
+    if (gles_packed_unpack(&p, &back) || !same(&back, l))
+        return fail("unpack");
+    gles_cmdlist_free(&back);
+    *bytes += p.size;
+    gles_packed_free(&p);
+    return 0;
+}
+
+int main(void) {
+    dx8gles11_caps caps = {DX8GLES11_CAP_VBO};
+    dx8gles11_options opt = {.caps = &caps};
+    size_t plain = 0, packed = 0;
+    for (size_t i = 0; i < sizeof(k_paths) / sizeof(k_paths[0]); ++i) {
+        GLES_CommandList l;
+        if (dx8gles11_compile_file(k_paths[i], &opt, &l))
+            return fail(k_paths[i]);
+        if (round_trip(&l, &packed))
+            return 1;
+        plain += l.count * sizeof(gles_cmd);
+        gles_cmdlist_free(&l);
+    }
+    printf("fixtures: %zu bytes as gles_cmd, %zu packed\n", plain, packed);
+    if (packed * 4 > plain)
+        return fail("packing saved less than expected");
+
+    /* fields whose bit patterns must survive */
+    uint32_t nan_bits = 0x7fc00123;
+    gles_cmd odd[3] = {{.type = GLES_CMD_LOAD_CONSTANT, .f = {-0.0f, 1e-40f, 0, -3.5f}},
+                       {.type = GLES_CMD_UNKNOWN, .u = {UINT32_MAX, 0, 127, 128}},
+                       {.type = GLES_CMD_LOAD_IDENTITY}};
+    memcpy(&odd[0].f[2], &nan_bits, 4);
+    GLES_CommandList edge = {odd, 3, 3};
+    size_t edge_bytes = 0;
+    if (round_trip(&edge, &edge_bytes))
+        return 1;
+    GLES_CommandList empty = {0};
+    if (round_trip(&empty, &edge_bytes))
+        return 1;
+
+    /* malformed: truncated payload, unknown type, count mismatch, a count no
+     * stream of that size can hold */
+    GLES_PackedList p;
+    GLES_CommandList out;
+    if (gles_cmdlist_pack(&edge, &p))
+        return fail("pack edge");
+    p.size -= 2;
+    if (gles_packed_unpack(&p, &out) == 0)
+        return fail("truncated list accepted");
+    p.size += 2;
+    p.count = 2;
+    if (gles_packed_unpack(&p, &out) == 0)
+        return fail("count mismatch accepted");
+    uint8_t bad[] = {0x3f};
+    GLES_PackedList junk = {bad, 1, 1};
+    if (gles_packed_unpack(&junk, &out) == 0)
+        return fail("unknown type accepted");
+    p.count = SIZE_MAX / 4;
+    if (gles_packed_unpack(&p, &out) == 0)
+        return fail("impossible count accepted");
+    GLES_PackedList none = {NULL, 0, 3};
+    if (gles_packed_unpack(&none, &out) == 0)
+        return fail("count without data accepted");
+    gles_packed_free(&p);
+    odd[2].type = (gles_cmd_type)200;
+    if (gles_cmdlist_pack(&edge, &p) == 0)
+        return fail("out of range type packed");
+    puts("packed tests passed");
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include "dx8asm_parser.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int expect_operand(const asm_instr *i, const asm_operand *o, const char *text) {
+    char buf[64];
+    asm_operand_format(i, o, buf, sizeof(buf));
+    if (strcmp(buf, text)) {
+        fprintf(stderr, "operand: expected '%s', got '%s'\n", text, buf);
+        return 1;
+    }
+    return 0;
+}
+
+/* the vector scan must agree with a byte loop at every offset and length */
+static int check_find2(void) {
+    char buf[80];
+    for (size_t i = 0; i < sizeof(buf); ++i)
+        buf[i] = (char)('a' + i % 23);
+    for (size_t len = 0; len <= 64; ++len) {
+        for (size_t hit = 0; hit <= len; ++hit) {
+            char saved = buf[hit];
+            buf[hit] = ';';
+            const char *got = util_find2(buf, buf + len, '\n', ';');
+            buf[hit] = saved;
+            if (got != buf + hit) {
+                fprintf(stderr, "util_find2(len %zu): expected %zu, got %td\n", len, hit,
+                        got - buf);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(void) {
+    if (check_find2())
+        return 1;
+    const char *src = "vs.1.1\n"
+                      "mov oT3.xy, -c[a0.x+2].xyz\n"
+                      "+mul_sat r0.a, 1-t1_bx2, v0.w ; volume texture\n"
+                      "mload t1, 1.5, -2.0, 3.0\n"
+                      "tex t0_shadow\n";
+    asm_program prog;
+    char *err = NULL;
+    if (asm_parse(src, &prog, &err)) {
+        fprintf(stderr, "parse failed: %s\n", err ? err : "?");
+        free(err);
+        return 1;
+    }
+    int bad = prog.count != 4 || prog.type != ASM_SHADER_VS11;
+    if (!bad) {
+        const asm_instr *i = &prog.code[0];
+        bad |= i->op != ASM_OP_MOV || i->nsrc != 1 || i->dst.file != ASM_REG_TEXCRDOUT ||
+               i->dst.index != 3 || i->src[0].file != ASM_REG_CONST ||
+               !(i->src[0].mod & ASM_MOD_REL) || !(i->src[0].mod & ASM_MOD_NEG);
+        bad |= expect_operand(i, &i->dst, "oT3.xy");
+        bad |= expect_operand(i, &i->src[0], "-c[a0.x+2].xyzz");
+
+        i = &prog.code[1];
+        bad |= i->op != ASM_OP_MUL || !(i->flags & ASM_INSTR_COISSUE) ||
+               !(i->flags & ASM_INSTR_VOLUME) || i->imod != ASM_IMOD_SAT || i->nsrc != 2;
+        bad |= expect_operand(i, &i->dst, "r0.w");
+        bad |= expect_operand(i, &i->src[0], "1-t1_bx2");
+        bad |= expect_operand(i, &i->src[1], "v0.wwww");
+
+        i = &prog.code[2];
+        bad |= i->op != ASM_OP_MLOAD || i->nsrc != 3 || i->src[1].file != ASM_REG_IMM ||
+               i->imm[i->src[0].index] != 1.5f || i->imm[i->src[1].index] != -2.0f ||
+               i->imm[i->src[2].index] != 3.0f;
+
+        i = &prog.code[3];
+        bad |= i->op != ASM_OP_TEX || i->flags != ASM_INSTR_SHADOW || i->dst.index != 0;
+    }
+    asm_program_free(&prog);
+    if (bad) {
+        fprintf(stderr, "unexpected IR\n");
+        return 1;
+    }
+
+    /* lines and comments longer than a vector, CRLF endings, tabs */
+    const char *wide = "ps.1.1\r\n"
+                       "\tadd_x2\tr1.rgb ,\tr0_bias ,  -c2.wzyx   ; long comment, with shadow\r\n"
+                       "; only a comment, shadow\r\n"
+                       "def c3 , 1 , 2 , 3 , 4 \r\n";
+    if (asm_parse(wide, &prog, &err)) {
+        fprintf(stderr, "parse failed: %s\n", err ? err : "?");
+        free(err);
+        return 1;
+    }
+    bad = prog.count != 1 || prog.const_count != 1 || prog.type != ASM_SHADER_PS11 ||
+          prog.code[0].op != ASM_OP_ADD || prog.code[0].imod != ASM_IMOD_X2 ||
+          prog.code[0].flags != ASM_INSTR_SHADOW || prog.code[0].nsrc != 2 ||
+          prog.consts[0].idx != 3 || prog.consts[0].value[3] != 4.0f;
+    if (!bad) {
+        bad |= expect_operand(&prog.code[0], &prog.code[0].dst, "r1.xyz");
+        bad |= expect_operand(&prog.code[0], &prog.code[0].src[1], "-c2.wzyx");
+    }
+    asm_program_free(&prog);
+    if (bad) {
+        fprintf(stderr, "unexpected IR for wide lines\n");
+        return 1;
+    }
+
+    /* operands in any case, either order inside [], stray commas */
+    const char *loose = "vs.1.1\n"
+                        "MOV R0.XY, V0.WZYX\n"
+                        "mov OPOS, c[A0.X]\n"
+                        "mov oD0, c[5+a0.x]\n"
+                        "mov ot1, C[a0.X+7].X,\n"
+                        "add r0,, v0, v1\n";
+    if (asm_parse(loose, &prog, &err)) {
+        fprintf(stderr, "parse failed: %s\n", err ? err : "?");
+        free(err);
+        return 1;
+    }
+    bad = prog.count != 5;
+    if (!bad) {
+        const asm_instr *i = prog.code;
+        bad |= expect_operand(&i[0], &i[0].dst, "r0.xy");
+        bad |= expect_operand(&i[0], &i[0].src[0], "v0.wzyx");
+        bad |= expect_operand(&i[1], &i[1].dst, "oPos");
+        bad |= expect_operand(&i[1], &i[1].src[0], "c[a0.x+0]");
+        bad |= expect_operand(&i[2], &i[2].dst, "oD0");
+        bad |= expect_operand(&i[2], &i[2].src[0], "c[a0.x+5]");
+        bad |= i[3].nsrc != 1 || expect_operand(&i[3], &i[3].dst, "oT1");
+        bad |= expect_operand(&i[3], &i[3].src[0], "c[a0.x+7].xxxx");
+        bad |= i[4].op != ASM_OP_ADD || i[4].nsrc != 2;
+        bad |= expect_operand(&i[4], &i[4].src[0], "v0");
+        bad |= expect_operand(&i[4], &i[4].src[1], "v1");
+    }
+    asm_program_free(&prog);
+    if (bad) {
+        fprintf(stderr, "unexpected IR for loose operands\n");
+        return 1;
+    }
+
+    const char *invalid[] = {"mov r0, q1\n", "mov r0, c[a1.x]\n", "add r0, v0.xq, v1\n",
+                             "mload 1, 2, 3, 4\n", "mov r0, c[5+a0.x+1]\n",
+                             "mov r0, r 1\n", "def c0, 1, 2, 3\n", "mov oP, r0\n"};
+    for (size_t k = 0; k < sizeof(invalid) / sizeof(invalid[0]); ++k) {
+        if (asm_parse(invalid[k], &prog, &err) == 0) {
+            fprintf(stderr, "accepted: %s", invalid[k]);
+            asm_program_free(&prog);
+            return 1;
+        }
+        free(err);
+        err = NULL;
+    }
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include "dx8gles11.h"
+#include "preprocess.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* every permutation must match a plain compile with the same defines */
+
+static const char k_src[] = "#define BASE c0\n"
+                            "def c0, 1.0, 0.0, 0.0, 1.0\n"
+                            "def c1, 0.5, 0.5, 0.5, 1.0\n"
+                            "#if LIGHTS > 1\n"
+                            "mul r0, v0, BASE\n"
+                            "#endif\n"
+                            "#ifdef FOG\n"
+                            "add r1, v1, c1\n"
+                            "#endif\n"
+                            "#ifdef SKIN\n"
+                            "; skinning is not done here\n"
+                            "#endif\n"
+                            "mov r2, v2\n";
+
+static const char *k_lights[] = {"1", "2", "3", NULL};
+
+static int same_list(const GLES_CommandList *a, const GLES_CommandList *b) {
+    return a->count == b->count && !memcmp(a->data, b->data, a->count * sizeof(gles_cmd));
+}
+
+static int check_prefix(void) {
+    const char *keys[] = {"FOG", "LIGHTS", NULL};
+    char *err = NULL;
+    pp_snapshot *snap = pp_snapshot_create_for(k_src, NULL, NULL, keys, &err);
+    if (!snap) {
+        fprintf(stderr, "%s\n", err);
+        return 1;
+    }
+    const char *defines[] = {"FOG", "LIGHTS=2", NULL};
+    pp_config full = {.defines = defines}, with = full;
+    with.snapshot = snap;
+    char *a = pp_run_string_cfg(k_src, &full, &err);
+    char *b = pp_run_string_cfg(k_src, &with, &err);
+    int bad = !a || !b || strcmp(a, b) || pp_snapshot_resumed(snap) != 1;
+    /* the prefix was only proven free of the keys */
+    const char *other[] = {"SKIN", NULL};
+    with.defines = other;
+    free(b);
+    b = pp_run_string_cfg(k_src, &with, &err);
+    bad |= !b || strstr(b, "add") || pp_snapshot_resumed(snap) != 1;
+    if (bad)
+        fprintf(stderr, "prefix snapshot: '%s' vs '%s'\n", a ? a : "", b ? b : "");
+    free(a);
+    free(b);
+    pp_snapshot_destroy(snap);
+    return bad;
+}
+
+/* the prefix redefines and #undefs names that were also given with -D */
+static int check_base_defines(void) {
+    static const char src[] = "#define BASE c0\n"
+                              "#undef SKIN\n"
+                              "#ifdef FOG\n"
+                              "add r1, v1, c1\n"
+                              "#endif\n"
+                              "#ifdef SKIN\n"
+                              "mov r3, v3\n"
+                              "#endif\n"
+                              "mul r0, v0, BASE\n";
+    const char *base[] = {"BASE=c1", "SKIN", NULL};
+    dx8gles11_feature fog = {"FOG", NULL};
+    dx8gles11_options opt = {.defines = base};
+    dx8gles11_permutations p;
+    if (dx8gles11_compile_permutations(src, &fog, 1, &opt, 2, &p)) {
+        fprintf(stderr, "%s\n", dx8gles11_error());
+        return 1;
+    }
+    int bad = p.count != 2;
+    for (size_t v = 0; !bad && v < p.count; ++v) {
+        const char *defines[] = {"BASE=c1", "SKIN", v ? "FOG" : NULL, NULL};
+        dx8gles11_options plain = {.defines = defines};
+        GLES_CommandList want;
+        bad = dx8gles11_compile_string(src, &plain, &want) ||
+              !same_list(&want, &p.lists[p.variant[v]]);
+        gles_cmdlist_free(&want);
+    }
+    if (bad)
+        fprintf(stderr, "redefined -D names differ from a plain compile\n");
+    dx8gles11_permutations_free(&p);
+    return bad;
+}
+
+int main(void) {
+    if (check_prefix() || check_base_defines())
+        return 1;
+    dx8gles11_feature features[] = {{"FOG", NULL}, {"LIGHTS", k_lights}, {"SKIN", NULL}};
+    dx8gles11_permutations p;
+    for (int threads = 1; threads <= 4; threads += 3) {
+        if (dx8gles11_compile_permutations(k_src, features, 3, NULL, threads, &p)) {
+            fprintf(stderr, "%s\n", dx8gles11_error());
+            return 1;
+        }
+        /* SKIN only adds a comment and LIGHTS 2 and 3 agree: 2 x 2 lists */
+        if (p.count != 12 || p.nlists != 4) {
+            fprintf(stderr, "%zu variants, %zu lists\n", p.count, p.nlists);
+            return 1;
+        }
+        for (size_t v = 0; v < p.count; ++v) {
+            char lights[16];
+            snprintf(lights, sizeof(lights), "LIGHTS=%s", k_lights[v / 2 % 3]);
+            const char *defines[4] = {lights, NULL, NULL, NULL};
+            size_t n = 1;
+            if (v % 2)
+                defines[n++] = "FOG";
+            if (v / 6)
+                defines[n++] = "SKIN";
+            dx8gles11_options opt = {.defines = defines};
+            GLES_CommandList want;
+            if (dx8gles11_compile_string(k_src, &opt, &want) ||
+                !same_list(&want, &p.lists[p.variant[v]])) {
+                fprintf(stderr, "variant %zu differs\n", v);
+                return 1;
+            }
+            gles_cmdlist_free(&want);
+        }
+        dx8gles11_permutations_free(&p);
+    }
+
+    /* a failing variant fails the whole call */
+    const char bad_src[] = "#ifdef FOG\ndef c0, 1.0, 2.0\n#endif\nmov r0, v0\n";
+    if (!dx8gles11_compile_permutations(bad_src, features, 1, NULL, 2, &p) || p.lists ||
+        !strstr(dx8gles11_error(), "variant 1")) {
+        fprintf(stderr, "failure not reported: %s\n", dx8gles11_error());
+        return 1;
+    }
+    return 0;
+}
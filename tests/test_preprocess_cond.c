@@ -0,0 +1,55 @@
+#include "preprocess.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* conditional groups, function-like macros and predefined macros */
+
+typedef struct pp_case {
+    const char *src;
+    const char *want; /* NULL when the run must fail */
+} pp_case;
+
+static const pp_case k_cases[] = {
+    {"#ifdef FOG\nfog\n#else\nnofog\n#endif\n", "fog\n"},
+    {"#ifndef FOG\nnofog\n#endif\nmov\n", "mov\n"},
+    {"#if LIGHTS >= 2 && !defined(SKIN)\ntwo\n#elif LIGHTS\none\n#else\nnone\n#endif\n",
+     "two\n"},
+    {"#if UNDEFINED_NAME\nx\n#elif defined FOG\ny\n#endif\n", "y\n"},
+    {"#if 0\n#if 1/0\n#endif\n#else\nok\n#endif\n", "ok\n"},
+    {"#if 0 && 1/0 || (2+3)*4 == 20 ? -1 < 0 : 0\nt\n#endif\n", "t\n"},
+    {"#if 1\n#if 0\na\n#elif 1\nb\n#elif 1\nc\n#else\nd\n#endif\n#endif\n", "b\n"},
+    {"#undef FOG\n#ifdef FOG\nx\n#endif\n", ""},
+    {"#define MAD(d, a, b, c) mad d, a, b, c\nMAD(r0, v0, c0, (r1))\n", "mad r0, v0, c0, (r1)\n"},
+    {"#define REG(n) r##n\n#define TWICE(x) add x, x, x\nTWICE(REG(2)), REG(LIGHTS)\n",
+     "add r2, r2, r2, rLIGHTS\n"},
+    {"#define F(a) mov a\nF(LIGHTS)\n", "mov 2\n"},
+    {"#define X Y\n#define Y c3\n#define F(a) a\nmov F(X), F (r1)\n", "mov c3, r1\n"},
+    {"#define F(a) F(a)\n#define G G\nF(G)\n", "F(G)\n"},
+    {"#define F(a) x\nmov F, r0\n", "mov F, r0\n"},
+    {"#if 1/0\n#endif\n", NULL},
+    {"#if 1\nmov\n", NULL},
+    {"#endif\n", NULL},
+    {"#if 1\n#else\n#else\n#endif\n", NULL},
+    {"#if (1\n#endif\n", NULL},
+    {"#define F(a, b) a\nF(r0)\n", NULL},
+    {"#define F(a) a\nF(r0\n)\n", NULL},
+};
+
+int main(void) {
+    const char *defines[] = {"FOG", "LIGHTS=2", NULL};
+    pp_config cfg = {.defines = defines};
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(k_cases) / sizeof(k_cases[0]); ++i) {
+        char *err = NULL;
+        char *out = pp_run_string_cfg(k_cases[i].src, &cfg, &err);
+        const char *want = k_cases[i].want;
+        if (want ? !out || strcmp(out, want) : out || !err || !*err) {
+            fprintf(stderr, "case %zu: got '%s'\n", i, out ? out : err ? err : "(null)");
+            failed = 1;
+        }
+        free(out);
+        free(err);
+    }
+    return failed;
+}
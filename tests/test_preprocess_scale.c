@@ -0,0 +1,94 @@
+#include "preprocess.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* macro expansion must stay linear in input size and flat in macro count */
+
+#define LINES 100000
+
+static double now_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000.0 + t.tv_nsec / 1e6;
+}
+
+/* nmacros defines followed by LINES uses; *expect receives the output */
+static char *gen(int nmacros, char **expect) {
+    char *src = NULL, *exp = NULL;
+    char line[128];
+    for (int i = 0; i < nmacros; ++i) {
+        int n = snprintf(line, sizeof(line), "#define M%d r%d\n", i, i % 12);
+        for (int k = 0; k < n; ++k)
+            sb_push(src, line[k]);
+    }
+    for (int i = 0; i < LINES; ++i) {
+        int m = (i * 7919) % nmacros;
+        /* xM%d and M%dx are longer identifiers and must be left alone */
+        int n = snprintf(line, sizeof(line), "mov M%d, xM%d+M%dx ; M%d\n", m, m, m, m);
+        for (int k = 0; k < n; ++k)
+            sb_push(src, line[k]);
+        n = snprintf(line, sizeof(line), "mov r%d, xM%d+M%dx ; r%d\n", m % 12, m, m, m % 12);
+        for (int k = 0; k < n; ++k)
+            sb_push(exp, line[k]);
+    }
+    sb_push(src, '\0');
+    sb_push(exp, '\0');
+    *expect = exp;
+    return src;
+}
+
+/* best of three runs, or -1 on a wrong result */
+static double run(int nmacros) {
+    char *expect = NULL;
+    char *src = gen(nmacros, &expect);
+    double best = -1.0;
+    for (int it = 0; it < 3; ++it) {
+        char *err = NULL;
+        double t0 = now_ms();
+        char *out = pp_run_string(src, NULL, &err);
+        double ms = now_ms() - t0;
+        if (!out || strcmp(out, expect)) {
+            fprintf(stderr, "%d macros: %s\n", nmacros, out ? "unexpected output" : err);
+            free(out);
+            free(err);
+            best = -1.0;
+            break;
+        }
+        free(out);
+        if (best < 0 || ms < best)
+            best = ms;
+    }
+    sb_free(src);
+    sb_free(expect);
+    return best;
+}
+
+static int check_redefine(void) {
+    char *err = NULL;
+    char *out = pp_run_string("#define A r0\nmov A\n#define A r1\nmov A, _A, A_\n", NULL, &err);
+    int bad = !out || strcmp(out, "mov r0\nmov r1, _A, A_\n");
+    if (bad)
+        fprintf(stderr, "redefine: %s\n", out ? out : err);
+    free(out);
+    free(err);
+    return bad;
+}
+
+int main(void) {
+    if (check_redefine())
+        return 1;
+    double few = run(100);
+    double many = run(10000);
+    if (few < 0 || many < 0)
+        return 1;
+    printf("%d lines: 100 macros %.2f ms, 10000 macros %.2f ms\n", LINES, few, many);
+    /* a linear macro scan makes the second run ~100x slower; allow noise */
+    if (many > few * 8 + 50) {
+        fprintf(stderr, "expansion cost grows with the macro count\n");
+        return 1;
+    }
+    return 0;
+}
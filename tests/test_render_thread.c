@@ -0,0 +1,176 @@
+#include "dx8gles11.h"
+#include "runtime_pipeline.h"
+#include "utils.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+/* a render pipeline dispatches everything the parallel stages produce, on
+ * the thread that calls pipeline_render() and pipeline_stop(); programs go
+ * through whole, constants included, or not at all, and reach the render
+ * thread in queue order */
+
+#define SHADERS 400
+
+static const char *k_src = "mov oD0, v0\nmov oT1, v1\ntex t0\ntexcrd r0, t1\n"
+                           "texkill t2\ndp4 oPos.x, v0, c0\nadd r0, v0, v1\n";
+static const char *k_consts = "ps.1.1\ndef c0, 1, 0, 0, 1\ndef c1, 0, 1, 0, 1\nmov r0, c0\n";
+/* nine arithmetic instructions: over the ps.1.1 limit */
+static const char *k_invalid = "ps.1.1\nadd r0, v0, v1\nadd r0, v0, v1\nadd r0, v0, v1\n"
+                               "add r0, v0, v1\nadd r0, v0, v1\nadd r0, v0, v1\n"
+                               "add r0, v0, v1\nadd r0, v0, v1\nadd r0, v0, v1\n";
+
+/* ordering: distinct programs, told apart by their first constant */
+#define ORDERED 3000
+
+static char g_src[ORDERED][128];
+static GLES_CommandList g_expect[ORDERED];
+static gles_cmd *g_seen; /* render mode: everything, in dispatch order */
+static atomic_int g_split;
+
+static void make_sources(void) {
+    for (int i = 0; i < ORDERED; ++i) {
+        /* lengths vary so translation times do too */
+        int n = snprintf(g_src[i], sizeof(g_src[i]), "ps.1.1\ndef c0, %d, 0, 0, 1\n", i);
+        for (int k = 0; k <= i % 5; ++k)
+            n += snprintf(g_src[i] + n, sizeof(g_src[i]) - (size_t)n, "add r0, v0, v1\n");
+    }
+}
+
+static void record(void *user, const gles_cmd *cmds, size_t n) {
+    (void)user;
+    for (size_t i = 0; i < n; ++i)
+        sb_push(g_seen, cmds[i]);
+}
+
+/* pooled mode: every run handed to a dispatcher holds whole programs */
+static void check_whole(void *user, const gles_cmd *cmds, size_t n) {
+    (void)user;
+    size_t at = 0;
+    while (at < n) {
+        int id = cmds[at].type == GLES_CMD_LOAD_CONSTANT ? (int)cmds[at].f[0] : -1;
+        if (id < 0 || id >= ORDERED || n - at < g_expect[id].count ||
+            memcmp(cmds + at, g_expect[id].data, g_expect[id].count * sizeof(gles_cmd))) {
+            atomic_store(&g_split, 1);
+            return;
+        }
+        at += g_expect[id].count;
+    }
+}
+
+static int check_order(void) {
+    make_sources();
+    GLES_CommandList all = {0};
+    for (int i = 0; i < ORDERED; ++i) {
+        if (dx8gles11_compile_string(g_src[i], NULL, &g_expect[i]))
+            return 1;
+        for (size_t k = 0; k < g_expect[i].count; ++k)
+            sb_push(all.data, g_expect[i].data[k]);
+    }
+    all.count = sb_count(all.data);
+
+    /* one decoder fixes the queue order; prepare workers race each other */
+    pipeline p;
+    if (pipeline_init_render(&p, 1, 3))
+        return 1;
+    p.trace = record;
+    if (pipeline_start(&p))
+        return 1;
+    /* small chunks, and a render thread slow enough that prepare workers
+     * stall on a full command pool in the middle of handing on */
+    for (int i = 0; i < ORDERED; ++i) {
+        lf_queue_push(&p.decode_q, g_src[i]);
+        if (i % 8 == 0)
+            thrd_yield();
+        if (i % 200 == 0)
+            pipeline_render(&p, 7); /* cuts chunks mid-program */
+    }
+    pipeline_stop(&p);
+    pipeline_join(&p);
+    int bad = sb_count(g_seen) != all.count ||
+              memcmp(g_seen, all.data, all.count * sizeof(gles_cmd));
+    if (bad)
+        fprintf(stderr, "render order: %zu of %zu commands, or out of order\n",
+                sb_count(g_seen), all.count);
+
+    if (!bad && (pipeline_init_stages(&p, 2, 3, 3) == 0)) {
+        p.trace = check_whole;
+        if (pipeline_start(&p))
+            return 1;
+        for (int i = 0; i < ORDERED; ++i)
+            lf_queue_push(&p.decode_q, g_src[i]);
+        pipeline_stop(&p);
+        bad = pipeline_commands_dispatched(&p) != all.count || atomic_load(&g_split);
+        pipeline_join(&p);
+        if (bad)
+            fprintf(stderr, "pooled dispatch split or lost programs\n");
+    }
+    sb_free(g_seen);
+    gles_cmdlist_free(&all);
+    for (int i = 0; i < ORDERED; ++i)
+        gles_cmdlist_free(&g_expect[i]);
+    return bad;
+}
+
+static int fail(const char *what) {
+    fprintf(stderr, "failed: %s (%s)\n", what, dx8gles11_error());
+    return 1;
+}
+
+int main(void) {
+    GLES_CommandList l;
+    if (dx8gles11_compile_string(k_src, NULL, &l))
+        return fail("compile");
+    size_t per_shader = l.count;
+    gles_cmdlist_free(&l);
+    if (dx8gles11_compile_string(k_consts, NULL, &l))
+        return fail("compile constants");
+    per_shader += l.count;
+    gles_cmdlist_free(&l);
+    if (!dx8gles11_compile_string(k_invalid, NULL, &l))
+        return fail("over-long shader accepted");
+
+    pipeline p;
+    if (pipeline_init_render(&p, 2, 2) || pipeline_start(&p))
+        return fail("start render pipeline");
+    if (p.num_threads != 1)
+        return fail("render pipeline dispatch threads");
+    int rendered = 0;
+    for (int i = 0; i < SHADERS; ++i) {
+        lf_queue_push(&p.decode_q, (void *)k_src);
+        lf_queue_push(&p.decode_q, (void *)k_invalid);
+        lf_queue_push(&p.decode_q, (void *)k_consts);
+        if (i % 50 == 0) /* a frame's worth */
+            rendered += pipeline_render(&p, 256);
+    }
+    pipeline_stop(&p);
+    size_t total = pipeline_commands_dispatched(&p);
+    int left = pipeline_render(&p, 0);
+    pipeline_join(&p);
+    if (total != per_shader * SHADERS || left != 0 || (size_t)rendered > total) {
+        fprintf(stderr, "dispatched %zu of %zu, %d left\n", total, per_shader * SHADERS, left);
+        return fail("render pipeline lost commands");
+    }
+
+    /* the pooled dispatch mode produces the same stream */
+    if (pipeline_init_stages(&p, 2, 2, 2) || pipeline_start(&p))
+        return fail("start pooled pipeline");
+    if (pipeline_render(&p, 0) != -1)
+        return fail("render on a pooled pipeline");
+    for (int i = 0; i < SHADERS; ++i) {
+        lf_queue_push(&p.decode_q, (void *)k_src);
+        lf_queue_push(&p.decode_q, (void *)k_invalid);
+        lf_queue_push(&p.decode_q, (void *)k_consts);
+    }
+    pipeline_stop(&p);
+    total = pipeline_commands_dispatched(&p);
+    pipeline_join(&p);
+    if (total != per_shader * SHADERS)
+        return fail("pooled pipeline lost commands");
+    if (check_order())
+        return fail("program order");
+    puts("render thread tests passed");
+    return 0;
+}
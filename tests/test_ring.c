@@ -0,0 +1,127 @@
+#include "ring.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <threads.h>
+
+/* rings deliver every item exactly once, in order per producer, and report
+ * full and empty instead of waiting */
+
+#define PER_PRODUCER 200000
+#define THREADS 3
+
+typedef struct item {
+    uint32_t producer;
+    uint32_t seq;
+    uint64_t pad; /* payloads wider than a pointer */
+} item;
+
+static ring_buffer g_ring;
+static atomic_ullong g_sum;
+static atomic_int g_live;
+static atomic_int g_bad;
+
+static int produce(void *arg) {
+    uint32_t id = (uint32_t)(uintptr_t)arg;
+    item batch[7];
+    uint32_t next = 0;
+    while (next < PER_PRODUCER) {
+        size_t n = 0;
+        while (n < 7 && next + n < PER_PRODUCER) {
+            batch[n] = (item){id, next + (uint32_t)n, 0};
+            ++n;
+        }
+        size_t k = ring_push_many(&g_ring, batch, n);
+        if (!k)
+            thrd_yield();
+        next += (uint32_t)k;
+    }
+    atomic_fetch_sub(&g_live, 1);
+    return 0;
+}
+
+static int consume(void *arg) {
+    (void)arg;
+    uint32_t last[THREADS];
+    memset(last, 0xff, sizeof(last));
+    item batch[13];
+    for (;;) {
+        size_t n = ring_pop_many(&g_ring, batch, 13);
+        if (!n) {
+            if (!atomic_load(&g_live) && !(n = ring_pop_many(&g_ring, batch, 13)))
+                break;
+            if (!n) {
+                thrd_yield();
+                continue;
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t p = batch[i].producer;
+            if (p >= THREADS || (last[p] != UINT32_MAX && batch[i].seq <= last[p]))
+                atomic_store(&g_bad, 1);
+            else
+                last[p] = batch[i].seq;
+            atomic_fetch_add(&g_sum, (unsigned long long)batch[i].seq + 1);
+        }
+    }
+    return 0;
+}
+
+static int run(int spsc, int producers, int consumers) {
+    if (ring_init(&g_ring, sizeof(item), 100, spsc))
+        return 1;
+    atomic_store(&g_sum, 0);
+    atomic_store(&g_live, producers);
+    atomic_store(&g_bad, 0);
+    thrd_t t[2 * THREADS];
+    for (int i = 0; i < consumers; ++i)
+        thrd_create(&t[i], consume, NULL);
+    for (int i = 0; i < producers; ++i)
+        thrd_create(&t[consumers + i], produce, (void *)(uintptr_t)i);
+    for (int i = 0; i < producers + consumers; ++i)
+        thrd_join(t[i], NULL);
+    ring_destroy(&g_ring);
+    unsigned long long want = (unsigned long long)PER_PRODUCER * (PER_PRODUCER + 1) / 2;
+    if (atomic_load(&g_bad) || atomic_load(&g_sum) != want * (unsigned long long)producers) {
+        fprintf(stderr, "failed: %s %dx%d lost, duplicated or reordered items\n",
+                spsc ? "spsc" : "mpmc", producers, consumers);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    /* capacity rounds up; partial pushes and pops at the edges */
+    for (int spsc = 0; spsc < 2; ++spsc) {
+        ring_buffer r;
+        int v[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9}, out[10];
+        if (ring_init(&r, sizeof(int), 5, spsc))
+            return 1;
+        if (ring_pop_many(&r, out, 10) != 0 || ring_push_many(&r, v, 10) != 8 ||
+            ring_push(&r, v) == 0 || ring_pop_many(&r, out, 3) != 3 || out[2] != 2 ||
+            ring_push_many(&r, v, 10) != 3 || ring_pop_many(&r, out, 10) != 8 || out[4] != 7 ||
+            out[5] != 0 || out[7] != 2 || ring_pop(&r, out) == 0) {
+            fprintf(stderr, "failed: %s edges\n", spsc ? "spsc" : "mpmc");
+            return 1;
+        }
+        /* empty batches return at once, full or empty ring alike */
+        if (ring_push_many(&r, v, 0) != 0 || ring_pop_many(&r, out, 0) != 0 ||
+            ring_push_many(&r, v, 1) != 1 || ring_pop_many(&r, out, 0) != 0 ||
+            ring_pop_many(&r, out, 1) != 1) {
+            fprintf(stderr, "failed: %s empty batches\n", spsc ? "spsc" : "mpmc");
+            return 1;
+        }
+        /* positions count every item ever queued */
+        size_t pos = 0;
+        if (ring_push_many(&r, v, 5) != 5 || ring_pop_many_at(&r, out, 2, &pos) != 2 ||
+            pos != 12 || ring_pop_many_at(&r, out, 10, &pos) != 3 || pos != 14) {
+            fprintf(stderr, "failed: %s positions\n", spsc ? "spsc" : "mpmc");
+            return 1;
+        }
+        ring_destroy(&r);
+    }
+    if (run(1, 1, 1) || run(0, 1, 1) || run(0, THREADS, 1) || run(0, THREADS, THREADS))
+        return 1;
+    puts("ring tests passed");
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "dx8gles11.h"
+#include "utils.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *k_fixtures[] = {"fixtures/root.asm",       "fixtures/matrix_ops.asm",
+                                   "fixtures/terrain_ps.asm", "fixtures/motion_blur_vs.asm",
+                                   "fixtures/tex_ops.asm",    "fixtures/ps13_ops.asm"};
+
+static int same_list(const GLES_CommandList *a, const GLES_CommandList *b) {
+    return a->count == b->count && !memcmp(a->data, b->data, a->count * sizeof(gles_cmd));
+}
+
+static int check_arena(void) {
+    util_arena a = {0};
+    char *p = util_arena_alloc(&a, 10);
+    memcpy(p, "0123456789", 10);
+    /* the latest allocation grows in place */
+    char *q = util_arena_grow(&a, p, 10, 100);
+    if (q != p || memcmp(q, "0123456789", 10)) {
+        fprintf(stderr, "arena grow did not keep the block\n");
+        return 1;
+    }
+    /* a large request spills into a new block; reset keeps one block of the total */
+    void *big = util_arena_alloc(&a, 1 << 20);
+    if (!big || ((uintptr_t)big & 15)) {
+        fprintf(stderr, "arena alloc misaligned\n");
+        return 1;
+    }
+    util_arena_reset(&a);
+    void *first = util_arena_alloc(&a, 16);
+    void *again = util_arena_alloc(&a, 1 << 20);
+    if (!first || !again || (char *)again != (char *)first + 16) {
+        fprintf(stderr, "arena reset did not coalesce\n");
+        return 1;
+    }
+    util_arena_free(&a);
+    return 0;
+}
+
+int main(void) {
+    if (check_arena())
+        return 1;
+
+    dx8gles11_options opt = {.include_dir = "fixtures/dir1"};
+    dx8gles11_session *s = dx8gles11_session_create();
+    if (!s)
+        return 1;
+    /* repeated passes reuse the warm arena and must match one-shot compiles */
+    for (int pass = 0; pass < 3; ++pass) {
+        for (size_t k = 0; k < sizeof(k_fixtures) / sizeof(k_fixtures[0]); ++k) {
+            GLES_CommandList ref, got;
+            int rc_ref = dx8gles11_compile_file(k_fixtures[k], &opt, &ref);
+            int rc = dx8gles11_session_compile_file(s, k_fixtures[k], &opt, &got);
+            if (rc != rc_ref || (rc == 0 && !same_list(&ref, &got))) {
+                fprintf(stderr, "%s: session result differs (rc %d vs %d)\n", k_fixtures[k], rc,
+                        rc_ref);
+                return 1;
+            }
+            gles_cmdlist_free(&ref);
+            gles_cmdlist_free(&got);
+        }
+    }
+
+    /* a failed compile leaves the session usable */
+    GLES_CommandList l;
+    if (dx8gles11_session_compile_string(s, "ps.1.1\nbogus r0, r 1\n", NULL, &l) == 0) {
+        fprintf(stderr, "invalid shader compiled\n");
+        return 1;
+    }
+    if (dx8gles11_session_compile_string(s, "ps.1.1\ntex t0\nmov r0, t0\n", NULL, &l) ||
+        l.count != 2) {
+        fprintf(stderr, "compile after failure: %s\n", dx8gles11_error());
+        return 1;
+    }
+    gles_cmdlist_free(&l);
+    dx8gles11_session_destroy(s);
+    puts("ok");
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include "preprocess.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* a run resumed from a prelude snapshot must match a full run */
+
+static char g_dir[] = "/tmp/dx8gles11_snapXXXXXX";
+
+static void write_inc(const char *text) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/common.inc", g_dir);
+    FILE *f = fopen(path, "wb");
+    fputs(text, f);
+    fclose(f);
+}
+
+static int check(const pp_config *cfg, const char *src, const char *want) {
+    char *err = NULL;
+    char *out = pp_run_string_cfg(src, cfg, &err);
+    int bad = !out || strcmp(out, want);
+    if (bad)
+        fprintf(stderr, "'%s': got '%s'\n", src, out ? out : err);
+    free(out);
+    free(err);
+    return bad;
+}
+
+static int fail(const char *what) {
+    fprintf(stderr, "failed: %s\n", what);
+    return 1;
+}
+
+int main(void) {
+    if (!mkdtemp(g_dir))
+        return 1;
+    write_inc("#define A r0\n#define B c3\nvs.1.1\n");
+
+    pp_config cfg = {.include_dir = g_dir};
+    char *err = NULL;
+    pp_snapshot *snap = pp_snapshot_create("#include \"common.inc\"", NULL, &cfg, &err);
+    if (!snap) {
+        fprintf(stderr, "%s\n", err);
+        return 1;
+    }
+    pp_config with = cfg;
+    with.snapshot = snap;
+    const char *src = "#include \"common.inc\"\nmov A, B\n";
+
+    if (check(&cfg, src, "vs.1.1\nmov r0, c3\n") || check(&with, src, "vs.1.1\nmov r0, c3\n"))
+        return 1;
+    if (pp_snapshot_resumed(snap) != 1)
+        return fail("prelude not resumed");
+
+    /* macros of the body shadow the frozen ones */
+    if (check(&with, "#include \"common.inc\"\n#define A r9\nmov A, B\n", "vs.1.1\nmov r9, c3\n"))
+        return 1;
+
+    /* resumed runs still report the prelude's includes */
+    pp_dep *deps = NULL;
+    pp_config dep_cfg = with;
+    dep_cfg.deps = &deps;
+    if (check(&dep_cfg, src, "vs.1.1\nmov r0, c3\n"))
+        return 1;
+    int dep_ok = sb_count(deps) == 1 && strstr(deps[0].path, "common.inc");
+    pp_deps_free(deps);
+    if (!dep_ok || pp_snapshot_resumed(snap) != 3)
+        return fail("deps of resumed run");
+
+    /* different prefix or search paths: full run */
+    if (check(&with, "#include \"common.inc\" \nmov A\n", "vs.1.1\nmov r0\n"))
+        return 1;
+    const char *paths[] = {"/nonexistent", NULL};
+    pp_config other = with;
+    other.include_paths = paths;
+    if (check(&other, src, "vs.1.1\nmov r0, c3\n") || pp_snapshot_resumed(snap) != 3)
+        return fail("snapshot applied to a different source or search path");
+
+    /* an edited prelude include invalidates the snapshot */
+    write_inc("#define A r1\n#define B c4\nvs.1.1\n");
+    if (check(&with, src, "vs.1.1\nmov r1, c4\n") || pp_snapshot_resumed(snap) != 3)
+        return fail("stale snapshot used");
+
+    pp_snapshot_destroy(snap);
+
+    /* the prelude's redefinition and #undef of a -D name outlive resuming */
+    const char *defines[] = {"FOO=1", "BAR", NULL};
+    pp_config d_cfg = {.defines = defines};
+    const char *prelude = "#define FOO 2\n#undef BAR\n";
+    snap = pp_snapshot_create(prelude, NULL, &d_cfg, &err);
+    if (!snap) {
+        fprintf(stderr, "%s\n", err);
+        return 1;
+    }
+    pp_config d_with = d_cfg;
+    d_with.snapshot = snap;
+    const char *d_src = "#define FOO 2\n#undef BAR\nmov r0, c[FOO]\n#ifdef BAR\nnop\n#endif\n";
+    if (check(&d_cfg, d_src, "mov r0, c[2]\n") || check(&d_with, d_src, "mov r0, c[2]\n"))
+        return 1;
+    if (pp_snapshot_resumed(snap) != 1)
+        return fail("prelude with -D names not resumed");
+    pp_snapshot_destroy(snap);
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/common.inc", g_dir);
+    remove(path);
+    rmdir(g_dir);
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include "dx8gles11.h"
+#include "preprocess.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* streamed preprocessing, the fused compile path and pushed compiles must
+ * match the string-based ones */
+
+static const char *k_fixtures[] = {"fixtures/root.asm", "fixtures/matrix_ops.asm",
+                                   "fixtures/terrain_ps.asm", "fixtures/motion_blur_vs.asm",
+                                   "fixtures/tex_ops.asm", "fixtures/ps13_ops.asm"};
+
+static const char k_src[] = "#define BLEND(d, a, b) lrp d, v0.a, a, b\n"
+                            "ps.1.1\n"
+                            "tex t0\n"
+                            "\n"
+                            "#ifdef FOG\n"
+                            "tex t1 ; volume\n"
+                            "#endif\n"
+                            "BLEND(r0, t0, t1)\n";
+
+static int append_line(void *ctx, const char *line, size_t len) {
+    char **text = ctx;
+    for (size_t i = 0; i < len; ++i)
+        sb_push(*text, line[i]);
+    sb_push(*text, '\n');
+    return 0;
+}
+
+static int stop_at_first(void *ctx, const char *line, size_t len) {
+    (void)line, (void)len;
+    ++*(int *)ctx;
+    return 1;
+}
+
+static char *read_text(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    rewind(f);
+    char *b = malloc((size_t)n + 1);
+    if (b && fread(b, 1, (size_t)n, f) != (size_t)n) {
+        free(b);
+        b = NULL;
+    }
+    if (b)
+        b[n] = '\0';
+    fclose(f);
+    return b;
+}
+
+static int feed(dx8gles11_stream *s, const char *text) {
+    return dx8gles11_stream_feed(s, text, strlen(text));
+}
+
+static int same_list(const GLES_CommandList *a, const GLES_CommandList *b) {
+    return a->count == b->count && !memcmp(a->data, b->data, a->count * sizeof(gles_cmd));
+}
+
+static int check_lines(const char *src, const pp_config *cfg) {
+    char *err = NULL, *lines = NULL;
+    char *want = pp_run_string_cfg(src, cfg, &err);
+    int rc = pp_stream_string_cfg(src, cfg, append_line, &lines, &err);
+    sb_push(lines, '\0');
+    int bad = !want || rc || strcmp(want, lines);
+    if (bad)
+        fprintf(stderr, "streamed '%s', want '%s'\n", lines, want ? want : err);
+    free(want);
+    free(err);
+    sb_free(lines);
+    return bad;
+}
+
+int main(void) {
+    const char *fog[] = {"FOG", NULL};
+    pp_config cfg = {.defines = fog};
+    if (check_lines(k_src, NULL) || check_lines(k_src, &cfg))
+        return 1;
+
+    /* resumed snapshot output is split into lines as well */
+    char *err = NULL;
+    pp_snapshot *snap = pp_snapshot_create("#define BASE c1\nps.1.1\ndef c1, 1, 1, 1, 1", NULL,
+                                           NULL, &err);
+    pp_config with = {.snapshot = snap};
+    if (!snap ||
+        check_lines("#define BASE c1\nps.1.1\ndef c1, 1, 1, 1, 1\nmov r0, BASE\n", &with) ||
+        pp_snapshot_resumed(snap) != 2) {
+        fprintf(stderr, "snapshot not streamed\n");
+        return 1;
+    }
+    pp_snapshot_destroy(snap);
+
+    /* a sink can end the run; that is not a preprocessing error */
+    int calls = 0;
+    if (pp_stream_string_cfg(k_src, NULL, stop_at_first, &calls, &err) != -1 || calls != 1 ||
+        err) {
+        fprintf(stderr, "sink stop: %d calls\n", calls);
+        return 1;
+    }
+
+    /* without a compile cache, compiles take the fused path */
+    dx8gles11_cache *cache = dx8gles11_cache_create(1 << 20);
+    dx8gles11_options cached = {.include_dir = "fixtures/dir1", .cache = cache};
+    dx8gles11_options fused = {.include_dir = "fixtures/dir1"};
+    for (size_t i = 0; i < sizeof(k_fixtures) / sizeof(k_fixtures[0]); ++i) {
+        GLES_CommandList a, b;
+        if (dx8gles11_compile_file(k_fixtures[i], &fused, &a) ||
+            dx8gles11_compile_file(k_fixtures[i], &cached, &b) || !same_list(&a, &b)) {
+            fprintf(stderr, "%s: %s\n", k_fixtures[i], dx8gles11_error());
+            return 1;
+        }
+        gles_cmdlist_free(&a);
+        gles_cmdlist_free(&b);
+    }
+    dx8gles11_cache_destroy(cache);
+
+    /* pushed in chunks of any size, a source compiles as it does in one piece */
+    dx8gles11_options opt = {.include_dir = "fixtures"};
+    static const size_t k_chunks[] = {1, 7, 64, 1 << 20};
+    for (size_t i = 0; i < sizeof(k_fixtures) / sizeof(k_fixtures[0]); ++i) {
+        char *text = read_text(k_fixtures[i]);
+        GLES_CommandList want, got;
+        if (!text || dx8gles11_compile_string(text, &opt, &want)) {
+            fprintf(stderr, "%s: %s\n", k_fixtures[i], dx8gles11_error());
+            return 1;
+        }
+        for (size_t c = 0; c < sizeof(k_chunks) / sizeof(k_chunks[0]); ++c) {
+            dx8gles11_stream *st = dx8gles11_stream_create(&opt);
+            size_t len = strlen(text);
+            int rc = !st;
+            for (size_t off = 0; !rc && off < len; off += k_chunks[c])
+                rc = dx8gles11_stream_feed(st, text + off,
+                                           len - off < k_chunks[c] ? len - off : k_chunks[c]);
+            if (rc || dx8gles11_stream_finish(st, &got) || !same_list(&want, &got)) {
+                fprintf(stderr, "%s in chunks of %zu: %s\n", k_fixtures[i], k_chunks[c],
+                        dx8gles11_error());
+                return 1;
+            }
+            gles_cmdlist_free(&got);
+            dx8gles11_stream_destroy(st);
+        }
+        gles_cmdlist_free(&want);
+        free(text);
+    }
+
+    GLES_CommandList l;
+    /* a feed reports the error it hits, and later calls repeat it */
+    dx8gles11_stream *st = dx8gles11_stream_create(NULL);
+    if (feed(st, "ps.1.1\nmov r0") ||
+        feed(st, " r1\nmov r1, v0\n") != -3 ||
+        !strstr(dx8gles11_error(), "line 2: invalid instruction") ||
+        feed(st, "mov r2, v0\n") != -3 ||
+        dx8gles11_stream_finish(st, &l) != -3) {
+        fprintf(stderr, "streamed parse error: %s\n", dx8gles11_error());
+        return 1;
+    }
+    dx8gles11_stream_destroy(st);
+    st = dx8gles11_stream_create(NULL);
+    if (feed(st, "#if 1\nmov r0, v0") || dx8gles11_stream_finish(st, &l) != -2 ||
+        !strstr(dx8gles11_error(), "unterminated #if")) {
+        fprintf(stderr, "streamed preprocess error: %s\n", dx8gles11_error());
+        return 1;
+    }
+    dx8gles11_stream_destroy(st);
+
+    /* errors keep their codes, line numbers and precedence */
+    if (dx8gles11_compile_string("ps.1.1\n#define X\n\nmov r0 r1\n", NULL, &l) != -3 ||
+        !strstr(dx8gles11_error(), "line 3: invalid instruction")) {
+        fprintf(stderr, "parse error: %s\n", dx8gles11_error());
+        return 1;
+    }
+    if (dx8gles11_compile_string("mov r0 r1\n#include \"missing.inc\"\n", NULL, &l) != -2) {
+        fprintf(stderr, "preprocess error: %s\n", dx8gles11_error());
+        return 1;
+    }
+    return 0;
+}
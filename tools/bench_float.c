@@ -0,0 +1,60 @@
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* util_parse_float() against strtof on shader-style and full-precision inputs */
+
+static double now_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000.0 + t.tv_nsec / 1e6;
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    int iters = argc > 2 ? atoi(argv[2]) : 10;
+    if (count <= 0)
+        return 1;
+    char *text = malloc((size_t)count * 24);
+    const char **strs = malloc((size_t)count * sizeof(*strs));
+    if (!text || !strs)
+        return 1;
+    uint32_t rng = 12345;
+    size_t off = 0;
+    for (int i = 0; i < count; ++i) {
+        rng = rng * 1664525u + 1013904223u;
+        strs[i] = text + off;
+        float v = (float)(rng >> 8) / (float)(1u << 24) * 200.0f - 100.0f;
+        /* half short constants like "0.25", half round-trip precision */
+        int n = i & 1 ? snprintf(text + off, 24, "%.3g", v) : snprintf(text + off, 24, "%.9g", v);
+        off += (size_t)n + 1;
+    }
+
+    for (int pass = 0; pass < 2; ++pass) {
+        double best = 0.0;
+        float sum = 0.0f;
+        for (int it = 0; it < iters; ++it) {
+            double t0 = now_ms();
+            for (int i = 0; i < count; ++i) {
+                float f;
+                if (pass == 0) {
+                    f = strtof(strs[i], NULL);
+                } else {
+                    const char *s = strs[i];
+                    util_parse_float(s, s + strlen(s), &f);
+                }
+                sum += f;
+            }
+            double ms = now_ms() - t0;
+            if (it == 0 || ms < best)
+                best = ms;
+        }
+        printf("%-16s %8.2f ms  %6.1f ns/value  (checksum %g)\n",
+               pass == 0 ? "strtof" : "util_parse_float", best, best * 1e6 / count, sum);
+    }
+    free(strs);
+    free(text);
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include "dx8asm_parser.h"
+#include "preprocess.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* a mix of the line shapes asm_parse() sees in real shaders */
+static const char *const k_lines[] = {
+    "    mul r0, v0, t0 ; modulate",
+    "+add_x2 r1.rgb, r0_bias, -c2.wzyx",
+    "tex t1 ; volume",
+    "dp3_sat r0, t0_bx2, v0_bx2",
+    "mad r0, c[a0.x+12].xyzz, r1.w, 1-r2",
+    "def c4, 0.25, -1.5, 3.0e-2, 1.0",
+    "mload t2, 0.5, 1.0, -2.0",
+    "",
+    "; a comment line with no code",
+    "lrp r0.a, t0, r1, v1",
+};
+
+static char *generate(size_t lines, size_t *bytes) {
+    size_t n = sizeof(k_lines) / sizeof(k_lines[0]);
+    size_t cap = 16, len = 0;
+    for (size_t i = 0; i < n; ++i)
+        cap += (strlen(k_lines[i]) + 1) * (lines / n + 1);
+    char *s = malloc(cap);
+    if (!s)
+        return NULL;
+    len += (size_t)sprintf(s, "ps.1.1\n");
+    for (size_t i = 0; i < lines; ++i) {
+        size_t l = strlen(k_lines[i % n]);
+        memcpy(s + len, k_lines[i % n], l);
+        len += l;
+        s[len++] = '\n';
+    }
+    s[len] = '\0';
+    *bytes = len;
+    return s;
+}
+
+static double elapsed_ms(const struct timespec *s, const struct timespec *e) {
+    return (e->tv_sec - s->tv_sec) * 1000.0 + (e->tv_nsec - s->tv_nsec) / 1e6;
+}
+
+static int stream_line(void *ctx, const char *line, size_t len) {
+    return asm_stream_line(ctx, line, len, NULL);
+}
+
+/* preprocess then parse, either through the full expanded string or with
+ * lines streamed straight into the parser; best time of iters */
+static double preprocess_and_parse(const char *src, int iters, int fused) {
+    double best = -1.0;
+    for (int i = 0; i < iters; ++i) {
+        struct timespec s, e;
+        asm_program prog;
+        int rc;
+        clock_gettime(CLOCK_MONOTONIC, &s);
+        if (fused) {
+            asm_stream st;
+            asm_stream_begin(&st, &prog, NULL);
+            rc = pp_stream_string_cfg(src, NULL, stream_line, &st, NULL) || st.failed;
+        } else {
+            char *text = pp_run_string(src, NULL, NULL);
+            rc = !text || asm_parse(text, &prog, NULL);
+            free(text);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &e);
+        if (rc)
+            return -1.0;
+        asm_program_free(&prog);
+        double ms = elapsed_ms(&s, &e);
+        if (best < 0 || ms < best)
+            best = ms;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    size_t lines = argc > 1 ? (size_t)atol(argv[1]) : 200000;
+    int iters = argc > 2 ? atoi(argv[2]) : 20;
+    size_t bytes = 0;
+    char *src = generate(lines, &bytes);
+    if (!src)
+        return 1;
+    /* the fastest pass is the least disturbed by the rest of the machine */
+    double best = 0.0, total = 0.0;
+    size_t instrs = 0;
+    for (int i = 0; i < iters; ++i) {
+        struct timespec s, e;
+        asm_program prog;
+        char *err = NULL;
+        clock_gettime(CLOCK_MONOTONIC, &s);
+        int rc = asm_parse(src, &prog, &err);
+        clock_gettime(CLOCK_MONOTONIC, &e);
+        if (rc) {
+            fprintf(stderr, "parse failed: %s\n", err ? err : "?");
+            free(err);
+            free(src);
+            return 1;
+        }
+        instrs = prog.count;
+        asm_program_free(&prog);
+        double ms = elapsed_ms(&s, &e);
+        total += ms;
+        if (i == 0 || ms < best)
+            best = ms;
+    }
+    printf("Lines: %zu (%zu instructions, %.1f MB)\n"
+           "Parse time: %.2f ms best, %.2f ms mean, %.1f MB/s\n",
+           lines, instrs, bytes / 1e6, best, iters > 0 ? total / iters : 0.0,
+           best > 0 ? bytes / 1e3 / best : 0.0);
+    double two_pass = preprocess_and_parse(src, iters, 0);
+    double fused = preprocess_and_parse(src, iters, 1);
+    if (two_pass < 0 || fused < 0) {
+        fprintf(stderr, "preprocess + parse failed\n");
+        free(src);
+        return 1;
+    }
+    printf("Preprocess + parse: %.2f ms via string, %.2f ms streamed\n", two_pass, fused);
+    free(src);
+    return 0;
+}
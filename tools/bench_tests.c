@@ -30,7 +30,7 @@ static char *read_file(const char *path) {
 int main(int argc, char **argv) {
     const char *dir = argc > 1 ? argv[1] : "../tests/fixtures";
     int iters = argc > 2 ? atoi(argv[2]) : 100000;
-    int stage1 = 1, stage2 = 1, stage3 = 2;
+    int stage1 = 1, stage2 = 1, stage3 = 2, render = 0;
     for (int i = 3; i < argc; ++i) {
         if (strcmp(argv[i], "-stage1") == 0 && i + 1 < argc) {
             stage1 = atoi(argv[++i]);
@@ -38,6 +38,8 @@ int main(int argc, char **argv) {
             stage2 = atoi(argv[++i]);
         } else if (strcmp(argv[i], "-stage3") == 0 && i + 1 < argc) {
             stage3 = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-render") == 0) {
+            render = 1; /* dispatch on this thread instead of stage3 workers */
         }
     }
 
@@ -84,13 +86,18 @@ int main(int argc, char **argv) {
         struct timespec s, e;
         pipeline p;
         clock_gettime(CLOCK_MONOTONIC, &s);
-        if (pipeline_init_stages(&p, stage1, stage2, stage3) || pipeline_start(&p)) {
+        int rc = render ? pipeline_init_render(&p, stage1, stage2)
+                        : pipeline_init_stages(&p, stage1, stage2, stage3);
+        if (rc || pipeline_start(&p)) {
             fprintf(stderr, "pipeline init failed\n");
             free(src);
             continue;
         }
-        for (int j = 0; j < iters; ++j)
+        for (int j = 0; j < iters; ++j) {
             lf_queue_push(&p.decode_q, src);
+            if (render && j % 64 == 63)
+                pipeline_render(&p, 0);
+        }
         pipeline_stop(&p);
         double cps = pipeline_commands_per_second(&p);
         pipeline_join(&p);
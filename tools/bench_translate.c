@@ -5,6 +5,30 @@
 #include <string.h>
 #include <time.h>
 
+#ifdef BENCH_COUNT_ALLOCS
+/* linked with --wrap=malloc,--wrap=calloc,--wrap=realloc (see CMakeLists.txt) */
+#include <stdatomic.h>
+static _Atomic unsigned long g_allocs;
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t n);
+void *__wrap_malloc(size_t n) {
+  atomic_fetch_add_explicit(&g_allocs, 1, memory_order_relaxed);
+  return __real_malloc(n);
+}
+void *__wrap_calloc(size_t n, size_t size) {
+  atomic_fetch_add_explicit(&g_allocs, 1, memory_order_relaxed);
+  return __real_calloc(n, size);
+}
+void *__wrap_realloc(void *p, size_t n) {
+  atomic_fetch_add_explicit(&g_allocs, 1, memory_order_relaxed);
+  return __real_realloc(p, n);
+}
+static unsigned long alloc_count(void) { return atomic_load(&g_allocs); }
+#else
+static unsigned long alloc_count(void) { return 0; }
+#endif
+
 static char *read_file(const char *path) {
   FILE *f = fopen(path, "rb");
   if (!f)
@@ -43,6 +67,20 @@ static double bench_serial(const char *src, int iters) {
   return (e.tv_sec - s.tv_sec) * 1000.0 + (e.tv_nsec - s.tv_nsec) / 1e6;
 }
 
+static double bench_session(const char *src, int iters) {
+  dx8gles11_session *sess = dx8gles11_session_create();
+  struct timespec s, e;
+  clock_gettime(CLOCK_MONOTONIC, &s);
+  for (int i = 0; i < iters; ++i) {
+    GLES_CommandList cl;
+    dx8gles11_session_compile_string(sess, src, NULL, &cl);
+    gles_cmdlist_free(&cl);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &e);
+  dx8gles11_session_destroy(sess);
+  return (e.tv_sec - s.tv_sec) * 1000.0 + (e.tv_nsec - s.tv_nsec) / 1e6;
+}
+
 static double bench_threaded(const char *src, int iters, int threads) {
   mt_pool p;
   mt_pool_init(&p, threads);
@@ -56,6 +94,21 @@ static double bench_threaded(const char *src, int iters, int threads) {
   return (e.tv_sec - s.tv_sec) * 1000.0 + (e.tv_nsec - s.tv_nsec) / 1e6;
 }
 
+static double bench_batch(const char *src, int iters, int threads) {
+  dx8gles11_batch_item *items = calloc((size_t)iters, sizeof(*items));
+  if (!items)
+    return 0.0;
+  for (int i = 0; i < iters; ++i)
+    items[i].source = src;
+  struct timespec s, e;
+  clock_gettime(CLOCK_MONOTONIC, &s);
+  dx8gles11_compile_batch(items, (size_t)iters, NULL, threads);
+  clock_gettime(CLOCK_MONOTONIC, &e);
+  dx8gles11_batch_free(items, (size_t)iters);
+  free(items);
+  return (e.tv_sec - s.tv_sec) * 1000.0 + (e.tv_nsec - s.tv_nsec) / 1e6;
+}
+
 int main(int argc, char **argv) {
   const char *path = argc > 1 ? argv[1] : "../tests/fixtures/matrix_ops.asm";
   int iters = argc > 2 ? atoi(argv[2]) : 100;
@@ -65,11 +118,26 @@ int main(int argc, char **argv) {
     fprintf(stderr, "failed to read %s\n", path);
     return 1;
   }
+  unsigned long a0 = alloc_count();
   double t_serial = bench_serial(src, iters);
+  unsigned long a1 = alloc_count();
+  double t_session = bench_session(src, iters);
+  unsigned long a2 = alloc_count();
   double t_thread = bench_threaded(src, iters, threads);
+  double t_batch = bench_batch(src, iters, threads);
   printf(
-      "Iterations: %d\nSerial time: %.2f ms\nThreaded (%d threads): %.2f ms\n",
-      iters, t_serial, threads, t_thread);
+      "Iterations: %d\nSerial time: %.2f ms\nSession time: %.2f ms\n"
+      "Threaded (%d threads): %.2f ms\nBatch (%d threads): %.2f ms\n",
+      iters, t_serial, t_session, threads, t_thread, threads, t_batch);
+#ifdef BENCH_COUNT_ALLOCS
+  if (iters > 0)
+    printf("Allocations per compile: %.1f serial, %.1f session\n",
+           (double)(a1 - a0) / iters, (double)(a2 - a1) / iters);
+#else
+  (void)a0;
+  (void)a1;
+  (void)a2;
+#endif
   free(src);
   return 0;
 }
@@ -0,0 +1,175 @@
+#include "dx8gles11.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+/*
+ * Offline compiler: translates a tree of DX8 shaders for one target and
+ * packs the command lists into an archive read by dx8gles11_archive_map().
+ * Entries are named by their path relative to the directory given on the
+ * command line, or by the path itself for single files.
+ */
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: dx8gles11c [-I dir]... [-D NAME[=value]]... [-p profile] [-j threads]\n"
+            "                  [-e ext] -o archive source...\n"
+            "  source   a shader file, or a directory searched for *.asm (see -e)\n"
+            "  -p       target profile; without one no extensions are assumed\n");
+}
+
+typedef struct shader {
+    char *path; /* to open */
+    char *name; /* stored in the archive */
+} shader;
+
+static int ends_with(const char *s, const char *ext) {
+    size_t n = strlen(s), e = strlen(ext);
+    return n > e && !strcmp(s + n - e, ext);
+}
+
+static char *join(const char *a, const char *b) {
+    char *s = NULL;
+    return util_asprintf(&s, "%s%s%s", a, *a ? "/" : "", b) < 0 ? NULL : s;
+}
+
+/* add every file under root/rel ending in ext */
+static int walk(const char *root, const char *rel, const char *ext, shader **out) {
+#ifndef _WIN32
+    char *dir = *rel ? join(root, rel) : util_strdup(root);
+    DIR *d = dir ? opendir(dir) : NULL;
+    if (!d) {
+        fprintf(stderr, "dx8gles11c: cannot read directory %s\n", dir ? dir : root);
+        free(dir);
+        return -1;
+    }
+    int rc = 0;
+    struct dirent *de;
+    while (!rc && (de = readdir(d))) {
+        if (de->d_name[0] == '.')
+            continue;
+        char *name = join(rel, de->d_name);
+        char *path = name ? join(root, name) : NULL;
+        struct stat st;
+        if (!path || stat(path, &st) != 0) {
+            rc = -1;
+        } else if (S_ISDIR(st.st_mode)) {
+            rc = walk(root, name, ext, out);
+        } else if (ends_with(de->d_name, ext)) {
+            sb_push(*out, ((shader){path, name}));
+            continue;
+        }
+        free(path);
+        free(name);
+    }
+    closedir(d);
+    free(dir);
+    return rc;
+#else
+    (void)rel, (void)ext, (void)out;
+    fprintf(stderr, "dx8gles11c: directories are not supported here: %s\n", root);
+    return -1;
+#endif
+}
+
+static int by_name(const void *a, const void *b) {
+    return strcmp(((const shader *)a)->name, ((const shader *)b)->name);
+}
+
+int main(int argc, char **argv) {
+    const char **includes = NULL, **defines = NULL;
+    const char *output = NULL, *profile = NULL, *ext = ".asm";
+    int threads = 4;
+    shader *shaders = NULL;
+    int bad = 0;
+    for (int i = 1; i < argc && !bad; ++i) {
+        const char *a = argv[i];
+        if (a[0] == '-' && strchr("IDpjeo", a[1]) && a[1]) {
+            const char *v = a[2] ? a + 2 : i + 1 < argc ? argv[++i] : NULL;
+            if (!v) {
+                bad = 1;
+                break;
+            }
+            switch (a[1]) {
+            case 'I': sb_push(includes, v); break;
+            case 'D': sb_push(defines, v); break;
+            case 'p': profile = v; break;
+            case 'j': threads = atoi(v); break;
+            case 'e': ext = v; break;
+            case 'o': output = v; break;
+            }
+            continue;
+        }
+        if (a[0] == '-') {
+            bad = 1;
+            break;
+        }
+        struct stat st;
+        if (stat(a, &st) != 0) {
+            fprintf(stderr, "dx8gles11c: no such file or directory: %s\n", a);
+            return 1;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            if (walk(a, "", ext, &shaders))
+                return 1;
+        } else {
+            sb_push(shaders, ((shader){util_strdup(a), util_strdup(a)}));
+        }
+    }
+    if (bad || !output || !sb_count(shaders)) {
+        usage();
+        return 2;
+    }
+
+    dx8gles11_caps target = {0};
+    if (profile && dx8gles11_caps_load(profile, &target)) {
+        fprintf(stderr, "dx8gles11c: %s\n", dx8gles11_error());
+        return 1;
+    }
+    sb_push(includes, NULL);
+    sb_push(defines, NULL);
+    dx8gles11_options opt = {.include_paths = includes, .defines = defines, .caps = &target};
+
+    size_t n = sb_count(shaders);
+    qsort(shaders, n, sizeof(*shaders), by_name);
+    dx8gles11_batch_item *items = calloc(n, sizeof(*items));
+    dx8gles11_archive_item *entries = calloc(n, sizeof(*entries));
+    if (!items || !entries) {
+        fprintf(stderr, "dx8gles11c: out of memory\n");
+        return 1;
+    }
+    for (size_t i = 0; i < n; ++i)
+        items[i].path = shaders[i].path;
+    int failed = dx8gles11_compile_batch(items, n, &opt, threads);
+    for (size_t i = 0; i < n; ++i) {
+        if (items[i].rc)
+            fprintf(stderr, "%s: %s\n", shaders[i].path, items[i].error);
+        entries[i] = (dx8gles11_archive_item){shaders[i].name, &items[i].list};
+    }
+    int rc = failed ? 1 : 0;
+    if (!rc && dx8gles11_archive_write(output, entries, n, &target)) {
+        fprintf(stderr, "dx8gles11c: %s\n", dx8gles11_error());
+        rc = 1;
+    }
+    if (!rc)
+        printf("%zu shaders -> %s\n", n, output);
+    else if (failed)
+        fprintf(stderr, "dx8gles11c: %d of %zu shaders failed, nothing written\n", failed, n);
+
+    dx8gles11_batch_free(items, n);
+    free(items);
+    free(entries);
+    for (size_t i = 0; i < n; ++i) {
+        free(shaders[i].path);
+        free(shaders[i].name);
+    }
+    sb_free(shaders);
+    sb_free(includes);
+    sb_free(defines);
+    return rc;
+}
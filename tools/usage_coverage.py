@@ -8,6 +8,11 @@ followed by a usage count, e.g.::
     dp4 3
 
 Lines starting with ``#`` are ignored.
+
+The opcode set comes from the ``DX8ASM_OPCODES`` table in
+``include/dx8asm_opcodes.h``; an opcode counts as implemented when the
+translator's ``k_xlate`` dispatch table in ``dx8_to_gles11.c`` has a handler
+for it.
 """
 from __future__ import annotations
 
@@ -36,24 +41,38 @@ def parse_report(path: Path) -> dict[str, int]:
     return tokens
 
 
-def load_sources(src_dir: Path) -> str:
-    text_parts = []
+OPCODE_ROW = re.compile(r'X\((\w+),\s*"(\w+)"')
+XLATE_TABLE = re.compile(r'k_xlate\[ASM_OP_COUNT\]\s*=\s*\{(.*?)\};', re.S)
+XLATE_ROW = re.compile(r'\[ASM_OP_(\w+)\]\s*=')
+
+
+def load_implemented(src_dir: Path) -> set[str]:
+    """Return the mnemonics that have a translator handler."""
+    header = src_dir.parent / 'include' / 'dx8asm_opcodes.h'
+    ids: dict[str, str] = {}
+    try:
+        ids = dict(OPCODE_ROW.findall(header.read_text(encoding='utf-8')))
+    except OSError:
+        print(f"opcode table not found: {header}", file=sys.stderr)
+    handled: set[str] = set()
     for root, _dirs, files in os.walk(src_dir):
         for name in files:
-            if name.endswith(('.c', '.h')):
-                p = Path(root) / name
-                try:
-                    text_parts.append(p.read_text(encoding='utf-8'))
-                except OSError:
-                    continue
-    return "\n".join(text_parts)
+            if not name.endswith('.c'):
+                continue
+            try:
+                text = (Path(root) / name).read_text(encoding='utf-8')
+            except OSError:
+                continue
+            for table in XLATE_TABLE.findall(text):
+                handled.update(XLATE_ROW.findall(table))
+    return {mnem for ident, mnem in ids.items() if ident in handled}
 
 
-def write_markdown(tokens: dict[str, int], sources: str, out_path: Path) -> None:
+def write_markdown(tokens: dict[str, int], implemented_ops: set[str], out_path: Path) -> None:
     rows: list[tuple[str, int, bool]] = []
     covered = 0
     for token, count in sorted(tokens.items()):
-        implemented = f'"{token}"' in sources
+        implemented = token in implemented_ops
         rows.append((token, count, implemented))
         if implemented:
             covered += 1
@@ -84,11 +103,11 @@ def main(argv: list[str]) -> int:
         print(f"report not found: {report_path}", file=sys.stderr)
         return 1
     tokens = parse_report(report_path)
-    sources = load_sources(src_dir)
+    implemented_ops = load_implemented(src_dir)
     covered = 0
     print(f"Coverage for report: {report_path}")
     for token, count in sorted(tokens.items()):
-        implemented = f'"{token}"' in sources
+        implemented = token in implemented_ops
         if implemented:
             covered += 1
         status = 'yes' if implemented else 'no'
@@ -97,7 +116,7 @@ def main(argv: list[str]) -> int:
     ratio = (covered / total * 100) if total else 0.0
     print(f"\nCovered {covered}/{total} tokens ({ratio:.1f}%)")
 
-    write_markdown(tokens, sources, Path("COVERAGE.md"))
+    write_markdown(tokens, implemented_ops, Path("COVERAGE.md"))
     print("Saved coverage table to COVERAGE.md")
     return 0
 